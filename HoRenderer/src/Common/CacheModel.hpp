@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Set-associative LRU cache fed with the addresses a traversal reads. Stands in for hardware
+// counters where those are not available, and unlike them sees nothing but the accelerator.
+// With line_bytes = 4096 and ways = entries it models a fully associative TLB. Not thread-safe:
+// one model per thread, like the per-core caches it imitates.
+class CacheModel {
+public:
+    CacheModel(size_t total_bytes, size_t line_bytes, size_t ways) :
+        line_bytes(line_bytes), ways(ways), sets(total_bytes / (line_bytes * ways)),
+        tags(sets * ways, ~0ull), stamps(sets * ways, 0) {}
+
+    // Touch every line in [address, address + bytes), returns how many of them missed
+    uint64_t Access(const void *address, size_t bytes) {
+        uint64_t first = reinterpret_cast<uintptr_t>(address) / line_bytes;
+        uint64_t last = (reinterpret_cast<uintptr_t>(address) + bytes - 1) / line_bytes;
+        uint64_t new_misses = 0;
+        for (uint64_t line = first; line <= last; line++) {
+            size_t base = (line % sets) * ways;
+            size_t victim = base;
+            bool hit = false;
+            for (size_t way = base; way < base + ways; way++) {
+                if (tags[way] == line) {
+                    victim = way;
+                    hit = true;
+                    break;
+                }
+                if (stamps[way] < stamps[victim])
+                    victim = way;
+            }
+            tags[victim] = line;
+            stamps[victim] = ++clock;
+            new_misses += !hit;
+        }
+        misses += new_misses;
+        return new_misses;
+    }
+
+    uint64_t Misses() const { return misses; }
+
+private:
+    size_t line_bytes;
+    size_t ways;
+    size_t sets;
+    std::vector<uint64_t> tags;
+    std::vector<uint64_t> stamps;
+    uint64_t clock = 0;
+    uint64_t misses = 0;
+};
@@ -49,4 +49,14 @@ std::string FileManager::getTexturePath(const std::string &filename) {
 std::string FileManager::getMaterialPath(const std::string &filename) {
     std::filesystem::path materialPath = std::filesystem::path(projectRoot) / "assets" / "materials" / filename;
     return materialPath.generic_string();
-}
\ No newline at end of file
+}
+
+std::string FileManager::getModelPath(const std::string &filename) {
+    std::filesystem::path modelPath = std::filesystem::path(projectRoot) / "assets" / "models" / filename;
+    return modelPath.generic_string();
+}
+
+std::string FileManager::getCachePath() {
+    std::filesystem::path cachePath = std::filesystem::path(projectRoot) / "build" / "cache";
+    return cachePath.generic_string();
+}
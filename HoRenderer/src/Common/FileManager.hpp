@@ -29,4 +29,7 @@ public:
     std::string getShaderPath(const std::string &filename);
     std::string getTexturePath(const std::string &filename);
     std::string getMaterialPath(const std::string &filename);
+    std::string getModelPath(const std::string &filename);
+    // Directory for SceneCache files, next to the build output
+    std::string getCachePath();
 };
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "MappedFile.hpp"
+#include <iostream>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::Open(const std::string &path) {
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        std::cerr << "Failed to map empty file: " << path << std::endl;
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    void *view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        std::cerr << "Failed to map file: " << path << std::endl;
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    file_handle = file;
+    mapping_handle = mapping;
+    data = static_cast<const char *>(view);
+    size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        std::cerr << "Failed to map empty file: " << path << std::endl;
+        close(fd);
+        return false;
+    }
+    void *view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps its own reference to the file
+    close(fd);
+    if (view == MAP_FAILED) {
+        std::cerr << "Failed to map file: " << path << std::endl;
+        return false;
+    }
+    data = static_cast<const char *>(view);
+    size = static_cast<size_t>(st.st_size);
+#endif
+    return true;
+}
+
+void MappedFile::Close() {
+    if (!data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+#else
+    munmap(const_cast<char *>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Read-only memory mapping of a whole file. Pages are faulted in on first touch, so
+// large assets can be parsed in parallel straight from the page cache without a copy.
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string &path) { Open(path); }
+    ~MappedFile() { Close(); }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool Open(const std::string &path);
+    void Close();
+
+    bool IsOpen() const { return data != nullptr; }
+    const char *Data() const { return data; }
+    size_t Size() const { return size; }
+
+private:
+    const char *data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void *file_handle = nullptr;
+    void *mapping_handle = nullptr;
+#endif
+};
+
+// Array that either owns its elements or reads them in place from a shared MappedFile, which
+// stays open while any array points into it. Arrays loaded from a mapping are copied out the
+// first time something writes to them (the non-const accessors), reads never copy.
+template <typename T>
+class MappedArray {
+public:
+    MappedArray() = default;
+    explicit MappedArray(std::vector<T> elements) : owned(std::move(elements)) {}
+    MappedArray(std::shared_ptr<const MappedFile> file, const T *elements, size_t count) :
+        file(std::move(file)), view(elements), count(count) {}
+
+    bool IsMapped() const { return file != nullptr; }
+    size_t size() const { return file ? count : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const T *data() const { return file ? view : owned.data(); }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+    const T &operator[](size_t i) const { return data()[i]; }
+    operator std::span<const T>() const { return {data(), size()}; }
+
+    // The owned elements, copied out of the mapping first if needed. Not thread-safe while mapped
+    std::vector<T> &Mutable() {
+        if (file) {
+            owned.assign(view, view + count);
+            file.reset();
+        }
+        return owned;
+    }
+    MappedArray &operator=(std::vector<T> elements) {
+        file.reset();
+        owned = std::move(elements);
+        return *this;
+    }
+    T &operator[](size_t i) { return Mutable()[i]; }
+    void resize(size_t n) { Mutable().resize(n); }
+    void clear() { Mutable().clear(); }
+    void push_back(const T &value) { Mutable().push_back(value); }
+
+private:
+    std::shared_ptr<const MappedFile> file;
+    std::vector<T> owned;
+    const T *view = nullptr; // into file, only while mapped
+    size_t count = 0;
+};
@@ -0,0 +1,39 @@
+#include "MemoryArena.hpp"
+#include <algorithm>
+
+void *MemoryArena::Alloc(size_t bytes, size_t alignment)
+{
+    while (current_block < blocks.size()) {
+        Block &block = blocks[current_block];
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.memory.get());
+        uintptr_t aligned = (base + current_offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (aligned + bytes <= base + block.size) {
+            current_offset = aligned + bytes - base;
+            return reinterpret_cast<void *>(aligned);
+        }
+        // Move on to the next block (possibly left over from before a Reset)
+        current_block++;
+        current_offset = 0;
+    }
+
+    // Oversized requests get a block of their own
+    size_t size = std::max(block_size, bytes + alignment);
+    blocks.push_back({std::make_unique<uint8_t[]>(size), size});
+    current_block = blocks.size() - 1;
+    current_offset = 0;
+    return Alloc(bytes, alignment);
+}
+
+void MemoryArena::Reset()
+{
+    current_block = 0;
+    current_offset = 0;
+}
+
+size_t MemoryArena::TotalAllocated() const
+{
+    size_t total = 0;
+    for (const auto &block : blocks)
+        total += block.size;
+    return total;
+}
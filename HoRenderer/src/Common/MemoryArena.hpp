@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+// Bump allocator for short-lived build data. Objects are never destroyed individually,
+// everything is released at once by Reset() or the destructor, so only trivially
+// destructible types should be allocated from it. Not thread-safe: use one arena per thread.
+class MemoryArena {
+public:
+    MemoryArena(size_t block_size = 256 * 1024) : block_size(block_size) {}
+    MemoryArena(const MemoryArena &) = delete;
+    MemoryArena &operator=(const MemoryArena &) = delete;
+    MemoryArena(MemoryArena &&) = default;
+    MemoryArena &operator=(MemoryArena &&) = default;
+
+    void *Alloc(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+    template <typename T>
+    T *Alloc(size_t count = 1) {
+        void *memory = Alloc(count * sizeof(T), alignof(T));
+        T *objects = static_cast<T *>(memory);
+        for (size_t i = 0; i < count; i++)
+            new (&objects[i]) T();
+        return objects;
+    }
+
+    // Keep the blocks for reuse but forget everything allocated from them
+    void Reset();
+    size_t TotalAllocated() const;
+
+private:
+    struct Block {
+        std::unique_ptr<uint8_t[]> memory;
+        size_t size;
+    };
+
+    size_t block_size;
+    size_t current_offset = 0;
+    size_t current_block = 0;
+    std::vector<Block> blocks;
+};
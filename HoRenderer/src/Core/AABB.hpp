@@ -11,6 +11,8 @@ public:
     AABB(const Vector3f& a, const Vector3f& b);
 
     bool isHit(const Ray &r, Vector2f &t_interval) const;
+    // Slab test with the reciprocal direction precomputed once per ray (no division per axis)
+    inline bool isHit(const Vector3f &origin, const Vector3f &inv_dir, const int dir_is_neg[3], Vector2f t_interval) const;
 
     inline Vector3f min() const {
         return p_min;
@@ -18,6 +20,13 @@ public:
     inline Vector3f max() const {
         return p_max;
     }
+    inline Vector3f centroid() const {
+        return 0.5f * (p_min + p_max);
+    }
+    inline float SurfaceArea() const {
+        Vector3f extent = p_max - p_min;
+        return 2.0f * (extent.x * extent.y + extent.x * extent.z + extent.y * extent.z);
+    }
 
 private:
     void pad_to_minimums();
@@ -37,4 +46,17 @@ inline AABB calculateSurroundingBox(AABB box0, AABB box1) {
                     std::max(box0.max().z, box1.max().z));
     
     return AABB(pmin, pmax);
+}
+
+inline bool AABB::isHit(const Vector3f &origin, const Vector3f &inv_dir, const int dir_is_neg[3], Vector2f t_interval) const {
+    float tx0 = ((dir_is_neg[0] ? p_max.x : p_min.x) - origin.x) * inv_dir.x;
+    float tx1 = ((dir_is_neg[0] ? p_min.x : p_max.x) - origin.x) * inv_dir.x;
+    float ty0 = ((dir_is_neg[1] ? p_max.y : p_min.y) - origin.y) * inv_dir.y;
+    float ty1 = ((dir_is_neg[1] ? p_min.y : p_max.y) - origin.y) * inv_dir.y;
+    float tz0 = ((dir_is_neg[2] ? p_max.z : p_min.z) - origin.z) * inv_dir.z;
+    float tz1 = ((dir_is_neg[2] ? p_min.z : p_max.z) - origin.z) * inv_dir.z;
+
+    float t_min = std::max(std::max(tx0, ty0), std::max(tz0, t_interval.x));
+    float t_max = std::min(std::min(tx1, ty1), std::min(tz1, t_interval.y));
+    return t_min <= t_max;
 }
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include "AdaptiveSampling.hpp"
+
+namespace {
+    // Dark pixels are compared against this luminance rather than their own, or they would never converge
+    constexpr float MinLuminance = 0.01f;
+
+    float Luminance(const Vector3f &color)
+    {
+        return glm::dot(color, Vector3f(0.2126f, 0.7152f, 0.0722f));
+    }
+}
+
+void AdaptiveSampling::Reset(int width, int height)
+{
+    image_width = width;
+    image_height = height;
+    size_t pixel_count = static_cast<size_t>(width) * height;
+    mean.assign(pixel_count, Vector3f(0.0f));
+    luminance_mean.assign(pixel_count, 0.0f);
+    luminance_m2.assign(pixel_count, 0.0f);
+    sample_count.assign(pixel_count, 0);
+    converged.assign(pixel_count, 0);
+    error.assign(pixel_count, Infinity);
+    planned.assign(pixel_count, 1);
+    active_pixels = pixel_count;
+    max_sample_count = 0;
+}
+
+void AdaptiveSampling::AddSample(size_t pixel, const Vector3f &radiance)
+{
+    uint32_t n = ++sample_count[pixel];
+    mean[pixel] += (radiance - mean[pixel]) / static_cast<float>(n);
+
+    float luminance = Luminance(radiance);
+    float delta = luminance - luminance_mean[pixel];
+    luminance_mean[pixel] += delta / n;
+    luminance_m2[pixel] += delta * (luminance - luminance_mean[pixel]);
+}
+
+float AdaptiveSampling::RelativeError(size_t pixel) const
+{
+    uint32_t n = sample_count[pixel];
+    if (n < static_cast<uint32_t>(std::max(settings.min_samples, 2)))
+        return Infinity;
+    float variance = luminance_m2[pixel] / (n - 1);
+    float standard_error = std::sqrt(variance / n);
+    return standard_error / std::max(luminance_mean[pixel], MinLuminance);
+}
+
+void AdaptiveSampling::EndFrame()
+{
+    for (size_t pixel = 0; pixel < error.size(); pixel++)
+        error[pixel] = RelativeError(pixel);
+
+    active_pixels = 0;
+    max_sample_count = 0;
+    double error_sum = 0.0;
+    size_t error_count = 0;
+    for (int y = 0; y < image_height; y++) {
+        for (int x = 0; x < image_width; x++) {
+            size_t pixel = static_cast<size_t>(y) * image_width + x;
+            max_sample_count = std::max(max_sample_count, sample_count[pixel]);
+            if (converged[pixel])
+                continue;
+            float worst = 0.0f;
+            for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, image_height - 1); ny++)
+                for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, image_width - 1); nx++)
+                    worst = std::max(worst, error[static_cast<size_t>(ny) * image_width + nx]);
+            if (worst < settings.threshold) {
+                converged[pixel] = 1;
+                continue;
+            }
+            active_pixels++;
+            if (std::isfinite(error[pixel])) {
+                error_sum += error[pixel];
+                error_count++;
+            }
+        }
+    }
+
+    // Active pixels share a budget of one sample per pixel of the image, the noisier ones taking more
+    float share = static_cast<float>(error.size()) / std::max<size_t>(active_pixels, 1);
+    float mean_error = error_count > 0 ? static_cast<float>(error_sum / error_count) : 0.0f;
+    float max_samples = static_cast<float>(std::clamp(settings.max_samples_per_frame, 1, 255));
+    // The clamps push the total off the budget, a second pass with the share scaled back corrects most of it
+    size_t budget = error.size(), total = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        total = 0;
+        for (size_t pixel = 0; pixel < error.size(); pixel++) {
+            if (converged[pixel]) {
+                planned[pixel] = 0;
+                continue;
+            }
+            // Pixels short of min_samples have no error yet and take an even share
+            float weight = std::isfinite(error[pixel]) && mean_error > 0.0f ? error[pixel] / mean_error : 1.0f;
+            planned[pixel] = static_cast<uint8_t>(std::clamp(std::round(share * weight), 1.0f, max_samples));
+            total += planned[pixel];
+        }
+        if (total <= budget)
+            break;
+        share *= static_cast<float>(budget) / total;
+    }
+    // Rounding and the one-sample floor can still overshoot. Every active pixel keeps one sample,
+    // which fits since active_pixels <= budget, and the rest comes off the largest plans first
+    for (int level = static_cast<int>(max_samples); total > budget && level > 1; level--) {
+        for (size_t pixel = 0; pixel < planned.size() && total > budget; pixel++) {
+            if (planned[pixel] == level) {
+                planned[pixel]--;
+                total--;
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Util.hpp"
+
+// Per-pixel running estimates for adaptive sampling: the mean radiance and, for the luminance,
+// Welford's running mean and sum of squared deviations. A pixel stops taking samples once the
+// relative standard error of its luminance, and of its 8 neighbours', is below the threshold; the
+// neighbours keep a pixel that has only ever seen dark samples of a caustic from stopping early.
+// The samples converged pixels no longer take are handed to the rest in proportion to their error,
+// so a frame never costs more than one sample per pixel of the image.
+class AdaptiveSampling {
+public:
+    struct Settings {
+        float threshold = 0.02f;        // relative standard error of the luminance mean, 0 never converges
+        int min_samples = 16;           // before a pixel may converge
+        int max_samples_per_frame = 16; // cap on the freed budget one pixel gets per frame
+    };
+
+    void Reset(int width, int height);
+    bool Matches(int width, int height) const { return width == image_width && height == image_height; }
+
+    // Samples pixel takes this frame, 0 once converged
+    int SamplesThisFrame(size_t pixel) const { return planned[pixel]; }
+    // Only from the thread that renders the pixel
+    void AddSample(size_t pixel, const Vector3f &radiance);
+    // Updates the convergence mask and next frame's samples per pixel, after every pixel of the frame
+    void EndFrame();
+
+    const Vector3f &Mean(size_t pixel) const { return mean[pixel]; }
+    uint32_t SampleCount(size_t pixel) const { return sample_count[pixel]; }
+    const std::vector<uint32_t> &GetSampleCounts() const { return sample_count; }
+    uint32_t MaxSampleCount() const { return max_sample_count; }
+    size_t GetActivePixels() const { return active_pixels; }
+
+    void SetSettings(const Settings &new_settings) { settings = new_settings; }
+    const Settings &GetSettings() const { return settings; }
+
+private:
+    // Relative standard error of pixel's luminance mean, infinite before min_samples
+    float RelativeError(size_t pixel) const;
+
+private:
+    Settings settings;
+    int image_width = 0, image_height = 0;
+    std::vector<Vector3f> mean;
+    std::vector<float> luminance_mean, luminance_m2;
+    std::vector<uint32_t> sample_count;
+    std::vector<uint8_t> converged;
+    std::vector<float> error;
+    std::vector<uint8_t> planned; // samples of the next frame
+    size_t active_pixels = 0;
+    uint32_t max_sample_count = 0;
+};
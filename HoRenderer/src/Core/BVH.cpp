@@ -3,6 +3,17 @@
 */
 #include "BVH.hpp"
 #include "Scene.hpp"
+#include "SceneCache.hpp"
+#include "ThreadPool.hpp"
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <queue>
+
+namespace {
+    // Objects below which BVHnode builds both children on the calling thread
+    constexpr size_t ParallelBuildThreshold = 1024;
+}
 
 // Constructing BVH from Scene
 BVHnode::BVHnode(const Scene& scene) {
@@ -56,33 +67,40 @@ BVHnode::BVHnode(std::vector<std::shared_ptr<Hittable>>& objects, size_t start,
         }
     }
 
-    #pragma omp parallel sections
-    {
-        #pragma omp section
-            {
-                left = std::make_shared<BVHnode>(objects, start, split_point);
-            }
-        #pragma omp section
-            {
-                right = std::make_shared<BVHnode>(objects, split_point, end);
-            }
+    // Large subtrees build as tasks on the engine pool, small ones inline
+    if (object_span > ParallelBuildThreshold) {
+        TaskGraph subtrees;
+        subtrees.Add([&] { left = std::make_shared<BVHnode>(objects, start, split_point); });
+        subtrees.Add([&] { right = std::make_shared<BVHnode>(objects, split_point, end); });
+        subtrees.Run();
+    } else {
+        left = std::make_shared<BVHnode>(objects, start, split_point);
+        right = std::make_shared<BVHnode>(objects, split_point, end);
     }
 }
 
-bool BVHnode::isHit(const Ray& r, Vector2f t_interval, Hit_Payload& rec) const {
+bool BVHnode::Intersect(const Ray& r, Vector2f t_interval, SurfaceHit& hit) const {
     // First detect the bounding box
     Vector2f temp_interval = t_interval;
     if (!bbox.isHit(r, temp_interval))
         return false;
 
-    // Check left and right subtrees
-    bool hit_left = left->isHit(r, t_interval, rec);
-    Vector2f right_interval = Vector2f(t_interval.x, hit_left ? rec.t : t_interval.y);
-    bool hit_right = right->isHit(r, right_interval, rec);
+    // Check left and right subtrees, hit.object is left pointing at the leaf that was hit
+    bool hit_left = left->Intersect(r, t_interval, hit);
+    Vector2f right_interval = Vector2f(t_interval.x, hit_left ? hit.t : t_interval.y);
+    bool hit_right = right->Intersect(r, right_interval, hit);
 
     return hit_left || hit_right;
 }
 
+bool BVHnode::isOccluded(const Ray& r, float t_max) const {
+    Vector2f temp_interval = Vector2f(Epsilon, t_max);
+    if (!bbox.isHit(r, temp_interval))
+        return false;
+
+    return left->isOccluded(r, t_max) || right->isOccluded(r, t_max);
+}
+
 float BVHnode::calculateSurfaceArea(const AABB &bbox)
 {
     Vector3f extent = bbox.max() - bbox.min();
@@ -175,4 +193,374 @@ SplitResult BVHnode::FindOptimalSplitAccumulated(std::vector<std::shared_ptr<Hit
         best_split = start + object_span / 2;  
     
     return {best_split, min_cost, best_left_bbox, best_right_bbox};
-}
\ No newline at end of file
+}
+
+LinearBVH::LinearBVH(const std::vector<AABB> &primitive_bounds, const BVHBuildOptions &options, BVHBuildStats *stats,
+                     const PrimitivePolygonFn &polygon) {
+    // The cache key covers everything that changes the resulting tree: the node layout, the build
+    // options the builders read and, for SBVH, the polygons it clips
+    uint64_t cache_key = 0;
+    if (options.scene_cache && SceneCache::Enabled() && !primitive_bounds.empty()) {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        uint64_t layout[] = {sizeof(LinearBVHNode),
+                             offsetof(LinearBVHNode, primitives_offset),
+                             offsetof(LinearBVHNode, n_primitives),
+                             offsetof(LinearBVHNode, axis),
+                             MaxBVHDepth,
+                             static_cast<uint64_t>(options.quality),
+                             static_cast<uint64_t>(options.max_prims_in_node),
+                             std::bit_cast<uint32_t>(options.spatial_split_alpha),
+                             std::bit_cast<uint32_t>(options.spatial_split_budget),
+                             polygon != nullptr};
+        cache_key = SceneCache::Hash(primitive_bounds.data(), primitive_bounds.size() * sizeof(AABB),
+                                     SceneCache::Hash(layout, sizeof(layout)));
+        if (polygon && options.quality == BVHBuildQuality::SBVH) {
+            // Clipped leaf bounds depend on the shape inside each box, not only on the box
+            std::vector<Vector3f> vertices(primitive_bounds.size() * MaxPolygonVertices);
+            std::vector<int> counts(primitive_bounds.size());
+            #pragma omp parallel for schedule(static)
+            for (int64_t i = 0; i < static_cast<int64_t>(primitive_bounds.size()); i++) {
+                Vector3f *polygon_vertices = &vertices[i * MaxPolygonVertices];
+                counts[i] = polygon(static_cast<uint32_t>(i), polygon_vertices);
+                std::fill(polygon_vertices + counts[i], polygon_vertices + MaxPolygonVertices, Vector3f(0.0f));
+            }
+            cache_key = SceneCache::Hash(counts.data(), counts.size() * sizeof(int), cache_key);
+            cache_key = SceneCache::Hash(vertices.data(), vertices.size() * sizeof(Vector3f), cache_key);
+        }
+        bool loaded = SceneCache::LoadBVH(cache_key, nodes, primitive_indices);
+        if (loaded && !IsWellFormed(primitive_bounds)) {
+            std::cerr << "SceneCache: cached BVH " << std::hex << cache_key << std::dec << " is corrupt, rebuilding" << std::endl;
+            nodes = MappedArray<LinearBVHNode>();
+            primitive_indices = MappedArray<uint32_t>();
+            loaded = false;
+        }
+        if (loaded) {
+            if (stats) {
+                *stats = BVHBuildStats();
+                BVHBuilder::ComputeStats(nodes, *stats);
+                stats->from_cache = true;
+                stats->duplicate_references = primitive_indices.size() - primitive_bounds.size();
+                stats->build_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+            }
+            return;
+        }
+    }
+
+    if (stats)
+        *stats = BVHBuildStats();
+    BVHBuilder builder(options);
+    builder.Build(primitive_bounds, nodes.Mutable(), primitive_indices.Mutable(), stats, polygon);
+    if (cache_key != 0)
+        SceneCache::SaveBVH(cache_key, nodes, primitive_indices);
+}
+bool LinearBVH::IsWellFormed(const std::vector<AABB> &primitive_bounds) const {
+    // SBVH trees reference some primitives more than once, but every primitive at least once
+    size_t primitive_count = primitive_bounds.size();
+    if (nodes.empty() || primitive_indices.size() < primitive_count)
+        return false;
+    bool split_references = primitive_indices.size() > primitive_count;
+    auto contains = [](const AABB &outer, const AABB &inner) {
+        Vector3f outer_min = outer.min(), outer_max = outer.max(), inner_min = inner.min(), inner_max = inner.max();
+        return outer_min.x <= inner_min.x && outer_min.y <= inner_min.y && outer_min.z <= inner_min.z &&
+               outer_max.x >= inner_max.x && outer_max.y >= inner_max.y && outer_max.z >= inner_max.z;
+    };
+    auto overlaps = [](const AABB &a, const AABB &b) {
+        Vector3f a_min = a.min(), a_max = a.max(), b_min = b.min(), b_max = b.max();
+        return a_min.x <= b_max.x && a_min.y <= b_max.y && a_min.z <= b_max.z &&
+               b_min.x <= a_max.x && b_min.y <= a_max.y && b_min.z <= a_max.z;
+    };
+    std::vector<uint8_t> referenced(primitive_count, 0);
+    for (uint32_t primitive : primitive_indices) {
+        if (primitive >= primitive_count)
+            return false;
+        referenced[primitive] = 1;
+    }
+    if (std::find(referenced.begin(), referenced.end(), 0) != referenced.end())
+        return false;
+
+    // Children come after their parent, so a forward sweep knows every node's depth before its
+    // children, and each node but the root must be reached exactly once
+    std::vector<int> depth(nodes.size(), -1);
+    depth[0] = 0;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const LinearBVHNode &node = nodes[i];
+        if (depth[i] < 0 || depth[i] > MaxBVHDepth)
+            return false;
+        if (node.n_primitives > 0) {
+            if (static_cast<size_t>(node.primitives_offset) + node.n_primitives > primitive_indices.size())
+                return false;
+            // A tree built for other geometry misses parts of these primitives. SBVH leaves hold
+            // clipped pieces of the references they duplicate, those only have to overlap
+            for (uint32_t k = 0; k < node.n_primitives; k++) {
+                const AABB &bounds = primitive_bounds[primitive_indices[node.primitives_offset + k]];
+                if (split_references ? !overlaps(node.bounds, bounds) : !contains(node.bounds, bounds))
+                    return false;
+            }
+            continue;
+        }
+        uint32_t second = node.second_child_offset;
+        if (node.axis > 2 || second <= i + 1 || second >= nodes.size() || depth[i + 1] >= 0 || depth[second] >= 0)
+            return false;
+        depth[i + 1] = depth[second] = depth[i] + 1;
+    }
+    // Parents enclose their children, the offsets were checked above
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const LinearBVHNode &node = nodes[i];
+        if (node.n_primitives == 0 && (!contains(node.bounds, nodes[i + 1].bounds) ||
+                                       !contains(node.bounds, nodes[node.second_child_offset].bounds)))
+            return false;
+    }
+    return true;
+}
+
+uint32_t LinearBVH::SubtreeEnd(uint32_t node) const {
+    while (nodes[node].n_primitives == 0)
+        node = nodes[node].second_child_offset;
+    return node + 1;
+}
+
+void LinearBVH::SubtreePrimitives(uint32_t node, uint32_t &begin, uint32_t &end) const {
+    uint32_t first = node;
+    while (nodes[first].n_primitives == 0)
+        first = first + 1;
+    uint32_t last = SubtreeEnd(node) - 1;
+    begin = nodes[first].primitives_offset;
+    end = nodes[last].primitives_offset + nodes[last].n_primitives;
+}
+
+void LinearBVH::Refit(const std::vector<AABB> &primitive_bounds, const std::vector<uint8_t> &live) {
+    // Children are always stored after their parent, so one backwards sweep sees them first
+    for (int64_t i = static_cast<int64_t>(nodes.size()) - 1; i >= 0; i--) {
+        LinearBVHNode &node = nodes[i];
+        if (node.n_primitives == 0) {
+            node.bounds = calculateSurroundingBox(nodes[i + 1].bounds, nodes[node.second_child_offset].bounds);
+            continue;
+        }
+
+        bool any_live = false;
+        AABB bounds;
+        for (uint32_t k = 0; k < node.n_primitives; k++) {
+            uint32_t primitive = primitive_indices[node.primitives_offset + k];
+            if (!live[primitive])
+                continue;
+            bounds = any_live ? calculateSurroundingBox(bounds, primitive_bounds[primitive]) : primitive_bounds[primitive];
+            any_live = true;
+        }
+        // A leaf that only holds removed primitives collapses to a point until the next rebuild
+        node.bounds = any_live ? bounds : AABB(node.bounds.centroid(), node.bounds.centroid());
+    }
+}
+
+void LinearBVH::Insert(const std::vector<uint32_t> &new_primitives, const std::vector<AABB> &primitive_bounds,
+                       const std::vector<uint8_t> &live, const BVHBuildOptions &options) {
+    if (new_primitives.empty())
+        return;
+
+    BVHBuilder builder(options);
+    auto build_subtree = [&](const std::vector<uint32_t> &subtree_primitives, std::vector<LinearBVHNode> &out_nodes,
+                             std::vector<uint32_t> &out_indices) {
+        std::vector<AABB> bounds(subtree_primitives.size());
+        for (size_t i = 0; i < subtree_primitives.size(); i++)
+            bounds[i] = primitive_bounds[subtree_primitives[i]];
+        std::vector<uint32_t> local_indices;
+        builder.Build(bounds, out_nodes, local_indices);
+        out_indices.resize(local_indices.size());
+        for (size_t i = 0; i < local_indices.size(); i++)
+            out_indices[i] = subtree_primitives[local_indices[i]];
+    };
+
+    if (nodes.empty()) {
+        build_subtree(new_primitives, nodes.Mutable(), primitive_indices.Mutable());
+        return;
+    }
+
+    // Small subtrees leave the builder no room to improve on the insertion point
+    constexpr uint32_t MinRebuildPrimitives = 32;
+    struct Target {
+        uint32_t root;
+        uint32_t primitive;
+    };
+    std::vector<Target> targets;
+    targets.reserve(new_primitives.size());
+    std::vector<uint32_t> path;
+    for (uint32_t primitive : new_primitives) {
+        const AABB &bounds = primitive_bounds[primitive];
+        path.clear();
+        uint32_t current = 0;
+        while (nodes[current].n_primitives == 0) {
+            path.push_back(current);
+            uint32_t left = current + 1, right = nodes[current].second_child_offset;
+            float grow_left = calculateSurroundingBox(nodes[left].bounds, bounds).SurfaceArea() - nodes[left].bounds.SurfaceArea();
+            float grow_right = calculateSurroundingBox(nodes[right].bounds, bounds).SurfaceArea() - nodes[right].bounds.SurfaceArea();
+            current = grow_left <= grow_right ? left : right;
+        }
+
+        uint32_t begin, end;
+        SubtreePrimitives(current, begin, end);
+        while (!path.empty() && end - begin < MinRebuildPrimitives) {
+            current = path.back();
+            path.pop_back();
+            SubtreePrimitives(current, begin, end);
+        }
+        targets.push_back({current, primitive});
+    }
+
+    // Subtrees nest as contiguous node ranges, so after sorting a target inside the previous
+    // one is merged into it
+    std::sort(targets.begin(), targets.end(), [](const Target &a, const Target &b) { return a.root < b.root; });
+    struct Rebuild {
+        uint32_t root;
+        uint32_t end;
+        std::vector<uint32_t> inserted;
+    };
+    std::vector<Rebuild> rebuilds;
+    for (const Target &target : targets) {
+        if (rebuilds.empty() || target.root >= rebuilds.back().end)
+            rebuilds.push_back({target.root, SubtreeEnd(target.root), {}});
+        rebuilds.back().inserted.push_back(target.primitive);
+    }
+
+    // Copy the untouched nodes and splice in the rebuilt subtrees, second child offsets of copied
+    // interior nodes are patched once every old node has its new position
+    std::vector<LinearBVHNode> new_nodes;
+    std::vector<uint32_t> new_indices;
+    new_nodes.reserve(nodes.size() + 2 * new_primitives.size());
+    new_indices.reserve(primitive_indices.size() + new_primitives.size());
+    std::vector<uint32_t> new_position(nodes.size());
+    std::vector<uint32_t> copied_interior;
+    size_t next_rebuild = 0;
+    for (uint32_t i = 0; i < nodes.size();) {
+        new_position[i] = static_cast<uint32_t>(new_nodes.size());
+        if (next_rebuild < rebuilds.size() && rebuilds[next_rebuild].root == i) {
+            const Rebuild &rebuild = rebuilds[next_rebuild++];
+            std::vector<uint32_t> subtree_primitives = rebuild.inserted;
+            uint32_t begin, end;
+            SubtreePrimitives(i, begin, end);
+            for (uint32_t k = begin; k < end; k++) {
+                if (live[primitive_indices[k]])
+                    subtree_primitives.push_back(primitive_indices[k]);
+            }
+            // Spatial splits may have put a primitive into several leaves
+            std::sort(subtree_primitives.begin(), subtree_primitives.end());
+            subtree_primitives.erase(std::unique(subtree_primitives.begin(), subtree_primitives.end()), subtree_primitives.end());
+
+            std::vector<LinearBVHNode> subtree_nodes;
+            std::vector<uint32_t> subtree_indices;
+            build_subtree(subtree_primitives, subtree_nodes, subtree_indices);
+            uint32_t node_base = static_cast<uint32_t>(new_nodes.size());
+            uint32_t index_base = static_cast<uint32_t>(new_indices.size());
+            for (LinearBVHNode node : subtree_nodes) {
+                if (node.n_primitives > 0)
+                    node.primitives_offset += index_base;
+                else
+                    node.second_child_offset += node_base;
+                new_nodes.push_back(node);
+            }
+            new_indices.insert(new_indices.end(), subtree_indices.begin(), subtree_indices.end());
+            i = rebuild.end;
+            continue;
+        }
+
+        LinearBVHNode node = nodes[i];
+        if (node.n_primitives > 0) {
+            uint32_t offset = static_cast<uint32_t>(new_indices.size());
+            new_indices.insert(new_indices.end(), primitive_indices.begin() + node.primitives_offset,
+                               primitive_indices.begin() + node.primitives_offset + node.n_primitives);
+            node.primitives_offset = offset;
+        } else {
+            copied_interior.push_back(static_cast<uint32_t>(new_nodes.size()));
+        }
+        new_nodes.push_back(node);
+        i++;
+    }
+    for (uint32_t index : copied_interior)
+        new_nodes[index].second_child_offset = new_position[new_nodes[index].second_child_offset];
+
+    nodes = std::move(new_nodes);
+    primitive_indices = std::move(new_indices);
+}
+
+std::vector<uint32_t> ComputeNodeLayout(size_t block_count, BVHNodeLayout layout, size_t treelet_bytes,
+                                        const std::function<int(uint32_t, uint32_t *)> &children,
+                                        const std::function<float(uint32_t)> &area,
+                                        const std::function<size_t(uint32_t)> &bytes)
+{
+    std::vector<uint32_t> order;
+    order.reserve(block_count);
+    uint32_t child_blocks[8];
+
+    switch (layout) {
+    case BVHNodeLayout::DEPTH_FIRST:
+        for (uint32_t block = 0; block < block_count; block++)
+            order.push_back(block);
+        break;
+
+    case BVHNodeLayout::TREELET: {
+        // Each treelet takes the largest block on its frontier until the next one would not fit,
+        // whatever is left on the frontier roots the next treelets
+        auto smaller = [&](uint32_t a, uint32_t b) { return area(a) < area(b); };
+        std::queue<uint32_t> roots;
+        roots.push(0);
+        while (!roots.empty()) {
+            std::priority_queue<uint32_t, std::vector<uint32_t>, decltype(smaller)> frontier(smaller);
+            frontier.push(roots.front());
+            roots.pop();
+            size_t used = 0;
+            while (!frontier.empty() && (used == 0 || used + bytes(frontier.top()) <= treelet_bytes)) {
+                uint32_t block = frontier.top();
+                frontier.pop();
+                order.push_back(block);
+                used += bytes(block);
+                int n_children = children(block, child_blocks);
+                for (int i = 0; i < n_children; i++)
+                    frontier.push(child_blocks[i]);
+            }
+            for (; !frontier.empty(); frontier.pop())
+                roots.push(frontier.top());
+        }
+        break;
+    }
+
+    case BVHNodeLayout::VAN_EMDE_BOAS: {
+        // Children are numbered after their parents, so one backwards sweep gives every height
+        std::vector<int> height(block_count, 1);
+        for (size_t block = block_count; block-- > 0;) {
+            int n_children = children(static_cast<uint32_t>(block), child_blocks);
+            for (int i = 0; i < n_children; i++)
+                height[block] = std::max(height[block], height[child_blocks[i]] + 1);
+        }
+
+        // Store the top `levels` levels under block: the upper half recursively, then each subtree
+        // hanging below it with the remaining levels
+        std::function<void(uint32_t, int)> emit = [&](uint32_t block, int levels) {
+            if (levels == 1) {
+                order.push_back(block);
+                return;
+            }
+            int top = (levels + 1) / 2;
+            emit(block, top);
+
+            std::vector<std::pair<uint32_t, int>> stack = {{block, 0}};
+            std::vector<uint32_t> bottom;
+            while (!stack.empty()) {
+                auto [current, depth] = stack.back();
+                stack.pop_back();
+                if (depth == top) {
+                    bottom.push_back(current);
+                    continue;
+                }
+                uint32_t below[8];
+                int n_children = children(current, below);
+                for (int i = n_children - 1; i >= 0; i--)
+                    stack.push_back({below[i], depth + 1});
+            }
+            for (uint32_t subtree : bottom)
+                emit(subtree, levels - top);
+        };
+        emit(0, height[0]);
+        break;
+    }
+    }
+
+    return order;
+}
@@ -5,6 +5,10 @@
 
 #include "Util.hpp"
 #include "Hittable.hpp"
+#include "BVHBuilder.hpp"
+#include "RayPacket.hpp"
+#include "../Common/MappedFile.hpp"
+#include <type_traits>
 
 struct SplitResult {
     size_t split_index;
@@ -22,8 +26,14 @@ public:
     BVHnode(const Scene &scene);
     BVHnode(std::vector<std::shared_ptr<Hittable>> &objects, size_t start, size_t end);
 
-    bool isHit(const Ray& r, Vector2f t_interval, Hit_Payload& rec) const override;
+    bool Intersect(const Ray& r, Vector2f t_interval, SurfaceHit& hit) const override;
+    bool isOccluded(const Ray& r, float t_max) const override;
     AABB getBoundingBox() const override { return bbox; }
+    void BindMaterials(MaterialTable& table) override {
+        left->BindMaterials(table);
+        right->BindMaterials(table);
+    }
+    int WrapperDepth() const override { return std::max(left->WrapperDepth(), right->WrapperDepth()); }
     
 private:
     // Calculate the surface area of ​​the bounding box
@@ -44,4 +54,364 @@ private:
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
     AABB bbox;
-};
\ No newline at end of file
+};
+
+// 32-byte node of the flattened BVH. Nodes are stored depth-first, so the first
+// child of an interior node is always the next node in the array.
+struct alignas(32) LinearBVHNode {
+    AABB bounds;
+    union {
+        uint32_t primitives_offset;   // leaf
+        uint32_t second_child_offset; // interior
+    };
+    uint16_t n_primitives; // 0 -> interior node
+    uint8_t axis;          // split axis, used to pick the near child
+    uint8_t pad;
+};
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode must stay 32 bytes");
+
+/*
+* @brief: Storage order for the blocks of a tree, the post-build pass behind BVHNodeLayout. A block
+*         is whatever has to stay contiguous: one node, or a group of sibling nodes.
+*
+* @args: block_count: blocks [0, block_count), block 0 is the root and children come after their parent
+*        children: int(uint32_t block, uint32_t *children), writes at most 8 child blocks
+*        area: float(uint32_t block), surface area, TREELET grows towards the largest
+*        bytes: size_t(uint32_t block)
+* @ret: order[i] is the block to store at position i, the root stays first
+*/
+std::vector<uint32_t> ComputeNodeLayout(size_t block_count, BVHNodeLayout layout, size_t treelet_bytes,
+                                        const std::function<int(uint32_t, uint32_t *)> &children,
+                                        const std::function<float(uint32_t)> &area,
+                                        const std::function<size_t(uint32_t)> &bytes);
+
+// Calls intersect for one leaf of a traversal. A callback taking the whole leaf,
+// bool(const uint32_t *primitives, uint32_t count, Vector2f &t_interval), gets it in one call (e.g.
+// for CompiledScene::IntersectLeaf), a per-primitive one is called once per primitive.
+template <typename IntersectFn>
+inline bool IntersectLeafPrimitives(IntersectFn &intersect, const uint32_t *primitives, uint32_t count, Vector2f &t_interval) {
+    if constexpr (std::is_invocable_r_v<bool, IntersectFn &, const uint32_t *, uint32_t, Vector2f &>) {
+        return intersect(primitives, count, t_interval);
+    } else {
+        bool hit_anything = false;
+        for (uint32_t i = 0; i < count; i++) {
+            if (intersect(primitives[i], t_interval))
+                hit_anything = true;
+        }
+        return hit_anything;
+    }
+}
+
+// Index-based BVH over an arbitrary set of primitive bounds. The owner keeps the
+// primitives; leaves refer to them through GetPrimitiveIndices().
+class LinearBVH {
+public:
+    LinearBVH() {}
+    // polygon is only used by BVHBuildQuality::SBVH, see PrimitivePolygonFn
+    LinearBVH(const std::vector<AABB> &primitive_bounds, const BVHBuildOptions &options = {}, BVHBuildStats *stats = nullptr,
+              const PrimitivePolygonFn &polygon = nullptr);
+
+    /*
+    * @brief: Iterative closest-hit traversal, near child first according to the ray direction sign.
+    *
+    * @args: r: ray in the space of the primitive bounds
+    *        t_interval: valid ray interval
+    *        intersect: bool(uint32_t primitive, Vector2f &t_interval), returns true on a hit
+    *                   and shrinks t_interval.y to the hit distance. Or the whole-leaf form, see
+    *                   IntersectLeafPrimitives
+    *        stats: optional counters, compiled out when the call passes none
+    * @ret: true if any primitive was hit
+    */
+    template <typename IntersectFn>
+    bool Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats = nullptr) const;
+
+    /*
+    * @brief: Any-hit traversal, returns as soon as one primitive reports a hit.
+    *
+    * @args: occluded: bool(uint32_t primitive)
+    */
+    template <typename OccludedFn>
+    bool Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const;
+
+    /*
+    * @brief: Closest hits of a packet of coherent rays in one traversal. A node is skipped for the
+    *         whole packet when PacketFrustum culls it, otherwise one AVX slab test gives the lanes
+    *         that enter it; leaves are tested for those lanes only. Children are visited in the
+    *         near-first order of the first active lane.
+    *
+    * @args: intersect: bool(int lane, uint32_t primitive, Vector2f &t_interval), or the whole-leaf
+    *                   form with the lane in front, see Intersect
+    *        packet: t_max of every lane that hits shrinks to its hit distance
+    * @ret: mask of the lanes that hit
+    */
+    template <typename IntersectFn>
+    int IntersectPacket(RayPacket &packet, IntersectFn &&intersect) const;
+
+    /*
+    * @brief: Any-hit traversal of a packet, a lane drops out at its first blocker.
+    *
+    * @args: occluded: bool(int lane, uint32_t primitive)
+    * @ret: mask of the occluded lanes
+    */
+    template <typename OccludedFn>
+    int OccludedPacket(const RayPacket &packet, OccludedFn &&occluded) const;
+
+    /*
+    * @brief: Recompute every node's bounds bottom-up after primitives moved, the topology is kept.
+    *
+    * @args: primitive_bounds: current bounds, indexed by primitive
+    *        live: 0 for removed primitives, which stay in their leaves but no longer count
+    */
+    void Refit(const std::vector<AABB> &primitive_bounds, const std::vector<uint8_t> &live);
+
+    /*
+    * @brief: Add primitives without a full build. Each one walks down to the leaf whose bounds grow
+    *         least, then the subtree a few levels above it is rebuilt with its live primitives plus
+    *         the new ones. Call Refit afterwards so the ancestors enclose the new subtrees.
+    */
+    void Insert(const std::vector<uint32_t> &new_primitives, const std::vector<AABB> &primitive_bounds,
+                const std::vector<uint8_t> &live, const BVHBuildOptions &options = {});
+
+    AABB getBoundingBox() const { return nodes.empty() ? AABB() : nodes[0].bounds; }
+    std::span<const LinearBVHNode> GetNodes() const { return nodes; }
+    std::span<const uint32_t> GetPrimitiveIndices() const { return primitive_indices; }
+    size_t MemoryBytes() const { return nodes.size() * sizeof(LinearBVHNode) + primitive_indices.size() * sizeof(uint32_t); }
+
+private:
+    // Indices in range, every node reached once within MaxBVHDepth and bounds that enclose what
+    // they hold, for trees read from SceneCache
+    bool IsWellFormed(const std::vector<AABB> &primitive_bounds) const;
+    // Lanes whose slab interval through box overlaps [t_min, t_max]
+    static int IntersectPacketBounds(const AABB &box, const __m256 org[3], const __m256 inv[3], __m256 t_min, __m256 t_max);
+    // One past the last node of the subtree rooted at `node` (subtrees are contiguous)
+    uint32_t SubtreeEnd(uint32_t node) const;
+    // Range of primitive_indices covered by the leaves of a subtree, also contiguous
+    void SubtreePrimitives(uint32_t node, uint32_t &begin, uint32_t &end) const;
+
+    // Read in place from the cache file when the tree was loaded, copied out by Refit and Insert
+    MappedArray<LinearBVHNode> nodes;
+    MappedArray<uint32_t> primitive_indices;
+};
+
+template <typename IntersectFn>
+bool LinearBVH::Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats) const {
+    if (nodes.empty())
+        return false;
+    if (stats)
+        stats->rays++;
+
+    const Vector3f &origin = r.origin();
+    Vector3f inv_dir = 1.0f / r.direction();
+    int dir_is_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+
+    uint32_t to_visit[MaxBVHDepth];
+    int to_visit_offset = 0;
+    uint32_t current = 0;
+    bool hit_anything = false;
+
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        if (stats) {
+            stats->node_visits++;
+            stats->Touch(&node, sizeof(node));
+        }
+        if (node.bounds.isHit(origin, inv_dir, dir_is_neg, t_interval)) {
+            if (node.n_primitives > 0) {
+                if (stats) {
+                    stats->primitive_tests += node.n_primitives;
+                    stats->Touch(&primitive_indices[node.primitives_offset], node.n_primitives * sizeof(uint32_t));
+                }
+                if (IntersectLeafPrimitives(intersect, &primitive_indices[node.primitives_offset], node.n_primitives, t_interval))
+                    hit_anything = true;
+                if (to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            } else {
+                // Visit the child on the near side of the split plane first
+                if (dir_is_neg[node.axis]) {
+                    to_visit[to_visit_offset++] = current + 1;
+                    current = node.second_child_offset;
+                } else {
+                    to_visit[to_visit_offset++] = node.second_child_offset;
+                    current = current + 1;
+                }
+            }
+        } else {
+            if (to_visit_offset == 0)
+                break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+
+    return hit_anything;
+}
+
+template <typename OccludedFn>
+bool LinearBVH::Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const {
+    if (nodes.empty())
+        return false;
+
+    const Vector3f &origin = r.origin();
+    Vector3f inv_dir = 1.0f / r.direction();
+    int dir_is_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+
+    uint32_t to_visit[MaxBVHDepth];
+    int to_visit_offset = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        if (node.bounds.isHit(origin, inv_dir, dir_is_neg, t_interval)) {
+            if (node.n_primitives > 0) {
+                for (uint32_t i = 0; i < node.n_primitives; i++) {
+                    if (occluded(primitive_indices[node.primitives_offset + i]))
+                        return true;
+                }
+                if (to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            } else {
+                // Order does not matter for correctness, near first still finds blockers sooner
+                if (dir_is_neg[node.axis]) {
+                    to_visit[to_visit_offset++] = current + 1;
+                    current = node.second_child_offset;
+                } else {
+                    to_visit[to_visit_offset++] = node.second_child_offset;
+                    current = current + 1;
+                }
+            }
+        } else {
+            if (to_visit_offset == 0)
+                break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+
+    return false;
+}
+
+inline int LinearBVH::IntersectPacketBounds(const AABB &box, const __m256 org[3], const __m256 inv[3], __m256 t_min, __m256 t_max) {
+    Vector3f b_min = box.min(), b_max = box.max();
+    for (int axis = 0; axis < 3; axis++) {
+        // Lanes may disagree on the direction sign, so the near plane is picked per lane
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b_min[axis]), org[axis]), inv[axis]);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(b_max[axis]), org[axis]), inv[axis]);
+        t_min = _mm256_max_ps(t_min, _mm256_min_ps(t0, t1));
+        t_max = _mm256_min_ps(t_max, _mm256_max_ps(t0, t1));
+    }
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ));
+}
+
+template <typename IntersectFn>
+int LinearBVH::IntersectPacket(RayPacket &packet, IntersectFn &&intersect) const {
+    if (nodes.empty() || packet.active == 0)
+        return 0;
+
+    PacketFrustum frustum(packet);
+    __m256 org[3] = {_mm256_load_ps(packet.org_x), _mm256_load_ps(packet.org_y), _mm256_load_ps(packet.org_z)};
+    __m256 inv[3] = {_mm256_load_ps(packet.inv_x), _mm256_load_ps(packet.inv_y), _mm256_load_ps(packet.inv_z)};
+    __m256 t_min = _mm256_load_ps(packet.t_min);
+    __m256 t_max = _mm256_load_ps(packet.t_max);
+    int first = packet.FirstLane();
+    int dir_is_neg[3] = {packet.inv_x[first] < 0.0f, packet.inv_y[first] < 0.0f, packet.inv_z[first] < 0.0f};
+
+    uint32_t to_visit[MaxBVHDepth];
+    int to_visit_offset = 0;
+    uint32_t current = 0;
+    int hit_mask = 0;
+
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        int mask = 0;
+        if (!frustum.valid || !frustum.Misses(node.bounds))
+            mask = IntersectPacketBounds(node.bounds, org, inv, t_min, t_max) & packet.active;
+        if (mask) {
+            if (node.n_primitives > 0) {
+                for (; mask; mask &= mask - 1) {
+                    int lane = std::countr_zero(static_cast<unsigned>(mask));
+                    auto lane_intersect = [&](auto &&...args) -> decltype(intersect(lane, args...)) { return intersect(lane, args...); };
+                    Vector2f interval(packet.t_min[lane], packet.t_max[lane]);
+                    if (IntersectLeafPrimitives(lane_intersect, &primitive_indices[node.primitives_offset], node.n_primitives, interval)) {
+                        packet.t_max[lane] = interval.y;
+                        hit_mask |= 1 << lane;
+                    }
+                }
+                t_max = _mm256_load_ps(packet.t_max);
+                if (to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            } else {
+                if (dir_is_neg[node.axis]) {
+                    to_visit[to_visit_offset++] = current + 1;
+                    current = node.second_child_offset;
+                } else {
+                    to_visit[to_visit_offset++] = node.second_child_offset;
+                    current = current + 1;
+                }
+            }
+        } else {
+            if (to_visit_offset == 0)
+                break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+
+    return hit_mask;
+}
+
+template <typename OccludedFn>
+int LinearBVH::OccludedPacket(const RayPacket &packet, OccludedFn &&occluded) const {
+    if (nodes.empty() || packet.active == 0)
+        return 0;
+
+    PacketFrustum frustum(packet);
+    __m256 org[3] = {_mm256_load_ps(packet.org_x), _mm256_load_ps(packet.org_y), _mm256_load_ps(packet.org_z)};
+    __m256 inv[3] = {_mm256_load_ps(packet.inv_x), _mm256_load_ps(packet.inv_y), _mm256_load_ps(packet.inv_z)};
+    __m256 t_min = _mm256_load_ps(packet.t_min);
+    __m256 t_max = _mm256_load_ps(packet.t_max);
+    int first = packet.FirstLane();
+    int dir_is_neg[3] = {packet.inv_x[first] < 0.0f, packet.inv_y[first] < 0.0f, packet.inv_z[first] < 0.0f};
+
+    uint32_t to_visit[MaxBVHDepth];
+    int to_visit_offset = 0;
+    uint32_t current = 0;
+    int pending = packet.active;
+
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        int mask = 0;
+        if (!frustum.valid || !frustum.Misses(node.bounds))
+            mask = IntersectPacketBounds(node.bounds, org, inv, t_min, t_max) & pending;
+        if (mask) {
+            if (node.n_primitives > 0) {
+                for (; mask; mask &= mask - 1) {
+                    int lane = std::countr_zero(static_cast<unsigned>(mask));
+                    for (uint32_t i = 0; i < node.n_primitives; i++) {
+                        if (occluded(lane, primitive_indices[node.primitives_offset + i])) {
+                            pending &= ~(1 << lane);
+                            break;
+                        }
+                    }
+                }
+                // Done once every lane found a blocker
+                if (pending == 0 || to_visit_offset == 0)
+                    break;
+                current = to_visit[--to_visit_offset];
+            } else {
+                if (dir_is_neg[node.axis]) {
+                    to_visit[to_visit_offset++] = current + 1;
+                    current = node.second_child_offset;
+                } else {
+                    to_visit[to_visit_offset++] = node.second_child_offset;
+                    current = current + 1;
+                }
+            }
+        } else {
+            if (to_visit_offset == 0)
+                break;
+            current = to_visit[--to_visit_offset];
+        }
+    }
+
+    return packet.active & ~pending;
+}
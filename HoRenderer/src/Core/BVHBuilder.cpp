@@ -0,0 +1,856 @@
+#include "BVHBuilder.hpp"
+#include "BVH.hpp"
+#include <bit>
+#include <cassert>
+#include <chrono>
+
+namespace {
+    // Bounds that start empty, AABB itself always pads to a minimum extent
+    struct BinBounds {
+        Vector3f lo = Vector3f(Infinity);
+        Vector3f hi = Vector3f(-Infinity);
+
+        inline void Extend(const Vector3f &p_min, const Vector3f &p_max) {
+            lo = glm::min(lo, p_min);
+            hi = glm::max(hi, p_max);
+        }
+        inline void Extend(const BinBounds &b) { Extend(b.lo, b.hi); }
+        inline float SurfaceArea() const {
+            if (lo.x > hi.x)
+                return 0.0f;
+            Vector3f extent = hi - lo;
+            return 2.0f * (extent.x * extent.y + extent.x * extent.z + extent.y * extent.z);
+        }
+    };
+
+    constexpr int MaxBins = 32;
+    constexpr uint32_t MaxLeafPrimitives = 0xFFFF;
+
+    // Levels below a node of n primitives when every split halves them
+    inline int CeilLog2(uint32_t n) {
+        return n <= 1 ? 0 : 32 - std::countl_zero(n - 1);
+    }
+
+    // Splits where any split, however lopsided, still leaves room for median splits to finish
+    // the subtree within MaxBVHDepth. Past that, splits must halve the range.
+    inline bool MedianSplitsOnly(int depth, uint32_t span, int max_depth = MaxBVHDepth) {
+        return depth + CeilLog2(span) >= max_depth;
+    }
+
+    struct ObjectSplit {
+        float cost = Infinity; // relative to the parent area, traversal included
+        int axis = -1;         // -1 when no split separates the primitives
+        int bin = 0;           // last bin on the left side
+        BinBounds left, right;
+    };
+
+    // Binned SAH over the centroids of primitives [start, end) on the axes [first_axis, last_axis]
+    template <typename Primitive>
+    ObjectSplit FindObjectSplit(const Primitive *primitives, uint32_t start, uint32_t end, const BinBounds &bounds,
+                                const BinBounds &centroid_bounds, int n_bins, int first_axis, int last_axis) {
+        ObjectSplit best;
+        uint32_t span = end - start;
+        float parent_area = bounds.SurfaceArea();
+        Vector3f extent = centroid_bounds.hi - centroid_bounds.lo;
+
+        for (int axis = first_axis; axis <= last_axis; axis++) {
+            if (extent[axis] <= 0.0f)
+                continue;
+
+            BinBounds bin_bounds[MaxBins];
+            uint32_t bin_counts[MaxBins] = {};
+            float scale = n_bins / extent[axis];
+            for (uint32_t i = start; i < end; i++) {
+                int b = std::min(n_bins - 1, static_cast<int>((primitives[i].centroid[axis] - centroid_bounds.lo[axis]) * scale));
+                bin_counts[b]++;
+                bin_bounds[b].Extend(primitives[i].bounds.min(), primitives[i].bounds.max());
+            }
+
+            // Sweep from the right to collect the area/count of every right-hand side
+            float right_cost[MaxBins];
+            BinBounds right_side[MaxBins];
+            BinBounds right_bounds;
+            uint32_t right_count = 0;
+            for (int b = n_bins - 1; b > 0; b--) {
+                right_bounds.Extend(bin_bounds[b]);
+                right_count += bin_counts[b];
+                right_cost[b - 1] = right_count * right_bounds.SurfaceArea();
+                right_side[b - 1] = right_bounds;
+            }
+
+            // Sweep from the left and evaluate the split after every bin
+            BinBounds left_bounds;
+            uint32_t left_count = 0;
+            for (int b = 0; b < n_bins - 1; b++) {
+                left_bounds.Extend(bin_bounds[b]);
+                left_count += bin_counts[b];
+                if (left_count == 0 || left_count == span)
+                    continue;
+                float cost = BVHBuilder::TraversalCost +
+                             BVHBuilder::IntersectionCost * (left_count * left_bounds.SurfaceArea() + right_cost[b]) / parent_area;
+                if (cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.bin = b;
+                    best.left = left_bounds;
+                    best.right = right_side[b];
+                }
+            }
+        }
+        return best;
+    }
+
+    float OverlapArea(const BinBounds &a, const BinBounds &b) {
+        BinBounds overlap;
+        overlap.lo = glm::max(a.lo, b.lo);
+        overlap.hi = glm::min(a.hi, b.hi);
+        if (overlap.hi.x < overlap.lo.x || overlap.hi.y < overlap.lo.y || overlap.hi.z < overlap.lo.z)
+            return 0.0f;
+        return overlap.SurfaceArea();
+    }
+
+    AABB IntersectBounds(const AABB &a, const AABB &b) {
+        return AABB(glm::max(a.min(), b.min()), glm::min(a.max(), b.max()));
+    }
+
+    // Bounds of the part of a convex polygon in each slab [lo + b * width, lo + (b + 1) * width) for
+    // b in [first, last], the outer slabs also take whatever lies beyond them. One pass over the
+    // edges: vertices go to their own slab, plane crossings to the slabs on both sides.
+    void BinPolygon(const Vector3f *vertices, int count, int axis, float lo, float width, int first, int last, BinBounds *parts) {
+        auto slab_of = [&](float x) { return std::clamp(static_cast<int>((x - lo) / width), first, last); };
+        for (int i = 0; i < count; i++) {
+            Vector3f a = vertices[i], b = vertices[(i + 1) % count];
+            int slab_a = slab_of(a[axis]);
+            parts[slab_a].Extend(a, a);
+            int slab_b = slab_of(b[axis]);
+            if (slab_a == slab_b)
+                continue;
+            if (slab_a > slab_b) {
+                std::swap(a, b);
+                std::swap(slab_a, slab_b);
+            }
+            for (int k = slab_a + 1; k <= slab_b; k++) {
+                float plane = lo + k * width;
+                Vector3f p = a + ((plane - a[axis]) / (b[axis] - a[axis])) * (b - a);
+                p[axis] = plane;
+                parts[k - 1].Extend(p, p);
+                parts[k].Extend(p, p);
+            }
+        }
+    }
+
+    struct MortonPrimitive {
+        uint64_t code;
+        uint32_t primitive;
+    };
+
+    // Spread the low 21 bits of v so that there are two zero bits between each of them
+    inline uint64_t ExpandBits(uint64_t v) {
+        v &= 0x1FFFFF;
+        v = (v | v << 32) & 0x1F00000000FFFFull;
+        v = (v | v << 16) & 0x1F0000FF0000FFull;
+        v = (v | v << 8) & 0x100F00F00F00F00Full;
+        v = (v | v << 4) & 0x10C30C30C30C30C3ull;
+        v = (v | v << 2) & 0x1249249249249249ull;
+        return v;
+    }
+
+    // Parallel LSD radix sort on the low key_bits of the code, 8 bits per pass. Every thread
+    // counts its own contiguous chunk, so the scatter keeps the order of equal digits.
+    void RadixSort(std::vector<MortonPrimitive> &items, int key_bits) {
+        constexpr int DigitBits = 8;
+        constexpr int Buckets = 1 << DigitBits;
+        std::vector<MortonPrimitive> scratch(items.size());
+        std::vector<uint32_t> counts(static_cast<size_t>(omp_get_max_threads()) * Buckets);
+
+        for (int shift = 0; shift < key_bits; shift += DigitBits) {
+            #pragma omp parallel
+            {
+                int thread = omp_get_thread_num();
+                int n_threads = omp_get_num_threads();
+                size_t begin = items.size() * thread / n_threads;
+                size_t end = items.size() * (thread + 1) / n_threads;
+                uint32_t *count = &counts[static_cast<size_t>(thread) * Buckets];
+                std::fill(count, count + Buckets, 0u);
+                for (size_t i = begin; i < end; i++)
+                    count[(items[i].code >> shift) & (Buckets - 1)]++;
+
+                #pragma omp barrier
+                #pragma omp single
+                {
+                    // Bucket-major prefix sum, threads in order within each bucket
+                    uint32_t offset = 0;
+                    for (int b = 0; b < Buckets; b++)
+                        for (int t = 0; t < n_threads; t++) {
+                            uint32_t c = counts[static_cast<size_t>(t) * Buckets + b];
+                            counts[static_cast<size_t>(t) * Buckets + b] = offset;
+                            offset += c;
+                        }
+                }
+
+                for (size_t i = begin; i < end; i++)
+                    scratch[count[(items[i].code >> shift) & (Buckets - 1)]++] = items[i];
+            }
+            items.swap(scratch);
+        }
+    }
+}
+
+void BVHBuilder::Build(const std::vector<AABB> &primitive_bounds, std::vector<LinearBVHNode> &nodes,
+                       std::vector<uint32_t> &primitive_indices, BVHBuildStats *stats, const PrimitivePolygonFn &polygon) const
+{
+    auto start_time = std::chrono::high_resolution_clock::now();
+    nodes.clear();
+    primitive_indices.clear();
+    if (primitive_bounds.empty())
+        return;
+
+    std::vector<BuildPrimitive> primitives(primitive_bounds.size());
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < static_cast<long long>(primitive_bounds.size()); i++)
+        primitives[i] = {primitive_bounds[i], primitive_bounds[i].centroid(), static_cast<uint32_t>(i)};
+
+    // One scratch arena per thread, the tasks below allocate from the arena of whichever thread runs them
+    std::vector<MemoryArena> arenas(omp_get_max_threads());
+    std::atomic<size_t> node_count = 0;
+    BuildNode *root = nullptr;
+
+    size_t duplicate_references = 0;
+    if (options.quality == BVHBuildQuality::SBVH) {
+        SpatialBuild state;
+        state.polygon = polygon ? &polygon : nullptr;
+        state.arena = &arenas[0];
+        state.duplicate_budget = static_cast<size_t>(options.spatial_split_budget * primitives.size());
+        BinBounds root_bounds;
+        for (const auto &primitive : primitives)
+            root_bounds.Extend(primitive.bounds.min(), primitive.bounds.max());
+        state.root_area = root_bounds.SurfaceArea();
+        root = BuildSpatial(state, primitives, 0);
+        node_count = state.node_count;
+        duplicate_references = state.output.size() - primitive_bounds.size();
+
+        nodes.reserve(node_count);
+        Flatten(root, nodes);
+        primitive_indices = std::move(state.output);
+    } else if (options.quality == BVHBuildQuality::LBVH || options.quality == BVHBuildQuality::HLBVH) {
+        root = BuildMorton(arenas, primitives, node_count);
+    } else {
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            root = BuildRecursive(arenas, primitives.data(), 0, static_cast<uint32_t>(primitives.size()), 0, node_count);
+        }
+    }
+
+    if (options.quality != BVHBuildQuality::SBVH) {
+        nodes.reserve(node_count);
+        Flatten(root, nodes);
+
+        primitive_indices.resize(primitives.size());
+        for (size_t i = 0; i < primitives.size(); i++)
+            primitive_indices[i] = primitives[i].index;
+    }
+
+    if (stats) {
+        stats->build_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+        ComputeStats(nodes, *stats);
+        stats->duplicate_references = duplicate_references;
+        stats->arena_bytes = 0;
+        for (const auto &arena : arenas)
+            stats->arena_bytes += arena.TotalAllocated();
+    }
+}
+
+BVHBuilder::BuildNode *BVHBuilder::BuildRecursive(std::vector<MemoryArena> &arenas, BuildPrimitive *primitives, uint32_t start, uint32_t end,
+                                                  int depth, std::atomic<size_t> &node_count) const
+{
+    BuildNode *node = arenas[omp_get_thread_num()].Alloc<BuildNode>();
+    node_count++;
+
+    BinBounds bounds, centroid_bounds;
+    for (uint32_t i = start; i < end; i++) {
+        bounds.Extend(primitives[i].bounds.min(), primitives[i].bounds.max());
+        centroid_bounds.Extend(primitives[i].centroid, primitives[i].centroid);
+    }
+    node->bounds = AABB(bounds.lo, bounds.hi);
+
+    uint32_t span = end - start;
+    auto make_leaf = [&]() {
+        node->first_prim_offset = start;
+        node->n_primitives = span;
+        return node;
+    };
+    if (span <= 2)
+        return make_leaf();
+
+    // Binned SAH over the centroid bounds
+    Vector3f extent = centroid_bounds.hi - centroid_bounds.lo;
+    int widest = 0;
+    if (extent.y > extent.x) widest = 1;
+    if (extent.z > extent[widest]) widest = 2;
+    if (extent[widest] <= 0.0f) {
+        // All centroids coincide, SAH cannot separate them. Keep them in one leaf
+        // unless that would overflow the leaf counter of the flattened node.
+        if (span <= MaxLeafPrimitives)
+            return make_leaf();
+        return SplitChildren(arenas, primitives, start, start + span / 2, end, widest, depth, node, node_count);
+    }
+    if (MedianSplitsOnly(depth, span)) {
+        // SAH peels off a few primitives per level when the centroids bunch up in one bin
+        if (span <= static_cast<uint32_t>(options.max_prims_in_node))
+            return make_leaf();
+        uint32_t mid = start + span / 2;
+        std::nth_element(primitives + start, primitives + mid, primitives + end, [&](const BuildPrimitive &a, const BuildPrimitive &b) {
+            return a.centroid[widest] < b.centroid[widest];
+        });
+        return SplitChildren(arenas, primitives, start, mid, end, widest, depth, node, node_count);
+    }
+
+    const int n_bins = options.quality == BVHBuildQuality::HIGH ? 32 : 16;
+    const int first_axis = options.quality == BVHBuildQuality::HIGH ? 0 : widest;
+    const int last_axis = options.quality == BVHBuildQuality::HIGH ? 2 : widest;
+
+    ObjectSplit split = FindObjectSplit(primitives, start, end, bounds, centroid_bounds, n_bins, first_axis, last_axis);
+    float best_cost = split.cost;
+    int best_axis = split.axis, best_split = split.bin;
+
+    float leaf_cost = IntersectionCost * span;
+    if (best_axis < 0 || (span <= static_cast<uint32_t>(options.max_prims_in_node) && best_cost >= leaf_cost))
+        return make_leaf();
+
+    float scale = n_bins / extent[best_axis];
+    float lo = centroid_bounds.lo[best_axis];
+    BuildPrimitive *mid_ptr = std::partition(primitives + start, primitives + end, [&](const BuildPrimitive &p) {
+        return std::min(n_bins - 1, static_cast<int>((p.centroid[best_axis] - lo) * scale)) <= best_split;
+    });
+    uint32_t mid = static_cast<uint32_t>(mid_ptr - primitives);
+    if (mid == start || mid == end) {
+        // Floating point disagreement between binning and partitioning, fall back to a median split
+        mid = start + span / 2;
+        std::nth_element(primitives + start, primitives + mid, primitives + end, [&](const BuildPrimitive &a, const BuildPrimitive &b) {
+            return a.centroid[best_axis] < b.centroid[best_axis];
+        });
+    }
+
+    return SplitChildren(arenas, primitives, start, mid, end, best_axis, depth, node, node_count);
+}
+
+BVHBuilder::BuildNode *BVHBuilder::SplitChildren(std::vector<MemoryArena> &arenas, BuildPrimitive *primitives, uint32_t start, uint32_t mid, uint32_t end,
+                                                 int axis, int depth, BuildNode *node, std::atomic<size_t> &node_count) const
+{
+    node->axis = static_cast<uint8_t>(axis);
+    if (end - start > options.parallel_threshold) {
+        #pragma omp task shared(arenas, node_count) if (end - mid > options.parallel_threshold)
+        node->children[1] = BuildRecursive(arenas, primitives, mid, end, depth + 1, node_count);
+        node->children[0] = BuildRecursive(arenas, primitives, start, mid, depth + 1, node_count);
+        #pragma omp taskwait
+    } else {
+        node->children[0] = BuildRecursive(arenas, primitives, start, mid, depth + 1, node_count);
+        node->children[1] = BuildRecursive(arenas, primitives, mid, end, depth + 1, node_count);
+    }
+    return node;
+}
+
+AABB BVHBuilder::ClipReference(const SpatialBuild &state, const BuildPrimitive &reference, const AABB &box) const
+{
+    AABB clipped = IntersectBounds(reference.bounds, box);
+    Vector3f vertices[MaxPolygonVertices];
+    int count = state.polygon ? (*state.polygon)(reference.index, vertices) : 0;
+    if (count > 0)
+        clipped = IntersectBounds(ClipPolygonBounds(vertices, count, clipped), clipped);
+    return clipped;
+}
+
+BVHBuilder::BuildNode *BVHBuilder::BuildSpatial(SpatialBuild &state, std::vector<BuildPrimitive> &references, int depth) const
+{
+    BuildNode *node = state.arena->Alloc<BuildNode>();
+    state.node_count++;
+
+    BinBounds bounds, centroid_bounds;
+    for (const auto &reference : references) {
+        bounds.Extend(reference.bounds.min(), reference.bounds.max());
+        centroid_bounds.Extend(reference.centroid, reference.centroid);
+    }
+    node->bounds = AABB(bounds.lo, bounds.hi);
+
+    uint32_t span = static_cast<uint32_t>(references.size());
+    auto make_leaf = [&]() {
+        node->first_prim_offset = static_cast<uint32_t>(state.output.size());
+        node->n_primitives = span;
+        for (const auto &reference : references)
+            state.output.push_back(reference.index);
+        return node;
+    };
+    if (span <= 2)
+        return make_leaf();
+    // Neither spatial nor lopsided object splits are guaranteed to halve the references, near
+    // MaxBVHDepth the node is split at the median instead
+    bool median_only = MedianSplitsOnly(depth, span);
+    if (median_only && span <= static_cast<uint32_t>(options.max_prims_in_node))
+        return make_leaf();
+
+    constexpr int n_bins = 32;
+    ObjectSplit object;
+    if (!median_only)
+        object = FindObjectSplit(references.data(), 0, span, bounds, centroid_bounds, n_bins, 0, 2);
+    float parent_area = bounds.SurfaceArea();
+
+    // Spatial split: bins over the node bounds, references are clipped into every bin they
+    // touch and counted on entry and exit. Only worth it where object split children overlap.
+    float spatial_cost = Infinity;
+    int spatial_axis = -1, spatial_bin = 0;
+    if (!median_only && state.duplicate_budget > 0 && (object.axis < 0 || OverlapArea(object.left, object.right) > options.spatial_split_alpha * state.root_area)) {
+        BinBounds bin_bounds[3][n_bins];
+        uint32_t entries[3][n_bins] = {}, exits[3][n_bins] = {};
+        Vector3f extent = bounds.hi - bounds.lo;
+        for (const auto &reference : references) {
+            Vector3f vertices[MaxPolygonVertices];
+            int n_vertices = -1; // fetched on the first axis the reference straddles
+            for (int axis = 0; axis < 3; axis++) {
+                if (extent[axis] <= 0.0f)
+                    continue;
+                float lo = bounds.lo[axis];
+                float bin_width = extent[axis] / n_bins;
+                int first = std::clamp(static_cast<int>((reference.bounds.min()[axis] - lo) / bin_width), 0, n_bins - 1);
+                int last = std::clamp(static_cast<int>((reference.bounds.max()[axis] - lo) / bin_width), first, n_bins - 1);
+                entries[axis][first]++;
+                exits[axis][last]++;
+                if (first == last) {
+                    bin_bounds[axis][first].Extend(reference.bounds.min(), reference.bounds.max());
+                    continue;
+                }
+
+                if (n_vertices < 0)
+                    n_vertices = state.polygon ? (*state.polygon)(reference.index, vertices) : 0;
+                BinBounds parts[n_bins];
+                if (n_vertices > 0)
+                    BinPolygon(vertices, n_vertices, axis, lo, bin_width, first, last, parts);
+                for (int b = first; b <= last; b++) {
+                    Vector3f slab_min = reference.bounds.min(), slab_max = reference.bounds.max();
+                    slab_min[axis] = std::max(slab_min[axis], lo + b * bin_width);
+                    slab_max[axis] = std::min(slab_max[axis], lo + (b + 1) * bin_width);
+                    AABB clipped(slab_min, slab_max);
+                    // A polygon part that misses the slab within rounding keeps the plain slab bounds
+                    if (parts[b].lo.x <= parts[b].hi.x) {
+                        Vector3f part_min = glm::max(parts[b].lo, slab_min), part_max = glm::min(parts[b].hi, slab_max);
+                        if (part_min.x <= part_max.x && part_min.y <= part_max.y && part_min.z <= part_max.z)
+                            clipped = AABB(part_min, part_max);
+                    }
+                    bin_bounds[axis][b].Extend(clipped.min(), clipped.max());
+                }
+            }
+        }
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (extent[axis] <= 0.0f)
+                continue;
+
+            float right_cost[n_bins];
+            uint32_t right_counts[n_bins];
+            BinBounds right_bounds;
+            uint32_t right_count = 0;
+            for (int b = n_bins - 1; b > 0; b--) {
+                right_bounds.Extend(bin_bounds[axis][b]);
+                right_count += exits[axis][b];
+                right_cost[b - 1] = right_count * right_bounds.SurfaceArea();
+                right_counts[b - 1] = right_count;
+            }
+            BinBounds left_bounds;
+            uint32_t left_count = 0;
+            for (int b = 0; b < n_bins - 1; b++) {
+                left_bounds.Extend(bin_bounds[axis][b]);
+                left_count += entries[axis][b];
+                // Both children must shrink, otherwise the recursion could duplicate forever
+                if (left_count == 0 || right_counts[b] == 0 || left_count >= span || right_counts[b] >= span)
+                    continue;
+                size_t duplicates = left_count + right_counts[b] - span;
+                if (duplicates > state.duplicate_budget)
+                    continue;
+                float cost = TraversalCost + IntersectionCost * (left_count * left_bounds.SurfaceArea() + right_cost[b]) / parent_area;
+                if (cost < spatial_cost) {
+                    spatial_cost = cost;
+                    spatial_axis = axis;
+                    spatial_bin = b;
+                }
+            }
+        }
+    }
+
+    float best_cost = std::min(object.cost, spatial_cost);
+    float leaf_cost = IntersectionCost * span;
+    if (!median_only && ((object.axis < 0 && spatial_axis < 0) ||
+                         (span <= static_cast<uint32_t>(options.max_prims_in_node) && best_cost >= leaf_cost))) {
+        if (span <= MaxLeafPrimitives)
+            return make_leaf();
+    }
+
+    std::vector<BuildPrimitive> left, right;
+    if (spatial_axis >= 0 && spatial_cost < object.cost) {
+        int axis = spatial_axis;
+        float lo = bounds.lo[axis];
+        float bin_width = (bounds.hi[axis] - lo) / n_bins;
+        float plane = lo + (spatial_bin + 1) * bin_width;
+        for (const auto &reference : references) {
+            // Same bin assignment as the counting pass above
+            int first = std::clamp(static_cast<int>((reference.bounds.min()[axis] - lo) / bin_width), 0, n_bins - 1);
+            int last = std::clamp(static_cast<int>((reference.bounds.max()[axis] - lo) / bin_width), first, n_bins - 1);
+            if (last <= spatial_bin) {
+                left.push_back(reference);
+            } else if (first > spatial_bin) {
+                right.push_back(reference);
+            } else {
+                Vector3f left_max = reference.bounds.max(), right_min = reference.bounds.min();
+                left_max[axis] = plane;
+                right_min[axis] = plane;
+                BuildPrimitive left_part = reference, right_part = reference;
+                left_part.bounds = ClipReference(state, reference, AABB(reference.bounds.min(), left_max));
+                right_part.bounds = ClipReference(state, reference, AABB(right_min, reference.bounds.max()));
+                left_part.centroid = left_part.bounds.centroid();
+                right_part.centroid = right_part.bounds.centroid();
+                left.push_back(left_part);
+                right.push_back(right_part);
+                state.duplicate_budget--;
+            }
+        }
+        node->axis = static_cast<uint8_t>(axis);
+    } else {
+        uint32_t mid;
+        int axis = object.axis;
+        if (axis >= 0) {
+            float scale = n_bins / (centroid_bounds.hi[axis] - centroid_bounds.lo[axis]);
+            float lo = centroid_bounds.lo[axis];
+            auto mid_it = std::partition(references.begin(), references.end(), [&](const BuildPrimitive &p) {
+                return std::min(n_bins - 1, static_cast<int>((p.centroid[axis] - lo) * scale)) <= object.bin;
+            });
+            mid = static_cast<uint32_t>(mid_it - references.begin());
+        } else {
+            Vector3f extent = centroid_bounds.hi - centroid_bounds.lo;
+            axis = 0;
+            if (extent.y > extent.x) axis = 1;
+            if (extent.z > extent[axis]) axis = 2;
+            mid = 0;
+        }
+        if (mid == 0 || mid == span) {
+            mid = span / 2;
+            std::nth_element(references.begin(), references.begin() + mid, references.end(), [&](const BuildPrimitive &a, const BuildPrimitive &b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+        }
+        left.assign(references.begin(), references.begin() + mid);
+        right.assign(references.begin() + mid, references.end());
+        node->axis = static_cast<uint8_t>(axis);
+    }
+
+    // The references of this node are not needed while its children are built
+    std::vector<BuildPrimitive>().swap(references);
+    node->children[0] = BuildSpatial(state, left, depth + 1);
+    node->children[1] = BuildSpatial(state, right, depth + 1);
+    return node;
+}
+
+AABB ClipPolygonBounds(const Vector3f *vertices, int count, const AABB &box)
+{
+    // Sutherland-Hodgman against the six faces, each adds at most one vertex
+    Vector3f buffers[2][12];
+    int n = std::min(count, 6);
+    std::copy(vertices, vertices + n, buffers[0]);
+    int current = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            const Vector3f *in = buffers[current];
+            Vector3f *out = buffers[1 - current];
+            int n_out = 0;
+            for (int i = 0; i < n; i++) {
+                const Vector3f &a = in[i];
+                const Vector3f &b = in[(i + 1) % n];
+                float da = side == 0 ? a[axis] - box.min()[axis] : box.max()[axis] - a[axis];
+                float db = side == 0 ? b[axis] - box.min()[axis] : box.max()[axis] - b[axis];
+                if (da >= 0.0f)
+                    out[n_out++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f))
+                    out[n_out++] = a + (da / (da - db)) * (b - a);
+            }
+            n = n_out;
+            current = 1 - current;
+            if (n == 0)
+                return box; // only touches the box within rounding, keep it conservative
+        }
+    }
+
+    Vector3f min_point = buffers[current][0], max_point = buffers[current][0];
+    for (int i = 1; i < n; i++) {
+        min_point = glm::min(min_point, buffers[current][i]);
+        max_point = glm::max(max_point, buffers[current][i]);
+    }
+    return AABB(min_point, max_point);
+}
+
+BVHBuilder::BuildNode *BVHBuilder::BuildMorton(std::vector<MemoryArena> &arenas, std::vector<BuildPrimitive> &primitives,
+                                               std::atomic<size_t> &node_count) const
+{
+    uint32_t count = static_cast<uint32_t>(primitives.size());
+    BinBounds centroid_bounds;
+    #pragma omp parallel
+    {
+        BinBounds local;
+        #pragma omp for schedule(static) nowait
+        for (long long i = 0; i < static_cast<long long>(count); i++)
+            local.Extend(primitives[i].centroid, primitives[i].centroid);
+        #pragma omp critical
+        centroid_bounds.Extend(local);
+    }
+
+    // 10 bits per axis (30-bit codes) are enough up to about a million primitives, past that
+    // use 21 bits per axis (63-bit codes) so that neighbours still get distinct codes
+    const int axis_bits = count > (1u << 20) ? 21 : 10;
+    const int code_bits = 3 * axis_bits;
+    const uint64_t max_cell = (1ull << axis_bits) - 1;
+    Vector3f extent = centroid_bounds.hi - centroid_bounds.lo;
+    std::vector<MortonPrimitive> morton(count);
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < static_cast<long long>(count); i++) {
+        Vector3f offset = primitives[i].centroid - centroid_bounds.lo;
+        uint64_t code = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            float t = extent[axis] > 0.0f ? offset[axis] / extent[axis] : 0.0f;
+            uint64_t cell = std::min(static_cast<uint64_t>(t * static_cast<float>(max_cell + 1)), max_cell);
+            code |= ExpandBits(cell) << (2 - axis);
+        }
+        morton[i] = {code, static_cast<uint32_t>(i)};
+    }
+    RadixSort(morton, code_bits);
+
+    std::vector<BuildPrimitive> sorted(count);
+    std::vector<uint64_t> codes(count);
+    #pragma omp parallel for schedule(static)
+    for (long long i = 0; i < static_cast<long long>(count); i++) {
+        sorted[i] = primitives[morton[i].primitive];
+        codes[i] = morton[i].code;
+    }
+    primitives.swap(sorted);
+
+    BuildNode *root = nullptr;
+    if (options.quality == BVHBuildQuality::LBVH) {
+        #pragma omp parallel
+        {
+            #pragma omp single nowait
+            root = EmitLBVH(arenas, primitives.data(), codes.data(), 0, count, code_bits - 1, 0, node_count);
+        }
+        return root;
+    }
+
+    // One treelet per value of the top bits, built independently, then SAH above them
+    constexpr int TreeletBits = 12;
+    const int treelet_shift = code_bits - TreeletBits;
+    std::vector<uint32_t> treelet_starts;
+    for (uint32_t i = 0; i < count; i++) {
+        if (i == 0 || (codes[i] >> treelet_shift) != (codes[i - 1] >> treelet_shift))
+            treelet_starts.push_back(i);
+    }
+    treelet_starts.push_back(count);
+    // The upper tree gets twice the levels median splits would need (capped so the treelets
+    // keep most of MaxBVHDepth), the treelets start below it
+    const int median_depth = CeilLog2(static_cast<uint32_t>(treelet_starts.size() - 1));
+    const int upper_depth = std::min(2 * median_depth, median_depth + MaxBVHDepth / 4);
+
+    std::vector<BuildNode *> treelets(treelet_starts.size() - 1);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (long long t = 0; t < static_cast<long long>(treelets.size()); t++)
+        treelets[t] = EmitLBVH(arenas, primitives.data(), codes.data(), treelet_starts[t], treelet_starts[t + 1],
+                               treelet_shift - 1, upper_depth, node_count);
+
+    return BuildUpperSAH(arenas[omp_get_thread_num()], treelets.data(), 0, static_cast<uint32_t>(treelets.size()), 0,
+                         upper_depth, node_count);
+}
+
+BVHBuilder::BuildNode *BVHBuilder::EmitLBVH(std::vector<MemoryArena> &arenas, BuildPrimitive *primitives, const uint64_t *codes,
+                                            uint32_t start, uint32_t end, int bit, int depth, std::atomic<size_t> &node_count) const
+{
+    // The range is sorted and shares every bit above `bit`, skip the ones it also agrees on
+    while (bit >= 0 && (((codes[start] ^ codes[end - 1]) >> bit) & 1) == 0)
+        bit--;
+
+    BuildNode *node = arenas[omp_get_thread_num()].Alloc<BuildNode>();
+    node_count++;
+
+    uint32_t span = end - start;
+    uint32_t mid;
+    int child_bit = bit - 1;
+    if (span <= static_cast<uint32_t>(options.max_prims_in_node) || bit < 0) {
+        if (span <= MaxLeafPrimitives) {
+            BinBounds bounds;
+            for (uint32_t i = start; i < end; i++)
+                bounds.Extend(primitives[i].bounds.min(), primitives[i].bounds.max());
+            node->bounds = AABB(bounds.lo, bounds.hi);
+            node->first_prim_offset = start;
+            node->n_primitives = span;
+            return node;
+        }
+        // Identical codes that overflow the leaf counter
+        mid = start + span / 2;
+    } else if (MedianSplitsOnly(depth, span)) {
+        // Long runs of nearly equal codes would go one bit per level, halve the range instead and
+        // let the children find where the same bit flips
+        mid = start + span / 2;
+        child_bit = bit;
+        node->axis = static_cast<uint8_t>(2 - bit % 3);
+    } else {
+        // First code with the bit set, codes[start] has it clear and codes[end - 1] has it set
+        uint32_t lo = start, hi = end - 1;
+        uint64_t mask = 1ull << bit;
+        while (lo + 1 != hi) {
+            uint32_t m = lo + (hi - lo) / 2;
+            if (codes[m] & mask)
+                hi = m;
+            else
+                lo = m;
+        }
+        mid = hi;
+        // Codes interleave x, y, z from the most significant bit down
+        node->axis = static_cast<uint8_t>(2 - bit % 3);
+    }
+
+    if (span > options.parallel_threshold) {
+        #pragma omp task shared(arenas, node_count) if (end - mid > options.parallel_threshold)
+        node->children[1] = EmitLBVH(arenas, primitives, codes, mid, end, child_bit, depth + 1, node_count);
+        node->children[0] = EmitLBVH(arenas, primitives, codes, start, mid, child_bit, depth + 1, node_count);
+        #pragma omp taskwait
+    } else {
+        node->children[0] = EmitLBVH(arenas, primitives, codes, start, mid, child_bit, depth + 1, node_count);
+        node->children[1] = EmitLBVH(arenas, primitives, codes, mid, end, child_bit, depth + 1, node_count);
+    }
+    node->bounds = calculateSurroundingBox(node->children[0]->bounds, node->children[1]->bounds);
+    return node;
+}
+
+BVHBuilder::BuildNode *BVHBuilder::BuildUpperSAH(MemoryArena &arena, BuildNode **roots, uint32_t start, uint32_t end,
+                                                 int depth, int max_depth, std::atomic<size_t> &node_count) const
+{
+    uint32_t span = end - start;
+    if (span == 1)
+        return roots[start];
+
+    BuildNode *node = arena.Alloc<BuildNode>();
+    node_count++;
+
+    BinBounds bounds, centroid_bounds;
+    for (uint32_t i = start; i < end; i++) {
+        bounds.Extend(roots[i]->bounds.min(), roots[i]->bounds.max());
+        Vector3f centroid = roots[i]->bounds.centroid();
+        centroid_bounds.Extend(centroid, centroid);
+    }
+    node->bounds = AABB(bounds.lo, bounds.hi);
+
+    Vector3f extent = centroid_bounds.hi - centroid_bounds.lo;
+    int axis = 0;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    uint32_t mid = start + span / 2;
+    if (extent[axis] > 0.0f && !MedianSplitsOnly(depth, span, max_depth)) {
+        constexpr int n_bins = 16;
+        BinBounds bin_bounds[n_bins];
+        uint32_t bin_counts[n_bins] = {};
+        float scale = n_bins / extent[axis];
+        auto bin_of = [&](const BuildNode *root) {
+            return std::min(n_bins - 1, static_cast<int>((root->bounds.centroid()[axis] - centroid_bounds.lo[axis]) * scale));
+        };
+        for (uint32_t i = start; i < end; i++) {
+            int b = bin_of(roots[i]);
+            bin_counts[b]++;
+            bin_bounds[b].Extend(roots[i]->bounds.min(), roots[i]->bounds.max());
+        }
+
+        // Same sweep as BuildRecursive, with subtrees in place of primitives
+        float right_cost[n_bins];
+        BinBounds right_bounds;
+        uint32_t right_count = 0;
+        for (int b = n_bins - 1; b > 0; b--) {
+            right_bounds.Extend(bin_bounds[b]);
+            right_count += bin_counts[b];
+            right_cost[b - 1] = right_count * right_bounds.SurfaceArea();
+        }
+        BinBounds left_bounds;
+        uint32_t left_count = 0;
+        float best_cost = Infinity;
+        int best_split = -1;
+        for (int b = 0; b < n_bins - 1; b++) {
+            left_bounds.Extend(bin_bounds[b]);
+            left_count += bin_counts[b];
+            if (left_count == 0 || left_count == span)
+                continue;
+            float cost = left_count * left_bounds.SurfaceArea() + right_cost[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+        if (best_split >= 0) {
+            BuildNode **mid_ptr = std::partition(roots + start, roots + end, [&](const BuildNode *root) {
+                return bin_of(root) <= best_split;
+            });
+            if (mid_ptr != roots + start && mid_ptr != roots + end)
+                mid = static_cast<uint32_t>(mid_ptr - roots);
+        }
+    }
+
+    node->axis = static_cast<uint8_t>(axis);
+    node->children[0] = BuildUpperSAH(arena, roots, start, mid, depth + 1, max_depth, node_count);
+    node->children[1] = BuildUpperSAH(arena, roots, mid, end, depth + 1, max_depth, node_count);
+    return node;
+}
+
+uint32_t BVHBuilder::Flatten(const BuildNode *node, std::vector<LinearBVHNode> &nodes, int depth) const
+{
+    assert(depth <= MaxBVHDepth && "BVH deeper than the traversal stacks");
+    uint32_t node_index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    nodes[node_index].bounds = node->bounds;
+
+    if (node->n_primitives > 0) {
+        nodes[node_index].primitives_offset = node->first_prim_offset;
+        nodes[node_index].n_primitives = static_cast<uint16_t>(node->n_primitives);
+        return node_index;
+    }
+
+    nodes[node_index].axis = node->axis;
+    Flatten(node->children[0], nodes, depth + 1);
+    nodes[node_index].second_child_offset = Flatten(node->children[1], nodes, depth + 1);
+    return node_index;
+}
+
+float BVHBuilder::ComputeSAHCost(std::span<const LinearBVHNode> nodes)
+{
+    if (nodes.empty())
+        return 0.0f;
+
+    float root_area = nodes[0].bounds.SurfaceArea();
+    double cost = 0.0;
+    for (const auto &node : nodes) {
+        float area = node.bounds.SurfaceArea() / root_area;
+        if (node.n_primitives > 0)
+            cost += area * IntersectionCost * node.n_primitives;
+        else
+            cost += area * TraversalCost;
+    }
+    return static_cast<float>(cost);
+}
+
+void BVHBuilder::ComputeStats(std::span<const LinearBVHNode> nodes, BVHBuildStats &stats)
+{
+    stats.sah_cost = ComputeSAHCost(nodes);
+    stats.node_count = nodes.size();
+    stats.leaf_count = 0;
+    stats.max_depth = 0;
+    // Children are stored after their parent, so one forward sweep sees every parent first
+    std::vector<int> depth(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const LinearBVHNode &node = nodes[i];
+        if (node.n_primitives > 0) {
+            stats.leaf_count++;
+            stats.max_depth = std::max(stats.max_depth, depth[i]);
+        } else {
+            depth[i + 1] = depth[node.second_child_offset] = depth[i] + 1;
+        }
+    }
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "Util.hpp"
+#include "AABB.hpp"
+#include "../Common/MemoryArena.hpp"
+#include "../Common/CacheModel.hpp"
+#include <atomic>
+#include <functional>
+#include <span>
+
+struct LinearBVHNode;
+
+// Every builder keeps its leaves within this many levels of the root, so the fixed traversal
+// stacks (MaxBVHDepth entries per child slot of a node) cannot overflow. Once the primitives left
+// in a range could need more levels than remain, the range is split at its median, which halves
+// it on every level.
+constexpr int MaxBVHDepth = 64;
+
+enum class BVHBuildQuality {
+    FAST,  // 16 bins on the widest centroid axis only
+    HIGH,  // 32 bins on all three axes
+    LBVH,  // Morton order of the centroids, no SAH at all. Fastest build, for previews of huge scenes
+    HLBVH, // Morton-built treelets under the top 12 bits, joined by a binned SAH over the treelet roots
+    SBVH   // HIGH plus spatial splits that clip straddling references into both children. Sequential,
+           // for large or thin primitives whose bounds overlap (e.g. walls, long triangles)
+};
+
+// Storage order of the nodes of WideBVH and QuantizedBVH, applied after collapsing. LinearBVH
+// stays depth-first, its traversal relies on the first child following its parent.
+enum class BVHNodeLayout {
+    DEPTH_FIRST,  // order of the collapse, subtrees are contiguous
+    TREELET,      // treelets of treelet_bytes grown from their root towards the largest children,
+                  // so the likeliest paths share pages; treelets are stored breadth-first
+    VAN_EMDE_BOAS // top half of the levels first, then each subtree below them, recursively
+};
+
+struct BVHBuildOptions {
+    BVHBuildQuality quality = BVHBuildQuality::HIGH;
+    int max_prims_in_node = 4;
+    // Ranges smaller than this are built on the current thread instead of spawning a task
+    size_t parallel_threshold = 4096;
+    // Scene::UpdateBVH rebuilds from scratch once refits and insertions push the SAH cost past
+    // this multiple of the cost right after the last full build
+    float rebuild_cost_ratio = 1.5f;
+    // SBVH: spatial splits are only tried where the children of the best object split overlap by more
+    // than this fraction of the root area, and stop once the duplicated references reach this
+    // fraction of the primitive count
+    float spatial_split_alpha = 1e-5f;
+    float spatial_split_budget = 0.5f;
+    BVHNodeLayout layout = BVHNodeLayout::DEPTH_FIRST;
+    size_t treelet_bytes = 4096; // one page
+    // LAZY_BVH: primitives per cluster that is built on first use
+    size_t lazy_cluster_size = 4096;
+    // Look the tree up in SceneCache and store it there, when the cache is enabled
+    bool scene_cache = true;
+};
+
+struct BVHBuildStats {
+    double build_ms = 0.0;
+    float sah_cost = 0.0f; // expected cost of a random ray relative to the root, lower is better
+    size_t node_count = 0;
+    size_t leaf_count = 0;
+    size_t arena_bytes = 0;
+    bool from_cache = false; // loaded from SceneCache, build_ms is the load time
+    bool updated = false;    // refit/insertion by Scene::UpdateBVH, build_ms is the update time
+    size_t duplicate_references = 0; // SBVH leaf references beyond one per primitive
+    size_t memory_bytes = 0; // nodes and primitive indices of the tree that is traversed
+    int max_depth = 0;       // of the deepest leaf, the root is at depth 0
+};
+
+// Counters for one or more traversals, see LinearBVH::Intersect. The cache models are optional
+// and see the nodes and primitive indices read, not the primitives themselves.
+struct TraversalStats {
+    uint64_t rays = 0;
+    uint64_t node_visits = 0; // nodes whose children (or, for LinearBVH, whose own bounds) were tested
+    uint64_t primitive_tests = 0;
+    uint64_t line_misses = 0;
+    uint64_t page_misses = 0;
+    CacheModel *lines = nullptr;
+    CacheModel *pages = nullptr;
+
+    inline void Touch(const void *address, size_t bytes) {
+        if (lines)
+            line_misses += lines->Access(address, bytes);
+        if (pages)
+            page_misses += pages->Access(address, bytes);
+    }
+};
+
+// Writes the vertices of a planar convex primitive (up to MaxPolygonVertices) and returns their count,
+// 0 for anything else. SBVH clips these polygons at split planes; primitives without one have their
+// bounds clipped instead, which is exact for axis-aligned boxes and loose for anything diagonal.
+constexpr int MaxPolygonVertices = 4;
+using PrimitivePolygonFn = std::function<int(uint32_t primitive, Vector3f *vertices)>;
+
+// Bounds of a convex polygon (up to 6 vertices) clipped to a box
+AABB ClipPolygonBounds(const Vector3f *vertices, int count, const AABB &box);
+
+// Top-down binned SAH builder producing the flattened LinearBVH layout. LBVH and HLBVH
+// quality sort the primitives by Morton code instead and split on the code bits.
+class BVHBuilder {
+public:
+    BVHBuilder(const BVHBuildOptions &options = {}) : options(options) {}
+
+    // With SBVH primitive_indices may hold a primitive more than once
+    void Build(const std::vector<AABB> &primitive_bounds, std::vector<LinearBVHNode> &nodes,
+               std::vector<uint32_t> &primitive_indices, BVHBuildStats *stats = nullptr,
+               const PrimitivePolygonFn &polygon = nullptr) const;
+
+    // Same cost constants as the BVHnode SAH split
+    static constexpr float TraversalCost = 0.5f;
+    static constexpr float IntersectionCost = 1.0f;
+    static float ComputeSAHCost(std::span<const LinearBVHNode> nodes);
+    // Fills the node counts, depth and SAH cost of stats (timing is left to the caller)
+    static void ComputeStats(std::span<const LinearBVHNode> nodes, BVHBuildStats &stats);
+
+private:
+    struct BuildPrimitive {
+        AABB bounds;
+        Vector3f centroid;
+        uint32_t index;
+    };
+
+    // Temporary pointer-based node, lives in the per-thread scratch arena until flattened
+    struct BuildNode {
+        AABB bounds;
+        BuildNode *children[2] = {nullptr, nullptr};
+        uint32_t first_prim_offset = 0;
+        uint32_t n_primitives = 0;
+        uint8_t axis = 0;
+    };
+
+    // depth: level of the node built for [start, end), the root is 0
+    BuildNode *BuildRecursive(std::vector<MemoryArena> &arenas, BuildPrimitive *primitives, uint32_t start, uint32_t end,
+                              int depth, std::atomic<size_t> &node_count) const;
+    BuildNode *SplitChildren(std::vector<MemoryArena> &arenas, BuildPrimitive *primitives, uint32_t start, uint32_t mid, uint32_t end,
+                             int axis, int depth, BuildNode *node, std::atomic<size_t> &node_count) const;
+    uint32_t Flatten(const BuildNode *node, std::vector<LinearBVHNode> &nodes, int depth = 0) const;
+
+    // Sorts primitives into Morton order and returns the root, see BVHBuildQuality::LBVH/HLBVH
+    BuildNode *BuildMorton(std::vector<MemoryArena> &arenas, std::vector<BuildPrimitive> &primitives,
+                           std::atomic<size_t> &node_count) const;
+    // Split [start, end) where `bit` of the sorted codes flips, the next lower bit below that.
+    // Falls back to median splits near MaxBVHDepth, depth is the level of the node emitted
+    BuildNode *EmitLBVH(std::vector<MemoryArena> &arenas, BuildPrimitive *primitives, const uint64_t *codes,
+                        uint32_t start, uint32_t end, int bit, int depth, std::atomic<size_t> &node_count) const;
+    // SBVH state shared by the whole (sequential) recursion
+    struct SpatialBuild {
+        const PrimitivePolygonFn *polygon;
+        MemoryArena *arena;
+        size_t node_count = 0;
+        size_t duplicate_budget;
+        float root_area;
+        std::vector<uint32_t> output; // leaf references in depth-first order
+    };
+    // depth is the level of the node built, see MaxBVHDepth
+    BuildNode *BuildSpatial(SpatialBuild &state, std::vector<BuildPrimitive> &references, int depth) const;
+    AABB ClipReference(const SpatialBuild &state, const BuildPrimitive &reference, const AABB &box) const;
+
+    // Binned SAH over whole subtrees, used above the HLBVH treelets, keeping every root at a depth
+    // below max_depth
+    BuildNode *BuildUpperSAH(MemoryArena &arena, BuildNode **roots, uint32_t start, uint32_t end,
+                             int depth, int max_depth, std::atomic<size_t> &node_count) const;
+
+private:
+    BVHBuildOptions options;
+};
@@ -0,0 +1,1207 @@
+#include "Benchmark.hpp"
+#include "Scene.hpp"
+#include "Sampler.hpp"
+#include "Integrator.hpp"
+#include "Material.hpp"
+#include "RendererScene.hpp"
+#include "Instance.hpp"
+#include "QuantizedBVH.hpp"
+#include "Shape.hpp"
+#include "Transform.hpp"
+#include "TriangleMesh.hpp"
+#include "ThreadPool.hpp"
+#include "SceneCache.hpp"
+#include <array>
+#include <chrono>
+#include <iomanip>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace Benchmark {
+    namespace {
+        const char *AcceleratorName(AcceleratorType type) {
+            switch (type) {
+            case AcceleratorType::NONE: return "NONE";
+            case AcceleratorType::BVH_TREE: return "BVH_TREE";
+            case AcceleratorType::LINEAR_BVH: return "LINEAR_BVH";
+            case AcceleratorType::WIDE_BVH4: return "WIDE_BVH4";
+            case AcceleratorType::WIDE_BVH8: return "WIDE_BVH8";
+            case AcceleratorType::QUANTIZED_BVH: return "QUANTIZED_BVH";
+            case AcceleratorType::LAZY_BVH: return "LAZY_BVH";
+            case AcceleratorType::EMBREE: return "EMBREE";
+            }
+            return "UNKNOWN";
+        }
+
+        const char *QualityName(BVHBuildQuality quality) {
+            switch (quality) {
+            case BVHBuildQuality::FAST: return "FAST";
+            case BVHBuildQuality::HIGH: return "HIGH";
+            case BVHBuildQuality::LBVH: return "LBVH";
+            case BVHBuildQuality::HLBVH: return "HLBVH";
+            case BVHBuildQuality::SBVH: return "SBVH";
+            }
+            return "UNKNOWN";
+        }
+
+        const char *LayoutName(BVHNodeLayout layout) {
+            switch (layout) {
+            case BVHNodeLayout::DEPTH_FIRST: return "DEPTH_FIRST";
+            case BVHNodeLayout::TREELET: return "TREELET";
+            case BVHNodeLayout::VAN_EMDE_BOAS: return "VAN_EMDE_BOAS";
+            }
+            return "UNKNOWN";
+        }
+
+        // Last-level cache misses of the calling thread and the threads it spawns afterwards,
+        // through perf_event_open. Valid() is false elsewhere or without permission
+        class CacheMissCounter {
+        public:
+            CacheMissCounter() {
+#ifdef __linux__
+                perf_event_attr attr = {};
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+                attr.disabled = 1;
+                attr.inherit = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+            }
+            ~CacheMissCounter() {
+#ifdef __linux__
+                if (fd >= 0)
+                    close(fd);
+#endif
+            }
+            bool Valid() const { return fd >= 0; }
+            void Start() {
+#ifdef __linux__
+                ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+            }
+            uint64_t Stop() {
+                uint64_t count = 0;
+#ifdef __linux__
+                ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fd, &count, sizeof(count)) != sizeof(count))
+                    count = 0;
+#endif
+                return count;
+            }
+
+        private:
+            int fd = -1;
+        };
+
+        // Looks at the sphere field from outside, down the z axis
+        CameraParams SphereFieldCamera() {
+            return {
+                1.0f,
+                900,
+                40.0f,
+                Vector3f(0.0f, 0.0f, -300.0f),
+                Vector3f(0.0f, 0.0f, 0.0f),
+                Vector3f(0.0f, 1.0f, 0.0f),
+                0.0f,
+                1.0f
+            };
+        }
+
+        // Seconds of the best of three passes of test over every ray, results[i] is its answer for ray i
+        template <typename TestFn>
+        double TimeRays(const std::vector<Ray> &rays, TestFn &&test, std::vector<float> &results) {
+            results.resize(rays.size());
+            double best_seconds = Infinity;
+            for (int pass = 0; pass < 3; pass++) {
+                auto start_time = std::chrono::high_resolution_clock::now();
+                for (size_t i = 0; i < rays.size(); i++)
+                    results[i] = test(rays[i]);
+                auto end_time = std::chrono::high_resolution_clock::now();
+                best_seconds = std::min(best_seconds, std::chrono::duration<double>(end_time - start_time).count());
+            }
+            return best_seconds;
+        }
+
+        // Prints the throughputs, returns how many rays got a different answer from the SIMD kernel
+        size_t ReportKernel(const char *name, size_t tests, double scalar_seconds, double simd_seconds,
+                            const std::vector<float> &scalar, const std::vector<float> &simd) {
+            size_t mismatches = 0;
+            for (size_t i = 0; i < scalar.size(); i++)
+                mismatches += scalar[i] != simd[i];
+            std::cout << std::fixed << std::setprecision(2)
+                      << "  " << std::left << std::setw(12) << name << std::right
+                      << " scalar " << std::setw(8) << tests / scalar_seconds * 1e-6 << " Mtests/s"
+                      << " | SIMD " << std::setw(8) << tests / simd_seconds * 1e-6 << " Mtests/s"
+                      << " | speedup " << std::setw(5) << scalar_seconds / simd_seconds << "x"
+                      << " | mismatches " << mismatches << std::endl;
+            return mismatches;
+        }
+
+        // Nearest hit over every block, block after block as a leaf loop would
+        template <int Width>
+        size_t CompareSphereKernel(const std::vector<Ray> &rays, size_t primitive_count, std::mt19937 &rng) {
+            std::uniform_real_distribution<float> position(-1.0f, 1.0f), radius(0.02f, 0.1f);
+            std::vector<SphereBlock<Width>> blocks(primitive_count / Width);
+            for (auto &block : blocks)
+                for (int lane = 0; lane < Width; lane++)
+                    block.Set(lane, Vector3f(position(rng), position(rng), position(rng)), radius(rng));
+
+            std::vector<float> scalar, simd;
+            double scalar_seconds = TimeRays(rays, [&](const Ray &r) {
+                Vector2f interval(Epsilon, Infinity);
+                for (const auto &block : blocks) {
+                    for (int lane = 0; lane < Width; lane++) {
+                        float t;
+                        if (IntersectSphere(Vector3f(block.cx[lane], block.cy[lane], block.cz[lane]), block.radius[lane], r, interval, t))
+                            interval.y = t;
+                    }
+                }
+                return interval.y;
+            }, scalar);
+            double simd_seconds = TimeRays(rays, [&](const Ray &r) {
+                Vector2f interval(Epsilon, Infinity);
+                for (const auto &block : blocks) {
+                    float t;
+                    if (IntersectSpheres<Width>(block.Lanes(), Width, r, interval, t) >= 0)
+                        interval.y = t;
+                }
+                return interval.y;
+            }, simd);
+            return ReportKernel(Width == 4 ? "spheres x4" : "spheres x8", rays.size() * blocks.size() * Width, scalar_seconds, simd_seconds, scalar, simd);
+        }
+
+        template <int Width>
+        size_t CompareQuadKernel(const std::vector<Ray> &rays, size_t primitive_count, std::mt19937 &rng) {
+            std::uniform_real_distribution<float> position(-1.0f, 1.0f), edge(-0.15f, 0.15f);
+            std::vector<QuadBlock<Width>> blocks(primitive_count / Width);
+            for (auto &block : blocks) {
+                for (int lane = 0; lane < Width; lane++) {
+                    Quad quad(Vector3f(position(rng), position(rng), position(rng)), Vector3f(edge(rng), edge(rng), edge(rng)),
+                              Vector3f(edge(rng), edge(rng), edge(rng)));
+                    block.Set(lane, quad.get_Q(), quad.get_u(), quad.get_v(), quad.get_normal(), quad.get_w(), quad.get_D());
+                }
+            }
+
+            std::vector<float> scalar, simd;
+            double scalar_seconds = TimeRays(rays, [&](const Ray &r) {
+                Vector2f interval(Epsilon, Infinity);
+                for (const auto &block : blocks) {
+                    for (int lane = 0; lane < Width; lane++) {
+                        float t;
+                        Vector2f local;
+                        if (IntersectQuad(Vector3f(block.qx[lane], block.qy[lane], block.qz[lane]), Vector3f(block.ux[lane], block.uy[lane], block.uz[lane]),
+                                          Vector3f(block.vx[lane], block.vy[lane], block.vz[lane]), Vector3f(block.nx[lane], block.ny[lane], block.nz[lane]),
+                                          Vector3f(block.wx[lane], block.wy[lane], block.wz[lane]), block.d[lane], r, interval, t, local))
+                            interval.y = t;
+                    }
+                }
+                return interval.y;
+            }, scalar);
+            double simd_seconds = TimeRays(rays, [&](const Ray &r) {
+                Vector2f interval(Epsilon, Infinity);
+                for (const auto &block : blocks) {
+                    float t;
+                    Vector2f local;
+                    if (IntersectQuads<Width>(block.Lanes(), Width, r, interval, t, local) >= 0)
+                        interval.y = t;
+                }
+                return interval.y;
+            }, simd);
+            return ReportKernel(Width == 4 ? "quads x4" : "quads x8", rays.size() * blocks.size() * Width, scalar_seconds, simd_seconds, scalar, simd);
+        }
+
+        struct Configuration {
+            AcceleratorType accelerator;
+            BVHBuildQuality quality;
+        };
+
+        // Rays of one value per pixel (row-major, width pixels per row) grouped into 4x2 pixel packets.
+        // Lanes whose t_intervals[i].y is not above t_intervals[i].x stay inactive
+        std::vector<RayPacket> TilePackets(const std::vector<Ray> &rays, const std::vector<Vector2f> &t_intervals, int width, int height) {
+            std::vector<RayPacket> packets;
+            for (int y = 0; y < height; y += 2) {
+                for (int x = 0; x < width; x += 4) {
+                    RayPacket packet;
+                    for (int lane = 0; lane < RayPacket::Size; lane++) {
+                        int px = x + lane % 4, py = y + lane / 4;
+                        size_t i = static_cast<size_t>(py) * width + px;
+                        if (px < width && py < height && t_intervals[i].x < t_intervals[i].y)
+                            packet.Set(lane, rays[i], t_intervals[i]);
+                    }
+                    packets.push_back(packet);
+                }
+            }
+            return packets;
+        }
+
+        // Seconds of the best of three runs of pass over indices [0, count), spread over threads
+        template <typename PassFn>
+        double TimeParallel(size_t count, int threads, PassFn &&pass) {
+            omp_set_num_threads(threads);
+            double best_seconds = Infinity;
+            for (int run = 0; run < 3; run++) {
+                auto start_time = std::chrono::high_resolution_clock::now();
+                #pragma omp parallel for schedule(dynamic, 64)
+                for (long long i = 0; i < static_cast<long long>(count); i++)
+                    pass(static_cast<size_t>(i));
+                auto end_time = std::chrono::high_resolution_clock::now();
+                best_seconds = std::min(best_seconds, std::chrono::duration<double>(end_time - start_time).count());
+            }
+            return best_seconds;
+        }
+
+        // Scalar against packet tracing of the primary rays of camParams and of shadow rays from their
+        // hits towards a point light above the scene, on LINEAR_BVH. Returns the lanes that disagree
+        size_t ComparePackets(const std::string &name, Scene &scene, const CameraParams &camParams, int threads) {
+            scene.SetAccelerator(AcceleratorType::LINEAR_BVH);
+            scene.BuildBVH();
+            Camera camera;
+            camera.Create(camParams);
+            int width = camera.image_width, height = camera.image_height;
+            std::vector<Ray> primary_rays = GenerateCameraRays(camParams);
+            size_t ray_count = primary_rays.size();
+
+            std::vector<Vector2f> primary_intervals(ray_count, Vector2f(Epsilon, Infinity));
+            std::vector<Hit_Payload> scalar_hits(ray_count);
+            std::vector<uint8_t> scalar_hit(ray_count);
+            double scalar_primary = TimeParallel(ray_count, threads, [&](size_t i) {
+                scalar_hit[i] = scene.isHit(primary_rays[i], primary_intervals[i], scalar_hits[i]);
+            });
+
+            std::vector<RayPacket> primary_packets = TilePackets(primary_rays, primary_intervals, width, height);
+            std::vector<int> packet_hits(primary_packets.size());
+            std::vector<std::array<Hit_Payload, RayPacket::Size>> packet_recs(primary_packets.size());
+            double packet_primary = TimeParallel(primary_packets.size(), threads, [&](size_t i) {
+                RayPacket packet = primary_packets[i];
+                packet_hits[i] = scene.IntersectPacket(packet, packet_recs[i].data());
+            });
+
+            // Shadow rays from the scalar hits, so both paths trace the same queries
+            AABB bounds = scene.getBoundingBox();
+            Vector3f light = bounds.centroid() + Vector3f(0.0f, bounds.max().y - bounds.min().y, 0.0f);
+            std::vector<Ray> shadow_rays(ray_count);
+            std::vector<Vector2f> shadow_intervals(ray_count, Vector2f(0.0f));
+            size_t shadow_count = 0;
+            for (size_t i = 0; i < ray_count; i++) {
+                if (!scalar_hit[i])
+                    continue;
+                Vector3f to_light = light - scalar_hits[i].p;
+                float distance = glm::length(to_light);
+                shadow_rays[i] = Ray::SpawnRay(scalar_hits[i].p, to_light / distance, scalar_hits[i].normal);
+                shadow_intervals[i] = Vector2f(Epsilon, distance);
+                shadow_count++;
+            }
+            std::vector<uint8_t> scalar_occluded(ray_count);
+            double scalar_shadow = TimeParallel(ray_count, threads, [&](size_t i) {
+                if (scalar_hit[i])
+                    scalar_occluded[i] = scene.isOccluded(shadow_rays[i], shadow_intervals[i].y);
+            });
+            std::vector<RayPacket> shadow_packets = TilePackets(shadow_rays, shadow_intervals, width, height);
+            std::vector<int> packet_occluded(shadow_packets.size());
+            double packet_shadow = TimeParallel(shadow_packets.size(), threads, [&](size_t i) {
+                packet_occluded[i] = scene.OccludedPacket(shadow_packets[i]);
+            });
+
+            size_t primary_mismatches = 0, shadow_mismatches = 0;
+            for (size_t p = 0; p < primary_packets.size(); p++) {
+                size_t tile_x = (p % ((width + 3) / 4)) * 4, tile_y = (p / ((width + 3) / 4)) * 2;
+                for (int lane = 0; lane < RayPacket::Size; lane++) {
+                    size_t px = tile_x + lane % 4, py = tile_y + lane / 4;
+                    if (px >= static_cast<size_t>(width) || py >= static_cast<size_t>(height))
+                        continue;
+                    size_t i = py * width + px;
+                    bool hit = (packet_hits[p] >> lane) & 1;
+                    primary_mismatches += hit != static_cast<bool>(scalar_hit[i]) || (hit && packet_recs[p][lane].t != scalar_hits[i].t);
+                    if (scalar_hit[i])
+                        shadow_mismatches += static_cast<bool>((packet_occluded[p] >> lane) & 1) != static_cast<bool>(scalar_occluded[i]);
+                }
+            }
+
+            std::cout << name << ": " << scene.GetObjects().size() << " objects, " << ray_count << " primary and "
+                      << shadow_count << " shadow rays" << std::endl;
+            std::cout << std::fixed << std::setprecision(2)
+                      << "  primary scalar " << std::setw(8) << ray_count / scalar_primary * 1e-6 << " Mrays/s"
+                      << " | packets " << std::setw(8) << ray_count / packet_primary * 1e-6 << " Mrays/s"
+                      << " | mismatches " << primary_mismatches << std::endl
+                      << "  shadow  scalar " << std::setw(8) << shadow_count / scalar_shadow * 1e-6 << " Mrays/s"
+                      << " | packets " << std::setw(8) << shadow_count / packet_shadow * 1e-6 << " Mrays/s"
+                      << " | mismatches " << shadow_mismatches << std::endl;
+            return primary_mismatches + shadow_mismatches;
+        }
+
+        void RunScene(const std::string &name, Scene &scene, const CameraParams &camParams, int threads, const std::vector<Configuration> &configurations) {
+            std::vector<Ray> primary_rays = GenerateCameraRays(camParams);
+            std::vector<Ray> random_rays = GenerateRandomRays(scene, primary_rays.size());
+
+            std::cout << name << ": " << scene.GetObjects().size() << " objects, " << primary_rays.size() << " rays per pass" << std::endl;
+            for (const auto &config : configurations) {
+#ifndef HO_EMBREE
+                if (config.accelerator == AcceleratorType::EMBREE)
+                    continue;
+#endif
+                scene.SetAccelerator(config.accelerator);
+                BVHBuildOptions options;
+                options.quality = config.quality;
+                scene.SetBuildOptions(options);
+                scene.BuildBVH();
+                const BVHBuildStats &stats = scene.GetBuildStats();
+
+                double primary = MeasureThroughput(scene, primary_rays, threads);
+                double random = MeasureThroughput(scene, random_rays, threads);
+                std::string label = AcceleratorName(config.accelerator);
+                std::ostringstream sah;
+                sah << std::fixed << std::setprecision(2);
+                bool own_builder = config.accelerator != AcceleratorType::NONE && config.accelerator != AcceleratorType::BVH_TREE &&
+                                   config.accelerator != AcceleratorType::EMBREE;
+                if (own_builder) {
+                    label += std::string(" (") + QualityName(config.quality) + ")";
+                    sah << stats.sah_cost;
+                } else {
+                    sah << "-";
+                }
+                std::ostringstream memory;
+                memory << std::fixed << std::setprecision(1);
+                if (stats.memory_bytes > 0)
+                    memory << stats.memory_bytes / (1024.0 * 1024.0) << " MB";
+                else
+                    memory << "-";
+                std::cout << std::fixed << std::setprecision(2)
+                          << "  " << std::left << std::setw(20) << label << std::right
+                          << " build " << std::setw(10) << stats.build_ms << " ms"
+                          << " | SAH " << std::setw(8) << sah.str()
+                          << " | memory " << std::setw(8) << memory.str()
+                          << " | primary " << std::setw(8) << primary << " Mrays/s"
+                          << " | random " << std::setw(8) << random << " Mrays/s" << std::endl;
+            }
+        }
+    }
+
+    std::vector<Ray> GenerateCameraRays(const CameraParams &params)
+    {
+        Camera camera;
+        camera.Create(params);
+        Sampler sampler(FilterType::UNIFORM);
+
+        std::vector<Ray> rays;
+        rays.reserve(static_cast<size_t>(camera.image_width) * camera.image_height);
+        for (int j = 0; j < camera.image_height; j++)
+            for (int i = 0; i < camera.image_width; i++)
+                rays.push_back(camera.GenerateRay(i, j, sampler, Vector2f(0.5f, 0.5f)));
+        return rays;
+    }
+
+    std::vector<Ray> GenerateRandomRays(const Scene &scene, size_t count, uint32_t seed)
+    {
+        AABB bounds = scene.getBoundingBox();
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        std::vector<Ray> rays;
+        rays.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            Vector3f t(unit(rng), unit(rng), unit(rng));
+            Vector3f origin = bounds.min() + t * (bounds.max() - bounds.min());
+            float z = 2.0f * unit(rng) - 1.0f;
+            float phi = 2.0f * PI * unit(rng);
+            float r = std::sqrt(std::max(0.0f, 1.0f - z * z));
+            rays.emplace_back(origin, Vector3f(r * std::cos(phi), r * std::sin(phi), z));
+        }
+        return rays;
+    }
+
+    double MeasureThroughput(const Scene &scene, const std::vector<Ray> &rays, int threads, int passes)
+    {
+        omp_set_num_threads(threads);
+        double best_seconds = Infinity;
+        for (int pass = 0; pass < passes; pass++) {
+            long long hits = 0;
+            auto start_time = std::chrono::high_resolution_clock::now();
+            #pragma omp parallel for schedule(dynamic, 1024) reduction(+ : hits)
+            for (long long i = 0; i < static_cast<long long>(rays.size()); i++) {
+                Hit_Payload rec;
+                if (scene.isHit(rays[i], Vector2f(Epsilon, Infinity), rec))
+                    hits++;
+            }
+            auto end_time = std::chrono::high_resolution_clock::now();
+            best_seconds = std::min(best_seconds, std::chrono::duration<double>(end_time - start_time).count());
+            if (hits < 0) // keep the traversal observable
+                std::cout << hits;
+        }
+        return rays.size() / best_seconds * 1e-6;
+    }
+
+    double MeasureShadingThroughput(const Scene &scene, const std::vector<Ray> &rays, int threads, int passes)
+    {
+        omp_set_num_threads(threads);
+        double best_seconds = Infinity;
+        for (int pass = 0; pass < passes; pass++) {
+            long long scattered = 0;
+            auto start_time = std::chrono::high_resolution_clock::now();
+            #pragma omp parallel reduction(+ : scattered)
+            {
+                Sampler sampler(FilterType::UNIFORM);
+                #pragma omp for schedule(dynamic, 1024)
+                for (long long i = 0; i < static_cast<long long>(rays.size()); i++) {
+                    Hit_Payload rec;
+                    if (!scene.isHit(rays[i], Vector2f(Epsilon, Infinity), rec))
+                        continue;
+                    const Material *mat = scene.GetMaterial(rec.material_id);
+                    if (!mat)
+                        continue;
+                    sampler.SetPixel(static_cast<int>(i % 4096), static_cast<int>(i / 4096));
+                    Vector3f scatter_direction;
+                    float pdf;
+                    mat->Sample(rays[i], rec, scatter_direction, pdf, sampler);
+                    if (pdf > 0.0f)
+                        scattered++;
+                }
+            }
+            auto end_time = std::chrono::high_resolution_clock::now();
+            best_seconds = std::min(best_seconds, std::chrono::duration<double>(end_time - start_time).count());
+            if (scattered < 0) // keep the shading observable
+                std::cout << scattered;
+        }
+        return rays.size() / best_seconds * 1e-6;
+    }
+
+    TraversalStats MeasureTraversal(const Scene &scene, const std::vector<Ray> &rays, bool simulate_caches)
+    {
+        TraversalStats total;
+        #pragma omp parallel
+        {
+            TraversalStats local;
+            CacheModel lines(256 * 1024, 64, 8);
+            CacheModel pages(64 * 4096, 4096, 64);
+            if (simulate_caches) {
+                local.lines = &lines;
+                local.pages = &pages;
+            }
+            #pragma omp for schedule(dynamic, 1024) nowait
+            for (long long i = 0; i < static_cast<long long>(rays.size()); i++) {
+                SurfaceHit hit;
+                scene.IntersectCounted(rays[i], Vector2f(Epsilon, Infinity), hit, local);
+            }
+            #pragma omp critical
+            {
+                total.rays += local.rays;
+                total.node_visits += local.node_visits;
+                total.primitive_tests += local.primitive_tests;
+                total.line_misses += local.line_misses;
+                total.page_misses += local.page_misses;
+            }
+        }
+        return total;
+    }
+
+    double MeasureCacheMisses(const Scene &scene, const std::vector<Ray> &rays, int threads)
+    {
+        // Opened before the pool threads exist, so that they inherit it
+        CacheMissCounter counter;
+        if (!counter.Valid())
+            return -1.0;
+        omp_set_num_threads(threads);
+        long long hits = 0;
+        counter.Start();
+        #pragma omp parallel for schedule(dynamic, 1024) reduction(+ : hits)
+        for (long long i = 0; i < static_cast<long long>(rays.size()); i++) {
+            Hit_Payload rec;
+            if (scene.isHit(rays[i], Vector2f(Epsilon, Infinity), rec))
+                hits++;
+        }
+        uint64_t misses = counter.Stop();
+        if (hits < 0)
+            std::cout << hits;
+        return double(misses) / rays.size();
+    }
+
+    bool LeafKernels(size_t primitive_count, size_t ray_count)
+    {
+        // Rays from a shell around the unit cube towards points inside it
+        std::mt19937 rng(7);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::vector<Ray> rays;
+        rays.reserve(ray_count);
+        for (size_t i = 0; i < ray_count; i++) {
+            Vector3f origin = 3.0f * glm::normalize(Vector3f(unit(rng), unit(rng), unit(rng)) + Vector3f(1e-3f));
+            Vector3f target(unit(rng), unit(rng), unit(rng));
+            rays.emplace_back(origin, glm::normalize(target - origin));
+        }
+
+        std::cout << "Leaf kernels: " << primitive_count << " primitives, " << ray_count << " rays, nearest hit per ray" << std::endl;
+        size_t mismatches = CompareSphereKernel<4>(rays, primitive_count, rng);
+        mismatches += CompareSphereKernel<8>(rays, primitive_count, rng);
+        mismatches += CompareQuadKernel<4>(rays, primitive_count, rng);
+        mismatches += CompareQuadKernel<8>(rays, primitive_count, rng);
+        return mismatches == 0;
+    }
+
+    bool TransformedHits(size_t ray_count)
+    {
+        auto material = std::make_shared<Diffuse>(Vector3f(0.5f));
+        Vector3f box_scale(2.0f, 0.5f, 3.0f), offset(0.7f, -0.4f, 0.2f);
+        // A rotation by 180 degrees about y maps (x, y, z) to (-x, y, -z)
+        struct Case {
+            const char *name;
+            std::shared_ptr<Hittable> wrapped, reference;
+        };
+        const Case cases[] = {
+            {"Scale(sphere)", std::make_shared<Scale>(std::make_shared<Sphere>(Vector3f(0.2f, -0.1f, 0.3f), 0.4f, material), 2.5f),
+             std::make_shared<Sphere>(Vector3f(0.5f, -0.25f, 0.75f), 1.0f, material)},
+            {"Scale(box)", std::make_shared<Scale>(std::make_shared<Box>(Vector3f(0.1f, 0.2f, -0.1f), Vector3f(0.4f, 0.6f, 0.2f), material), box_scale),
+             std::make_shared<Box>(Vector3f(0.1f, 0.2f, -0.1f) * box_scale, Vector3f(0.4f, 0.6f, 0.2f) * box_scale, material)},
+            {"Translate(box)", std::make_shared<Translate>(std::make_shared<Box>(Vector3f(0.0f), Vector3f(0.8f, 0.5f, 1.0f), material), offset),
+             std::make_shared<Box>(offset, Vector3f(0.8f, 0.5f, 1.0f), material)},
+            {"Rotate(sphere)", std::make_shared<Rotate>(std::make_shared<Sphere>(Vector3f(0.6f, 0.1f, -0.3f), 0.5f, material), RotationAxis::Y, 180.0f),
+             std::make_shared<Sphere>(Vector3f(-0.6f, 0.1f, 0.3f), 0.5f, material)},
+        };
+
+        // Directions are left unnormalised, t must still be the world-space ray parameter
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f), length(0.25f, 4.0f);
+        std::vector<Ray> rays;
+        rays.reserve(ray_count);
+        for (size_t i = 0; i < ray_count; i++) {
+            Vector3f origin = 6.0f * glm::normalize(Vector3f(unit(rng), unit(rng), unit(rng)) + Vector3f(1e-3f));
+            Vector3f target = 1.5f * Vector3f(unit(rng), unit(rng), unit(rng));
+            rays.emplace_back(origin, length(rng) * glm::normalize(target - origin));
+        }
+
+        std::cout << "Transformed hits: " << ray_count << " rays per shape" << std::endl;
+        size_t total_mismatches = 0;
+        for (const Case &c : cases) {
+            size_t hits = 0, mismatches = 0;
+            for (const Ray &r : rays) {
+                Hit_Payload wrapped, reference;
+                bool wrapped_hit = c.wrapped->isHit(r, Vector2f(Epsilon, Infinity), wrapped);
+                bool reference_hit = c.reference->isHit(r, Vector2f(Epsilon, Infinity), reference);
+                hits += reference_hit;
+                if (wrapped_hit != reference_hit) {
+                    mismatches++;
+                    continue;
+                }
+                // The two sides round differently, so distances only agree to a tolerance
+                if (reference_hit && (std::abs(wrapped.t - reference.t) > 1e-4f * std::max(1.0f, reference.t) ||
+                                      glm::length(wrapped.p - reference.p) > 1e-3f || glm::dot(wrapped.normal, reference.normal) < 0.999f))
+                    mismatches++;
+            }
+            std::cout << "  " << std::left << std::setw(16) << c.name << std::right << " hits " << std::setw(7) << hits
+                      << " | mismatches " << mismatches << std::endl;
+            total_mismatches += mismatches;
+        }
+        return total_mismatches == 0;
+    }
+
+#ifdef HO_EMBREE
+    bool EmbreeBackend(size_t sphere_count, size_t ray_count)
+    {
+        auto material = std::make_shared<Diffuse>(Vector3f(0.5f));
+        Scene cornell, spheres, forest;
+        RendererScene::BuildCornellBox(cornell);
+        RendererScene::BuildSphereField(spheres, sphere_count);
+        RendererScene::BuildForest(forest, 200);
+
+        // Transform chains become Embree instances, the mesh native triangles
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<float> position(-80.0f, 80.0f);
+        for (int i = 0; i < 100; i++) {
+            auto box = std::make_shared<Box>(Vector3f(0.0f), Vector3f(3.0f, 1.0f, 2.0f), material);
+            spheres.Add(std::make_shared<Translate>(std::make_shared<Rotate>(std::make_shared<Scale>(box, 1.5f), RotationAxis::Y, 30.0f * i),
+                                                    Vector3f(position(rng), position(rng), position(rng))));
+        }
+        auto grid = std::make_shared<MeshBuffers>();
+        constexpr int GridSize = 32;
+        for (int y = 0; y <= GridSize; y++) {
+            for (int x = 0; x <= GridSize; x++) {
+                grid->px.push_back(60.0f * x / GridSize - 30.0f);
+                grid->py.push_back(4.0f * std::sin(0.5f * x) * std::cos(0.4f * y));
+                grid->pz.push_back(60.0f * y / GridSize - 30.0f);
+            }
+        }
+        for (int y = 0; y < GridSize; y++) {
+            for (int x = 0; x < GridSize; x++) {
+                uint32_t corner = y * (GridSize + 1) + x;
+                for (uint32_t index : {corner, corner + 1, corner + GridSize + 1, corner + 1, corner + GridSize + 2, corner + GridSize + 1})
+                    grid->indices.push_back(index);
+            }
+        }
+        spheres.Add(std::make_shared<TriangleMesh>(grid, material));
+
+        struct Case {
+            const char *name;
+            Scene *scene;
+        };
+        size_t total_rays = 0, total_mismatches = 0;
+        for (const Case &c : {Case{"CornellBox", &cornell}, Case{"SphereField", &spheres}, Case{"Forest", &forest}}) {
+            std::vector<Ray> rays = GenerateRandomRays(*c.scene, ray_count);
+            c.scene->SetAccelerator(AcceleratorType::LINEAR_BVH);
+            c.scene->BuildBVH();
+            std::vector<Hit_Payload> reference(rays.size());
+            std::vector<uint8_t> reference_hit(rays.size()), reference_occluded(rays.size());
+            for (size_t i = 0; i < rays.size(); i++) {
+                reference_hit[i] = c.scene->isHit(rays[i], Vector2f(Epsilon, Infinity), reference[i]);
+                reference_occluded[i] = c.scene->isOccluded(rays[i], reference_hit[i] ? 0.5f * reference[i].t : 50.0f);
+            }
+
+            c.scene->SetAccelerator(AcceleratorType::EMBREE);
+            c.scene->BuildBVH();
+            size_t hit_mismatches = 0, occlusion_mismatches = 0;
+            for (size_t i = 0; i < rays.size(); i++) {
+                Hit_Payload rec;
+                bool hit = c.scene->isHit(rays[i], Vector2f(Epsilon, Infinity), rec);
+                const Hit_Payload &ref = reference[i];
+                hit_mismatches += hit != static_cast<bool>(reference_hit[i]) ||
+                                  (hit && (std::abs(rec.t - ref.t) > 1e-4f * std::max(1.0f, ref.t) ||
+                                           rec.material_id != ref.material_id || glm::dot(rec.normal, ref.normal) < 0.99f));
+                occlusion_mismatches += c.scene->isOccluded(rays[i], reference_hit[i] ? 0.5f * ref.t : 50.0f) !=
+                                        static_cast<bool>(reference_occluded[i]);
+            }
+            std::cout << c.name << ": " << c.scene->GetObjects().size() << " objects, " << rays.size()
+                      << " random rays | closest-hit mismatches " << hit_mismatches
+                      << " | occlusion mismatches " << occlusion_mismatches << std::endl;
+            total_rays += 2 * rays.size();
+            total_mismatches += hit_mismatches + occlusion_mismatches;
+        }
+        return total_mismatches * 10000 <= total_rays;
+    }
+#endif
+
+    void CacheLayouts(size_t sphere_count, int threads)
+    {
+        Scene scene;
+        RendererScene::BuildSphereField(scene, sphere_count);
+        std::vector<Ray> primary_rays = GenerateCameraRays(SphereFieldCamera());
+        std::vector<Ray> random_rays = GenerateRandomRays(scene, primary_rays.size());
+        std::cout << "SphereField: " << scene.GetObjects().size() << " objects, " << primary_rays.size()
+                  << " rays per pass, modeled misses of a 256KB cache / 64-entry TLB per ray" << std::endl;
+
+        for (AcceleratorType accelerator : {AcceleratorType::WIDE_BVH8, AcceleratorType::QUANTIZED_BVH}) {
+            for (BVHNodeLayout layout : {BVHNodeLayout::DEPTH_FIRST, BVHNodeLayout::TREELET, BVHNodeLayout::VAN_EMDE_BOAS}) {
+                scene.SetAccelerator(accelerator);
+                BVHBuildOptions options;
+                options.layout = layout;
+                scene.SetBuildOptions(options);
+                scene.BuildBVH();
+
+                std::ostringstream line;
+                line << std::fixed << std::setprecision(2);
+                for (const std::vector<Ray> *rays : {&primary_rays, &random_rays}) {
+                    TraversalStats traversal = MeasureTraversal(scene, *rays, true);
+                    double throughput = MeasureThroughput(scene, *rays, threads);
+                    double hardware = MeasureCacheMisses(scene, *rays, threads);
+                    std::ostringstream measured;
+                    measured << std::fixed << std::setprecision(2);
+                    if (hardware >= 0.0)
+                        measured << hardware;
+                    else
+                        measured << "n/a";
+                    line << " | " << (rays == &primary_rays ? "primary " : "random ") << std::setw(7) << throughput << " Mrays/s"
+                         << " lines " << std::setw(6) << double(traversal.line_misses) / traversal.rays
+                         << " pages " << std::setw(6) << double(traversal.page_misses) / traversal.rays
+                         << " perf " << std::setw(6) << measured.str();
+                }
+                std::cout << "  " << std::left << std::setw(14) << AcceleratorName(accelerator) << std::setw(14) << LayoutName(layout)
+                          << std::right << line.str() << std::endl;
+            }
+        }
+    }
+
+    void SpatialSplits(size_t sliver_count, size_t sphere_count, int threads)
+    {
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        Scene slivers;
+        RendererScene::BuildSlivers(slivers, sliver_count, sphere_count);
+        CameraParams sliverCamera = {
+            1.0f,
+            900,
+            40.0f,
+            Vector3f(0.0f, 0.0f, -300.0f),
+            Vector3f(0.0f, 0.0f, 0.0f),
+            Vector3f(0.0f, 1.0f, 0.0f),
+            0.0f,
+            1.0f
+        };
+
+        struct Case {
+            const char *name;
+            Scene *scene;
+            CameraParams camera;
+        };
+        for (const Case &c : {Case{"CornellBox", &cornell, RendererScene::CornellBoxCamera()}, Case{"Slivers", &slivers, sliverCamera}}) {
+            std::vector<Ray> primary_rays = GenerateCameraRays(c.camera);
+            std::vector<Ray> random_rays = GenerateRandomRays(*c.scene, primary_rays.size());
+            std::cout << c.name << ": " << c.scene->GetObjects().size() << " objects, " << primary_rays.size() << " rays per pass" << std::endl;
+            for (BVHBuildQuality quality : {BVHBuildQuality::HIGH, BVHBuildQuality::SBVH}) {
+                c.scene->SetAccelerator(AcceleratorType::LINEAR_BVH);
+                BVHBuildOptions options;
+                options.quality = quality;
+                c.scene->SetBuildOptions(options);
+                c.scene->BuildBVH();
+                const BVHBuildStats &stats = c.scene->GetBuildStats();
+
+                omp_set_num_threads(threads);
+                TraversalStats primary_traversal = MeasureTraversal(*c.scene, primary_rays);
+                TraversalStats random_traversal = MeasureTraversal(*c.scene, random_rays);
+                double primary = MeasureThroughput(*c.scene, primary_rays, threads);
+                double random = MeasureThroughput(*c.scene, random_rays, threads);
+                std::cout << std::fixed << std::setprecision(2)
+                          << "  " << std::left << std::setw(6) << QualityName(quality) << std::right
+                          << " build " << std::setw(9) << stats.build_ms << " ms"
+                          << " | SAH " << std::setw(7) << stats.sah_cost
+                          << " | duplicates " << std::setw(7) << stats.duplicate_references
+                          << " | nodes/ray " << std::setw(6) << double(primary_traversal.node_visits) / primary_traversal.rays
+                          << " / " << std::setw(6) << double(random_traversal.node_visits) / random_traversal.rays
+                          << " | prims/ray " << std::setw(6) << double(primary_traversal.primitive_tests) / primary_traversal.rays
+                          << " / " << std::setw(6) << double(random_traversal.primitive_tests) / random_traversal.rays
+                          << " | primary " << std::setw(6) << primary << " Mrays/s"
+                          << " | random " << std::setw(6) << random << " Mrays/s" << std::endl;
+            }
+        }
+    }
+
+    void AcceleratorThroughput(size_t sphere_count, int threads)
+    {
+        std::cout << "BVH_TREE nodes take " << sizeof(BVHnode) << " bytes plus their shared_ptr control blocks, LINEAR_BVH nodes "
+                  << sizeof(LinearBVHNode) << ", QUANTIZED_BVH nodes " << sizeof(QuantizedBVHNode) << " for 8 children" << std::endl;
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        RunScene("CornellBox", cornell, RendererScene::CornellBoxCamera(), threads,
+                 {{AcceleratorType::NONE, BVHBuildQuality::HIGH},
+                  {AcceleratorType::BVH_TREE, BVHBuildQuality::HIGH},
+                  {AcceleratorType::LINEAR_BVH, BVHBuildQuality::FAST},
+                  {AcceleratorType::LINEAR_BVH, BVHBuildQuality::HIGH},
+                  {AcceleratorType::WIDE_BVH4, BVHBuildQuality::HIGH},
+                  {AcceleratorType::WIDE_BVH8, BVHBuildQuality::HIGH},
+                  {AcceleratorType::QUANTIZED_BVH, BVHBuildQuality::HIGH},
+                  {AcceleratorType::EMBREE, BVHBuildQuality::HIGH}});
+
+        Scene spheres;
+        RendererScene::BuildSphereField(spheres, sphere_count);
+        CameraParams sphereCamera = SphereFieldCamera();
+        // The brute-force loop is left out, it would take hours at this size
+        RunScene("SphereField", spheres, sphereCamera, threads,
+                 {{AcceleratorType::BVH_TREE, BVHBuildQuality::HIGH},
+                  {AcceleratorType::LINEAR_BVH, BVHBuildQuality::LBVH},
+                  {AcceleratorType::LINEAR_BVH, BVHBuildQuality::HLBVH},
+                  {AcceleratorType::LINEAR_BVH, BVHBuildQuality::FAST},
+                  {AcceleratorType::LINEAR_BVH, BVHBuildQuality::HIGH},
+                  {AcceleratorType::WIDE_BVH4, BVHBuildQuality::HIGH},
+                  {AcceleratorType::WIDE_BVH8, BVHBuildQuality::HIGH},
+                  {AcceleratorType::QUANTIZED_BVH, BVHBuildQuality::HIGH},
+                  {AcceleratorType::LAZY_BVH, BVHBuildQuality::HIGH},
+                  {AcceleratorType::EMBREE, BVHBuildQuality::HIGH}});
+    }
+
+    void TimeToFirstPixel(size_t sphere_count, int threads)
+    {
+        Scene scene;
+        RendererScene::BuildSphereField(scene, sphere_count);
+        // From a corner into the field, the spheres near the camera hide most of the others
+        CameraParams closeup = {
+            1.0f,
+            512,
+            30.0f,
+            Vector3f(-95.0f, -95.0f, -95.0f),
+            Vector3f(-60.0f, -70.0f, -60.0f),
+            Vector3f(0.0f, 1.0f, 0.0f),
+            0.0f,
+            1.0f
+        };
+        std::vector<Ray> rays = GenerateCameraRays(closeup);
+        std::cout << "SphereField: " << scene.GetObjects().size() << " objects, " << rays.size() << " primary rays per frame" << std::endl;
+
+        omp_set_num_threads(threads);
+        auto frame = [&]() {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            long long hits = 0;
+            #pragma omp parallel for schedule(dynamic, 1024) reduction(+ : hits)
+            for (long long i = 0; i < static_cast<long long>(rays.size()); i++) {
+                Hit_Payload rec;
+                if (scene.isHit(rays[i], Vector2f(Epsilon, Infinity), rec))
+                    hits++;
+            }
+            if (hits < 0)
+                std::cout << hits;
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+        };
+
+        for (AcceleratorType accelerator : {AcceleratorType::LINEAR_BVH, AcceleratorType::LAZY_BVH}) {
+            for (BVHBuildQuality quality : {BVHBuildQuality::LBVH, BVHBuildQuality::HIGH}) {
+                scene.SetAccelerator(accelerator);
+                BVHBuildOptions options;
+                options.quality = quality;
+                scene.SetBuildOptions(options);
+                scene.BuildBVH();
+                double build_ms = scene.GetBuildStats().build_ms;
+                double first_ms = frame();
+                double second_ms = frame();
+                std::cout << std::fixed << std::setprecision(2)
+                          << "  " << std::left << std::setw(20) << (std::string(AcceleratorName(accelerator)) + " (" + QualityName(quality) + ")")
+                          << std::right << " build " << std::setw(9) << build_ms << " ms"
+                          << " | first frame " << std::setw(9) << first_ms << " ms"
+                          << " | first pixel after " << std::setw(9) << build_ms + first_ms << " ms"
+                          << " | second frame " << std::setw(8) << second_ms << " ms" << std::endl;
+            }
+        }
+    }
+
+    bool PacketThroughput(size_t sphere_count, int threads)
+    {
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        size_t mismatches = ComparePackets("CornellBox", cornell, RendererScene::CornellBoxCamera(), threads);
+
+        Scene spheres;
+        RendererScene::BuildSphereField(spheres, sphere_count);
+        mismatches += ComparePackets("SphereField", spheres, SphereFieldCamera(), threads);
+        return mismatches == 0;
+    }
+
+    bool IntegratorThroughput(int frames, int threads, int image_width)
+    {
+        // Both trace the same sample streams, compilers that contract or reorder differently may
+        // still leave the last bits of a pixel apart
+        constexpr double MaxRoundingDifference = 1e-3;
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        cornell.BuildBVH();
+        cornell.BuildLightTable();
+        CameraParams camParams = RendererScene::CornellBoxCamera();
+        camParams.image_width = image_width;
+        Camera camera;
+        camera.Create(camParams);
+        Sampler sampler(FilterType::GAUSSIAN);
+        size_t value_count = static_cast<size_t>(camera.image_width) * camera.image_height * 4;
+
+        auto path = Integrator::Create(IntegratorType::PATH, camera.image_width, camera.image_height, threads, 30);
+        auto wavefront = Integrator::Create(IntegratorType::WAVEFRONT, camera.image_width, camera.image_height, threads, 30);
+        std::cout << "CornellBox: " << camera.image_width << "x" << camera.image_height << ", 30 bounces, " << frames << " frames" << std::endl;
+
+        double path_ms = 0.0, wavefront_ms = 0.0, difference = 0.0, max_difference = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            path->RenderImage(camera, cornell, sampler, frame);
+            auto middle_time = std::chrono::high_resolution_clock::now();
+            wavefront->RenderImage(camera, cornell, sampler, frame);
+            auto end_time = std::chrono::high_resolution_clock::now();
+            path_ms += std::chrono::duration<double, std::milli>(middle_time - start_time).count();
+            wavefront_ms += std::chrono::duration<double, std::milli>(end_time - middle_time).count();
+
+            const float *a = path->GetFloatPixels(), *b = wavefront->GetFloatPixels();
+            for (size_t i = 0; i < value_count; i++) {
+                double value_difference = std::abs(a[i] - b[i]);
+                difference += value_difference;
+                max_difference = std::max(max_difference, value_difference);
+            }
+        }
+        std::cout << std::fixed << std::setprecision(2)
+                  << "  PATH      " << std::setw(9) << path_ms / frames << " ms/frame" << std::endl
+                  << "  WAVEFRONT " << std::setw(9) << wavefront_ms / frames << " ms/frame"
+                  << " | mean difference " << std::setprecision(6) << difference / (value_count * frames)
+                  << ", max " << max_difference << std::endl;
+        return max_difference <= MaxRoundingDifference;
+    }
+
+    void RouletteThroughput(int frames, int threads)
+    {
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        cornell.BuildBVH();
+        cornell.BuildLightTable();
+        Camera camera;
+        camera.Create(RendererScene::CornellBoxCamera());
+        Sampler sampler(FilterType::GAUSSIAN);
+        size_t value_count = static_cast<size_t>(camera.image_width) * camera.image_height * 4;
+        const int bounces = 30;
+        std::cout << "CornellBox: " << camera.image_width << "x" << camera.image_height << ", " << bounces << " bounces, "
+                  << frames << " frames" << std::endl;
+
+        // A roulette depth of max_bounce never plays, every path runs until it escapes or its bounces run out
+        for (int roulette_depth : {bounces, 3}) {
+            auto integrator = Integrator::Create(IntegratorType::PATH, camera.image_width, camera.image_height, threads, bounces);
+            integrator->SetRouletteDepth(roulette_depth);
+            std::vector<uint64_t> paths(bounces, 0);
+            double ms = 0.0, mean = 0.0;
+            for (int frame = 0; frame < frames; frame++) {
+                auto start_time = std::chrono::high_resolution_clock::now();
+                integrator->RenderImage(camera, cornell, sampler, frame);
+                auto end_time = std::chrono::high_resolution_clock::now();
+                ms += std::chrono::duration<double, std::milli>(end_time - start_time).count();
+
+                const float *pixels = integrator->GetFloatPixels();
+                for (size_t i = 0; i < value_count; i++)
+                    mean += pixels[i];
+                const std::vector<uint64_t> &stats = integrator->GetBounceStats();
+                for (int depth = 0; depth < bounces; depth++)
+                    paths[depth] += stats[depth];
+            }
+
+            // The roulette is unbiased, so the image mean only moves by noise
+            std::cout << std::fixed << std::setprecision(2)
+                      << "  roulette from " << std::setw(2) << roulette_depth << std::setw(9) << ms / frames << " ms/frame"
+                      << " | image mean " << std::setprecision(5) << mean / (value_count * frames) << std::endl
+                      << "    alive per bounce:";
+            for (int depth = 0; depth < bounces && paths[depth] > 0; depth++)
+                std::cout << " " << std::setprecision(3) << static_cast<double>(paths[depth]) / paths[0];
+            std::cout << std::endl;
+        }
+    }
+
+    void TileScheduling(int frames, int threads)
+    {
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        cornell.BuildBVH();
+        cornell.BuildLightTable();
+        Camera camera;
+        camera.Create(RendererScene::CornellBoxCamera());
+        Sampler sampler(FilterType::GAUSSIAN);
+        size_t value_count = static_cast<size_t>(camera.image_width) * camera.image_height * 4;
+        std::cout << "CornellBox: " << camera.image_width << "x" << camera.image_height << ", 30 bounces, " << frames << " frames" << std::endl;
+
+        auto integrator = Integrator::Create(IntegratorType::PATH, camera.image_width, camera.image_height, threads, 30);
+        TileScheduler &scheduler = integrator->GetTileScheduler();
+        std::vector<float> reference;
+        const std::pair<TileOrder, const char *> orders[] = {
+            {TileOrder::SCANLINE, "SCANLINE"}, {TileOrder::MORTON, "MORTON"}, {TileOrder::CENTER_FIRST, "CENTER_FIRST"}};
+        for (int tile_size : {16, 32}) {
+            for (const auto &[order, name] : orders) {
+                scheduler.SetTileSize(tile_size);
+                scheduler.SetOrder(order);
+                double ms = 0.0;
+                size_t steals = 0;
+                for (int frame = 0; frame < frames; frame++) {
+                    auto start_time = std::chrono::high_resolution_clock::now();
+                    integrator->RenderImage(camera, cornell, sampler, frame);
+                    auto end_time = std::chrono::high_resolution_clock::now();
+                    ms += std::chrono::duration<double, std::milli>(end_time - start_time).count();
+                    steals += scheduler.GetSteals();
+                }
+
+                // Every pixel draws its own sample stream, so the tiling must not change the last frame
+                const float *pixels = integrator->GetFloatPixels();
+                if (reference.empty())
+                    reference.assign(pixels, pixels + value_count);
+                size_t mismatches = 0;
+                for (size_t i = 0; i < value_count; i++)
+                    mismatches += pixels[i] != reference[i];
+
+                std::cout << std::fixed << std::setprecision(2)
+                          << "  " << std::setw(2) << tile_size << "x" << std::setw(2) << tile_size << " " << std::setw(12) << name
+                          << std::setw(10) << ms / frames << " ms/frame"
+                          << " | " << std::setw(6) << steals / frames << " steals/frame"
+                          << " | " << mismatches << " values differ" << std::endl;
+            }
+        }
+    }
+
+    void ThreadPoolDispatch(size_t sphere_count, int dispatches)
+    {
+        ThreadPool &pool = ThreadPool::Global();
+        int threads = pool.Size();
+        std::cout << "ThreadPool: " << threads << " threads, " << dispatches << " empty dispatches" << std::endl;
+
+        std::atomic<int> sink = 0;
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < dispatches; i++) {
+            #pragma omp parallel num_threads(threads)
+            sink += omp_get_thread_num();
+        }
+        auto middle_time = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < dispatches; i++)
+            pool.Parallel(threads, [&](int thread) { sink += thread; });
+        auto end_time = std::chrono::high_resolution_clock::now();
+        std::cout << std::fixed << std::setprecision(2)
+                  << "  omp parallel " << std::setw(9) << std::chrono::duration<double, std::micro>(middle_time - start_time).count() / dispatches << " us" << std::endl
+                  << "  ThreadPool   " << std::setw(9) << std::chrono::duration<double, std::micro>(end_time - middle_time).count() / dispatches << " us" << std::endl;
+
+        Scene scene;
+        RendererScene::BuildSphereField(scene, sphere_count);
+        scene.SetAccelerator(AcceleratorType::BVH_TREE);
+        std::cout << "SphereField BVH_TREE, " << scene.GetObjects().size() << " objects:" << std::endl;
+        scene.BuildBVH();
+    }
+
+    bool AdaptiveConvergence(int frames, int image_width, int threads)
+    {
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        cornell.BuildBVH();
+        cornell.BuildLightTable();
+        CameraParams params = RendererScene::CornellBoxCamera();
+        params.image_width = image_width;
+        Camera camera;
+        camera.Create(params);
+        Sampler sampler(FilterType::GAUSSIAN);
+        size_t pixel_count = static_cast<size_t>(camera.image_width) * camera.image_height;
+
+        // A threshold of 0 never converges: every pixel takes one sample per frame. over_budget
+        // counts the frames that planned more samples than the image has pixels
+        auto render = [&](float threshold, int frame_count, double &ms, int &over_budget) {
+            auto integrator = Integrator::Create(IntegratorType::PATH, camera.image_width, camera.image_height, threads, 30);
+            integrator->SetAdaptiveSampling(true);
+            AdaptiveSampling::Settings settings;
+            settings.threshold = threshold;
+            integrator->GetAdaptiveSampling().SetSettings(settings);
+            over_budget = 0;
+            double total_ms = 0.0;
+            for (int frame = 0; frame < frame_count; frame++) {
+                const AdaptiveSampling &estimates = integrator->GetAdaptiveSampling();
+                if (estimates.Matches(camera.image_width, camera.image_height)) {
+                    size_t planned = 0;
+                    for (size_t pixel = 0; pixel < pixel_count; pixel++)
+                        planned += estimates.SamplesThisFrame(pixel);
+                    over_budget += planned > pixel_count;
+                }
+                auto start_time = std::chrono::high_resolution_clock::now();
+                integrator->RenderImage(camera, cornell, sampler, frame);
+                auto end_time = std::chrono::high_resolution_clock::now();
+                total_ms += std::chrono::duration<double, std::milli>(end_time - start_time).count();
+            }
+            ms = total_ms;
+            return integrator;
+        };
+        auto rmse = [&](Integrator &integrator, Integrator &reference) {
+            double sum = 0.0;
+            for (size_t pixel = 0; pixel < pixel_count; pixel++) {
+                Vector3f d = integrator.GetAdaptiveSampling().Mean(pixel) - reference.GetAdaptiveSampling().Mean(pixel);
+                sum += glm::dot(d, d) / 3.0f;
+            }
+            return std::sqrt(sum / pixel_count);
+        };
+
+        std::cout << "CornellBox: " << camera.image_width << "x" << camera.image_height << ", 30 bounces, " << frames
+                  << " frames, reference of " << 4 * frames << std::endl;
+        double reference_ms, uniform_ms;
+        int over_budget, frames_over_budget = 0;
+        auto reference = render(0.0f, 4 * frames, reference_ms, over_budget);
+        auto uniform = render(0.0f, frames, uniform_ms, over_budget);
+        std::cout << std::fixed << std::setprecision(2)
+                  << "  uniform           " << std::setw(9) << uniform_ms << " ms | RMSE " << std::setprecision(5) << rmse(*uniform, *reference) << std::endl;
+        for (float threshold : {0.1f, 0.05f}) {
+            double adaptive_ms;
+            auto adaptive = render(threshold, frames, adaptive_ms, over_budget);
+            frames_over_budget += over_budget;
+            AdaptiveSampling &estimates = adaptive->GetAdaptiveSampling();
+            std::cout << std::fixed << std::setprecision(2)
+                      << "  adaptive " << std::setprecision(3) << threshold << "   " << std::setprecision(2) << std::setw(9) << adaptive_ms << " ms"
+                      << " | RMSE " << std::setprecision(5) << rmse(*adaptive, *reference)
+                      << " | " << estimates.GetActivePixels() << " pixels still sampling, up to " << estimates.MaxSampleCount() << " samples"
+                      << " | frames over budget " << over_budget << std::endl;
+        }
+        return frames_over_budget == 0;
+    }
+
+    void ShadingThroughput(int threads)
+    {
+        Scene cornell;
+        RendererScene::BuildCornellBox(cornell);
+        cornell.SetAccelerator(AcceleratorType::LINEAR_BVH);
+        cornell.BuildBVH();
+        std::vector<Ray> primary_rays = GenerateCameraRays(RendererScene::CornellBoxCamera());
+        std::vector<Ray> random_rays = GenerateRandomRays(cornell, primary_rays.size());
+
+        std::cout << "CornellBox shading: " << cornell.GetMaterials().Size() << " materials, " << primary_rays.size() << " rays per pass" << std::endl;
+        for (int thread_count : {1, threads}) {
+            double primary = MeasureShadingThroughput(cornell, primary_rays, thread_count);
+            double random = MeasureShadingThroughput(cornell, random_rays, thread_count);
+            std::cout << std::fixed << std::setprecision(2)
+                      << "  " << std::setw(3) << thread_count << " threads"
+                      << " | primary " << std::setw(8) << primary << " Mrays/s"
+                      << " | random " << std::setw(8) << random << " Mrays/s" << std::endl;
+        }
+    }
+
+    void InstancingThroughput(size_t instance_count, int threads)
+    {
+        Scene forest;
+        RendererScene::BuildForest(forest, instance_count);
+        // Every instance points at the same tree, report what it would cost to copy it instead
+        auto instance = std::dynamic_pointer_cast<Instance>(forest.GetObjects().front());
+        size_t tree_primitives = instance->GetBLAS()->PrimitiveCount();
+        std::cout << "Forest: " << instance_count << " instances of a " << tree_primitives << " primitive tree, "
+                  << instance_count * sizeof(Instance) / (1024 * 1024) << " MB of instances vs "
+                  << instance_count * tree_primitives << " primitives if flattened" << std::endl;
+
+        RunScene("Forest", forest, RendererScene::ForestCamera(instance_count), threads,
+                 {{AcceleratorType::LINEAR_BVH, BVHBuildQuality::FAST},
+                  {AcceleratorType::LINEAR_BVH, BVHBuildQuality::HIGH},
+                  {AcceleratorType::WIDE_BVH4, BVHBuildQuality::HIGH},
+                  {AcceleratorType::WIDE_BVH8, BVHBuildQuality::HIGH},
+                  {AcceleratorType::QUANTIZED_BVH, BVHBuildQuality::HIGH},
+                  {AcceleratorType::EMBREE, BVHBuildQuality::HIGH}});
+    }
+
+    bool Run(const std::string &name)
+    {
+        static const std::pair<const char *, void (*)()> benchmarks[] = {
+            {"AcceleratorThroughput", [] { AcceleratorThroughput(); }},
+            {"ShadingThroughput", [] { ShadingThroughput(); }},
+            {"InstancingThroughput", [] { InstancingThroughput(); }},
+            {"SpatialSplits", [] { SpatialSplits(); }},
+            {"CacheLayouts", [] { CacheLayouts(); }},
+            {"TimeToFirstPixel", [] { TimeToFirstPixel(); }},
+            {"LeafKernels", [] { LeafKernels(); }},
+            {"PacketThroughput", [] { PacketThroughput(); }},
+            {"IntegratorThroughput", [] { IntegratorThroughput(); }},
+            {"RouletteThroughput", [] { RouletteThroughput(); }},
+            {"TileScheduling", [] { TileScheduling(); }},
+            {"ThreadPoolDispatch", [] { ThreadPoolDispatch(); }},
+            {"AdaptiveConvergence", [] { AdaptiveConvergence(); }},
+        };
+        // Build times are measured, a warm cache would turn them into load times
+        SceneCache::SetDirectory("");
+        for (const auto &[benchmark_name, benchmark] : benchmarks) {
+            if (name == benchmark_name) {
+                benchmark();
+                return true;
+            }
+        }
+        std::cerr << "Unknown benchmark " << name << ", available:";
+        for (const auto &benchmark : benchmarks)
+            std::cerr << " " << benchmark.first;
+        std::cerr << std::endl;
+        return false;
+    }
+
+    bool Check(const std::string &name)
+    {
+        // Smaller than the benchmark defaults, the answers matter here and not the timings
+        static const std::pair<const char *, bool (*)()> checks[] = {
+            {"LeafKernels", [] { return LeafKernels(1024, 1024); }},
+            {"PacketThroughput", [] { return PacketThroughput(20000, 4); }},
+            {"IntegratorThroughput", [] { return IntegratorThroughput(2, 4, 200); }},
+            {"TransformedHits", [] { return TransformedHits(20000); }},
+            {"AdaptiveConvergence", [] { return AdaptiveConvergence(24, 120, 4); }},
+#ifdef HO_EMBREE
+            {"EmbreeBackend", [] { return EmbreeBackend(20000, 50000); }},
+#endif
+        };
+        // Every check builds what it compares instead of trusting an earlier run
+        SceneCache::SetDirectory("");
+        bool known = name == "all", passed = true;
+        for (const auto &[check_name, check] : checks) {
+            if (name != "all" && name != check_name)
+                continue;
+            known = true;
+            bool check_passed = check();
+            std::cout << check_name << (check_passed ? ": passed" : ": FAILED") << std::endl;
+            passed = passed && check_passed;
+        }
+        if (!known) {
+            std::cerr << "Unknown check " << name << ", available: all";
+            for (const auto &check : checks)
+                std::cerr << " " << check.first;
+            std::cerr << std::endl;
+        }
+        return known && passed;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Util.hpp"
+#include "Ray.hpp"
+#include "Camera.hpp"
+#include "BVHBuilder.hpp"
+
+// Headless measurements that do not need a window, started with HoRenderer --benchmark <name>.
+// Run and Check turn SceneCache off, so build times are never cache loads
+namespace Benchmark {
+    // Runs the measurement called name with its default arguments, false and a list of names if there is none
+    bool Run(const std::string &name);
+    /*
+    * @brief: Runs the measurements that compare a fast path against its reference (LeafKernels,
+    *         PacketThroughput, IntegratorThroughput, TransformedHits) or hold it to a budget
+    *         (AdaptiveConvergence) on smaller inputs, started with HoRenderer --check <name>,
+    *         where "all" runs every one.
+    *
+    * @ret: false if any of them disagrees with its reference or name is unknown
+    */
+    bool Check(const std::string &name);
+
+    // Primary rays through the camera, one per pixel
+    std::vector<Ray> GenerateCameraRays(const CameraParams &params);
+    // Rays with random origins inside the scene bounds and random directions (incoherent)
+    std::vector<Ray> GenerateRandomRays(const Scene &scene, size_t count, uint32_t seed = 7);
+
+    // Closest-hit throughput in Mrays/s, best of `passes` runs
+    double MeasureThroughput(const Scene &scene, const std::vector<Ray> &rays, int threads, int passes = 3);
+
+    // Closest hit plus one material lookup and BSDF sample per ray, in Mrays/s, best of `passes` runs
+    double MeasureShadingThroughput(const Scene &scene, const std::vector<Ray> &rays, int threads, int passes = 3);
+
+    // Compare every accelerator backend on the Cornell box and on a procedural sphere field
+    void AcceleratorThroughput(size_t sphere_count = 1000000, int threads = 16);
+    // Build time plus the first and second frame of a close-up of the sphere field, LINEAR_BVH against LAZY_BVH
+    void TimeToFirstPixel(size_t sphere_count = 1000000, int threads = 16);
+    // Primary and shadow rays traced one by one against 4x2 pixel packets, see Scene::IntersectPacket.
+    // True when every packet lane finds the same hit and occlusion as the scalar ray
+    bool PacketThroughput(size_t sphere_count = 1000000, int threads = 16);
+    // Frame time of the recursive and the wavefront integrator on the Cornell box rendered
+    // image_width wide. True when the two images differ by float rounding only
+    bool IntegratorThroughput(int frames = 8, int threads = 16, int image_width = 900);
+    // Frame time, image mean and paths alive per bounce with Russian roulette off and on, on the Cornell box
+    void RouletteThroughput(int frames = 8, int threads = 16);
+    // Frame time and steals of the tile scheduler per tile size and order, on the Cornell box
+    void TileScheduling(int frames = 4, int threads = 16);
+    // Cost of starting an empty parallel frame, OpenMP region against the ThreadPool, and the
+    // BVH_TREE build of the sphere field, whose subtrees are ThreadPool tasks
+    void ThreadPoolDispatch(size_t sphere_count = 200000, int dispatches = 1000);
+    // Error against a reference of 4x the frames, one sample per pixel and frame against adaptive
+    // sampling at the same total sample budget, on the Cornell box rendered image_width wide. True
+    // when no adaptive frame plans more samples than the image has pixels
+    bool AdaptiveConvergence(int frames = 64, int image_width = 450, int threads = 16);
+    // Shading throughput on the Cornell box, where a few materials are shared by most hits
+    void ShadingThroughput(int threads = 16);
+    /*
+    * @brief: Node visits and primitive tests per ray, see Scene::IntersectCounted.
+    *
+    * @args: simulate_caches: also run every thread's reads through its own CacheModel, a 256KB
+    *        8-way cache with 64-byte lines and a 64-entry TLB of 4KB pages
+    */
+    TraversalStats MeasureTraversal(const Scene &scene, const std::vector<Ray> &rays, bool simulate_caches = false);
+    // Hardware cache misses per ray over one closest-hit pass, negative where no counter is available
+    double MeasureCacheMisses(const Scene &scene, const std::vector<Ray> &rays, int threads);
+
+    // Object-split (HIGH) against spatial-split (SBVH) builds on the Cornell box and on thin slivers
+    void SpatialSplits(size_t sliver_count = 500, size_t sphere_count = 50000, int threads = 16);
+    // SIMD sphere and quad kernels (4 and 8 lanes) against the scalar routines, one thread, no BVH.
+    // True when every SIMD result equals the scalar one
+    bool LeafKernels(size_t primitive_count = 4096, size_t ray_count = 4096);
+    // Rays of random length against Translate, Rotate and Scale wrapped shapes and the same shapes
+    // built where the wrapper puts them. True when distance, position and normal agree
+    bool TransformedHits(size_t ray_count = 100000);
+#ifdef HO_EMBREE
+    // Closest hits and occlusion of EMBREE against LINEAR_BVH on the Cornell box, a sphere field with
+    // transformed boxes and a triangle mesh, and the forest of instances (Embree user geometry). True
+    // when at most one ray in 10^4 disagrees, grazing hits round differently in the two backends
+    bool EmbreeBackend(size_t sphere_count = 100000, size_t ray_count = 200000);
+#endif
+    // Depth-first, treelet and van Emde Boas node orders for WIDE_BVH8 and QUANTIZED_BVH
+    void CacheLayouts(size_t sphere_count = 1000000, int threads = 16);
+    // Two-level traversal on a forest of instances of one shared tree
+    void InstancingThroughput(size_t instance_count = 1000000, int threads = 16);
+}
@@ -0,0 +1,348 @@
+#include "CompiledScene.hpp"
+#include "Transform.hpp"
+#include "Instance.hpp"
+#include "Material.hpp"
+
+namespace {
+
+// Translation and positive uniform scale only: a sphere stays a sphere with the same uv
+bool IsSimilarityWithoutRotation(const Matrix4f &m, float &scale) {
+    scale = m[0][0];
+    if (scale <= 0.0f)
+        return false;
+    for (int column = 0; column < 3; column++)
+        for (int row = 0; row < 3; row++) {
+            float expected = column == row ? scale : 0.0f;
+            if (std::abs(m[column][row] - expected) > 1e-6f * scale)
+                return false;
+        }
+    return true;
+}
+
+bool IsIdentity(const Matrix4f &m) {
+    for (int column = 0; column < 4; column++)
+        for (int row = 0; row < 4; row++)
+            if (m[column][row] != (column == row ? 1.0f : 0.0f))
+                return false;
+    return true;
+}
+
+} // namespace
+
+
+void SphereArray::Add(const Vector3f &center, float r, MaterialID material_id)
+{
+    cx.push_back(center.x);
+    cy.push_back(center.y);
+    cz.push_back(center.z);
+    radius.push_back(r);
+    material_ids.push_back(material_id);
+}
+
+void SphereArray::Move(uint32_t from, uint32_t to)
+{
+    cx[to] = cx[from];
+    cy[to] = cy[from];
+    cz[to] = cz[from];
+    radius[to] = radius[from];
+    material_ids[to] = material_ids[from];
+}
+
+void SphereArray::Resize(size_t size)
+{
+    cx.resize(size);
+    cy.resize(size);
+    cz.resize(size);
+    radius.resize(size);
+    material_ids.resize(size);
+}
+
+AABB SphereArray::Bounds(uint32_t i) const
+{
+    Vector3f rvec(radius[i]);
+    return AABB(Center(i) - rvec, Center(i) + rvec);
+}
+
+void QuadArray::Add(const Vector3f &Q, const Vector3f &u, const Vector3f &v, const Vector3f &normal, MaterialID material_id)
+{
+    Vector3f n = glm::cross(u, v);
+    Vector3f w = n / glm::dot(n, n);
+    qx.push_back(Q.x); qy.push_back(Q.y); qz.push_back(Q.z);
+    ux.push_back(u.x); uy.push_back(u.y); uz.push_back(u.z);
+    vx.push_back(v.x); vy.push_back(v.y); vz.push_back(v.z);
+    nx.push_back(normal.x); ny.push_back(normal.y); nz.push_back(normal.z);
+    wx.push_back(w.x); wy.push_back(w.y); wz.push_back(w.z);
+    d.push_back(glm::dot(normal, Q));
+    material_ids.push_back(material_id);
+}
+
+void QuadArray::Move(uint32_t from, uint32_t to)
+{
+    qx[to] = qx[from]; qy[to] = qy[from]; qz[to] = qz[from];
+    ux[to] = ux[from]; uy[to] = uy[from]; uz[to] = uz[from];
+    vx[to] = vx[from]; vy[to] = vy[from]; vz[to] = vz[from];
+    nx[to] = nx[from]; ny[to] = ny[from]; nz[to] = nz[from];
+    wx[to] = wx[from]; wy[to] = wy[from]; wz[to] = wz[from];
+    d[to] = d[from];
+    material_ids[to] = material_ids[from];
+}
+
+void QuadArray::Resize(size_t size)
+{
+    for (auto *column : {&qx, &qy, &qz, &ux, &uy, &uz, &vx, &vy, &vz, &nx, &ny, &nz, &wx, &wy, &wz, &d})
+        column->resize(size);
+    material_ids.resize(size);
+}
+
+AABB QuadArray::Bounds(uint32_t i) const
+{
+    Vector3f corners[4] = {Q(i), Q(i) + U(i), Q(i) + V(i), Q(i) + U(i) + V(i)};
+    Vector3f min_point = corners[0], max_point = corners[0];
+    for (int k = 1; k < 4; k++) {
+        min_point = glm::min(min_point, corners[k]);
+        max_point = glm::max(max_point, corners[k]);
+    }
+    return AABB(min_point, max_point);
+}
+
+CompiledScene::CompiledScene(const std::vector<std::shared_ptr<Hittable>> &scene_objects, MaterialTable &materials)
+{
+    primitives.reserve(scene_objects.size());
+    object_ranges.reserve(scene_objects.size());
+    for (const auto &object : scene_objects) {
+        uint32_t first = static_cast<uint32_t>(primitives.size());
+        Flatten(object, materials);
+        object_ranges.push_back({first, static_cast<uint32_t>(primitives.size()) - first});
+    }
+
+    ExtendBounds({0, static_cast<uint32_t>(primitives.size())});
+}
+
+void CompiledScene::Flatten(const std::shared_ptr<Hittable> &object, MaterialTable &materials)
+{
+    Matrix4f matrix;
+    auto leaf = Transform::Unwrap(object, matrix);
+    Matrix3f linear(matrix);
+    Vector3f translation(matrix[3]);
+
+    std::vector<std::shared_ptr<Quad>> faces;
+    if (auto quad = std::dynamic_pointer_cast<Quad>(leaf))
+        faces.push_back(quad);
+    else if (auto box = std::dynamic_pointer_cast<Box>(leaf))
+        faces = box->get_sides();
+    if (!faces.empty()) {
+        // An affine map keeps a parallelogram a parallelogram with the same (alpha, beta).
+        // The normal follows the inverse transpose, which flips against cross(u, v) for mirrors.
+        float orientation = glm::determinant(linear) < 0.0f ? -1.0f : 1.0f;
+        for (const auto &face : faces) {
+            Vector3f Q = linear * face->get_Q() + translation;
+            Vector3f u = linear * face->get_u();
+            Vector3f v = linear * face->get_v();
+            Vector3f normal = orientation * glm::normalize(glm::cross(u, v));
+            primitives.push_back({PrimitiveType::QUAD, static_cast<uint32_t>(quads.Size())});
+            quads.Add(Q, u, v, normal, materials.Add(face->get_mat()));
+        }
+        return;
+    }
+
+    float scale;
+    auto sphere = std::dynamic_pointer_cast<Sphere>(leaf);
+    if (sphere && IsSimilarityWithoutRotation(matrix, scale)) {
+        primitives.push_back({PrimitiveType::SPHERE, static_cast<uint32_t>(spheres.Size())});
+        spheres.Add(linear * sphere->get_center() + translation, sphere->get_radius() * scale,
+                    materials.Add(sphere->get_mat()));
+        return;
+    }
+
+    // Everything else keeps its own Intersect, behind at most one matrix
+    if (IsIdentity(matrix))
+        AddReference(leaf);
+    else if (auto instance = std::dynamic_pointer_cast<Instance>(leaf))
+        AddReference(std::make_shared<Instance>(instance->GetBLAS(), matrix * instance->GetMatrix()));
+    else
+        AddReference(std::make_shared<AffineTransform>(leaf, matrix));
+}
+
+void CompiledScene::AddReference(const std::shared_ptr<Hittable> &object)
+{
+    primitives.push_back({PrimitiveType::OBJECT, static_cast<uint32_t>(objects.size())});
+    objects.push_back(object);
+}
+
+void CompiledScene::AddObject(const std::shared_ptr<Hittable> &object, MaterialTable &materials, std::vector<uint32_t> &added_primitives)
+{
+    uint32_t first = static_cast<uint32_t>(primitives.size());
+    Flatten(object, materials);
+    PrimitiveRange range = {first, static_cast<uint32_t>(primitives.size()) - first};
+    object_ranges.push_back(range);
+    for (uint32_t i = range.first; i < range.first + range.count; i++)
+        added_primitives.push_back(i);
+    ExtendBounds(range);
+}
+
+bool CompiledScene::UpdateObject(uint32_t object_index, const std::shared_ptr<Hittable> &object, MaterialTable &materials,
+                                 std::vector<uint32_t> &added_primitives)
+{
+    PrimitiveRange &old_range = object_ranges[object_index];
+    size_t sphere_count = spheres.Size(), quad_count = quads.Size(), object_count = objects.size();
+    uint32_t first = static_cast<uint32_t>(primitives.size());
+    Flatten(object, materials);
+    PrimitiveRange range = {first, static_cast<uint32_t>(primitives.size()) - first};
+
+    bool same_layout = range.count == old_range.count;
+    for (uint32_t k = 0; same_layout && k < range.count; k++)
+        same_layout = primitives[old_range.first + k].type == primitives[range.first + k].type;
+
+    if (same_layout) {
+        // Overwrite the old slots, the BVH leaves keep pointing at the right primitives
+        for (uint32_t k = 0; k < range.count; k++) {
+            const PrimitiveRef &from = primitives[range.first + k];
+            const PrimitiveRef &to = primitives[old_range.first + k];
+            switch (from.type) {
+            case PrimitiveType::SPHERE: spheres.Move(from.index, to.index); break;
+            case PrimitiveType::QUAD: quads.Move(from.index, to.index); break;
+            case PrimitiveType::OBJECT: objects[to.index] = objects[from.index]; break;
+            case PrimitiveType::REMOVED: break;
+            }
+        }
+        primitives.resize(first);
+        spheres.Resize(sphere_count);
+        quads.Resize(quad_count);
+        objects.resize(object_count);
+        ExtendBounds(old_range);
+        return true;
+    }
+
+    MarkRemoved(old_range);
+    old_range = range;
+    for (uint32_t i = range.first; i < range.first + range.count; i++)
+        added_primitives.push_back(i);
+    ExtendBounds(range);
+    return false;
+}
+
+void CompiledScene::RemoveObject(uint32_t object_index)
+{
+    MarkRemoved(object_ranges[object_index]);
+    object_ranges.erase(object_ranges.begin() + object_index);
+}
+
+void CompiledScene::SortStorage(std::span<const uint32_t> leaf_order)
+{
+    SphereArray sorted_spheres;
+    QuadArray sorted_quads;
+    std::vector<uint8_t> placed(primitives.size(), 0);
+    auto place = [&](uint32_t index) {
+        PrimitiveRef &primitive = primitives[index];
+        if (placed[index])
+            return;
+        placed[index] = 1;
+        uint32_t i = primitive.index;
+        if (primitive.type == PrimitiveType::SPHERE) {
+            primitive.index = static_cast<uint32_t>(sorted_spheres.Size());
+            sorted_spheres.Add(spheres.Center(i), spheres.radius[i], spheres.material_ids[i]);
+        } else if (primitive.type == PrimitiveType::QUAD) {
+            primitive.index = static_cast<uint32_t>(sorted_quads.Size());
+            sorted_quads.Add(quads.Q(i), quads.U(i), quads.V(i), quads.Normal(i), quads.material_ids[i]);
+        }
+    };
+    // SBVH leaves may repeat a primitive, the first reference decides
+    for (uint32_t index : leaf_order)
+        place(index);
+    // Anything the leaves missed keeps its data, removed slots are dropped
+    for (uint32_t index = 0; index < primitives.size(); index++)
+        place(index);
+    spheres = std::move(sorted_spheres);
+    quads = std::move(sorted_quads);
+}
+
+void CompiledScene::MarkRemoved(const PrimitiveRange &range)
+{
+    // The typed arrays keep their slots, only the next full build compacts them
+    for (uint32_t i = range.first; i < range.first + range.count; i++) {
+        if (primitives[i].type == PrimitiveType::OBJECT)
+            objects[primitives[i].index].reset();
+        primitives[i].type = PrimitiveType::REMOVED;
+    }
+    removed_count += range.count;
+}
+
+void CompiledScene::ExtendBounds(const PrimitiveRange &range)
+{
+    for (uint32_t i = range.first; i < range.first + range.count; i++) {
+        bbox = has_bounds ? calculateSurroundingBox(bbox, PrimitiveBounds(i)) : PrimitiveBounds(i);
+        has_bounds = true;
+    }
+}
+
+AABB CompiledScene::PrimitiveBounds(uint32_t index) const
+{
+    const PrimitiveRef &primitive = primitives[index];
+    switch (primitive.type) {
+    case PrimitiveType::SPHERE:
+        return spheres.Bounds(primitive.index);
+    case PrimitiveType::QUAD:
+        return quads.Bounds(primitive.index);
+    case PrimitiveType::OBJECT:
+        return objects[primitive.index]->getBoundingBox();
+    case PrimitiveType::REMOVED:
+        break;
+    }
+    // Callers skip removed primitives (IsLive)
+    return AABB();
+}
+
+int CompiledScene::PrimitivePolygon(uint32_t index, Vector3f *vertices) const
+{
+    const PrimitiveRef &primitive = primitives[index];
+    if (primitive.type != PrimitiveType::QUAD)
+        return 0;
+    uint32_t i = primitive.index;
+    vertices[0] = quads.Q(i);
+    vertices[1] = quads.Q(i) + quads.U(i);
+    vertices[2] = quads.Q(i) + quads.U(i) + quads.V(i);
+    vertices[3] = quads.Q(i) + quads.V(i);
+    return 4;
+}
+
+bool CompiledScene::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
+{
+    bool hit_anything = false;
+    for (uint32_t i = 0; i < primitives.size(); i++) {
+        if (IntersectPrimitive(i, r, t_interval, hit)) {
+            hit_anything = true;
+            t_interval.y = hit.t;
+        }
+    }
+    return hit_anything;
+}
+
+void CompiledScene::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const
+{
+    // Only spheres and quads record this object, OBJECT hits point at their own leaf
+    const PrimitiveRef &primitive = primitives[hit.prim_id];
+    uint32_t i = primitive.index;
+    rec.t = hit.t;
+    rec.p = r.at(rec.t);
+    if (primitive.type == PrimitiveType::SPHERE) {
+        Vector3f outward_normal = (rec.p - spheres.Center(i)) / spheres.radius[i];
+        rec.set_face_normal(r, outward_normal);
+        rec.material_id = spheres.material_ids[i];
+        rec.uv = SphereUV(glm::normalize(rec.p - spheres.Center(i)));
+        rec.tangent = SphereTangent(outward_normal);
+    } else {
+        rec.set_face_normal(r, quads.Normal(i));
+        rec.material_id = quads.material_ids[i];
+        rec.uv = hit.local;
+        rec.tangent = glm::normalize(quads.U(i));
+    }
+}
+
+bool CompiledScene::isOccluded(const Ray &r, float t_max) const
+{
+    for (uint32_t i = 0; i < primitives.size(); i++) {
+        if (OccludedPrimitive(i, r, t_max))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,307 @@
+#pragma once
+
+#include "Util.hpp"
+#include "Hittable.hpp"
+#include "Shape.hpp"
+#include "PrimitiveKernels.hpp"
+#include <span>
+
+// Type tag of a compiled primitive, traversal dispatches on it with a switch instead of a
+// virtual call
+enum class PrimitiveType : uint32_t {
+    SPHERE, // world-space sphere in CompiledScene::spheres
+    QUAD,   // world-space parallelogram in CompiledScene::quads
+    OBJECT, // anything else, called through Hittable
+    REMOVED // slot left by Scene::RemoveObject/UpdateObject, skipped until the next full build
+};
+
+struct PrimitiveRef {
+    PrimitiveType type;
+    uint32_t index; // into the array of that type
+};
+
+// Primitives produced by one scene object, they are always appended together
+struct PrimitiveRange {
+    uint32_t first;
+    uint32_t count;
+};
+
+// Spheres as structure of arrays
+struct SphereArray {
+    std::vector<float> cx, cy, cz, radius;
+    std::vector<MaterialID> material_ids;
+
+    size_t Size() const { return radius.size(); }
+    Vector3f Center(uint32_t i) const { return Vector3f(cx[i], cy[i], cz[i]); }
+    SphereLanes Lanes(uint32_t first) const { return {&cx[first], &cy[first], &cz[first], &radius[first]}; }
+    void Add(const Vector3f &center, float r, MaterialID material_id);
+    // Copy slot `from` over slot `to`
+    void Move(uint32_t from, uint32_t to);
+    void Resize(size_t size);
+    AABB Bounds(uint32_t i) const;
+};
+
+// Parallelograms as structure of arrays, with the plane constants Quad precomputes
+struct QuadArray {
+    std::vector<float> qx, qy, qz;
+    std::vector<float> ux, uy, uz;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> nx, ny, nz;
+    std::vector<float> wx, wy, wz;
+    std::vector<float> d;
+    std::vector<MaterialID> material_ids;
+
+    size_t Size() const { return d.size(); }
+    Vector3f Q(uint32_t i) const { return Vector3f(qx[i], qy[i], qz[i]); }
+    Vector3f U(uint32_t i) const { return Vector3f(ux[i], uy[i], uz[i]); }
+    Vector3f V(uint32_t i) const { return Vector3f(vx[i], vy[i], vz[i]); }
+    Vector3f Normal(uint32_t i) const { return Vector3f(nx[i], ny[i], nz[i]); }
+    Vector3f W(uint32_t i) const { return Vector3f(wx[i], wy[i], wz[i]); }
+    QuadLanes Lanes(uint32_t first) const {
+        return {&qx[first], &qy[first], &qz[first], &ux[first], &uy[first], &uz[first], &vx[first], &vy[first], &vz[first],
+                &nx[first], &ny[first], &nz[first], &wx[first], &wy[first], &wz[first], &d[first]};
+    }
+    /*
+    * @brief: Append a parallelogram.
+    *
+    * @args: normal: unit normal, not necessarily along cross(u, v) (mirrored transforms)
+    */
+    void Add(const Vector3f &Q, const Vector3f &u, const Vector3f &v, const Vector3f &normal, MaterialID material_id);
+    void Move(uint32_t from, uint32_t to);
+    void Resize(size_t size);
+    AABB Bounds(uint32_t i) const;
+};
+
+// Flat list of primitives produced by Scene::Compile. Box is split into its faces and
+// Translate/Rotate/Scale chains are baked into world-space geometry wherever that keeps
+// the surface data unchanged: any affine transform of a quad, translation and uniform
+// scale of a sphere. Other chains become one AffineTransform around the inner object, or are
+// folded into the matrix when the inner object is an Instance.
+class CompiledScene : public Hittable {
+public:
+    CompiledScene(const std::vector<std::shared_ptr<Hittable>> &objects, MaterialTable &materials);
+
+    size_t PrimitiveCount() const { return primitives.size(); }
+    const PrimitiveRef &GetPrimitive(uint32_t index) const { return primitives[index]; }
+    AABB PrimitiveBounds(uint32_t index) const;
+    // Corners of a quad primitive, 0 for the other types (PrimitivePolygonFn for SBVH)
+    int PrimitivePolygon(uint32_t index, Vector3f *vertices) const;
+    size_t SphereCount() const { return spheres.Size(); }
+    size_t QuadCount() const { return quads.Size(); }
+    size_t ObjectCount() const { return objects.size(); }
+    bool IsLive(uint32_t index) const { return primitives[index].type != PrimitiveType::REMOVED; }
+    size_t RemovedCount() const { return removed_count; }
+
+    /*
+    * @brief: Incremental changes behind Scene::AddObject/UpdateObject/RemoveObject. Object
+    *         indices follow the scene object list.
+    *
+    * @args: added_primitives: receives the indices of primitives that are not in any BVH leaf yet
+    * @ret: UpdateObject returns true when the new primitives took over the old slots (same
+    *       count and types, e.g. pure motion), so the BVH only needs a refit
+    */
+    void AddObject(const std::shared_ptr<Hittable> &object, MaterialTable &materials, std::vector<uint32_t> &added_primitives);
+    bool UpdateObject(uint32_t object_index, const std::shared_ptr<Hittable> &object, MaterialTable &materials,
+                      std::vector<uint32_t> &added_primitives);
+    void RemoveObject(uint32_t object_index);
+
+    // Rewrite the sphere and quad arrays in the order the accelerator's leaves reference their
+    // primitives, so that neighbouring leaves read neighbouring memory. Primitive indices stay the same
+    void SortStorage(std::span<const uint32_t> leaf_order);
+
+    // Closest hit against one primitive, sets hit.prim_id to the primitive index
+    inline bool IntersectPrimitive(uint32_t index, const Ray &r, Vector2f t_interval, SurfaceHit &hit) const;
+    // Any-hit against one primitive over (Epsilon, t_max)
+    inline bool OccludedPrimitive(uint32_t index, const Ray &r, float t_max) const;
+    /*
+    * @brief: Closest hit against the primitives of one BVH leaf. Spheres and quads go through the
+    *         SIMD kernels of PrimitiveKernels.hpp, 4 lanes for small leaves and 8 for larger ones,
+    *         read in place when the leaf's primitives are stored next to each other (SortStorage
+    *         makes that the usual case). Other primitives are tested one by one.
+    *
+    * @args: t_interval: shrunk to the hit distance, like the interval of a LinearBVH::Intersect callback
+    */
+    inline bool IntersectLeaf(const uint32_t *leaf, uint32_t count, const Ray &r, Vector2f &t_interval, SurfaceHit &hit) const;
+
+    // Brute force over every primitive, the accelerators call IntersectPrimitive instead
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    bool isOccluded(const Ray &r, float t_max) const override;
+    AABB getBoundingBox() const override { return bbox; }
+
+private:
+    void Flatten(const std::shared_ptr<Hittable> &object, MaterialTable &materials);
+    void AddReference(const std::shared_ptr<Hittable> &object);
+    void MarkRemoved(const PrimitiveRange &range);
+    void ExtendBounds(const PrimitiveRange &range);
+    template <int Width>
+    bool IntersectLeafLanes(const uint32_t *leaf, uint32_t count, const Ray &r, Vector2f &t_interval, SurfaceHit &hit) const;
+    // Record the nearest of count spheres/quads whose lane i is primitive lane_primitives[i]
+    template <int Width>
+    bool HitSpheres(const SphereLanes &lanes, const uint32_t *lane_primitives, int count, const Ray &r, Vector2f &t_interval,
+                    SurfaceHit &hit) const;
+    template <int Width>
+    bool HitQuads(const QuadLanes &lanes, const uint32_t *lane_primitives, int count, const Ray &r, Vector2f &t_interval,
+                  SurfaceHit &hit) const;
+
+    std::vector<PrimitiveRef> primitives;
+    SphereArray spheres;
+    QuadArray quads;
+    std::vector<std::shared_ptr<Hittable>> objects;
+    std::vector<PrimitiveRange> object_ranges;
+    size_t removed_count = 0;
+    AABB bbox; // only grows under updates
+    bool has_bounds = false;
+};
+
+inline bool CompiledScene::IntersectPrimitive(uint32_t index, const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
+{
+    const PrimitiveRef &primitive = primitives[index];
+    uint32_t i = primitive.index;
+    switch (primitive.type) {
+    case PrimitiveType::SPHERE: {
+        float t;
+        if (!IntersectSphere(spheres.Center(i), spheres.radius[i], r, t_interval, t))
+            return false;
+        hit.t = t;
+        hit.object = this;
+        hit.prim_id = index;
+        hit.depth = 0;
+        return true;
+    }
+    case PrimitiveType::QUAD: {
+        float t;
+        Vector2f local;
+        if (!IntersectQuad(quads.Q(i), quads.U(i), quads.V(i), quads.Normal(i), quads.W(i), quads.d[i], r, t_interval, t, local))
+            return false;
+        hit.t = t;
+        hit.object = this;
+        hit.prim_id = index;
+        hit.local = local;
+        hit.depth = 0;
+        return true;
+    }
+    case PrimitiveType::OBJECT:
+        return objects[i]->Intersect(r, t_interval, hit);
+    case PrimitiveType::REMOVED:
+        return false;
+    }
+    return false;
+}
+
+inline bool CompiledScene::OccludedPrimitive(uint32_t index, const Ray &r, float t_max) const
+{
+    const PrimitiveRef &primitive = primitives[index];
+    uint32_t i = primitive.index;
+    float t;
+    switch (primitive.type) {
+    case PrimitiveType::SPHERE:
+        return IntersectSphere(spheres.Center(i), spheres.radius[i], r, Vector2f(Epsilon, t_max), t);
+    case PrimitiveType::QUAD: {
+        Vector2f local;
+        return IntersectQuad(quads.Q(i), quads.U(i), quads.V(i), quads.Normal(i), quads.W(i), quads.d[i],
+                             r, Vector2f(Epsilon, t_max), t, local);
+    }
+    case PrimitiveType::OBJECT:
+        return objects[i]->isOccluded(r, t_max);
+    case PrimitiveType::REMOVED:
+        return false;
+    }
+    return false;
+}
+
+template <int Width>
+inline bool CompiledScene::HitSpheres(const SphereLanes &lanes, const uint32_t *lane_primitives, int count, const Ray &r,
+                                      Vector2f &t_interval, SurfaceHit &hit) const
+{
+    float t;
+    int lane = IntersectSpheres<Width>(lanes, count, r, t_interval, t);
+    if (lane < 0)
+        return false;
+    hit.t = t;
+    hit.object = this;
+    hit.prim_id = lane_primitives[lane];
+    hit.depth = 0;
+    t_interval.y = t;
+    return true;
+}
+
+template <int Width>
+inline bool CompiledScene::HitQuads(const QuadLanes &lanes, const uint32_t *lane_primitives, int count, const Ray &r,
+                                    Vector2f &t_interval, SurfaceHit &hit) const
+{
+    float t;
+    Vector2f local;
+    int lane = IntersectQuads<Width>(lanes, count, r, t_interval, t, local);
+    if (lane < 0)
+        return false;
+    hit.t = t;
+    hit.object = this;
+    hit.prim_id = lane_primitives[lane];
+    hit.local = local;
+    hit.depth = 0;
+    t_interval.y = t;
+    return true;
+}
+
+template <int Width>
+inline bool CompiledScene::IntersectLeafLanes(const uint32_t *leaf, uint32_t count, const Ray &r, Vector2f &t_interval,
+                                              SurfaceHit &hit) const
+{
+    // A leaf of consecutive spheres or quads is read straight from the arrays, as long as Width
+    // lanes fit before their end
+    const PrimitiveRef &front = primitives[leaf[0]];
+    bool in_place = count <= Width &&
+                    ((front.type == PrimitiveType::SPHERE && front.index + Width <= spheres.Size()) ||
+                     (front.type == PrimitiveType::QUAD && front.index + Width <= quads.Size()));
+    for (uint32_t i = 1; in_place && i < count; i++) {
+        const PrimitiveRef &primitive = primitives[leaf[i]];
+        in_place = primitive.type == front.type && primitive.index == front.index + i;
+    }
+    if (in_place) {
+        return front.type == PrimitiveType::SPHERE ? HitSpheres<Width>(spheres.Lanes(front.index), leaf, count, r, t_interval, hit)
+                                                   : HitQuads<Width>(quads.Lanes(front.index), leaf, count, r, t_interval, hit);
+    }
+
+    // Otherwise the spheres and quads are copied into blocks of Width, tested whenever one fills up
+    SphereBlock<Width> sphere_block;
+    QuadBlock<Width> quad_block;
+    uint32_t sphere_primitives[Width], quad_primitives[Width];
+    int n_spheres = 0, n_quads = 0;
+    bool hit_anything = false;
+    for (uint32_t k = 0; k < count; k++) {
+        uint32_t index = leaf[k];
+        const PrimitiveRef &primitive = primitives[index];
+        uint32_t i = primitive.index;
+        if (primitive.type == PrimitiveType::SPHERE) {
+            sphere_block.Set(n_spheres, spheres.Center(i), spheres.radius[i]);
+            sphere_primitives[n_spheres++] = index;
+            if (n_spheres == Width) {
+                hit_anything |= HitSpheres<Width>(sphere_block.Lanes(), sphere_primitives, n_spheres, r, t_interval, hit);
+                n_spheres = 0;
+            }
+        } else if (primitive.type == PrimitiveType::QUAD) {
+            quad_block.Set(n_quads, quads.Q(i), quads.U(i), quads.V(i), quads.Normal(i), quads.W(i), quads.d[i]);
+            quad_primitives[n_quads++] = index;
+            if (n_quads == Width) {
+                hit_anything |= HitQuads<Width>(quad_block.Lanes(), quad_primitives, n_quads, r, t_interval, hit);
+                n_quads = 0;
+            }
+        } else if (IntersectPrimitive(index, r, t_interval, hit)) {
+            t_interval.y = hit.t;
+            hit_anything = true;
+        }
+    }
+    if (n_spheres > 0)
+        hit_anything |= HitSpheres<Width>(sphere_block.Lanes(), sphere_primitives, n_spheres, r, t_interval, hit);
+    if (n_quads > 0)
+        hit_anything |= HitQuads<Width>(quad_block.Lanes(), quad_primitives, n_quads, r, t_interval, hit);
+    return hit_anything;
+}
+
+inline bool CompiledScene::IntersectLeaf(const uint32_t *leaf, uint32_t count, const Ray &r, Vector2f &t_interval, SurfaceHit &hit) const
+{
+    if (count <= 4)
+        return IntersectLeafLanes<4>(leaf, count, r, t_interval, hit);
+    return IntersectLeafLanes<8>(leaf, count, r, t_interval, hit);
+}
@@ -0,0 +1,282 @@
+#include "EmbreeScene.hpp"
+#ifdef HO_EMBREE
+#include "Shape.hpp"
+#include "TriangleMesh.hpp"
+#include "Transform.hpp"
+#include "Material.hpp"
+
+
+namespace {
+
+void ErrorCallback([[maybe_unused]] void *user_ptr, RTCError code, const char *message) {
+    std::cerr << "Embree error " << code << ": " << (message ? message : "") << std::endl;
+}
+
+void UserBounds(const RTCBoundsFunctionArguments *args) {
+    auto object = static_cast<const Hittable *>(args->geometryUserPtr);
+    AABB box = object->getBoundingBox();
+    args->bounds_o->lower_x = box.min().x;
+    args->bounds_o->lower_y = box.min().y;
+    args->bounds_o->lower_z = box.min().z;
+    args->bounds_o->upper_x = box.max().x;
+    args->bounds_o->upper_y = box.max().y;
+    args->bounds_o->upper_z = box.max().z;
+}
+
+void UserIntersect(const RTCIntersectFunctionNArguments *args) {
+    if (!args->valid[0])
+        return;
+    auto object = static_cast<const Hittable *>(args->geometryUserPtr);
+    auto rayhit = reinterpret_cast<RTCRayHit *>(args->rayhit);
+    Ray r(Vector3f(rayhit->ray.org_x, rayhit->ray.org_y, rayhit->ray.org_z),
+          Vector3f(rayhit->ray.dir_x, rayhit->ray.dir_y, rayhit->ray.dir_z));
+
+    // Only t is kept, EmbreeScene::Intersect intersects user geometry again for the rest
+    SurfaceHit hit;
+    if (!object->Intersect(r, Vector2f(rayhit->ray.tnear, rayhit->ray.tfar), hit))
+        return;
+    rayhit->ray.tfar = hit.t;
+    rayhit->hit.Ng_x = 0.0f;
+    rayhit->hit.Ng_y = 0.0f;
+    rayhit->hit.Ng_z = 0.0f;
+    rayhit->hit.u = 0.0f;
+    rayhit->hit.v = 0.0f;
+    rayhit->hit.primID = args->primID;
+    rayhit->hit.geomID = args->geomID;
+    for (unsigned int i = 0; i < RTC_MAX_INSTANCE_LEVEL_COUNT; i++)
+        rayhit->hit.instID[i] = args->context->instID[i];
+}
+
+void UserOccluded(const RTCOccludedFunctionNArguments *args) {
+    if (!args->valid[0])
+        return;
+    auto object = static_cast<const Hittable *>(args->geometryUserPtr);
+    auto ray = reinterpret_cast<RTCRay *>(args->ray);
+    Ray r(Vector3f(ray->org_x, ray->org_y, ray->org_z), Vector3f(ray->dir_x, ray->dir_y, ray->dir_z));
+
+    if (object->isOccluded(r, ray->tfar))
+        ray->tfar = -Infinity;
+}
+
+bool IsNativeGeometry(const std::shared_ptr<Hittable> &object) {
+    return std::dynamic_pointer_cast<Sphere>(object) || std::dynamic_pointer_cast<TriangleMesh>(object) ||
+           std::dynamic_pointer_cast<Quad>(object) || std::dynamic_pointer_cast<Box>(object);
+}
+
+} // namespace
+
+
+EmbreeScene::EmbreeScene(const std::vector<std::shared_ptr<Hittable>> &objects) : hit_objects(objects)
+{
+    device = rtcNewDevice(nullptr);
+    if (!device) {
+        std::cerr << "Embree error " << rtcGetDeviceError(nullptr) << ": cannot create device" << std::endl;
+        return;
+    }
+    rtcSetDeviceErrorFunction(device, ErrorCallback, nullptr);
+
+    scene = rtcNewScene(device);
+    rtcSetSceneBuildQuality(scene, RTC_BUILD_QUALITY_HIGH);
+    hit_targets.resize(hit_objects.size());
+    for (size_t i = 0; i < hit_objects.size(); i++) {
+        AttachObject(scene, hit_objects[i], static_cast<unsigned int>(i));
+
+        Matrix4f matrix;
+        auto leaf = Transform::Unwrap(hit_objects[i], matrix, &hit_targets[i].wrappers);
+        hit_targets[i].leaf = leaf.get();
+        hit_targets[i].native = IsNativeGeometry(leaf);
+    }
+    rtcCommitScene(scene);
+}
+
+EmbreeScene::~EmbreeScene()
+{
+    if (scene)
+        rtcReleaseScene(scene);
+    for (auto &[object, child] : child_scenes)
+        rtcReleaseScene(child);
+    if (device)
+        rtcReleaseDevice(device);
+}
+
+void EmbreeScene::AttachObject(RTCScene target, const std::shared_ptr<Hittable> &object, unsigned int id)
+{
+    RTCGeometry geom = CreateGeometry(object);
+    rtcCommitGeometry(geom);
+    rtcAttachGeometryByID(target, geom, id);
+    rtcReleaseGeometry(geom);
+}
+
+RTCGeometry EmbreeScene::CreateGeometry(const std::shared_ptr<Hittable> &object)
+{
+    if (auto sphere = std::dynamic_pointer_cast<Sphere>(object)) {
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_SPHERE_POINT);
+        auto vertex = static_cast<float *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0,
+                                           RTC_FORMAT_FLOAT4, 4 * sizeof(float), 1));
+        Vector3f center = sphere->get_center();
+        vertex[0] = center.x;
+        vertex[1] = center.y;
+        vertex[2] = center.z;
+        vertex[3] = sphere->get_radius();
+        return geom;
+    }
+
+    if (auto mesh = std::dynamic_pointer_cast<TriangleMesh>(object)) {
+        // Embree wants interleaved positions, the SoA buffers are copied once here
+        const MeshBuffers &buffers = mesh->GetBuffers();
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE);
+        auto vertex = static_cast<float *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0,
+                                           RTC_FORMAT_FLOAT3, 3 * sizeof(float), buffers.VertexCount()));
+        auto index = static_cast<unsigned int *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0,
+                                                 RTC_FORMAT_UINT3, 3 * sizeof(unsigned int), buffers.TriangleCount()));
+        for (size_t i = 0; i < buffers.VertexCount(); i++) {
+            vertex[3 * i + 0] = buffers.px[i];
+            vertex[3 * i + 1] = buffers.py[i];
+            vertex[3 * i + 2] = buffers.pz[i];
+        }
+        std::copy(buffers.indices.begin(), buffers.indices.end(), index);
+        return geom;
+    }
+
+    std::vector<std::shared_ptr<Quad>> quads;
+    if (auto quad = std::dynamic_pointer_cast<Quad>(object))
+        quads.push_back(quad);
+    else if (auto box = std::dynamic_pointer_cast<Box>(object))
+        quads = box->get_sides();
+    if (!quads.empty()) {
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_QUAD);
+        auto vertex = static_cast<float *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0,
+                                           RTC_FORMAT_FLOAT3, 3 * sizeof(float), 4 * quads.size()));
+        auto index = static_cast<unsigned int *>(rtcSetNewGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0,
+                                                 RTC_FORMAT_UINT4, 4 * sizeof(unsigned int), quads.size()));
+        for (size_t i = 0; i < quads.size(); i++) {
+            Vector3f Q = quads[i]->get_Q(), u = quads[i]->get_u(), v = quads[i]->get_v();
+            Vector3f corners[4] = {Q, Q + u, Q + u + v, Q + v};
+            for (int k = 0; k < 4; k++) {
+                vertex[(4 * i + k) * 3 + 0] = corners[k].x;
+                vertex[(4 * i + k) * 3 + 1] = corners[k].y;
+                vertex[(4 * i + k) * 3 + 2] = corners[k].z;
+                index[4 * i + k] = static_cast<unsigned int>(4 * i + k);
+            }
+        }
+        return geom;
+    }
+
+    if (std::dynamic_pointer_cast<Translate>(object) || std::dynamic_pointer_cast<Rotate>(object) ||
+        std::dynamic_pointer_cast<Scale>(object))
+        return CreateInstance(object);
+
+    return CreateUserGeometry(object);
+}
+
+RTCGeometry EmbreeScene::CreateInstance(const std::shared_ptr<Hittable> &object)
+{
+    Matrix4f matrix;
+    auto inner = Transform::Unwrap(object, matrix);
+
+    RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE);
+    rtcSetGeometryInstancedScene(geom, GetChildScene(inner));
+    rtcSetGeometryTimeStepCount(geom, 1);
+    rtcSetGeometryTransform(geom, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, &matrix[0][0]);
+    return geom;
+}
+
+RTCGeometry EmbreeScene::CreateUserGeometry(const std::shared_ptr<Hittable> &object)
+{
+    RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_USER);
+    rtcSetGeometryUserPrimitiveCount(geom, 1);
+    rtcSetGeometryUserData(geom, object.get());
+    rtcSetGeometryBoundsFunction(geom, UserBounds, nullptr);
+    rtcSetGeometryIntersectFunction(geom, UserIntersect);
+    rtcSetGeometryOccludedFunction(geom, UserOccluded);
+    return geom;
+}
+
+RTCScene EmbreeScene::GetChildScene(const std::shared_ptr<Hittable> &object)
+{
+    auto it = child_scenes.find(object.get());
+    if (it != child_scenes.end())
+        return it->second;
+
+    RTCScene child = rtcNewScene(device);
+    AttachObject(child, object, 0);
+    rtcCommitScene(child);
+    child_scenes.emplace(object.get(), child);
+    return child;
+}
+
+bool EmbreeScene::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
+{
+    if (!scene)
+        return false;
+
+    RTCRayHit rayhit;
+    rayhit.ray.org_x = r.origin().x;
+    rayhit.ray.org_y = r.origin().y;
+    rayhit.ray.org_z = r.origin().z;
+    rayhit.ray.dir_x = r.direction().x;
+    rayhit.ray.dir_y = r.direction().y;
+    rayhit.ray.dir_z = r.direction().z;
+    rayhit.ray.tnear = t_interval.x;
+    rayhit.ray.tfar = t_interval.y;
+    rayhit.ray.time = 0.0f;
+    rayhit.ray.mask = 0xFFFFFFFF;
+    rayhit.ray.id = 0;
+    rayhit.ray.flags = 0;
+    rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    rtcIntersect1(scene, &rayhit);
+
+    if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+        return false;
+
+    unsigned int index = rayhit.hit.instID[0] != RTC_INVALID_GEOMETRY_ID ? rayhit.hit.instID[0] : rayhit.hit.geomID;
+    const HitTarget &target = hit_targets[index];
+    if (!target.native) {
+        // Embree can not carry the user geometry's own SurfaceHit, intersect it again in a
+        // narrow window around t, which is cheap next to the traversal
+        const auto &object = hit_objects[index];
+        float t = rayhit.ray.tfar;
+        float tolerance = 1e-4f * std::max(1.0f, t);
+        if (object->Intersect(r, Vector2f(std::max(t_interval.x, t - tolerance), std::min(t_interval.y, t + tolerance)), hit))
+            return true;
+        return object->Intersect(r, t_interval, hit);
+    }
+
+    // Box faces are attached in get_sides() order, and Embree's quad u/v and triangle u/v
+    // are the same parametric and barycentric coordinates Quad and TriangleMesh use
+    hit.t = rayhit.ray.tfar;
+    hit.object = target.leaf;
+    hit.prim_id = rayhit.hit.primID;
+    hit.local = Vector2f(rayhit.hit.u, rayhit.hit.v);
+    hit.depth = 0;
+    for (auto it = target.wrappers.rbegin(); it != target.wrappers.rend(); ++it)
+        hit.PushWrapper(*it);
+    return true;
+}
+
+bool EmbreeScene::isOccluded(const Ray &r, Vector2f t_interval) const
+{
+    if (!scene)
+        return false;
+
+    RTCRay ray;
+    ray.org_x = r.origin().x;
+    ray.org_y = r.origin().y;
+    ray.org_z = r.origin().z;
+    ray.dir_x = r.direction().x;
+    ray.dir_y = r.direction().y;
+    ray.dir_z = r.direction().z;
+    ray.tnear = t_interval.x;
+    ray.tfar = t_interval.y;
+    ray.time = 0.0f;
+    ray.mask = 0xFFFFFFFF;
+    ray.id = 0;
+    ray.flags = 0;
+    rtcOccluded1(scene, &ray);
+
+    // tfar is set to -inf when any blocker was found
+    return ray.tfar < 0.0f;
+}
+
+#endif
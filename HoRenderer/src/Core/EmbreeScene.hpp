@@ -0,0 +1,55 @@
+#pragma once
+
+// Only built with the xmake option embree, which defines HO_EMBREE
+#ifdef HO_EMBREE
+
+#include "Util.hpp"
+#include "Hittable.hpp"
+#include <embree4/rtcore.h>
+#include <unordered_map>
+
+// Embree backed alternative to the built-in BVH. Every top-level object of the scene
+// is attached as exactly one Embree geometry whose ID is its index in the object list,
+// so a hit maps straight back to the Hittable that produced it:
+//   Sphere                  -> native sphere point geometry
+//   Quad, Box               -> native quad geometry
+//   TriangleMesh            -> native triangle geometry
+//   Translate/Rotate/Scale  -> instance of a child scene built from the inner object
+//   anything else           -> user geometry calling Hittable::Intersect
+class EmbreeScene {
+public:
+    explicit EmbreeScene(const std::vector<std::shared_ptr<Hittable>> &objects);
+    ~EmbreeScene();
+    EmbreeScene(const EmbreeScene &) = delete;
+    EmbreeScene &operator=(const EmbreeScene &) = delete;
+
+    // Closest hit, the SurfaceHit is rebuilt from Embree's primID and u/v without
+    // intersecting the object again (except for user geometry)
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const;
+    // Any-hit query for shadow rays
+    bool isOccluded(const Ray &r, Vector2f t_interval) const;
+
+private:
+
+    void AttachObject(RTCScene target, const std::shared_ptr<Hittable> &object, unsigned int id);
+    RTCGeometry CreateGeometry(const std::shared_ptr<Hittable> &object);
+    RTCGeometry CreateInstance(const std::shared_ptr<Hittable> &object);
+    RTCGeometry CreateUserGeometry(const std::shared_ptr<Hittable> &object);
+    RTCScene GetChildScene(const std::shared_ptr<Hittable> &object);
+
+    // How a hit on a top-level geometry maps back to the hittables
+    struct HitTarget {
+        const Hittable *leaf = nullptr;
+        std::vector<const Hittable *> wrappers; // transforms around leaf, outermost first
+        bool native = false;                    // leaf is a built-in Embree geometry
+    };
+
+    RTCDevice device = nullptr;
+    RTCScene scene = nullptr;
+    std::vector<std::shared_ptr<Hittable>> hit_objects;
+    std::vector<HitTarget> hit_targets;
+    // Child scenes are shared by every instance of the same object
+    std::unordered_map<const Hittable *, RTCScene> child_scenes;
+};
+
+#endif
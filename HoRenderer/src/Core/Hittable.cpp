@@ -11,3 +11,18 @@ void Hit_Payload::set_face_normal(const Ray &r, const Vector3f &outward_normal)
         front_face = dot(r.direction(), outward_normal) < 0.0f;
         normal = front_face ? outward_normal : -outward_normal;
 }
+
+bool Hittable::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const
+{
+    SurfaceHit hit;
+    if (!Intersect(r, t_interval, hit))
+        return false;
+    hit.object->ComputeSurfaceInteraction(r, hit, rec);
+    return true;
+}
+
+bool Hittable::isOccluded(const Ray &r, float t_max) const
+{
+    SurfaceHit hit;
+    return Intersect(r, Vector2f(Epsilon, t_max), hit);
+}
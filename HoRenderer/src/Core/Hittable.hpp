@@ -5,23 +5,74 @@
 
 #include "Ray.hpp"
 #include "AABB.hpp"
+#include "MaterialTable.hpp"
+#include <cassert>
 
+// Plain data, copied freely by the integrator. The material is looked up through
+// Scene::GetMaterial instead of being held by a shared_ptr.
 class Hit_Payload {
 public:    
     Vector3f p;
     Vector3f normal;
+    Vector3f tangent; // unit dp/du orthogonal to normal, zero when the surface has no parameterization
+    Vector2f uv;
     float t;
+    MaterialID material_id;
     bool front_face;
-    std::shared_ptr<Material> mat;
-    Vector2f uv;
 
 public:
     void set_face_normal(const Ray &r, const Vector3f &outward_normal);
 };
+static_assert(std::is_trivially_copyable_v<Hit_Payload>, "Hit_Payload must stay plain data");
+
+// What traversal records for a candidate hit. It is cheap to overwrite when a closer hit
+// is found; the full Hit_Payload is rebuilt from it once, for the final hit only.
+// Leaves set object to themselves. Transforms intersect into a fresh SurfaceHit and push
+// themselves with PushWrapper, so that object->ComputeSurfaceInteraction can map the ray
+// and walk back down with Unwrap. Scene::Add rejects objects nested deeper than
+// MaxWrapperDepth (see Hittable::WrapperDepth), so the stack never overflows.
+struct SurfaceHit {
+    static constexpr int MaxWrapperDepth = 8;
+
+    float t = Infinity;
+    const Hittable *object = nullptr;
+    uint32_t prim_id = 0;            // primitive inside object (box face, triangle)
+    Vector2f local = Vector2f(0.0f); // parametric (quad) or barycentric (triangle) coordinates
+    const Hittable *wrapped[MaxWrapperDepth];
+    int depth = 0;
+
+    void PushWrapper(const Hittable *wrapper) {
+        assert(depth < MaxWrapperDepth && "wrapper nesting deeper than SurfaceHit::MaxWrapperDepth");
+        wrapped[depth++] = object;
+        object = wrapper;
+    }
+    SurfaceHit Unwrap() const {
+        SurfaceHit inner = *this;
+        inner.object = wrapped[--inner.depth];
+        return inner;
+    }
+};
 
 class Hittable{
 public:
     virtual ~Hittable() = default;
-    virtual bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const = 0;
+    // Closest hit with full surface data: Intersect followed by ComputeSurfaceInteraction
+    virtual bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const;
+    /*
+    * @brief: Closest-hit test recording only t and what is needed to rebuild the hit later.
+    *         hit is left untouched when nothing is hit inside t_interval.
+    */
+    virtual bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const = 0;
+    // Position, normal, uv, tangent and material of a hit recorded by Intersect, r is the
+    // ray that was passed to Intersect
+    virtual void ComputeSurfaceInteraction([[maybe_unused]] const Ray &r, [[maybe_unused]] const SurfaceHit &hit, [[maybe_unused]] Hit_Payload &rec) const {}
+    // Any-hit query over (Epsilon, t_max) for shadow rays: stops at the first blocker and
+    // computes no surface data. Everything blocks, emitters included; shadow rays end just short
+    // of the light they sample instead. The default falls back to Intersect.
+    virtual bool isOccluded(const Ray &r, float t_max) const;
     virtual AABB getBoundingBox() const = 0;
+    // Register the materials used by this object and remember their IDs, called by Scene::Add
+    virtual void BindMaterials([[maybe_unused]] MaterialTable &table) {}
+    // Most PushWrapper calls a hit on this object goes through, checked by Scene::Add
+    virtual int WrapperDepth() const { return 0; }
 };
\ No newline at end of file
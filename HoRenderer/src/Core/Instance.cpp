@@ -0,0 +1,82 @@
+#include "Instance.hpp"
+#include "CompiledScene.hpp"
+#include "Transform.hpp"
+
+BottomLevelBVH::BottomLevelBVH(const std::vector<std::shared_ptr<Hittable>> &objects, const BVHBuildOptions &options)
+{
+    for (const auto &object : objects) {
+        object->BindMaterials(materials);
+        wrapper_depth = std::max(wrapper_depth, object->WrapperDepth());
+    }
+    compiled = std::make_shared<CompiledScene>(objects, materials);
+
+    std::vector<AABB> bounds(compiled->PrimitiveCount());
+    for (uint32_t i = 0; i < bounds.size(); i++)
+        bounds[i] = compiled->PrimitiveBounds(i);
+    auto polygon = [this](uint32_t primitive, Vector3f *vertices) { return compiled->PrimitivePolygon(primitive, vertices); };
+    bvh = LinearBVH(bounds, options, &build_stats, polygon);
+}
+
+size_t BottomLevelBVH::PrimitiveCount() const
+{
+    return compiled->PrimitiveCount();
+}
+
+bool BottomLevelBVH::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
+{
+    return bvh.Intersect(r, t_interval, [&](const uint32_t *leaf, uint32_t count, Vector2f &interval) {
+        return compiled->IntersectLeaf(leaf, count, r, interval, hit);
+    });
+}
+
+bool BottomLevelBVH::isOccluded(const Ray &r, float t_max) const
+{
+    return bvh.Occluded(r, Vector2f(Epsilon, t_max), [&](uint32_t index) {
+        return compiled->OccludedPrimitive(index, r, t_max);
+    });
+}
+
+void BottomLevelBVH::BindMaterials(MaterialTable &table)
+{
+    const auto &local = materials.GetAll();
+    material_map.resize(local.size());
+    for (size_t i = 0; i < local.size(); i++)
+        material_map[i] = table.Add(local[i]);
+}
+
+Instance::Instance(std::shared_ptr<BottomLevelBVH> blas, const Matrix4f &object_to_world) :
+    blas(std::move(blas)), to_world(object_to_world) {
+    to_object = glm::inverse(to_world);
+    bbox = TransformBoundingBox(this->blas->getBoundingBox(), to_world);
+}
+
+Ray Instance::toObjectSpace(const Ray &r) const {
+    return Ray(Vector3f(to_object * Vector4f(r.origin(), 1.0f)), Vector3f(to_object * Vector4f(r.direction(), 0.0f)));
+}
+
+bool Instance::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const {
+    SurfaceHit inner;
+    if (!blas->Intersect(toObjectSpace(r), t_interval, inner))
+        return false;
+
+    hit = inner;
+    hit.PushWrapper(this);
+    return true;
+}
+
+void Instance::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const {
+    SurfaceHit inner = hit.Unwrap();
+    inner.object->ComputeSurfaceInteraction(toObjectSpace(r), inner, rec);
+
+    // Normals go through the inverse transpose, i.e. the transposed linear part of to_object
+    Matrix3f normal_matrix = glm::transpose(Matrix3f(to_object));
+    rec.p = Vector3f(to_world * Vector4f(rec.p, 1.0f));
+    rec.normal = glm::normalize(normal_matrix * rec.normal);
+    if (glm::dot(rec.tangent, rec.tangent) > 0.0f)
+        rec.tangent = glm::normalize(Vector3f(to_world * Vector4f(rec.tangent, 0.0f)));
+    rec.material_id = blas->MapMaterial(rec.material_id);
+}
+
+bool Instance::isOccluded(const Ray &r, float t_max) const {
+    return blas->isOccluded(toObjectSpace(r), t_max);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Util.hpp"
+#include "Hittable.hpp"
+#include "BVH.hpp"
+
+// Bottom level of two-level instancing: a set of objects compiled and wrapped in a BVH once,
+// in their own object space, and shared by any number of Instances. Material IDs inside refer
+// to a table of its own, BindMaterials maps them to the table of the scene the instances live in.
+class BottomLevelBVH {
+public:
+    BottomLevelBVH(const std::vector<std::shared_ptr<Hittable>> &objects, const BVHBuildOptions &options = {});
+
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const;
+    bool isOccluded(const Ray &r, float t_max) const;
+    AABB getBoundingBox() const { return bvh.getBoundingBox(); }
+
+    // Rebuilds the local to scene material mapping, cheap enough to run for every instance added
+    void BindMaterials(MaterialTable &table);
+    MaterialID MapMaterial(MaterialID local_id) const {
+        return local_id < material_map.size() ? material_map[local_id] : InvalidMaterialID;
+    }
+
+    size_t PrimitiveCount() const;
+    int WrapperDepth() const { return wrapper_depth; }
+    const BVHBuildStats &GetBuildStats() const { return build_stats; }
+
+private:
+    MaterialTable materials;
+    std::vector<MaterialID> material_map;
+    std::shared_ptr<CompiledScene> compiled;
+    LinearBVH bvh;
+    BVHBuildStats build_stats;
+    int wrapper_depth = 0;
+};
+
+// Top level of two-level instancing: one placement of a shared BottomLevelBVH. Only the
+// matrices and bounds are stored per instance, so Scene's own BVH over instance bounds acts as
+// the top-level BVH. Rays are moved into object space instead of the geometry into world space.
+class Instance : public Hittable {
+public:
+    Instance(std::shared_ptr<BottomLevelBVH> blas, const Matrix4f &object_to_world);
+
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    bool isOccluded(const Ray &r, float t_max) const override;
+    AABB getBoundingBox() const override { return bbox; }
+    void BindMaterials(MaterialTable &table) override { blas->BindMaterials(table); }
+    int WrapperDepth() const override { return blas->WrapperDepth() + 1; }
+
+    std::shared_ptr<BottomLevelBVH> GetBLAS() const { return blas; }
+    const Matrix4f &GetMatrix() const { return to_world; }
+
+private:
+    // t is the same in both spaces since the direction is transformed without normalizing
+    Ray toObjectSpace(const Ray &r) const;
+
+    std::shared_ptr<BottomLevelBVH> blas;
+    Matrix4f to_world;
+    Matrix4f to_object;
+    AABB bbox;
+};
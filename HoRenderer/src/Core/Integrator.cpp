@@ -3,27 +3,64 @@
 */
 #include "Integrator.hpp"
 #include "Material.hpp"
+#include "WavefrontIntegrator.hpp"
 
+namespace {
+    constexpr int PacketTileWidth = 4; // 4x2 pixels per RayPacket
+    constexpr int PacketTileHeight = RayPacket::Size / PacketTileWidth;
+}
 
 Integrator::~Integrator()
 {
     Clean();
 }
 
+std::unique_ptr<Integrator> Integrator::Create(IntegratorType type, int width, int height, int threads, int bounce)
+{
+    switch (type) {
+        case IntegratorType::PATH:
+            return std::make_unique<Integrator>(width, height, threads, bounce);
+        case IntegratorType::WAVEFRONT:
+            return std::make_unique<WavefrontIntegrator>(width, height, threads, bounce);
+    }
+    return nullptr;
+}
+
+void Integrator::SnapHitPoint(Hit_Payload &rec)
+{
+    if (rec.p.x < 0.0f && std::abs(rec.p.x) < 1e-6f) {
+        rec.p.x = 0.0f;
+    }
+    if (rec.p.y < 0.0f && std::abs(rec.p.y) < 1e-6f) {
+        rec.p.y = 0.0f;
+    }
+    if (rec.p.z < 0.0f && std::abs(rec.p.z) < 1e-6f) {
+        rec.p.z = 0.0f;
+    }
+}
+
 void Integrator::RenderImage(Camera &cam, Scene &world, Sampler &sampler, int sample_index)
 {
+    BeginBounceStats();
+    if (adaptive_sampling) {
+        RenderImageAdaptive(cam, world, sampler, sample_index);
+        EndBounceStats();
+        return;
+    }
+    if (packet_tracing && max_bounce > 0) {
+        RenderImagePackets(cam, world, sampler, sample_index);
+        EndBounceStats();
+        return;
+    }
     sampler.SetCurrentSample(sample_index);
-    omp_set_num_threads(num_threads);
 
-   #pragma omp parallel
-    {
-        Sampler thread_sampler = sampler;
+    std::vector<Sampler> thread_samplers(num_threads, sampler);
+    scheduler.Run(num_threads, [&](const Tile &tile, int thread) {
+        Sampler &thread_sampler = thread_samplers[thread];
         thread_sampler.SetCurrentSample(sample_index);
-        // #pragma omp for schedule(dynamic, 4)
-        #pragma omp for schedule(guided)
-        for (int j = 0; j < height; ++j)
+        for (int j = tile.y0; j < tile.y1; ++j)
         {
-            for (int i = 0; i < width; i++) {
+            for (int i = tile.x0; i < tile.x1; i++) {
                 thread_sampler.SetPixel(i, j);
                 Vector2f offset = thread_sampler.sample_square();
                 Ray r = cam.GenerateRay(i, j, thread_sampler, offset);
@@ -32,6 +69,129 @@ void Integrator::RenderImage(Camera &cam, Scene &world, Sampler &sampler, int sa
                 write_color(i, j, pixel_color);  
             }
         }
+    });
+    EndBounceStats();
+}
+
+void Integrator::RenderImageAdaptive(Camera &cam, Scene &world, Sampler &sampler, int sample_index)
+{
+    if (sample_index == 0 || !adaptive.Matches(width, height))
+        adaptive.Reset(width, height);
+    bool show_counts = output_aov == OutputAOV::SAMPLE_COUNT;
+    float max_count = static_cast<float>(std::max<uint32_t>(adaptive.MaxSampleCount(), 1));
+
+    std::vector<Sampler> thread_samplers(num_threads, sampler);
+    scheduler.Run(num_threads, [&](const Tile &tile, int thread) {
+        Sampler &thread_sampler = thread_samplers[thread];
+        for (int j = tile.y0; j < tile.y1; ++j) {
+            for (int i = tile.x0; i < tile.x1; i++) {
+                size_t pixel = static_cast<size_t>(j) * width + i;
+                int samples = adaptive.SamplesThisFrame(pixel);
+                for (int s = 0; s < samples; s++) {
+                    // Each pixel walks its own sample sequence, however many samples it took so far
+                    thread_sampler.SetCurrentSample(adaptive.SampleCount(pixel));
+                    thread_sampler.SetPixel(i, j);
+                    Vector2f offset = thread_sampler.sample_square();
+                    Ray r = cam.GenerateRay(i, j, thread_sampler, offset);
+                    adaptive.AddSample(pixel, ray_color(r, max_bounce, world, thread_sampler));
+                }
+
+                if (show_counts)
+                    write_heat(i, j, adaptive.SampleCount(pixel) / max_count);
+                else
+                    write_color(i, j, adaptive.Mean(pixel));
+            }
+        }
+    });
+    adaptive.EndFrame();
+}
+
+void Integrator::BeginBounceStats()
+{
+    thread_bounce_counts.resize(std::max(num_threads, 1));
+    for (auto &counts : thread_bounce_counts)
+        counts.assign(std::max(max_bounce, 1), 0);
+}
+
+void Integrator::EndBounceStats()
+{
+    bounce_stats.assign(std::max(max_bounce, 1), 0);
+    for (const auto &counts : thread_bounce_counts)
+        for (size_t depth = 0; depth < counts.size(); depth++)
+            bounce_stats[depth] += counts[depth];
+}
+
+void Integrator::RenderImagePackets(Camera &cam, Scene &world, Sampler &sampler, int sample_index)
+{
+    sampler.SetCurrentSample(sample_index);
+
+    // One sampler per lane: each pixel draws the same sample stream as in the scalar loop
+    std::vector<Sampler> lane_samplers(static_cast<size_t>(num_threads) * RayPacket::Size, sampler);
+    for (Sampler &lane_sampler : lane_samplers)
+        lane_sampler.SetCurrentSample(sample_index);
+
+    scheduler.Run(num_threads, [&](const Tile &tile, int thread) {
+        RenderTilePackets(tile, cam, world, &lane_samplers[static_cast<size_t>(thread) * RayPacket::Size]);
+    });
+}
+
+void Integrator::RenderTilePackets(const Tile &tile, const Camera &cam, const Scene &world, Sampler *lane_samplers)
+{
+    for (int y = tile.y0; y < tile.y1; y += PacketTileHeight) {
+        for (int x = tile.x0; x < tile.x1; x += PacketTileWidth) {
+            int lane_x[RayPacket::Size], lane_y[RayPacket::Size];
+            RayPacket primary;
+            for (int lane = 0; lane < RayPacket::Size; lane++) {
+                lane_x[lane] = x + lane % PacketTileWidth;
+                lane_y[lane] = y + lane / PacketTileWidth;
+                if (lane_x[lane] >= tile.x1 || lane_y[lane] >= tile.y1)
+                    continue;
+                Sampler &lane_sampler = lane_samplers[lane];
+                lane_sampler.SetPixel(lane_x[lane], lane_y[lane]);
+                Vector2f offset = lane_sampler.sample_square();
+                primary.Set(lane, cam.GenerateRay(lane_x[lane], lane_y[lane], lane_sampler, offset), Vector2f(0.0f, Infinity));
+            }
+            CountPaths(0, std::popcount(static_cast<unsigned>(primary.active)));
+
+            Hit_Payload rec[RayPacket::Size];
+            int hits = world.IntersectPacket(primary, rec);
+
+            // The shadow rays of the primary hits leave as one packet too
+            RayPacket shadow;
+            Vector3f radiance[RayPacket::Size], unshadowed[RayPacket::Size];
+            for (int lane = 0; lane < RayPacket::Size; lane++) {
+                if (!((primary.active >> lane) & 1))
+                    continue;
+                if (!((hits >> lane) & 1)) {
+                    radiance[lane] = BackgroundRadiance;
+                    continue;
+                }
+                SnapHitPoint(rec[lane]);
+                const Material *mat = world.GetMaterial(rec[lane].material_id);
+                radiance[lane] = mat->Emit(primary.rays[lane], rec[lane], rec[lane].uv.x, rec[lane].uv.y);
+
+                Ray shadow_ray;
+                float shadow_distance;
+                if (SamplesDirectLighting(rec[lane], world) &&
+                    SampleDirectLight(primary.rays[lane], rec[lane], world, lane_samplers[lane], shadow_ray, shadow_distance, unshadowed[lane]))
+                    shadow.Set(lane, shadow_ray, Vector2f(Epsilon, shadow_distance));
+            }
+            int occluded = world.OccludedPacket(shadow);
+
+            // Each lane goes on alone from here, secondary bounces are too incoherent for packets
+            for (int lane = 0; lane < RayPacket::Size; lane++) {
+                if (!((primary.active >> lane) & 1))
+                    continue;
+                if ((hits >> lane) & 1) {
+                    const Ray &r = primary.rays[lane];
+                    Sampler &lane_sampler = lane_samplers[lane];
+                    if (((shadow.active & ~occluded) >> lane) & 1)
+                        radiance[lane] += unshadowed[lane];
+                    radiance[lane] += ScatterRadiance(r, rec[lane], max_bounce, world, lane_sampler);
+                }
+                write_color(lane_x[lane], lane_y[lane], radiance[lane]);
+            }
+        }
     }
 }
 
@@ -54,121 +214,177 @@ Vector3f Integrator::ray_color(const Ray &r, int bounce, const Scene &world, Sam
     if (bounce <= 0)
         return Vector3f(0, 0, 0);
 
+    CountPaths(max_bounce - bounce);
     Hit_Payload rec;
     if (!world.isHit(r, Vector2f(0.0f, Infinity), rec)) {
-        return Vector3f(0.05f, 0.05f, 0.05f); 
+        return BackgroundRadiance; 
     }
+    SnapHitPoint(rec);
 
-    if (rec.p.x < 0.0f && std::abs(rec.p.x) < 1e-6f) {
-        rec.p.x = 0.0f;
-    }
-    if (rec.p.y < 0.0f && std::abs(rec.p.y) < 1e-6f) {
-        rec.p.y = 0.0f;
-    }
-    if (rec.p.z < 0.0f && std::abs(rec.p.z) < 1e-6f) {
-        rec.p.z = 0.0f;
-    }
+    const Material *mat = world.GetMaterial(rec.material_id);
 
     // emission
-    Vector3f total_radiance = rec.mat->Emit(r, rec, rec.uv.x, rec.uv.y);
+    Vector3f total_radiance = mat->Emit(r, rec, rec.uv.x, rec.uv.y);
 
     // light sampling
     Vector3f direct_lighting = EstimateDirectLighting(r, rec, world, sampler);
     total_radiance += direct_lighting;
 
-    // BRDF sampling
-    Vector3f scatter_direction;
-    float pdf;
-    Vector3f brdf = rec.mat->Sample(r, rec, scatter_direction, pdf, sampler);
-    if (pdf > Epsilon && bounce > 1) {
-        Vector3f surface_normal = rec.normal;
+    // BRDF sampling, both for the emitters and for the rest of the path
+    total_radiance += ScatterRadiance(r, rec, bounce, world, sampler);
+
+    return total_radiance;
+}
 
-        Ray scattered = Ray::SpawnRay(rec.p, scatter_direction, surface_normal);
+Vector3f Integrator::ScatterRadiance(const Ray &r, const Hit_Payload &rec, int bounce, const Scene &world, Sampler &sampler)
+{
+    Vector3f radiance(0.0f);
+    Vector3f throughput(1.0f);
+    Ray ray = r;
+    Hit_Payload vertex = rec;
+
+    while (true) {
+        Ray scattered;
         Vector3f attenuation;
-        if (rec.mat->IsDelta()) {
-            attenuation = brdf;
-        } else if (rec.mat->IsVolumetric()) {
-            attenuation = brdf / pdf;
-        } else {
-            float cos_theta = std::abs(glm::dot(rec.normal, glm::normalize(scatter_direction)));
-            attenuation = brdf * cos_theta / pdf;
+        float pdf;
+        if (!SampleScatter(ray, vertex, world, sampler, scattered, attenuation, pdf))
+            break;
+        // The last vertex still needs its BSDF sample of the lights, but nothing further
+        bool light_sampled = SamplesDirectLighting(vertex, world);
+        bool last = bounce <= 1;
+        if (last && !light_sampled)
+            break;
+        throughput *= attenuation;
+        bounce--;
+        int depth = max_bounce - bounce;
+        if (!SurvivesRoulette(depth, throughput, sampler))
+            break;
+
+        ray = scattered;
+        if (!last)
+            CountPaths(depth);
+        if (!world.isHit(ray, Vector2f(0.0f, Infinity), vertex)) {
+            if (!last)
+                radiance += throughput * BackgroundRadiance;
+            break;
         }
-        total_radiance += attenuation * ray_color(scattered, bounce-1, world, sampler);
+        SnapHitPoint(vertex);
+
+        radiance += throughput * EmittedRadiance(ray, vertex, world, light_sampled, pdf);
+        if (last)
+            break;
+        radiance += throughput * EstimateDirectLighting(ray, vertex, world, sampler);
     }
 
-    return total_radiance;
+    return radiance;
+}
+
+bool Integrator::SurvivesRoulette(int depth, Vector3f &throughput, Sampler &sampler) const
+{
+    if (depth < roulette_depth)
+        return true;
+    float luminance = glm::dot(throughput, Vector3f(0.2126f, 0.7152f, 0.0722f));
+    if (luminance >= 1.0f)
+        return true;
+    if (sampler.random_float() >= luminance)
+        return false;
+    throughput /= luminance;
+    return true;
+}
+
+void Integrator::write_heat(int u, int v, float t)
+{
+    int offset = v * width * 4 + u * 4;
+    t = std::clamp(t, 0.0f, 1.0f);
+    Vector3f heat = glm::mix(Vector3f(0.0f, 0.0f, 1.0f), Vector3f(1.0f, 0.0f, 0.0f), t);
+    _mm_store_ps(float_pixels.get() + offset, _mm_set_ps(1.0f, heat.b, heat.g, heat.r));
+}
+
+bool Integrator::SampleScatter(const Ray &r, const Hit_Payload &rec, const Scene &world, Sampler &sampler,
+                               Ray &scattered, Vector3f &attenuation, float &pdf)
+{
+    const Material *mat = world.GetMaterial(rec.material_id);
+    Vector3f scatter_direction;
+    Vector3f brdf = mat->Sample(r, rec, scatter_direction, pdf, sampler);
+    if (pdf <= Epsilon)
+        return false;
+
+    Vector3f surface_normal = rec.normal;
+    scattered = Ray::SpawnRay(rec.p, scatter_direction, surface_normal);
+    if (mat->IsDelta()) {
+        attenuation = brdf;
+    } else if (mat->IsVolumetric()) {
+        attenuation = brdf / pdf;
+    } else {
+        float cos_theta = std::abs(glm::dot(rec.normal, glm::normalize(scatter_direction)));
+        attenuation = brdf * cos_theta / pdf;
+    }
+    return true;
+}
+
+bool Integrator::SamplesDirectLighting(const Hit_Payload &rec, const Scene &world) const
+{
+    const Material *mat = world.GetMaterial(rec.material_id);
+    return !mat->IsDelta() && !mat->IsVolumetric() && !world.GetLights().empty();
 }
 
 Vector3f Integrator::EstimateDirectLighting(const Ray &r_in, const Hit_Payload &rec, const Scene &world, Sampler &sampler)
 {
     Vector3f direct_lighting(0.0f);
-    if (rec.mat->IsDelta() || rec.mat->IsVolumetric()) {
+    if (!SamplesDirectLighting(rec, world)) {
         return direct_lighting;
     }
-    
-    const auto& lights = world.GetLights();
-    if (lights.empty()) {
-        return direct_lighting;
+
+    Ray shadow_ray;
+    float shadow_distance;
+    Vector3f light_contribution;
+    if (SampleDirectLight(r_in, rec, world, sampler, shadow_ray, shadow_distance, light_contribution) &&
+        !world.isOccluded(shadow_ray, shadow_distance)) {
+        direct_lighting += light_contribution;
     }
 
-    Vector3f V = -glm::normalize(r_in.direction());
+    return direct_lighting;
+}
 
-    // light sampling
+bool Integrator::SampleDirectLight(const Ray &r_in, const Hit_Payload &rec, const Scene &world, Sampler &sampler,
+                                   Ray &shadow_ray, float &shadow_distance, Vector3f &contribution)
+{
+    const Material *mat = world.GetMaterial(rec.material_id);
     Vector3f light_direction;
     float light_pdf;
-    Vector3f light_radiance = world.SampleLightEnvironment(r_in, rec, light_direction, light_pdf, sampler);
-    
-    if (light_pdf > Epsilon) {
-        Ray shadow_ray = Ray::SpawnRay(rec.p, light_direction, rec.normal);
-        Hit_Payload shadow_rec;
-        bool in_shadow = false;
-        
-        if (world.isHit(shadow_ray, Vector2f(Epsilon, Infinity), shadow_rec)) {
-            if (!shadow_rec.mat || !shadow_rec.mat->IsEmit()) {
-                in_shadow = true;
-            }
-        }
-
-        if (!in_shadow) {
-            float brdf_pdf;
-            Vector3f brdf = rec.mat->Evaluate(r_in, rec, light_direction, brdf_pdf);
-            
-            if (brdf_pdf > Epsilon) {
-                float cos_theta = std::abs(glm::dot(rec.normal, light_direction));
-                float mis_weight = PowerHeuristic(light_pdf, brdf_pdf);
-                direct_lighting += mis_weight * brdf * cos_theta * light_radiance / light_pdf;
-            }
-        }
+    Vector3f light_radiance = world.SampleLightEnvironment(r_in, rec, light_direction, shadow_distance, light_pdf, sampler);
+    if (light_pdf <= Epsilon)
+        return false;
+    if (std::isfinite(shadow_distance)) {
+        Vector3f light_point = rec.p + shadow_distance * light_direction;
+        float magnitude = std::max({std::abs(light_point.x), std::abs(light_point.y), std::abs(light_point.z)});
+        shadow_distance = std::max(shadow_distance - (ShadowEpsilon + ShadowEpsilonRelative * magnitude), 0.0f);
     }
 
-    // BRDF sampling
-    Vector3f scatter_direction;
+    // The BRDF is evaluated before the shadow test so that packets can trace all their shadow rays at once
     float brdf_pdf;
-    Vector3f brdf = rec.mat->Sample(r_in, rec, scatter_direction, brdf_pdf, sampler);
-    
-    if (brdf_pdf > Epsilon && glm::dot(rec.normal, scatter_direction) > 0.0f) {
-        Vector3f surface_normal = rec.normal;
-        if (glm::dot(scatter_direction, rec.normal) < 0.0f) 
-            surface_normal = -rec.normal;
-
-        Ray light_ray = Ray::SpawnRay(rec.p, scatter_direction, surface_normal);
-        Hit_Payload light_rec;
-        
-        if (world.isHit(light_ray, Vector2f(Epsilon, Infinity), light_rec)) {
-            if (light_rec.mat && light_rec.mat->IsEmit()) {
-                float light_eval_pdf;
-                Vector3f light_emission = world.EvaluateLight(light_ray, light_rec, light_eval_pdf);
-                
-                if (light_eval_pdf > Epsilon) {
-                    float cos_theta = glm::dot(rec.normal, scatter_direction);
-                    float mis_weight = PowerHeuristic(brdf_pdf, light_eval_pdf);
-                    direct_lighting += mis_weight * brdf * cos_theta * light_emission / brdf_pdf;
-                }
-            }
-        }
-    }
+    Vector3f brdf = mat->Evaluate(r_in, rec, light_direction, brdf_pdf);
+    if (brdf_pdf <= Epsilon)
+        return false;
 
-    return direct_lighting;
+    float cos_theta = std::abs(glm::dot(rec.normal, light_direction));
+    float mis_weight = PowerHeuristic(light_pdf, brdf_pdf);
+    contribution = mis_weight * brdf * cos_theta * light_radiance / light_pdf;
+    shadow_ray = Ray::SpawnRay(rec.p, light_direction, rec.normal);
+    return true;
+}
+
+Vector3f Integrator::EmittedRadiance(const Ray &r, const Hit_Payload &rec, const Scene &world, bool light_sampled, float scatter_pdf)
+{
+    const Material *mat = world.GetMaterial(rec.material_id);
+    if (light_sampled && mat->IsEmit()) {
+        // Emitters the light sample can reach share the estimate with it, the rest keep all of it
+        float light_pdf;
+        Vector3f light_emission = world.EvaluateLight(r, rec, light_pdf);
+        if (light_pdf > 0.0f)
+            return PowerHeuristic(scatter_pdf, light_pdf) * light_emission;
+    }
+    return mat->Emit(r, rec, rec.uv.x, rec.uv.y);
 }
 
 float Integrator::PowerHeuristic(float pdf1, float pdf2, int beta)
@@ -180,7 +396,7 @@ float Integrator::PowerHeuristic(float pdf1, float pdf2, int beta)
 
 void Integrator::SetNumThreads(int threads)
 {
-    num_threads = threads;
+    num_threads = threads > 0 ? threads : ThreadPool::Global().Size();
 }
 
 int Integrator::GetNumThreads() const
@@ -7,33 +7,154 @@
 #include "Ray.hpp"
 #include "Scene.hpp"
 #include "Camera.hpp"
+#include "TileScheduler.hpp"
+#include "AdaptiveSampling.hpp"
 
 
+enum class IntegratorType {
+    PATH,     // one ray_color path per pixel
+    WAVEFRONT // batched stages over queues of paths, see WavefrontIntegrator
+};
+
+// What RenderImage writes to the float pixels
+enum class OutputAOV {
+    COLOR,
+    SAMPLE_COUNT // samples per pixel so far, blue (fewest) to red (most); adaptive sampling only
+};
+
 class Integrator{
 public:
-    Integrator(int width, int height, int threads = 16, int bounce = 10) :
+    // threads: 0 for every thread of the engine's ThreadPool
+    Integrator(int width, int height, int threads = 0, int bounce = 10) :
         width(width), height(height),
         float_pixels(std::make_unique<float[]>(width * height * 4)),
-        num_threads(threads), max_bounce(bounce) {
+        num_threads(threads > 0 ? threads : ThreadPool::Global().Size()), max_bounce(bounce), scheduler(width, height) {
         std::fill(float_pixels.get(), float_pixels.get() + width * height * 4, 0.0f);
     }
-    ~Integrator();
+    virtual ~Integrator();
+
+    static std::unique_ptr<Integrator> Create(IntegratorType type, int width, int height, int threads = 0, int bounce = 10);
 
-    void RenderImage(Camera &cam, Scene &world, Sampler &sampler, int sample_index);
+    // One sample per pixel, tile by tile through the TileScheduler
+    virtual void RenderImage(Camera &cam, Scene &world, Sampler &sampler, int sample_index);
     void write_color(int u, int v, const Vector3f &color);
+    // Heat map pixel for the SAMPLE_COUNT AOV, t in [0, 1]
+    void write_heat(int u, int v, float t);
     Vector3f ray_color(const Ray &r, int bounce, const Scene &world, Sampler &sampler);
+    /*
+    * @brief: Light-sampling estimate of the direct lighting at rec, shadow ray included. The BSDF
+    *         half of the MIS pair is the path's own continuation ray, see ScatterRadiance.
+    */
     Vector3f EstimateDirectLighting(const Ray &r_in, const Hit_Payload &rec, const Scene &world, Sampler &sampler);
+    /*
+    * @brief: EstimateDirectLighting up to the shadow ray. Only for hits where SamplesDirectLighting holds.
+    *
+    * @args: shadow_ray, shadow_distance: the query to pass to Scene::isOccluded. It ends short of the
+    *        sampled light point by an absolute ShadowEpsilon plus ShadowEpsilonRelative times the
+    *        point's largest coordinate, so the light surface is not hit at any scale while
+    *        occluders close to it still are. Excluding the light's primitive in isOccluded
+    *        would need the primitive ID on every occlusion path, which the margin avoids
+    *        contribution: MIS-weighted radiance to add when the shadow ray is not blocked
+    * @ret: false when there is no shadow ray to trace
+    */
+    bool SampleDirectLight(const Ray &r_in, const Hit_Payload &rec, const Scene &world, Sampler &sampler,
+                           Ray &shadow_ray, float &shadow_distance, Vector3f &contribution);
+    // Whether EstimateDirectLighting does anything at this hit: not for delta or volumetric materials
+    // and not without lights
+    bool SamplesDirectLighting(const Hit_Payload &rec, const Scene &world) const;
+    /*
+    * @brief: Emission seen at rec by a ray BSDF-sampled at the previous vertex.
+    *
+    * @args: light_sampled: SamplesDirectLighting held at the previous vertex, so emitters that are
+    *        lights get the MIS weight of scatter_pdf against the light sample's pdf
+    *        scatter_pdf: pdf of the BSDF sample that produced r
+    */
+    Vector3f EmittedRadiance(const Ray &r, const Hit_Payload &rec, const Scene &world, bool light_sampled, float scatter_pdf);
+    /*
+    * @brief: The path continued from a shaded hit, the loop behind ray_color. Every vertex traces a
+    *         single BSDF-sampled ray: it picks up the MIS-weighted emission it finds and carries the
+    *         path on from there, with the throughput-weighted emission and direct lighting of each
+    *         later vertex, until the path leaves the scene, runs out of bounces or loses the Russian
+    *         roulette. Past the last bounce the ray only looks for emitters.
+    *
+    * @args: rec: a hit whose emission and direct lighting the caller has added already
+    *        bounce: bounces left at rec, as passed to ray_color for the ray that found it
+    * @ret: radiance reaching rec from its later vertices
+    */
+    Vector3f ScatterRadiance(const Ray &r, const Hit_Payload &rec, int bounce, const Scene &world, Sampler &sampler);
+    /*
+    * @brief: Sampling step of ScatterRadiance: the next ray of the path and its throughput weight.
+    *
+    * @args: pdf: of the sampled direction, for EmittedRadiance
+    * @ret: false when the material absorbs the path
+    */
+    bool SampleScatter(const Ray &r, const Hit_Payload &rec, const Scene &world, Sampler &sampler,
+                       Ray &scattered, Vector3f &attenuation, float &pdf);
+    /*
+    * @brief: Russian roulette before tracing vertex `depth` (the camera hit is depth 0). From the
+    *         minimum depth on a path survives with probability min(1, luminance(throughput)) and
+    *         the survivors' throughput is divided by it, which keeps the estimate unbiased.
+    *
+    * @ret: false when the path ends here
+    */
+    bool SurvivesRoulette(int depth, Vector3f &throughput, Sampler &sampler) const;
     float PowerHeuristic(float pdf1, float pdf2, int beta = 2);
     
     void SetNumThreads(int threads);
     int GetNumThreads() const;
+    // Trace primary rays and their shadow rays as 4x2 pixel packets (see RayPacket), later bounces
+    // stay scalar. The image is the same either way, on by default
+    void SetPacketTracing(bool enabled) { packet_tracing = enabled; }
+    bool GetPacketTracing() const { return packet_tracing; }
+    // First depth where Russian roulette may end a path, max_bounce or more turns it off
+    void SetRouletteDepth(int depth) { roulette_depth = depth; }
+    int GetRouletteDepth() const { return roulette_depth; }
+    // Paths that reached each depth during the last RenderImage, [0] counts the camera rays
+    const std::vector<uint64_t> &GetBounceStats() const { return bounce_stats; }
+    // Tile size, order, progress callback and cancellation of RenderImage
+    TileScheduler &GetTileScheduler() { return scheduler; }
+    /*
+    * @brief: Accumulate the samples of every pixel in the integrator and spend them where the
+    *         estimate is still noisy, see AdaptiveSampling. RenderImage then writes the running mean
+    *         instead of the frame's sample and starts over when sample_index is 0. Off by default:
+    *         one sample per pixel and frame, averaged by the caller.
+    */
+    void SetAdaptiveSampling(bool enabled) { adaptive_sampling = enabled; }
+    bool UsesAdaptiveSampling() const { return adaptive_sampling; }
+    AdaptiveSampling &GetAdaptiveSampling() { return adaptive; }
+    void SetOutputAOV(OutputAOV aov) { output_aov = aov; }
 
     const float* GetFloatPixels() const;
     void Clean();
 
+protected:
+    // Radiance of rays that leave the scene
+    static inline const Vector3f BackgroundRadiance = Vector3f(0.05f, 0.05f, 0.05f);
+    // Hits a hair below zero are snapped to zero
+    static void SnapHitPoint(Hit_Payload &rec);
+    // Per-thread path counters behind GetBounceStats: cleared by BeginBounceStats, summed by EndBounceStats
+    void BeginBounceStats();
+    void CountPaths(int depth, uint64_t count = 1) { thread_bounce_counts[ThreadPool::ThreadIndex()][depth] += count; }
+    void EndBounceStats();
+
 private:
+    // RenderImage with adaptive sampling, scalar paths only
+    void RenderImageAdaptive(Camera &cam, Scene &world, Sampler &sampler, int sample_index);
+    // RenderImage with packet tracing, each scheduler tile in packets of 4x2 pixels
+    void RenderImagePackets(Camera &cam, Scene &world, Sampler &sampler, int sample_index);
+    void RenderTilePackets(const Tile &tile, const Camera &cam, const Scene &world, Sampler *lane_samplers);
+
+protected:
     int width, height;
     std::unique_ptr<float[]> float_pixels;
     int num_threads;
     int max_bounce;
+    bool packet_tracing = true;
+    int roulette_depth = 3;
+    std::vector<uint64_t> bounce_stats;
+    std::vector<std::vector<uint64_t>> thread_bounce_counts;
+    TileScheduler scheduler;
+    bool adaptive_sampling = false;
+    AdaptiveSampling adaptive;
+    OutputAOV output_aov = OutputAOV::COLOR;
 };
\ No newline at end of file
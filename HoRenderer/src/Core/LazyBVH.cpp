@@ -0,0 +1,111 @@
+#include "LazyBVH.hpp"
+#include "ThreadPool.hpp"
+
+LazyBVH::LazyBVH(std::vector<AABB> primitive_bounds, const BVHBuildOptions &options, BVHBuildStats *stats,
+                 PrimitivePolygonFn polygon) :
+    primitive_bounds(std::move(primitive_bounds)), polygon(std::move(polygon)), options(options) {
+    const std::vector<AABB> &bounds = this->primitive_bounds;
+    if (bounds.empty())
+        return;
+
+    std::vector<Vector3f> centroids(bounds.size());
+    primitive_indices.resize(bounds.size());
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < static_cast<int64_t>(bounds.size()); i++) {
+        centroids[i] = bounds[i].centroid();
+        primitive_indices[i] = static_cast<uint32_t>(i);
+    }
+
+    #pragma omp parallel
+    #pragma omp single
+    Partition(centroids, 0, static_cast<uint32_t>(primitive_indices.size()));
+    AddClusters(0, static_cast<uint32_t>(primitive_indices.size()));
+
+    std::vector<AABB> cluster_bounds(clusters.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t c = 0; c < static_cast<int64_t>(clusters.size()); c++) {
+        Cluster &cluster = clusters[c];
+        AABB box = bounds[primitive_indices[cluster.first]];
+        for (uint32_t i = 1; i < cluster.count; i++)
+            box = calculateSurroundingBox(box, bounds[primitive_indices[cluster.first + i]]);
+        cluster.bounds = cluster_bounds[c] = box;
+    }
+
+    // One cluster per leaf, and no spatial splits: a cluster referenced twice would be tested twice
+    BVHBuildOptions top_options = options;
+    top_options.max_prims_in_node = 1;
+    if (top_options.quality == BVHBuildQuality::SBVH)
+        top_options.quality = BVHBuildQuality::HIGH;
+    top = LinearBVH(cluster_bounds, top_options, stats);
+}
+
+void LazyBVH::Partition(const std::vector<Vector3f> &centroids, uint32_t begin, uint32_t end) {
+    if (end - begin <= options.lazy_cluster_size)
+        return;
+
+    AABB centroid_bounds(centroids[primitive_indices[begin]], centroids[primitive_indices[begin]]);
+    for (uint32_t i = begin + 1; i < end; i++) {
+        const Vector3f &c = centroids[primitive_indices[i]];
+        centroid_bounds = calculateSurroundingBox(centroid_bounds, AABB(c, c));
+    }
+    Vector3f extent = centroid_bounds.max() - centroid_bounds.min();
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+    // The midpoint split keeps the cluster ranges a function of the count alone, see AddClusters
+    uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(primitive_indices.begin() + begin, primitive_indices.begin() + mid, primitive_indices.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    #pragma omp task if (end - begin > options.parallel_threshold)
+    Partition(centroids, begin, mid);
+    Partition(centroids, mid, end);
+    #pragma omp taskwait
+}
+
+void LazyBVH::AddClusters(uint32_t begin, uint32_t end) {
+    if (end - begin <= options.lazy_cluster_size) {
+        Cluster &cluster = clusters.emplace_back();
+        cluster.first = begin;
+        cluster.count = end - begin;
+        return;
+    }
+    uint32_t mid = begin + (end - begin) / 2;
+    AddClusters(begin, mid);
+    AddClusters(mid, end);
+}
+
+const LinearBVH &LazyBVH::Expand(uint32_t index) const {
+    Cluster &cluster = clusters[index];
+    std::call_once(cluster.once, [&]() {
+        std::vector<AABB> bounds(cluster.count);
+        for (uint32_t i = 0; i < cluster.count; i++)
+            bounds[i] = primitive_bounds[primitive_indices[cluster.first + i]];
+        PrimitivePolygonFn local_polygon;
+        if (polygon) {
+            local_polygon = [this, first = cluster.first](uint32_t local, Vector3f *vertices) {
+                return polygon(primitive_indices[first + local], vertices);
+            };
+        }
+        // Clusters are built by the render threads during the first frame, file I/O would only stall them
+        BVHBuildOptions cluster_options = options;
+        cluster_options.scene_cache = false;
+        cluster.bvh = LinearBVH(bounds, cluster_options, nullptr, local_polygon);
+        cluster.built.store(true, std::memory_order_release);
+        built_count.fetch_add(1, std::memory_order_relaxed);
+    });
+    return cluster.bvh;
+}
+
+void LazyBVH::BuildAll() {
+    // On the pool, so the cluster builds' own OpenMP regions stay serial on every thread
+    ThreadPool::Global().ParallelFor(clusters.size(), 1, [this](size_t c) { Expand(static_cast<uint32_t>(c)); });
+}
+
+size_t LazyBVH::MemoryBytes() const {
+    size_t bytes = top.MemoryBytes() + primitive_indices.size() * sizeof(uint32_t) + primitive_bounds.size() * sizeof(AABB);
+    for (const Cluster &cluster : clusters) {
+        if (cluster.built.load(std::memory_order_acquire))
+            bytes += cluster.bvh.MemoryBytes();
+    }
+    return bytes;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Util.hpp"
+#include "BVH.hpp"
+#include <deque>
+#include <mutex>
+
+// BVH whose subtrees are built the first time a ray reaches them. The constructor only cuts the
+// primitives at centroid medians into clusters of BVHBuildOptions::lazy_leaf_primitives and builds
+// a LinearBVH over the cluster bounds; every cluster becomes a LinearBVH of its own on first use,
+// exactly once even when several threads reach it together. Huge scenes get their first frame
+// after a few passes over the bounds, and pay for the subtrees the camera sees as it sees them.
+class LazyBVH {
+public:
+    // polygon follows the global primitive numbering, see PrimitivePolygonFn. stats describe the top levels
+    LazyBVH(std::vector<AABB> primitive_bounds, const BVHBuildOptions &options = {}, BVHBuildStats *stats = nullptr,
+            PrimitivePolygonFn polygon = nullptr);
+
+    // Same contract as LinearBVH::Intersect, builds the clusters the ray reaches
+    template <typename IntersectFn>
+    bool Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats = nullptr) const;
+
+    // Same contract as LinearBVH::Occluded
+    template <typename OccludedFn>
+    bool Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const;
+
+    // Builds every cluster that is still pending, in parallel
+    void BuildAll();
+
+    AABB getBoundingBox() const { return top.getBoundingBox(); }
+    size_t ClusterCount() const { return clusters.size(); }
+    size_t BuiltCount() const { return built_count.load(std::memory_order_relaxed); }
+    // Top levels plus the clusters built so far
+    size_t MemoryBytes() const;
+
+private:
+    struct Cluster {
+        uint32_t first = 0; // range of primitive_indices, cluster-local primitive i is primitive_indices[first + i]
+        uint32_t count = 0;
+        AABB bounds;
+        std::once_flag once;
+        std::atomic<bool> built = false;
+        LinearBVH bvh;
+    };
+
+    // Median splits of primitive_indices[begin, end) on the widest centroid axis, down to cluster size
+    void Partition(const std::vector<Vector3f> &centroids, uint32_t begin, uint32_t end);
+    // Appends the clusters Partition left behind, in primitive_indices order
+    void AddClusters(uint32_t begin, uint32_t end);
+    // The cluster's tree, built by the first caller
+    const LinearBVH &Expand(uint32_t cluster) const;
+
+private:
+    LinearBVH top; // leaves hold cluster indices
+    mutable std::deque<Cluster> clusters; // deque: once_flag cannot move
+    std::vector<uint32_t> primitive_indices;
+    std::vector<AABB> primitive_bounds;
+    PrimitivePolygonFn polygon;
+    BVHBuildOptions options;
+    mutable std::atomic<size_t> built_count = 0;
+};
+
+template <typename IntersectFn>
+bool LazyBVH::Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats) const
+{
+    return top.Intersect(r, t_interval, [&](uint32_t cluster, Vector2f &interval) {
+        const LinearBVH &bvh = Expand(cluster);
+        uint32_t first = clusters[cluster].first;
+        bool hit = bvh.Intersect(r, interval, [&](uint32_t local, Vector2f &local_interval) {
+            if (!intersect(primitive_indices[first + local], local_interval))
+                return false;
+            interval.y = local_interval.y;
+            return true;
+        }, stats);
+        // The ray was already counted by the top level
+        if (stats)
+            stats->rays--;
+        return hit;
+    }, stats);
+}
+
+template <typename OccludedFn>
+bool LazyBVH::Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const
+{
+    return top.Occluded(r, t_interval, [&](uint32_t cluster) {
+        const LinearBVH &bvh = Expand(cluster);
+        uint32_t first = clusters[cluster].first;
+        return bvh.Occluded(r, t_interval, [&](uint32_t local) { return occluded(primitive_indices[first + local]); });
+    });
+}
@@ -6,7 +6,7 @@
 #include "Material.hpp"
 
 
-Vector3f QuadAreaLight::Sample(const Ray &r_in, const Hit_Payload &rec, Vector3f &light_direction, float &pdf, Sampler &sampler) const
+Vector3f QuadAreaLight::Sample(const Ray &r_in, const Hit_Payload &rec, Vector3f &light_direction, float &light_distance, float &pdf, Sampler &sampler) const
 {
     Vector2f uv = sampler.get_2d_sample();
     Vector3f light_point = quad->get_Q() + uv.x * quad->get_u() + uv.y * quad->get_v();
@@ -18,6 +18,7 @@ Vector3f QuadAreaLight::Sample(const Ray &r_in, const Hit_Payload &rec, Vector3f
     }
     float distance = std::sqrt(distance_sq);
     light_direction = surface_to_light / distance;
+    light_distance = distance;
 
     Vector3f light_normal = glm::normalize(glm::cross(quad->get_u(), quad->get_v()));
     float cos_theta = glm::dot(-light_direction, light_normal);
@@ -56,4 +57,12 @@ float QuadAreaLight::GetPower() const
 std::shared_ptr<Hittable> QuadAreaLight::GetShape() const
 {
     return quad;
+}
+
+std::shared_ptr<Light> QuadAreaLight::Rebind(const std::shared_ptr<Hittable> &shape) const
+{
+    auto new_quad = std::dynamic_pointer_cast<Quad>(shape);
+    if (!new_quad)
+        return nullptr;
+    return std::make_shared<QuadAreaLight>(new_quad);
 }
\ No newline at end of file
@@ -7,16 +7,19 @@
 #include "Shape.hpp"
 // 1. Sample function: based on shading point information,
 // sample light source direction and calculate expected radiance
+// (light_distance bounds the shadow ray, Infinity for lights at infinity)
 // 2. Evaluate function: based on light source intersection information,
 // calculate actual radiance (avoid repeated intersection detection)
 class Light {
 public:
     virtual ~Light() = default;
 
-    virtual Vector3f Sample(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& pdf, Sampler& sampler) const = 0;
+    virtual Vector3f Sample(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& light_distance, float& pdf, Sampler& sampler) const = 0;
     virtual Vector3f Evaluate(const Ray& r_in, const Hit_Payload& rec, float& pdf) const = 0;
     virtual float GetPower() const = 0;
     virtual std::shared_ptr<Hittable> GetShape() const = 0;
+    // The same light on another shape, for Scene::UpdateObject. Null when it cannot emit from that shape
+    virtual std::shared_ptr<Light> Rebind(const std::shared_ptr<Hittable> &) const { return nullptr; }
 };
 
 class QuadAreaLight : public Light {
@@ -26,10 +29,11 @@ public:
         area = glm::length(glm::cross(quad->get_u(), quad->get_v()));
     }
 
-    virtual Vector3f Sample(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& pdf, Sampler& sampler) const override;
+    virtual Vector3f Sample(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& light_distance, float& pdf, Sampler& sampler) const override;
     virtual Vector3f Evaluate(const Ray& r_in, const Hit_Payload& rec, float& pdf) const override;
     virtual float GetPower() const override;
     virtual std::shared_ptr<Hittable> GetShape() const override;
+    virtual std::shared_ptr<Light> Rebind(const std::shared_ptr<Hittable> &shape) const override;
 
 private:
     std::shared_ptr<Quad> quad;
@@ -40,7 +44,7 @@ class SphereAreaLight : public Light {
 public:
     SphereAreaLight(std::shared_ptr<Sphere> sphere, const Vector3f &color, float intensity = 1.0f);
 
-    virtual Vector3f Sample(const Ray &r_in, const Hit_Payload &rec, Vector3f &light_direction, float &pdf, Sampler &sampler) const override;
+    virtual Vector3f Sample(const Ray &r_in, const Hit_Payload &rec, Vector3f &light_direction, float &light_distance, float &pdf, Sampler &sampler) const override;
     virtual Vector3f Evaluate(const Ray &r_in, const Hit_Payload &rec, float &pdf) const override;
 
 private:
@@ -58,7 +62,7 @@ class InfiniteAreaLight : public Light {
 public:
     InfiniteAreaLight(std::shared_ptr<HDRTexture> hdr, float scale = 1.0f);
 
-    virtual Vector3f Sample(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& pdf, Sampler& sampler) const override;
+    virtual Vector3f Sample(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& light_distance, float& pdf, Sampler& sampler) const override;
     virtual Vector3f Evaluate(const Ray& r_in, const Hit_Payload& rec, float& pdf) const override;
 
 private:
@@ -17,7 +17,7 @@ Vector3f Material::GetSurfaceNormal(const Hit_Payload& rec) const {
     if (normal_texture != nullptr) {
         Vector3f tangent_normal = normal_texture->GetColor(rec.uv.x, rec.uv.y);
         
-        surface_normal = NormalFromTangentToWorld(rec.normal, tangent_normal);
+        surface_normal = NormalFromTangentToWorld(rec.normal, rec.tangent, tangent_normal);
     }
     
     return surface_normal;
@@ -27,9 +27,17 @@ void Material::SetNormal(std::shared_ptr<Texture> &normal) {
     normal_texture = normal;
 }
 
-Vector3f Material::NormalFromTangentToWorld(const Vector3f &surface_normal, const Vector3f &tangent_normal) const {
+Vector3f Material::NormalFromTangentToWorld(const Vector3f &surface_normal, const Vector3f &surface_tangent, const Vector3f &tangent_normal) const {
     Vector3f mapped_normal = glm::normalize(tangent_normal * 2.0f - 1.0f);
-    return ToWorld(mapped_normal, surface_normal);
+
+    // Follow the uv parameterization when the surface provides dp/du, otherwise any frame around the normal
+    Vector3f T = surface_tangent - glm::dot(surface_tangent, surface_normal) * surface_normal;
+    float length = glm::length(T);
+    if (length < 1e-6f)
+        return ToWorld(mapped_normal, surface_normal);
+    T /= length;
+    Vector3f B = glm::cross(surface_normal, T);
+    return glm::normalize(mapped_normal.x * T + mapped_normal.y * B + mapped_normal.z * surface_normal);
 }
 
 Vector3f Diffuse::Sample(const Ray& r_in, const Hit_Payload& rec, Vector3f& scatter_direction, float& pdf, Sampler& sampler) const
@@ -0,0 +1,33 @@
+#include "MaterialTable.hpp"
+
+MaterialID MaterialTable::Add(const std::shared_ptr<Material> &material)
+{
+    if (!material)
+        return InvalidMaterialID;
+
+    auto it = ids.find(material.get());
+    if (it != ids.end())
+        return it->second;
+
+    MaterialID id = static_cast<MaterialID>(materials.size());
+    materials.push_back(material);
+    ids.emplace(material.get(), id);
+    return id;
+}
+
+void MaterialTable::Clear()
+{
+    materials.clear();
+    ids.clear();
+}
+
+void MaterialBinding::Bind(MaterialTable &table, const std::shared_ptr<Material> &material)
+{
+    if (bound_table && bound_table != &table) {
+        std::cerr << "MaterialBinding::Bind: shape already belongs to another scene, keeping its material ID there" << std::endl;
+        assert(false && "shape bound to two material tables");
+        return;
+    }
+    bound_table = &table;
+    id = table.Add(material);
+}
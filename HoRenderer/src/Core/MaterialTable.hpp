@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Util.hpp"
+#include <unordered_map>
+#include <iostream>
+#include <cassert>
+
+using MaterialID = uint32_t;
+constexpr MaterialID InvalidMaterialID = 0xFFFFFFFFu;
+
+// Scene-owned list of materials. Shapes keep their shared_ptr for ownership but hand out
+// a 32-bit ID in Hit_Payload, so the render loop never touches a reference count.
+class MaterialTable {
+public:
+    // Returns the existing ID when the material is already in the table, InvalidMaterialID for nullptr
+    MaterialID Add(const std::shared_ptr<Material> &material);
+    // nullptr for InvalidMaterialID
+    const Material *Get(MaterialID id) const {
+        return id < materials.size() ? materials[id].get() : nullptr;
+    }
+    size_t Size() const { return materials.size(); }
+    const std::vector<std::shared_ptr<Material>> &GetAll() const { return materials; }
+    void Clear();
+
+private:
+    std::vector<std::shared_ptr<Material>> materials;
+    std::unordered_map<const Material *, MaterialID> ids;
+};
+
+// The ID a shape hands out, valid in the one table it was bound to. Binding the same shape to a
+// second table would change the ID the first one sees, so Bind refuses it: a shape belongs to
+// one Scene (or BottomLevelBVH), use Instance to place the same geometry several times.
+class MaterialBinding {
+public:
+    void Bind(MaterialTable &table, const std::shared_ptr<Material> &material);
+    MaterialID ID() const { return id; }
+
+private:
+    MaterialID id = InvalidMaterialID;
+    const MaterialTable *bound_table = nullptr;
+};
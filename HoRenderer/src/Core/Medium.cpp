@@ -3,14 +3,15 @@
 */
 #include "Medium.hpp"
 
-bool HomogeneousMedium::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const {
-    Hit_Payload rec1, rec2;
+bool HomogeneousMedium::SampleScatterDistance(const Ray &r, Vector2f t_interval, float &t) const {
+    // Only the entry and exit distances are needed, no surface data
+    SurfaceHit rec1, rec2;
     Vector2f infinite_interval = Vector2f(-Infinity, Infinity);
-    if (!boundary->isHit(r, infinite_interval, rec1))
+    if (!boundary->Intersect(r, infinite_interval, rec1))
         return false;
 
     Vector2f second_interval = Vector2f(rec1.t + 0.0001f, Infinity);
-    if (!boundary->isHit(r, second_interval, rec2))
+    if (!boundary->Intersect(r, second_interval, rec2))
         return false;
 
     if (rec1.t < t_interval.x) rec1.t = t_interval.x;
@@ -34,14 +35,32 @@ bool HomogeneousMedium::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &re
     if (hit_distance > distance_inside_boundary)
         return false; 
 
-    rec.t = rec1.t + hit_distance;
+    t = rec1.t + hit_distance;
+    return true;
+}
+
+bool HomogeneousMedium::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const {
+    float t;
+    if (!SampleScatterDistance(r, t_interval, t))
+        return false;
+
+    hit.t = t;
+    hit.object = this;
+    return true;
+}
+
+void HomogeneousMedium::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const {
+    rec.t = hit.t;
     rec.p = r.at(rec.t);
 
     rec.normal = Vector3f(1, 0, 0); 
     rec.front_face = true;
-    rec.mat = phase_function; 
+    rec.material_id = phase_binding.ID(); 
     rec.uv = Vector2f(0, 0); 
-    
-    return true;
+    rec.tangent = Vector3f(0.0f);
 }
 
+bool HomogeneousMedium::isOccluded(const Ray &r, float t_max) const {
+    float t;
+    return SampleScatterDistance(r, Vector2f(Epsilon, t_max), t);
+}
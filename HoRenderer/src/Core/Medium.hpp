@@ -12,13 +12,23 @@ public:
     HomogeneousMedium(std::shared_ptr<Hittable> boundary, const Vector3f &sigma_s, const Vector3f &sigma_a, std::shared_ptr<Material> phase) :
         boundary(boundary), sigma_s(sigma_s), sigma_a(sigma_a), phase_function(phase), sigma_t(sigma_s + sigma_a) {}
 
-    virtual bool isHit(const Ray& r, Vector2f t_interval, Hit_Payload& rec) const override;
+    virtual bool Intersect(const Ray& r, Vector2f t_interval, SurfaceHit& hit) const override;
+    virtual void ComputeSurfaceInteraction(const Ray& r, const SurfaceHit& hit, Hit_Payload& rec) const override;
+    // The phase function never emits, so a sampled scattering event always blocks
+    virtual bool isOccluded(const Ray& r, float t_max) const override;
     virtual AABB getBoundingBox() const override { return boundary->getBoundingBox(); }
+    virtual void BindMaterials(MaterialTable& table) override { phase_binding.Bind(table, phase_function); }
+    virtual int WrapperDepth() const override { return boundary->WrapperDepth(); }
     
+private:
+    // Distance along the ray of the sampled scattering event, false if the ray passes through
+    bool SampleScatterDistance(const Ray& r, Vector2f t_interval, float& t) const;
+
 private:
     std::shared_ptr<Hittable> boundary;
     Vector3f sigma_s;  // Scattering coefficient
     Vector3f sigma_a;  // Absorption coefficient
     Vector3f sigma_t;  // Extinction coefficient -> sigma_s + sigma_a
     std::shared_ptr<Material> phase_function;  
+    MaterialBinding phase_binding;
 };
\ No newline at end of file
@@ -0,0 +1,643 @@
+#include "MeshLoader.hpp"
+#include "SceneCache.hpp"
+#include "../Common/MappedFile.hpp"
+#include <charconv>
+#include <chrono>
+#include <cstring>
+
+
+namespace {
+
+// ---------------------------------------------------------------- OBJ
+
+// Split the file into line-aligned chunks, a few per thread to even out the load
+std::vector<std::pair<const char *, const char *>> SplitLines(const char *begin, const char *end) {
+    const size_t min_chunk = 1 << 20;
+    size_t size = end - begin;
+    size_t chunk_count = std::max<size_t>(1, std::min<size_t>(size / min_chunk, omp_get_max_threads() * 4));
+    size_t chunk_size = size / chunk_count;
+
+    std::vector<std::pair<const char *, const char *>> chunks;
+    const char *chunk_begin = begin;
+    for (size_t i = 0; i < chunk_count && chunk_begin < end; i++) {
+        const char *chunk_end = (i + 1 == chunk_count) ? end : std::min(end, chunk_begin + chunk_size);
+        const char *newline = static_cast<const char *>(memchr(chunk_end, '\n', end - chunk_end));
+        chunk_end = newline ? newline + 1 : end;
+        chunks.emplace_back(chunk_begin, chunk_end);
+        chunk_begin = chunk_end;
+    }
+    return chunks;
+}
+
+inline const char *SkipSpaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+inline const char *ParseFloat(const char *p, const char *end, float &value) {
+    p = SkipSpaces(p, end);
+    if (p < end && *p == '+')
+        p++;
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        value = 0.0f;
+    return result.ptr;
+}
+
+inline const char *ParseInt(const char *p, const char *end, int64_t &value) {
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        value = 0;
+    return result.ptr;
+}
+
+struct OBJCounts {
+    size_t positions = 0, normals = 0, texcoords = 0;
+};
+
+struct OBJChunk {
+    OBJCounts counts;  // records in this chunk
+    OBJCounts offsets; // records in all previous chunks
+    std::vector<float> positions, normals, texcoords;
+    // Triangle corners, 0-based global indices, -1 when absent
+    std::vector<int64_t> corner_position, corner_texcoord, corner_normal;
+};
+
+// Kind of record a line starts with
+enum class OBJRecord { OTHER, POSITION, NORMAL, TEXCOORD, FACE };
+
+inline OBJRecord ClassifyLine(const char *p, const char *end) {
+    if (end - p < 2)
+        return OBJRecord::OTHER;
+    if (p[0] == 'v') {
+        if (p[1] == ' ' || p[1] == '\t') return OBJRecord::POSITION;
+        if (end - p >= 3 && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')) return OBJRecord::NORMAL;
+        if (end - p >= 3 && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')) return OBJRecord::TEXCOORD;
+    } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+        return OBJRecord::FACE;
+    }
+    return OBJRecord::OTHER;
+}
+
+template <typename LineFn>
+void ForEachLine(const char *begin, const char *end, LineFn &&fn) {
+    const char *p = begin;
+    while (p < end) {
+        const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+        const char *line_end = newline ? newline : end;
+        const char *line_begin = SkipSpaces(p, line_end);
+        fn(line_begin, line_end);
+        p = line_end + 1;
+    }
+}
+
+// Relative indices count back from the current record count
+inline int64_t ResolveIndex(int64_t index, size_t count) {
+    if (index > 0) return index - 1;
+    if (index < 0) return static_cast<int64_t>(count) + index;
+    return -1;
+}
+
+void ParseOBJChunk(const char *begin, const char *end, OBJChunk &chunk) {
+    size_t positions = chunk.offsets.positions, normals = chunk.offsets.normals, texcoords = chunk.offsets.texcoords;
+    chunk.positions.reserve(chunk.counts.positions * 3);
+    chunk.normals.reserve(chunk.counts.normals * 3);
+    chunk.texcoords.reserve(chunk.counts.texcoords * 2);
+
+    std::vector<int64_t> polygon[3];
+    ForEachLine(begin, end, [&](const char *p, const char *line_end) {
+        switch (ClassifyLine(p, line_end)) {
+        case OBJRecord::POSITION: {
+            float x, y, z;
+            p = ParseFloat(p + 1, line_end, x);
+            p = ParseFloat(p, line_end, y);
+            ParseFloat(p, line_end, z);
+            chunk.positions.insert(chunk.positions.end(), {x, y, z});
+            positions++;
+            break;
+        }
+        case OBJRecord::NORMAL: {
+            float x, y, z;
+            p = ParseFloat(p + 2, line_end, x);
+            p = ParseFloat(p, line_end, y);
+            ParseFloat(p, line_end, z);
+            chunk.normals.insert(chunk.normals.end(), {x, y, z});
+            normals++;
+            break;
+        }
+        case OBJRecord::TEXCOORD: {
+            float u, v = 0.0f;
+            p = ParseFloat(p + 2, line_end, u);
+            // The second coordinate is optional
+            p = SkipSpaces(p, line_end);
+            if (p < line_end && *p != '\r')
+                ParseFloat(p, line_end, v);
+            chunk.texcoords.insert(chunk.texcoords.end(), {u, v});
+            texcoords++;
+            break;
+        }
+        case OBJRecord::FACE: {
+            for (auto &list : polygon)
+                list.clear();
+            p++;
+            while (true) {
+                p = SkipSpaces(p, line_end);
+                if (p >= line_end || *p == '\r' || *p == '#')
+                    break;
+                // v, v/vt, v//vn or v/vt/vn
+                int64_t v = 0, vt = 0, vn = 0;
+                p = ParseInt(p, line_end, v);
+                if (p < line_end && *p == '/') {
+                    p++;
+                    if (p < line_end && *p != '/')
+                        p = ParseInt(p, line_end, vt);
+                    if (p < line_end && *p == '/')
+                        p = ParseInt(p + 1, line_end, vn);
+                }
+                while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r')
+                    p++;
+                polygon[0].push_back(ResolveIndex(v, positions));
+                polygon[1].push_back(ResolveIndex(vt, texcoords));
+                polygon[2].push_back(ResolveIndex(vn, normals));
+            }
+            // Fan triangulation
+            for (size_t i = 1; i + 1 < polygon[0].size(); i++) {
+                for (size_t corner : {size_t(0), i, i + 1}) {
+                    chunk.corner_position.push_back(polygon[0][corner]);
+                    chunk.corner_texcoord.push_back(polygon[1][corner]);
+                    chunk.corner_normal.push_back(polygon[2][corner]);
+                }
+            }
+            break;
+        }
+        case OBJRecord::OTHER:
+            break;
+        }
+    });
+}
+
+// ---------------------------------------------------------------- PLY
+
+enum class PLYType { INVALID, INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64 };
+
+PLYType ParsePLYType(const std::string &name) {
+    if (name == "char" || name == "int8") return PLYType::INT8;
+    if (name == "uchar" || name == "uint8") return PLYType::UINT8;
+    if (name == "short" || name == "int16") return PLYType::INT16;
+    if (name == "ushort" || name == "uint16") return PLYType::UINT16;
+    if (name == "int" || name == "int32") return PLYType::INT32;
+    if (name == "uint" || name == "uint32") return PLYType::UINT32;
+    if (name == "float" || name == "float32") return PLYType::FLOAT32;
+    if (name == "double" || name == "float64") return PLYType::FLOAT64;
+    return PLYType::INVALID;
+}
+
+size_t PLYTypeSize(PLYType type) {
+    switch (type) {
+    case PLYType::INT8: case PLYType::UINT8: return 1;
+    case PLYType::INT16: case PLYType::UINT16: return 2;
+    case PLYType::INT32: case PLYType::UINT32: case PLYType::FLOAT32: return 4;
+    case PLYType::FLOAT64: return 8;
+    default: return 0;
+    }
+}
+
+template <typename T>
+inline T ReadUnaligned(const char *p) {
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
+
+inline double ReadPLYValue(const char *p, PLYType type) {
+    switch (type) {
+    case PLYType::INT8: return ReadUnaligned<int8_t>(p);
+    case PLYType::UINT8: return ReadUnaligned<uint8_t>(p);
+    case PLYType::INT16: return ReadUnaligned<int16_t>(p);
+    case PLYType::UINT16: return ReadUnaligned<uint16_t>(p);
+    case PLYType::INT32: return ReadUnaligned<int32_t>(p);
+    case PLYType::UINT32: return ReadUnaligned<uint32_t>(p);
+    case PLYType::FLOAT32: return ReadUnaligned<float>(p);
+    case PLYType::FLOAT64: return ReadUnaligned<double>(p);
+    default: return 0.0;
+    }
+}
+
+struct PLYProperty {
+    std::string name;
+    PLYType type = PLYType::INVALID;       // value type, or item type of a list
+    PLYType count_type = PLYType::INVALID; // INVALID unless this is a list
+    size_t offset = 0;                     // byte offset in the element, fixed-size elements only
+};
+
+struct PLYElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PLYProperty> properties;
+    bool HasLists() const {
+        for (const auto &property : properties)
+            if (property.count_type != PLYType::INVALID) return true;
+        return false;
+    }
+    size_t FixedStride() const {
+        size_t stride = 0;
+        for (const auto &property : properties)
+            stride += PLYTypeSize(property.type);
+        return stride;
+    }
+    const PLYProperty *Find(std::initializer_list<const char *> names) const {
+        for (const auto &property : properties)
+            for (const char *name : names)
+                if (property.name == name) return &property;
+        return nullptr;
+    }
+};
+
+// Size in bytes of one element record starting at p
+size_t PLYRecordSize(const PLYElement &element, const char *p) {
+    size_t size = 0;
+    for (const auto &property : element.properties) {
+        if (property.count_type == PLYType::INVALID) {
+            size += PLYTypeSize(property.type);
+        } else {
+            size_t count = static_cast<size_t>(ReadPLYValue(p + size, property.count_type));
+            size += PLYTypeSize(property.count_type) + count * PLYTypeSize(property.type);
+        }
+    }
+    return size;
+}
+
+} // namespace
+
+
+namespace MeshLoader {
+
+std::shared_ptr<MeshBuffers> Load(const std::string &path) {
+    std::string extension = std::filesystem::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != ".obj" && extension != ".ply") {
+        std::cerr << "Unsupported mesh format: " << path << std::endl;
+        return nullptr;
+    }
+
+    // Parsed buffers are cached, keyed by the source file so an edited asset is parsed again
+    uint64_t cache_key = 0;
+    if (SceneCache::Enabled()) {
+        cache_key = SceneCache::HashFile(path);
+        if (auto mesh = SceneCache::LoadMesh(cache_key))
+            return mesh;
+    }
+
+    auto mesh = extension == ".obj" ? LoadOBJ(path) : LoadPLY(path);
+    if (mesh && cache_key != 0)
+        SceneCache::SaveMesh(cache_key, *mesh);
+    return mesh;
+}
+
+std::shared_ptr<MeshBuffers> LoadOBJ(const std::string &path) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    MappedFile file(path);
+    if (!file.IsOpen())
+        return nullptr;
+
+    auto ranges = SplitLines(file.Data(), file.Data() + file.Size());
+    std::vector<OBJChunk> chunks(ranges.size());
+
+    // Pass 1: count records per chunk so relative indices can be resolved in parallel
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < static_cast<int64_t>(chunks.size()); i++) {
+        OBJCounts &counts = chunks[i].counts;
+        ForEachLine(ranges[i].first, ranges[i].second, [&](const char *p, const char *line_end) {
+            switch (ClassifyLine(p, line_end)) {
+            case OBJRecord::POSITION: counts.positions++; break;
+            case OBJRecord::NORMAL: counts.normals++; break;
+            case OBJRecord::TEXCOORD: counts.texcoords++; break;
+            default: break;
+            }
+        });
+    }
+    OBJCounts total;
+    for (auto &chunk : chunks) {
+        chunk.offsets = total;
+        total.positions += chunk.counts.positions;
+        total.normals += chunk.counts.normals;
+        total.texcoords += chunk.counts.texcoords;
+    }
+
+    // Pass 2: parse
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < static_cast<int64_t>(chunks.size()); i++)
+        ParseOBJChunk(ranges[i].first, ranges[i].second, chunks[i]);
+
+    std::vector<size_t> corner_offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); i++)
+        corner_offsets[i + 1] = corner_offsets[i] + chunks[i].corner_position.size();
+    size_t corner_count = corner_offsets.back();
+    if (corner_count == 0 || total.positions == 0) {
+        std::cerr << "OBJ file has no faces: " << path << std::endl;
+        return nullptr;
+    }
+
+    // Vertices can be shared directly when every corner uses the same index for all
+    // attributes (or leaves them out), otherwise each corner gets its own vertex
+    bool valid = true, shared = true, all_normals = total.normals > 0, all_texcoords = total.texcoords > 0;
+    #pragma omp parallel for reduction(&& : valid, shared, all_normals, all_texcoords)
+    for (int64_t i = 0; i < static_cast<int64_t>(chunks.size()); i++) {
+        const OBJChunk &chunk = chunks[i];
+        for (size_t c = 0; c < chunk.corner_position.size(); c++) {
+            int64_t v = chunk.corner_position[c], vt = chunk.corner_texcoord[c], vn = chunk.corner_normal[c];
+            valid = valid && v >= 0 && v < static_cast<int64_t>(total.positions) &&
+                    vt < static_cast<int64_t>(total.texcoords) && vn < static_cast<int64_t>(total.normals);
+            all_normals = all_normals && vn >= 0;
+            all_texcoords = all_texcoords && vt >= 0;
+            shared = shared && (vt < 0 || vt == v) && (vn < 0 || vn == v);
+        }
+    }
+    if (!valid) {
+        std::cerr << "OBJ file has out of range indices: " << path << std::endl;
+        return nullptr;
+    }
+
+    std::vector<float> positions(total.positions * 3), normals(total.normals * 3), texcoords(total.texcoords * 2);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < static_cast<int64_t>(chunks.size()); i++) {
+        const OBJChunk &chunk = chunks[i];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.offsets.positions * 3);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.offsets.normals * 3);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords.begin() + chunk.offsets.texcoords * 2);
+    }
+
+    auto mesh = std::make_shared<MeshBuffers>();
+    size_t vertex_count = shared ? total.positions : corner_count;
+    bool has_normals = all_normals && (!shared || total.normals == total.positions);
+    bool has_texcoords = all_texcoords && (!shared || total.texcoords == total.positions);
+    mesh->px.resize(vertex_count);
+    mesh->py.resize(vertex_count);
+    mesh->pz.resize(vertex_count);
+    if (has_normals) {
+        mesh->nx.resize(vertex_count);
+        mesh->ny.resize(vertex_count);
+        mesh->nz.resize(vertex_count);
+    }
+    if (has_texcoords) {
+        mesh->u.resize(vertex_count);
+        mesh->v.resize(vertex_count);
+    }
+    mesh->indices.resize(corner_count);
+
+    auto copy_vertex = [&](size_t dst, int64_t v, int64_t vt, int64_t vn) {
+        mesh->px[dst] = positions[3 * v + 0];
+        mesh->py[dst] = positions[3 * v + 1];
+        mesh->pz[dst] = positions[3 * v + 2];
+        if (has_normals) {
+            mesh->nx[dst] = normals[3 * vn + 0];
+            mesh->ny[dst] = normals[3 * vn + 1];
+            mesh->nz[dst] = normals[3 * vn + 2];
+        }
+        if (has_texcoords) {
+            mesh->u[dst] = texcoords[2 * vt + 0];
+            mesh->v[dst] = texcoords[2 * vt + 1];
+        }
+    };
+
+    if (shared) {
+        #pragma omp parallel for schedule(static)
+        for (int64_t v = 0; v < static_cast<int64_t>(vertex_count); v++)
+            copy_vertex(v, v, v, v);
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int64_t i = 0; i < static_cast<int64_t>(chunks.size()); i++) {
+        const OBJChunk &chunk = chunks[i];
+        for (size_t c = 0; c < chunk.corner_position.size(); c++) {
+            size_t corner = corner_offsets[i] + c;
+            if (shared) {
+                mesh->indices[corner] = static_cast<uint32_t>(chunk.corner_position[c]);
+            } else {
+                copy_vertex(corner, chunk.corner_position[c], chunk.corner_texcoord[c], chunk.corner_normal[c]);
+                mesh->indices[corner] = static_cast<uint32_t>(corner);
+            }
+        }
+    }
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "Loaded " << path << ": " << mesh->VertexCount() << " vertices, " << mesh->TriangleCount()
+              << " triangles, Time: " << std::chrono::duration<double, std::milli>(end_time - start_time).count() << "ms" << std::endl;
+    return mesh;
+}
+
+std::shared_ptr<MeshBuffers> LoadPLY(const std::string &path) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    MappedFile file(path);
+    if (!file.IsOpen())
+        return nullptr;
+
+    // Header
+    const char *data = file.Data();
+    const char *end = data + file.Size();
+    const char *header_end = nullptr;
+    std::vector<PLYElement> elements;
+    bool binary_little_endian = false;
+    for (const char *p = data; p < end;) {
+        const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+        if (!newline)
+            break;
+        std::istringstream line(std::string(p, newline));
+        p = newline + 1;
+
+        std::string keyword;
+        line >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            line >> format;
+            binary_little_endian = format == "binary_little_endian";
+        } else if (keyword == "element") {
+            PLYElement element;
+            line >> element.name >> element.count;
+            elements.push_back(element);
+        } else if (keyword == "property" && !elements.empty()) {
+            PLYProperty property;
+            std::string type;
+            line >> type;
+            if (type == "list") {
+                std::string count_type, item_type;
+                line >> count_type >> item_type;
+                property.count_type = ParsePLYType(count_type);
+                property.type = ParsePLYType(item_type);
+            } else {
+                property.type = ParsePLYType(type);
+            }
+            line >> property.name;
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            header_end = p;
+            break;
+        }
+    }
+    if (!header_end || !binary_little_endian) {
+        std::cerr << "Only binary little-endian PLY files are supported: " << path << std::endl;
+        return nullptr;
+    }
+    for (auto &element : elements) {
+        size_t offset = 0;
+        for (auto &property : element.properties) {
+            if (property.type == PLYType::INVALID) {
+                std::cerr << "Unknown PLY property type for " << property.name << ": " << path << std::endl;
+                return nullptr;
+            }
+            property.offset = offset;
+            offset += PLYTypeSize(property.type);
+        }
+    }
+
+    auto mesh = std::make_shared<MeshBuffers>();
+    const char *p = header_end;
+    for (const auto &element : elements) {
+        if (element.name == "vertex") {
+            size_t stride = element.FixedStride();
+            if (element.HasLists() || p + element.count * stride > end) {
+                std::cerr << "Invalid PLY vertex element: " << path << std::endl;
+                return nullptr;
+            }
+            const PLYProperty *x = element.Find({"x"}), *y = element.Find({"y"}), *z = element.Find({"z"});
+            const PLYProperty *nx = element.Find({"nx"}), *ny = element.Find({"ny"}), *nz = element.Find({"nz"});
+            const PLYProperty *u = element.Find({"u", "s", "texture_u", "texture_s"});
+            const PLYProperty *v = element.Find({"v", "t", "texture_v", "texture_t"});
+            if (!x || !y || !z) {
+                std::cerr << "PLY vertex element has no position: " << path << std::endl;
+                return nullptr;
+            }
+            bool has_normals = nx && ny && nz;
+            bool has_texcoords = u && v;
+
+            size_t count = element.count;
+            mesh->px.resize(count);
+            mesh->py.resize(count);
+            mesh->pz.resize(count);
+            if (has_normals) {
+                mesh->nx.resize(count);
+                mesh->ny.resize(count);
+                mesh->nz.resize(count);
+            }
+            if (has_texcoords) {
+                mesh->u.resize(count);
+                mesh->v.resize(count);
+            }
+            const char *vertices = p;
+            #pragma omp parallel for schedule(static)
+            for (int64_t i = 0; i < static_cast<int64_t>(count); i++) {
+                const char *record = vertices + i * stride;
+                mesh->px[i] = static_cast<float>(ReadPLYValue(record + x->offset, x->type));
+                mesh->py[i] = static_cast<float>(ReadPLYValue(record + y->offset, y->type));
+                mesh->pz[i] = static_cast<float>(ReadPLYValue(record + z->offset, z->type));
+                if (has_normals) {
+                    mesh->nx[i] = static_cast<float>(ReadPLYValue(record + nx->offset, nx->type));
+                    mesh->ny[i] = static_cast<float>(ReadPLYValue(record + ny->offset, ny->type));
+                    mesh->nz[i] = static_cast<float>(ReadPLYValue(record + nz->offset, nz->type));
+                }
+                if (has_texcoords) {
+                    mesh->u[i] = static_cast<float>(ReadPLYValue(record + u->offset, u->type));
+                    mesh->v[i] = static_cast<float>(ReadPLYValue(record + v->offset, v->type));
+                }
+            }
+            p += count * stride;
+        } else if (element.name == "face") {
+            const PLYProperty *list = element.Find({"vertex_indices", "vertex_index"});
+            if (!list || list->count_type == PLYType::INVALID) {
+                std::cerr << "PLY face element has no vertex_indices list: " << path << std::endl;
+                return nullptr;
+            }
+            // Offset of the index list inside a face record; properties after a list have no fixed offset
+            size_t list_offset = 0;
+            for (const auto &property : element.properties) {
+                if (&property == list) break;
+                list_offset += PLYTypeSize(property.type);
+            }
+            size_t count_size = PLYTypeSize(list->count_type), index_size = PLYTypeSize(list->type);
+            size_t triangle_stride = element.FixedStride() + count_size + 2 * index_size;
+            bool single_list = true;
+            for (const auto &property : element.properties)
+                single_list = single_list && (&property == list || property.count_type == PLYType::INVALID);
+
+            // Fast path: all faces are triangles, so records have a fixed size and can be read in parallel
+            bool all_triangles = single_list && p + element.count * triangle_stride <= end;
+            if (all_triangles) {
+                mesh->indices.resize(element.count * 3);
+                const char *faces = p;
+                #pragma omp parallel for schedule(static) reduction(&& : all_triangles)
+                for (int64_t i = 0; i < static_cast<int64_t>(element.count); i++) {
+                    const char *record = faces + i * triangle_stride + list_offset;
+                    if (ReadPLYValue(record, list->count_type) != 3.0) {
+                        all_triangles = false;
+                        continue;
+                    }
+                    for (int k = 0; k < 3; k++)
+                        mesh->indices[3 * i + k] = static_cast<uint32_t>(ReadPLYValue(record + count_size + k * index_size, list->type));
+                }
+            }
+            if (all_triangles) {
+                p += element.count * triangle_stride;
+            } else {
+                // Mixed polygons: walk the records and fan-triangulate
+                mesh->indices.clear();
+                for (size_t i = 0; i < element.count; i++) {
+                    if (p >= end) {
+                        std::cerr << "Truncated PLY face element: " << path << std::endl;
+                        return nullptr;
+                    }
+                    const char *record = p;
+                    for (const auto &property : element.properties) {
+                        if (&property == list) {
+                            size_t n = static_cast<size_t>(ReadPLYValue(record, list->count_type));
+                            const char *indices = record + count_size;
+                            for (size_t k = 1; k + 1 < n; k++) {
+                                mesh->indices.push_back(static_cast<uint32_t>(ReadPLYValue(indices, list->type)));
+                                mesh->indices.push_back(static_cast<uint32_t>(ReadPLYValue(indices + k * index_size, list->type)));
+                                mesh->indices.push_back(static_cast<uint32_t>(ReadPLYValue(indices + (k + 1) * index_size, list->type)));
+                            }
+                            record += count_size + n * index_size;
+                        } else if (property.count_type != PLYType::INVALID) {
+                            size_t n = static_cast<size_t>(ReadPLYValue(record, property.count_type));
+                            record += PLYTypeSize(property.count_type) + n * PLYTypeSize(property.type);
+                        } else {
+                            record += PLYTypeSize(property.type);
+                        }
+                    }
+                    p = record;
+                }
+            }
+        } else {
+            // Skip elements we do not use
+            if (!element.HasLists()) {
+                p += element.count * element.FixedStride();
+            } else {
+                for (size_t i = 0; i < element.count && p < end; i++)
+                    p += PLYRecordSize(element, p);
+            }
+        }
+        if (p > end) {
+            std::cerr << "Truncated PLY file: " << path << std::endl;
+            return nullptr;
+        }
+    }
+
+    if (mesh->indices.empty() || mesh->VertexCount() == 0) {
+        std::cerr << "PLY file has no faces: " << path << std::endl;
+        return nullptr;
+    }
+    uint32_t max_index = 0;
+    #pragma omp parallel for reduction(max : max_index)
+    for (int64_t i = 0; i < static_cast<int64_t>(mesh->indices.size()); i++)
+        max_index = std::max(max_index, mesh->indices[i]);
+    if (max_index >= mesh->VertexCount()) {
+        std::cerr << "PLY file has out of range indices: " << path << std::endl;
+        return nullptr;
+    }
+
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "Loaded " << path << ": " << mesh->VertexCount() << " vertices, " << mesh->TriangleCount()
+              << " triangles, Time: " << std::chrono::duration<double, std::milli>(end_time - start_time).count() << "ms" << std::endl;
+    return mesh;
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Util.hpp"
+#include "TriangleMesh.hpp"
+
+// Mesh loaders. Files are memory-mapped and split into chunks that are parsed in
+// parallel, so loading scales with the core count instead of one getline at a time.
+// Polygons are fan-triangulated. Return nullptr (and print why) on failure.
+namespace MeshLoader {
+    // Dispatch on the file extension (.obj or .ply), going through SceneCache when it is enabled
+    std::shared_ptr<MeshBuffers> Load(const std::string &path);
+
+    // Wavefront OBJ: v/vt/vn/f records, negative (relative) indices supported.
+    // Groups, smoothing groups and materials are ignored.
+    std::shared_ptr<MeshBuffers> LoadOBJ(const std::string &path);
+
+    // Binary little-endian PLY with a vertex element (x, y, z, optional nx/ny/nz and u/v or s/t)
+    // and a face element with a vertex_indices list
+    std::shared_ptr<MeshBuffers> LoadPLY(const std::string &path);
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "Util.hpp"
+#include "Ray.hpp"
+#include <bit>
+
+// One ray against 4 (SSE) or 8 (AVX) spheres or quads at once. The kernels repeat the arithmetic
+// of IntersectSphere/IntersectQuad in Shape.hpp operation for operation, without FMA. A lane hits
+// exactly where the scalar routine would only as long as the compiler does not contract the scalar
+// routine into FMAs either, which xmake.lua turns off; otherwise grazing sphere hits differ in the
+// last bits and HoRenderer --check reports them.
+
+// The few float operations the kernels need, on Width lanes
+template <int Width>
+struct SimdFloat;
+
+template <>
+struct SimdFloat<4> {
+    __m128 v;
+
+    static SimdFloat Load(const float *p) { return {_mm_loadu_ps(p)}; }
+    static SimdFloat Set(float x) { return {_mm_set1_ps(x)}; }
+    void Store(float *p) const { _mm_storeu_ps(p, v); }
+    // Bit i set: lane i of a comparison result is true
+    int Mask() const { return _mm_movemask_ps(v); }
+
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return {_mm_add_ps(a.v, b.v)}; }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return {_mm_sub_ps(a.v, b.v)}; }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return {_mm_mul_ps(a.v, b.v)}; }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return {_mm_div_ps(a.v, b.v)}; }
+    friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return {_mm_and_ps(a.v, b.v)}; }
+    friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return {_mm_or_ps(a.v, b.v)}; }
+    friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+    friend SimdFloat operator<=(SimdFloat a, SimdFloat b) { return {_mm_cmple_ps(a.v, b.v)}; }
+    friend SimdFloat Sqrt(SimdFloat a) { return {_mm_sqrt_ps(a.v)}; }
+    friend SimdFloat Abs(SimdFloat a) { return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)}; }
+    // mask ? a : b
+    friend SimdFloat Select(SimdFloat mask, SimdFloat a, SimdFloat b) { return {_mm_blendv_ps(b.v, a.v, mask.v)}; }
+};
+
+template <>
+struct SimdFloat<8> {
+    __m256 v;
+
+    static SimdFloat Load(const float *p) { return {_mm256_loadu_ps(p)}; }
+    static SimdFloat Set(float x) { return {_mm256_set1_ps(x)}; }
+    void Store(float *p) const { _mm256_storeu_ps(p, v); }
+    int Mask() const { return _mm256_movemask_ps(v); }
+
+    friend SimdFloat operator+(SimdFloat a, SimdFloat b) { return {_mm256_add_ps(a.v, b.v)}; }
+    friend SimdFloat operator-(SimdFloat a, SimdFloat b) { return {_mm256_sub_ps(a.v, b.v)}; }
+    friend SimdFloat operator*(SimdFloat a, SimdFloat b) { return {_mm256_mul_ps(a.v, b.v)}; }
+    friend SimdFloat operator/(SimdFloat a, SimdFloat b) { return {_mm256_div_ps(a.v, b.v)}; }
+    friend SimdFloat operator&(SimdFloat a, SimdFloat b) { return {_mm256_and_ps(a.v, b.v)}; }
+    friend SimdFloat operator|(SimdFloat a, SimdFloat b) { return {_mm256_or_ps(a.v, b.v)}; }
+    friend SimdFloat operator<(SimdFloat a, SimdFloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+    friend SimdFloat operator<=(SimdFloat a, SimdFloat b) { return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+    friend SimdFloat Sqrt(SimdFloat a) { return {_mm256_sqrt_ps(a.v)}; }
+    friend SimdFloat Abs(SimdFloat a) { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+    friend SimdFloat Select(SimdFloat mask, SimdFloat a, SimdFloat b) { return {_mm256_blendv_ps(b.v, a.v, mask.v)}; }
+};
+
+// Structure-of-arrays view of up to Width spheres: pointers into CompiledScene's arrays, or into a
+// SphereBlock when the spheres of a leaf are not stored next to each other
+struct SphereLanes {
+    const float *cx, *cy, *cz, *radius;
+};
+
+// Same for quads, with the plane constants of IntersectQuad
+struct QuadLanes {
+    const float *qx, *qy, *qz;
+    const float *ux, *uy, *uz;
+    const float *vx, *vy, *vz;
+    const float *nx, *ny, *nz;
+    const float *wx, *wy, *wz;
+    const float *d;
+};
+
+template <int Width>
+struct SphereBlock {
+    alignas(32) float cx[Width], cy[Width], cz[Width], radius[Width];
+
+    void Set(int lane, const Vector3f &center, float r) {
+        cx[lane] = center.x;
+        cy[lane] = center.y;
+        cz[lane] = center.z;
+        radius[lane] = r;
+    }
+    SphereLanes Lanes() const { return {cx, cy, cz, radius}; }
+};
+
+template <int Width>
+struct QuadBlock {
+    alignas(32) float qx[Width], qy[Width], qz[Width];
+    alignas(32) float ux[Width], uy[Width], uz[Width];
+    alignas(32) float vx[Width], vy[Width], vz[Width];
+    alignas(32) float nx[Width], ny[Width], nz[Width];
+    alignas(32) float wx[Width], wy[Width], wz[Width];
+    alignas(32) float d[Width];
+
+    void Set(int lane, const Vector3f &Q, const Vector3f &u, const Vector3f &v, const Vector3f &normal, const Vector3f &w, float D) {
+        qx[lane] = Q.x; qy[lane] = Q.y; qz[lane] = Q.z;
+        ux[lane] = u.x; uy[lane] = u.y; uz[lane] = u.z;
+        vx[lane] = v.x; vy[lane] = v.y; vz[lane] = v.z;
+        nx[lane] = normal.x; ny[lane] = normal.y; nz[lane] = normal.z;
+        wx[lane] = w.x; wy[lane] = w.y; wz[lane] = w.z;
+        d[lane] = D;
+    }
+    QuadLanes Lanes() const { return {qx, qy, qz, ux, uy, uz, vx, vy, vz, nx, ny, nz, wx, wy, wz, d}; }
+};
+
+// Lowest lane of mask holding the smallest t, -1 for an empty mask
+template <int Width>
+inline int NearestLane(SimdFloat<Width> t, int mask, float &t_nearest) {
+    alignas(32) float lanes[Width];
+    t.Store(lanes);
+    int nearest = -1;
+    while (mask) {
+        int i = std::countr_zero(static_cast<unsigned>(mask));
+        mask &= mask - 1;
+        if (nearest < 0 || lanes[i] < t_nearest) {
+            nearest = i;
+            t_nearest = lanes[i];
+        }
+    }
+    return nearest;
+}
+
+/*
+* @brief: Nearest of up to Width spheres, see IntersectSphere.
+*
+* @args: spheres: Width readable lanes, only the first count are tested
+* @ret: lane of the nearest hit inside t_interval (t is its distance), -1 for none
+*/
+template <int Width>
+inline int IntersectSpheres(const SphereLanes &spheres, int count, const Ray &r, Vector2f t_interval, float &t) {
+    using F = SimdFloat<Width>;
+    const Vector3f &o = r.origin(), &dir = r.direction();
+    F dx = F::Set(dir.x), dy = F::Set(dir.y), dz = F::Set(dir.z);
+
+    F ocx = F::Load(spheres.cx) - F::Set(o.x);
+    F ocy = F::Load(spheres.cy) - F::Set(o.y);
+    F ocz = F::Load(spheres.cz) - F::Set(o.z);
+    F radius = F::Load(spheres.radius);
+    F a = F::Set(glm::dot(dir, dir));
+    F h = dx * ocx + dy * ocy + dz * ocz;
+    F c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+    F discriminant = h * h - a * c;
+    F valid = F::Set(0.0f) < discriminant;
+
+    F sqrt_d = Sqrt(discriminant);
+    F t_min = F::Set(t_interval.x), t_max = F::Set(t_interval.y);
+    F near_root = (h - sqrt_d) / a;
+    F far_root = (h + sqrt_d) / a;
+    F near_inside = (t_min < near_root) & (near_root < t_max);
+    F far_inside = (t_min < far_root) & (far_root < t_max);
+    F root = Select(near_inside, near_root, far_root);
+
+    int mask = (valid & (near_inside | far_inside)).Mask() & ((1 << count) - 1);
+    return NearestLane<Width>(root, mask, t);
+}
+
+/*
+* @brief: Nearest of up to Width quads, see IntersectQuad.
+*
+* @args: quads: Width readable lanes, only the first count are tested
+* @ret: lane of the nearest hit inside t_interval (t and local as in IntersectQuad), -1 for none
+*/
+template <int Width>
+inline int IntersectQuads(const QuadLanes &quads, int count, const Ray &r, Vector2f t_interval, float &t, Vector2f &local) {
+    using F = SimdFloat<Width>;
+    const Vector3f &o = r.origin(), &dir = r.direction();
+    F ox = F::Set(o.x), oy = F::Set(o.y), oz = F::Set(o.z);
+    F dx = F::Set(dir.x), dy = F::Set(dir.y), dz = F::Set(dir.z);
+
+    F nx = F::Load(quads.nx), ny = F::Load(quads.ny), nz = F::Load(quads.nz);
+    F denom = nx * dx + ny * dy + nz * dz;
+    // IntersectQuad compares against the double 1e-6, the float just above it gives the same answer
+    static const float parallel = std::nextafter(1e-6f, 1.0f);
+    F valid = F::Set(parallel) <= Abs(denom);
+
+    F t_plane = (F::Load(quads.d) - (nx * ox + ny * oy + nz * oz)) / denom;
+    valid = valid & (F::Set(t_interval.x) <= t_plane) & (t_plane <= F::Set(t_interval.y));
+
+    F hx = (ox + t_plane * dx) - F::Load(quads.qx);
+    F hy = (oy + t_plane * dy) - F::Load(quads.qy);
+    F hz = (oz + t_plane * dz) - F::Load(quads.qz);
+    F ux = F::Load(quads.ux), uy = F::Load(quads.uy), uz = F::Load(quads.uz);
+    F vx = F::Load(quads.vx), vy = F::Load(quads.vy), vz = F::Load(quads.vz);
+    F wx = F::Load(quads.wx), wy = F::Load(quads.wy), wz = F::Load(quads.wz);
+    // dot(w, cross(hit, v)) and dot(w, cross(u, hit)), in glm's order
+    F alpha = wx * (hy * vz - vy * hz) + wy * (hz * vx - vz * hx) + wz * (hx * vy - vx * hy);
+    F beta = wx * (uy * hz - hy * uz) + wy * (uz * hx - hz * ux) + wz * (ux * hy - hx * uy);
+    F low = F::Set(-Epsilon), high = F::Set(1 + Epsilon);
+    valid = valid & (low <= alpha) & (alpha <= high) & (low <= beta) & (beta <= high);
+
+    int mask = valid.Mask() & ((1 << count) - 1);
+    int lane = NearestLane<Width>(t_plane, mask, t);
+    if (lane >= 0) {
+        alignas(32) float alphas[Width], betas[Width];
+        alpha.Store(alphas);
+        beta.Store(betas);
+        local = Vector2f(alphas[lane], betas[lane]);
+    }
+    return lane;
+}
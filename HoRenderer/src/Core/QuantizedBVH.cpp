@@ -0,0 +1,216 @@
+#include "QuantizedBVH.hpp"
+
+namespace {
+    constexpr int MaxLeafSlot = 255; // QuantizedBVHNode::count is 8 bits
+}
+
+QuantizedBVH::QuantizedBVH(const LinearBVH &binary)
+{
+    const auto &binary_nodes = binary.GetNodes();
+    if (binary_nodes.empty())
+        return;
+
+    bounds = binary.getBoundingBox();
+    nodes.reserve(binary_nodes.size() / 7 + 1);
+    primitive_indices.reserve(binary.GetPrimitiveIndices().size());
+    nodes.emplace_back();
+
+    if (binary_nodes[0].n_primitives > 0) {
+        // A single leaf still needs a root node to live in
+        Child leaf = {bounds, 0, binary_nodes[0].primitives_offset, binary_nodes[0].n_primitives};
+        Emit(binary, bounds, &leaf, 1, 0);
+    } else {
+        Collapse(binary, 0, 0);
+    }
+    nodes.shrink_to_fit();
+}
+
+void QuantizedBVH::Collapse(const LinearBVH &binary, uint32_t binary_index, uint32_t node_index)
+{
+    // Same child selection as WideBVH<8>::Collapse: keep opening the largest interior child
+    const auto &binary_nodes = binary.GetNodes();
+    uint32_t opened[8];
+    int n_children = 0;
+    opened[n_children++] = binary_index + 1;
+    opened[n_children++] = binary_nodes[binary_index].second_child_offset;
+
+    while (n_children < 8) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < n_children; i++) {
+            const LinearBVHNode &candidate = binary_nodes[opened[i]];
+            if (candidate.n_primitives == 0 && candidate.bounds.SurfaceArea() > best_area) {
+                best_area = candidate.bounds.SurfaceArea();
+                best = i;
+            }
+        }
+        if (best < 0)
+            break;
+        uint32_t parent = opened[best];
+        opened[best] = parent + 1;
+        opened[n_children++] = binary_nodes[parent].second_child_offset;
+    }
+
+    Child children[8];
+    for (int i = 0; i < n_children; i++) {
+        const LinearBVHNode &child = binary_nodes[opened[i]];
+        children[i] = {child.bounds, opened[i], child.primitives_offset, child.n_primitives};
+    }
+    Emit(binary, binary_nodes[binary_index].bounds, children, n_children, node_index);
+}
+
+void QuantizedBVH::Emit(const LinearBVH &binary, const AABB &node_bounds, const Child *children, int n_children, uint32_t node_index)
+{
+    // Leaves too large for an 8-bit count get a node of their own, split over its slots
+    auto is_interior = [](const Child &child) { return child.n_primitives == 0 || child.n_primitives > MaxLeafSlot; };
+
+    QuantizedBVHNode node = {};
+    Vector3f lo = node_bounds.min(), hi = node_bounds.max();
+    float scale[3];
+    for (int axis = 0; axis < 3; axis++) {
+        // Smallest power of two grid whose 255 steps still reach the max plane
+        int exponent;
+        std::frexp((hi[axis] - lo[axis]) / 255.0f, &exponent);
+        exponent = std::clamp(exponent, -126, 127);
+        while (exponent < 127 && lo[axis] + 255.0f * std::ldexp(1.0f, exponent) < hi[axis])
+            exponent++;
+        node.origin[axis] = lo[axis];
+        node.exponent[axis] = static_cast<int8_t>(exponent);
+        scale[axis] = std::ldexp(1.0f, exponent);
+    }
+
+    auto quantize_min = [&](float value, int axis) {
+        int q = std::clamp(static_cast<int>(std::floor((value - lo[axis]) / scale[axis])), 0, 255);
+        while (q > 0 && lo[axis] + q * scale[axis] > value)
+            q--;
+        return static_cast<uint8_t>(q);
+    };
+    auto quantize_max = [&](float value, int axis) {
+        int q = std::clamp(static_cast<int>(std::ceil((value - lo[axis]) / scale[axis])), 0, 255);
+        while (q < 255 && lo[axis] + q * scale[axis] < value)
+            q++;
+        return static_cast<uint8_t>(q);
+    };
+
+    uint32_t n_interior = 0;
+    node.primitive_base = static_cast<uint32_t>(primitive_indices.size());
+    const auto &binary_primitives = binary.GetPrimitiveIndices();
+    for (int i = 0; i < n_children; i++) {
+        const Child &child = children[i];
+        Vector3f c_min = child.bounds.min(), c_max = child.bounds.max();
+        node.q_min_x[i] = quantize_min(c_min.x, 0);
+        node.q_min_y[i] = quantize_min(c_min.y, 1);
+        node.q_min_z[i] = quantize_min(c_min.z, 2);
+        node.q_max_x[i] = quantize_max(c_max.x, 0);
+        node.q_max_y[i] = quantize_max(c_max.y, 1);
+        node.q_max_z[i] = quantize_max(c_max.z, 2);
+        if (is_interior(child)) {
+            node.interior_mask |= static_cast<uint8_t>(1u << i);
+            n_interior++;
+        } else {
+            node.count[i] = static_cast<uint8_t>(child.n_primitives);
+            primitive_indices.insert(primitive_indices.end(), binary_primitives.begin() + child.primitives_offset,
+                                     binary_primitives.begin() + child.primitives_offset + child.n_primitives);
+        }
+    }
+
+    // Interior children are allocated as one block so that they stay consecutive
+    node.child_base = static_cast<uint32_t>(nodes.size());
+    nodes.resize(nodes.size() + n_interior);
+    nodes[node_index] = node;
+
+    uint32_t slot = node.child_base;
+    for (int i = 0; i < n_children; i++) {
+        const Child &child = children[i];
+        if (!is_interior(child))
+            continue;
+        if (child.n_primitives == 0) {
+            Collapse(binary, child.binary_index, slot++);
+            continue;
+        }
+
+        // Oversized leaf: up to 8 runs with the leaf's bounds, which recurse if still too large
+        Child runs[8];
+        uint32_t run_size = (child.n_primitives + 7) / 8;
+        int n_runs = 0;
+        for (uint32_t offset = 0; offset < child.n_primitives; offset += run_size)
+            runs[n_runs++] = {child.bounds, 0, child.primitives_offset + offset, std::min(run_size, child.n_primitives - offset)};
+        Emit(binary, child.bounds, runs, n_runs, slot++);
+    }
+}
+
+void QuantizedBVH::Reorder(BVHNodeLayout layout, size_t treelet_bytes)
+{
+    if (nodes.empty() || layout == BVHNodeLayout::DEPTH_FIRST)
+        return;
+
+    // Blocks: the root alone, then the interior children of each node in node order, so every
+    // block is numbered after its parent's
+    std::vector<uint32_t> block_first = {0}, block_size = {1};
+    std::vector<uint32_t> child_block(nodes.size(), 0); // block of a node's interior children, 0 for none
+    std::vector<float> node_areas(nodes.size());
+    node_areas[0] = bounds.SurfaceArea();
+    for (uint32_t index = 0; index < nodes.size(); index++) {
+        const QuantizedBVHNode &node = nodes[index];
+        if (node.interior_mask == 0)
+            continue;
+        child_block[index] = static_cast<uint32_t>(block_first.size());
+        block_first.push_back(node.child_base);
+        block_size.push_back(std::popcount(static_cast<unsigned>(node.interior_mask)));
+
+        uint32_t child = node.child_base;
+        for (int i = 0; i < 8; i++) {
+            if (!((node.interior_mask >> i) & 1))
+                continue;
+            auto decode = [&](uint8_t q, int axis) { return node.origin[axis] + q * std::ldexp(1.0f, node.exponent[axis]); };
+            Vector3f p_min(decode(node.q_min_x[i], 0), decode(node.q_min_y[i], 1), decode(node.q_min_z[i], 2));
+            Vector3f p_max(decode(node.q_max_x[i], 0), decode(node.q_max_y[i], 1), decode(node.q_max_z[i], 2));
+            node_areas[child++] = AABB(p_min, p_max).SurfaceArea();
+        }
+    }
+
+    auto children = [&](uint32_t block, uint32_t *out) {
+        int n = 0;
+        for (uint32_t index = block_first[block]; index < block_first[block] + block_size[block]; index++)
+            if (child_block[index] != 0)
+                out[n++] = child_block[index];
+        return n;
+    };
+    auto area = [&](uint32_t block) {
+        float sum = 0.0f;
+        for (uint32_t index = block_first[block]; index < block_first[block] + block_size[block]; index++)
+            sum += node_areas[index];
+        return sum;
+    };
+    auto bytes = [&](uint32_t block) { return block_size[block] * sizeof(QuantizedBVHNode); };
+    std::vector<uint32_t> order = ComputeNodeLayout(block_first.size(), layout, treelet_bytes, children, area, bytes);
+
+    std::vector<uint32_t> position(nodes.size());
+    std::vector<uint32_t> node_order;
+    node_order.reserve(nodes.size());
+    for (uint32_t block : order) {
+        for (uint32_t index = block_first[block]; index < block_first[block] + block_size[block]; index++) {
+            position[index] = static_cast<uint32_t>(node_order.size());
+            node_order.push_back(index);
+        }
+    }
+
+    std::vector<QuantizedBVHNode> reordered(nodes.size());
+    std::vector<uint32_t> reordered_primitives;
+    reordered_primitives.reserve(primitive_indices.size());
+    for (uint32_t i = 0; i < node_order.size(); i++) {
+        QuantizedBVHNode node = nodes[node_order[i]];
+        if (node.interior_mask != 0)
+            node.child_base = position[node.child_base];
+        uint32_t leaf_primitives = 0;
+        for (int slot = 0; slot < 8; slot++)
+            leaf_primitives += node.count[slot];
+        uint32_t first = static_cast<uint32_t>(reordered_primitives.size());
+        reordered_primitives.insert(reordered_primitives.end(), primitive_indices.begin() + node.primitive_base,
+                                    primitive_indices.begin() + node.primitive_base + leaf_primitives);
+        node.primitive_base = first;
+        reordered[i] = node;
+    }
+    nodes.swap(reordered);
+    primitive_indices.swap(reordered_primitives);
+}
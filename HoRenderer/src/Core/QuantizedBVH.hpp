@@ -0,0 +1,219 @@
+#pragma once
+
+#include "Util.hpp"
+#include "BVH.hpp"
+#include <bit>
+
+// 80-byte node with up to 8 children whose bounds are stored in 8 bits per plane, relative to
+// a grid over the node's own bounds: child min = origin + q_min * 2^exponent (rounded down, max
+// rounded up, so decoded boxes only ever grow). Interior children are consecutive nodes from
+// child_base, leaf children consecutive runs of primitive_indices from primitive_base, in slot
+// order. A WideBVHNode<8> takes 224 bytes for the same children.
+struct alignas(16) QuantizedBVHNode {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t interior_mask; // bit i set: slot i is a node
+    uint32_t child_base;
+    uint32_t primitive_base;
+    uint8_t count[8];      // primitives of a leaf slot, 0 for interior and empty slots
+    uint8_t q_min_x[8], q_min_y[8], q_min_z[8];
+    uint8_t q_max_x[8], q_max_y[8], q_max_z[8];
+};
+static_assert(sizeof(QuantizedBVHNode) == 80, "QuantizedBVHNode must stay 80 bytes");
+
+// 8-wide BVH with quantized child bounds, collapsed from a binary LinearBVH like WideBVH<8>.
+// The nodes take about a third of the memory of LinearBVH's or WideBVH<8>'s for the same tree;
+// the AVX child test decodes the bounds on the fly, one FMA per plane.
+class QuantizedBVH {
+public:
+    QuantizedBVH() {}
+    explicit QuantizedBVH(const LinearBVH &binary);
+
+    // Same contract as LinearBVH::Intersect
+    template <typename IntersectFn>
+    bool Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats = nullptr) const;
+
+    // Same contract as LinearBVH::Occluded
+    template <typename OccludedFn>
+    bool Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const;
+
+    AABB getBoundingBox() const { return bounds; }
+    size_t GetNodeCount() const { return nodes.size(); }
+    size_t MemoryBytes() const { return nodes.size() * sizeof(QuantizedBVHNode) + primitive_indices.size() * sizeof(uint32_t); }
+    const std::vector<uint32_t> &GetPrimitiveIndices() const { return primitive_indices; }
+
+    // Post-build pass, see WideBVH::Reorder. The interior children of a node move as one block
+    void Reorder(BVHNodeLayout layout, size_t treelet_bytes = 4096);
+
+private:
+    struct Child {
+        AABB bounds;
+        uint32_t binary_index;
+        uint32_t primitives_offset; // leaf children only
+        uint32_t n_primitives;      // 0 -> interior
+    };
+
+    // Fills nodes[node_index] from the binary subtree at binary_index
+    void Collapse(const LinearBVH &binary, uint32_t binary_index, uint32_t node_index);
+    // Quantizes children into nodes[node_index] and recurses into the interior ones
+    void Emit(const LinearBVH &binary, const AABB &node_bounds, const Child *children, int n_children, uint32_t node_index);
+
+    // Returns a bit mask of the children hit inside t_interval and writes their entry distances
+    static int IntersectChildren(const QuantizedBVHNode &node, const Vector3f &origin, const Vector3f &inv_dir,
+                                 const int dir_is_neg[3], Vector2f t_interval, float t_near[8]);
+
+private:
+    std::vector<QuantizedBVHNode> nodes;
+    std::vector<uint32_t> primitive_indices;
+    AABB bounds;
+};
+
+inline int QuantizedBVH::IntersectChildren(const QuantizedBVHNode &node, const Vector3f &origin, const Vector3f &inv_dir,
+                                           const int dir_is_neg[3], Vector2f t_interval, float t_near[8])
+{
+    // t = (q * scale + node origin - ray origin) * inv_dir. Folding scale into inv_dir would save the
+    // multiply but turns q = 0 into 0 * inf for axis-parallel rays
+    auto plane = [&](const uint8_t *q, int axis) {
+        float scale = std::bit_cast<float>(static_cast<uint32_t>(node.exponent[axis] + 127) << 23);
+        __m256 qf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(q))));
+        __m256 offset = _mm256_set1_ps(node.origin[axis] - origin[axis]);
+        return _mm256_mul_ps(_mm256_fmadd_ps(qf, _mm256_set1_ps(scale), offset), _mm256_set1_ps(inv_dir[axis]));
+    };
+
+    __m256 near_x = plane(dir_is_neg[0] ? node.q_max_x : node.q_min_x, 0);
+    __m256 near_y = plane(dir_is_neg[1] ? node.q_max_y : node.q_min_y, 1);
+    __m256 near_z = plane(dir_is_neg[2] ? node.q_max_z : node.q_min_z, 2);
+    __m256 far_x = plane(dir_is_neg[0] ? node.q_min_x : node.q_max_x, 0);
+    __m256 far_y = plane(dir_is_neg[1] ? node.q_min_y : node.q_max_y, 1);
+    __m256 far_z = plane(dir_is_neg[2] ? node.q_min_z : node.q_max_z, 2);
+
+    __m256 t_min = _mm256_max_ps(_mm256_max_ps(near_x, near_y), _mm256_max_ps(near_z, _mm256_set1_ps(t_interval.x)));
+    __m256 t_max = _mm256_min_ps(_mm256_min_ps(far_x, far_y), _mm256_min_ps(far_z, _mm256_set1_ps(t_interval.y)));
+    _mm256_storeu_ps(t_near, t_min);
+
+    // Empty slots decode to a valid box at the origin, so they are masked out here
+    __m128i counts = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(node.count));
+    int leaf_mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(counts, _mm_setzero_si128())) & 0xFF;
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ)) & (leaf_mask | node.interior_mask);
+}
+
+template <typename IntersectFn>
+bool QuantizedBVH::Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats) const
+{
+    if (nodes.empty())
+        return false;
+    if (stats)
+        stats->rays++;
+
+    const Vector3f &origin = r.origin();
+    Vector3f inv_dir = 1.0f / r.direction();
+    int dir_is_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+
+    struct StackEntry {
+        uint32_t child;
+        uint32_t count; // 0 -> interior node
+        float t_near;
+    };
+    StackEntry stack[MaxBVHDepth * 8];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, t_interval.x};
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.t_near > t_interval.y)
+            continue;
+
+        if (entry.count > 0) {
+            if (stats) {
+                stats->primitive_tests += entry.count;
+                stats->Touch(&primitive_indices[entry.child], entry.count * sizeof(uint32_t));
+            }
+            if (IntersectLeafPrimitives(intersect, &primitive_indices[entry.child], entry.count, t_interval))
+                hit_anything = true;
+            continue;
+        }
+
+        const QuantizedBVHNode &node = nodes[entry.child];
+        if (stats) {
+            stats->node_visits++;
+            stats->Touch(&node, sizeof(node));
+        }
+        alignas(32) float t_near[8];
+        int mask = IntersectChildren(node, origin, inv_dir, dir_is_neg, t_interval, t_near);
+        if (mask == 0)
+            continue;
+
+        // Slot offsets are prefix counts over the slots before it, see QuantizedBVHNode
+        uint32_t interior_before[8], primitives_before[8];
+        uint32_t interior = 0, primitives = 0;
+        for (int i = 0; i < 8; i++) {
+            interior_before[i] = interior;
+            primitives_before[i] = primitives;
+            interior += (node.interior_mask >> i) & 1;
+            primitives += node.count[i];
+        }
+
+        // Sort the hit children far to near so the nearest one is popped first
+        int first = stack_size;
+        while (mask) {
+            int i = std::countr_zero(static_cast<unsigned>(mask));
+            mask &= mask - 1;
+            StackEntry child = node.count[i] > 0 ? StackEntry{node.primitive_base + primitives_before[i], node.count[i], t_near[i]}
+                                                 : StackEntry{node.child_base + interior_before[i], 0, t_near[i]};
+            int j = stack_size++;
+            while (j > first && stack[j - 1].t_near < child.t_near) {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hit_anything;
+}
+
+template <typename OccludedFn>
+bool QuantizedBVH::Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const
+{
+    if (nodes.empty())
+        return false;
+
+    const Vector3f &origin = r.origin();
+    Vector3f inv_dir = 1.0f / r.direction();
+    int dir_is_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+
+    // Any hit ends the query, so children are pushed unsorted
+    struct StackEntry {
+        uint32_t child;
+        uint32_t count;
+    };
+    StackEntry stack[MaxBVHDepth * 8];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0};
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.count > 0) {
+            for (uint32_t i = 0; i < entry.count; i++) {
+                if (occluded(primitive_indices[entry.child + i]))
+                    return true;
+            }
+            continue;
+        }
+
+        const QuantizedBVHNode &node = nodes[entry.child];
+        alignas(32) float t_near[8];
+        int mask = IntersectChildren(node, origin, inv_dir, dir_is_neg, t_interval, t_near);
+        uint32_t interior = node.child_base, primitives = node.primitive_base;
+        for (int i = 0; i < 8; i++) {
+            bool is_interior = (node.interior_mask >> i) & 1;
+            if ((mask >> i) & 1)
+                stack[stack_size++] = is_interior ? StackEntry{interior, 0} : StackEntry{primitives, node.count[i]};
+            interior += is_interior;
+            primitives += node.count[i];
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Util.hpp"
+#include "Ray.hpp"
+#include "AABB.hpp"
+#include <bit>
+
+// Up to 8 rays traced together through LinearBVH::IntersectPacket/OccludedPacket, one per AVX lane.
+// Meant for coherent rays: the primary rays of a 4x2 pixel tile, or their shadow rays towards the
+// lights. Lanes whose bit is clear in `active` are skipped and may hold anything.
+struct RayPacket {
+    static constexpr int Size = 8;
+
+    alignas(32) float org_x[Size], org_y[Size], org_z[Size];
+    alignas(32) float inv_x[Size], inv_y[Size], inv_z[Size];
+    alignas(32) float t_min[Size], t_max[Size];
+    Ray rays[Size];
+    int active = 0;
+
+    void Set(int lane, const Ray &r, Vector2f t_interval) {
+        const Vector3f &o = r.origin();
+        Vector3f inv_dir = 1.0f / r.direction();
+        org_x[lane] = o.x;
+        org_y[lane] = o.y;
+        org_z[lane] = o.z;
+        inv_x[lane] = inv_dir.x;
+        inv_y[lane] = inv_dir.y;
+        inv_z[lane] = inv_dir.z;
+        t_min[lane] = t_interval.x;
+        t_max[lane] = t_interval.y;
+        rays[lane] = r;
+        active |= 1 << lane;
+    }
+
+    // Lowest active lane, -1 for an empty packet
+    int FirstLane() const { return active ? std::countr_zero(static_cast<unsigned>(active)) : -1; }
+};
+
+// Bounds of the whole packet, for culling a node once instead of once per lane. Only built when the
+// active lanes agree on the direction sign of every axis and none is axis-parallel, otherwise the
+// interval products below are not bounds of the per-lane slabs. Axes with negative directions are
+// mirrored, so every bound is a single product and the three axes go through one SSE register.
+struct PacketFrustum {
+    __m128 org_lo, org_hi;  // mirrored origin range
+    __m128 inv_lo, inv_hi;  // mirrored (positive) reciprocal direction range
+    __m128 neg_mask, flip;  // axes with negative directions: all bits, and the sign bit
+    float t_min, t_max;
+    bool valid = false;
+
+    explicit PacketFrustum(const RayPacket &packet) {
+        const float *org[3] = {packet.org_x, packet.org_y, packet.org_z};
+        const float *inv[3] = {packet.inv_x, packet.inv_y, packet.inv_z};
+        int first = packet.FirstLane();
+        if (first < 0)
+            return;
+        alignas(16) float o_lo[4] = {}, o_hi[4] = {}, i_lo[4] = {}, i_hi[4] = {}, neg[4] = {}, sign[4] = {};
+        float mirror[3];
+        for (int axis = 0; axis < 3; axis++) {
+            bool negative = inv[axis][first] < 0.0f;
+            mirror[axis] = negative ? -1.0f : 1.0f;
+            o_lo[axis] = o_hi[axis] = mirror[axis] * org[axis][first];
+            i_lo[axis] = i_hi[axis] = mirror[axis] * inv[axis][first];
+            neg[axis] = negative ? std::bit_cast<float>(~0u) : 0.0f;
+            sign[axis] = negative ? -0.0f : 0.0f;
+        }
+        t_min = Infinity;
+        t_max = -Infinity;
+        for (int mask = packet.active; mask; mask &= mask - 1) {
+            int lane = std::countr_zero(static_cast<unsigned>(mask));
+            for (int axis = 0; axis < 3; axis++) {
+                float o = mirror[axis] * org[axis][lane], inv_dir = mirror[axis] * inv[axis][lane];
+                if (inv_dir < 0.0f || std::isinf(inv_dir))
+                    return;
+                o_lo[axis] = std::min(o_lo[axis], o);
+                o_hi[axis] = std::max(o_hi[axis], o);
+                i_lo[axis] = std::min(i_lo[axis], inv_dir);
+                i_hi[axis] = std::max(i_hi[axis], inv_dir);
+            }
+            t_min = std::min(t_min, packet.t_min[lane]);
+            t_max = std::max(t_max, packet.t_max[lane]);
+        }
+        org_lo = _mm_load_ps(o_lo);
+        org_hi = _mm_load_ps(o_hi);
+        inv_lo = _mm_load_ps(i_lo);
+        inv_hi = _mm_load_ps(i_hi);
+        neg_mask = _mm_load_ps(neg);
+        flip = _mm_load_ps(sign);
+        valid = true;
+    }
+
+    // True when no lane of the packet can enter box inside [t_min, t_max]: the latest entry of any
+    // lane is bounded below by the nearest plane over the farthest origin, the exit above likewise
+    bool Misses(const AABB &box) const {
+        Vector3f b_min = box.min(), b_max = box.max();
+        __m128 lo = _mm_set_ps(0.0f, b_min.z, b_min.y, b_min.x);
+        __m128 hi = _mm_set_ps(0.0f, b_max.z, b_max.y, b_max.x);
+        // Mirrored axes swap their planes
+        __m128 near_plane = _mm_xor_ps(_mm_blendv_ps(lo, hi, neg_mask), flip);
+        __m128 far_plane = _mm_xor_ps(_mm_blendv_ps(hi, lo, neg_mask), flip);
+        __m128 zero = _mm_setzero_ps();
+
+        __m128 d_near = _mm_sub_ps(near_plane, org_hi);
+        __m128 enter = _mm_mul_ps(d_near, _mm_blendv_ps(inv_hi, inv_lo, _mm_cmpge_ps(d_near, zero)));
+        __m128 d_far = _mm_sub_ps(far_plane, org_lo);
+        __m128 exit = _mm_mul_ps(d_far, _mm_blendv_ps(inv_lo, inv_hi, _mm_cmpge_ps(d_far, zero)));
+
+        alignas(16) float enters[4], exits[4];
+        _mm_store_ps(enters, enter);
+        _mm_store_ps(exits, exit);
+        float t_enter = std::max(std::max(enters[0], enters[1]), std::max(enters[2], t_min));
+        float t_exit = std::min(std::min(exits[0], exits[1]), std::min(exits[2], t_max));
+        return t_enter > t_exit;
+    }
+};
@@ -108,7 +108,9 @@ void Renderer::Run() {
         glBindTexture(GL_TEXTURE_2D, nowFrame);
         glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, integrator->GetFloatPixels());
         pass1.m_shader.Use();
-        pass1.m_shader.SetUnInt("frameCounter", frameCounter++);
+        // With adaptive sampling the integrator already averages the frames
+        pass1.m_shader.SetUnInt("frameCounter", integrator->UsesAdaptiveSampling() ? 0u : frameCounter);
+        frameCounter++;
 
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, nowFrame);
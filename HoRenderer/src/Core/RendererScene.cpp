@@ -6,6 +6,7 @@
 #include "Material.hpp"
 #include "Filter.hpp"
 #include "Transform.hpp"
+#include "Instance.hpp"
 #include "Light.hpp"
 #include "Medium.hpp"
 #include "PhaseFunction.hpp"
@@ -13,7 +14,7 @@
 
 namespace RendererScene
 {    
-    std::shared_ptr<Renderer> CornellBox()
+    CameraParams CornellBoxCamera()
     {
         CameraParams camParams = {
             1.0f,                              
@@ -25,13 +26,11 @@ namespace RendererScene
             0.0f,                              
             1.0f                               
         };
-        std::unique_ptr<Camera> camera = std::make_unique<Camera>();
-        camera->Create(camParams);
-
-        std::unique_ptr<Integrator> integrator = std::make_unique<Integrator>(camera->image_width, camera->image_height, 12, 30);
-        std::unique_ptr<Sampler> sampler = std::make_unique<Sampler>(FilterType::GAUSSIAN);
-        std::unique_ptr<Scene> scene = std::make_unique<Scene>();
+        return camParams;
+    }
 
+    void BuildCornellBox(Scene &scene)
+    {
         auto emitMaterial = std::make_shared<Emission>(Vector3f(50.0f, 50.0f, 50.0f));
         auto redMaterial = std::make_shared<Diffuse>(Vector3f(0.65f, 0.05f, 0.05f));
         auto whiteMaterial =  std::make_shared<Diffuse>(Vector3f(0.73f, 0.73f, 0.73f));
@@ -50,64 +49,181 @@ namespace RendererScene
         auto glassMaterial = std::make_shared<Glass>(1.5f);
         // auto smokePhase = std::make_shared<HenyeyGreensteinPhase>(Vector3f(0.7f, 0.7f, 0.7f), 0.3f);
 
-        scene->Add(std::make_shared<Quad>(Vector3f(555.0f, 0.0f, 0.0f),
-                                          Vector3f(0.0f, 555.0f, 0.0f),
-                                          Vector3f(0.0f, 0.0f, 555.0f),
-                                          greenMaterial));
+        scene.Add(std::make_shared<Quad>(Vector3f(555.0f, 0.0f, 0.0f),
+                                         Vector3f(0.0f, 555.0f, 0.0f),
+                                         Vector3f(0.0f, 0.0f, 555.0f),
+                                         greenMaterial));
 
-        scene->Add(std::make_shared<Quad>(Vector3f(0.0f, 0.0f, 0.0f),
-                                          Vector3f(0.0f, 555.0f, 0.0f),
-                                          Vector3f(0.0f, 0.0f, 555.0f),
-                                          redMaterial));
+        scene.Add(std::make_shared<Quad>(Vector3f(0.0f, 0.0f, 0.0f),
+                                         Vector3f(0.0f, 555.0f, 0.0f),
+                                         Vector3f(0.0f, 0.0f, 555.0f),
+                                         redMaterial));
 
         auto ceiling_quad = std::make_shared<Quad>(Vector3f(213.0f, 548.8f, 227.0f),
                                                    Vector3f(130.0f, 0.0f, 0.0f),
                                                    Vector3f(0.0f, 0.0f, 105.0f),
                                                    emitMaterial);
         auto ceiling_light = std::make_shared<QuadAreaLight>(ceiling_quad);
-        scene->Add(ceiling_light);
+        scene.Add(ceiling_light);
 
-        scene->Add(std::make_shared<Quad>(Vector3f(0.0f, 0.0f, 0.0f),
-                                          Vector3f(555.0f, 0.0f, 0.0f),
-                                          Vector3f(0.0f, 0.0f, 555.0f),
-                                          whiteMaterial));
+        scene.Add(std::make_shared<Quad>(Vector3f(0.0f, 0.0f, 0.0f),
+                                         Vector3f(555.0f, 0.0f, 0.0f),
+                                         Vector3f(0.0f, 0.0f, 555.0f),
+                                         whiteMaterial));
 
-        scene->Add(std::make_shared<Quad>(Vector3f(555.0f, 555.0f, 555.0f),
-                                          Vector3f(-555.0f, 0.0f, 0.0f),
-                                          Vector3f(0.0f, 0.0f, -555.0f),
-                                          whiteMaterial));
+        scene.Add(std::make_shared<Quad>(Vector3f(555.0f, 555.0f, 555.0f),
+                                         Vector3f(-555.0f, 0.0f, 0.0f),
+                                         Vector3f(0.0f, 0.0f, -555.0f),
+                                         whiteMaterial));
 
-        scene->Add(std::make_shared<Quad>(Vector3f(0.0f, 0.0f, 555.0f),
-                                          Vector3f(0.0f, 555.0f, 0.0f),
-                                          Vector3f(555.0f, 0.0f, 0.0f),
-                                          whiteMaterial));
+        scene.Add(std::make_shared<Quad>(Vector3f(0.0f, 0.0f, 555.0f),
+                                         Vector3f(0.0f, 555.0f, 0.0f),
+                                         Vector3f(555.0f, 0.0f, 0.0f),
+                                         whiteMaterial));
 
         auto box1 = std::make_shared<Box>(Vector3f(0.0f,0.0f,0.0f),
                                          Vector3f(165.0f, 165.0f, 165.0f),
                                          whiteMaterial);
         auto rotate_box1 = Transform::rotate(box1, RotationAxis::Y,15.0f);
         auto translated_box1 = Transform::translate(rotate_box1, Vector3f(212.5f,82.5f,147.5f));
-        scene->Add(translated_box1);
+        scene.Add(translated_box1);
         // auto smoke_medium = std::make_shared<HomogeneousMedium>(translated_box1,                
         //                                                         Vector3f(0.05f, 0.05f, 0.05f),    
         //                                                         Vector3f(0.02f, 0.02f, 0.02f), 
         //                                                         smokePhase);
-        // scene->Add(smoke_medium);
+        // scene.Add(smoke_medium);
         
         auto box2 = std::make_shared<Box>(Vector3f(0.0f, 0.0f, 0.0f),
-                                          Vector3f(165.0f, 330.0f, 165.0f),
-                                          whiteMaterial);
+                                         Vector3f(165.0f, 330.0f, 165.0f),
+                                         whiteMaterial);
         auto rotate_box2 = Transform::rotate(box2, RotationAxis::Y,-18.0f);
         auto translated_box2 = Transform::translate(rotate_box2, Vector3f(347.5f, 165.0f, 377.5f));
-        scene->Add(translated_box2);
+        scene.Add(translated_box2);
+    }
+
+    void BuildSphereField(Scene &scene, size_t count)
+    {
+        // Deterministic so that benchmark runs are comparable
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> albedo(0.1f, 0.9f);
+
+        std::vector<std::shared_ptr<Material>> palette;
+        for (int i = 0; i < 16; i++)
+            palette.push_back(std::make_shared<Diffuse>(Vector3f(albedo(rng), albedo(rng), albedo(rng))));
+
+        // Keep the total sphere volume roughly constant as the count grows
+        float radius = 100.0f / std::cbrt(static_cast<float>(std::max<size_t>(count, 1))) * 0.4f;
+        for (size_t i = 0; i < count; i++) {
+            Vector3f center(position(rng), position(rng), position(rng));
+            scene.Add(std::make_shared<Sphere>(center, radius, palette[i % palette.size()]));
+        }
+    }
+
+    void BuildSlivers(Scene &scene, size_t sliver_count, size_t sphere_count)
+    {
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        auto material = std::make_shared<Diffuse>(Vector3f(0.6f, 0.6f, 0.6f));
+
+        for (size_t i = 0; i < sliver_count; i++) {
+            Vector3f direction = glm::normalize(Vector3f(unit(rng), unit(rng), unit(rng)) + Vector3f(0.0f, 0.0f, 1e-3f));
+            Vector3f side = glm::normalize(glm::cross(direction, Vector3f(unit(rng), unit(rng), unit(rng)) + Vector3f(1e-3f, 0.0f, 0.0f)));
+            Vector3f u = 150.0f * direction, v = 0.5f * side;
+            Vector3f center(position(rng), position(rng), position(rng));
+            scene.Add(std::make_shared<Quad>(center - 0.5f * u - 0.5f * v, u, v, material));
+        }
+        for (size_t i = 0; i < sphere_count; i++)
+            scene.Add(std::make_shared<Sphere>(Vector3f(position(rng), position(rng), position(rng)), 0.5f, material));
+    }
+
+    void BuildForest(Scene &scene, size_t count)
+    {
+        auto bark = std::make_shared<Diffuse>(Vector3f(0.35f, 0.2f, 0.1f));
+        auto leaves = std::make_shared<Diffuse>(Vector3f(0.1f, 0.45f, 0.12f));
+        auto grass = std::make_shared<Diffuse>(Vector3f(0.3f, 0.4f, 0.2f));
+
+        // Geometry of a single tree, stored once no matter how many are placed
+        std::vector<std::shared_ptr<Hittable>> tree = {
+            std::make_shared<Box>(Vector3f(0.0f, 1.0f, 0.0f), Vector3f(0.3f, 2.0f, 0.3f), bark),
+            std::make_shared<Sphere>(Vector3f(0.0f, 2.6f, 0.0f), 1.0f, leaves),
+            std::make_shared<Sphere>(Vector3f(0.4f, 3.3f, 0.2f), 0.7f, leaves),
+            std::make_shared<Sphere>(Vector3f(-0.3f, 3.5f, -0.3f), 0.5f, leaves)
+        };
+        auto blas = std::make_shared<BottomLevelBVH>(tree);
+
+        // Deterministic so that benchmark runs are comparable
+        std::mt19937 rng(1234);
+        float extent = 2.0f * std::sqrt(static_cast<float>(std::max<size_t>(count, 1)));
+        std::uniform_real_distribution<float> position(-extent, extent);
+        std::uniform_real_distribution<float> angle(0.0f, 2.0f * PI);
+        std::uniform_real_distribution<float> tilt(-0.1f, 0.1f);
+        std::uniform_real_distribution<float> size(0.7f, 1.3f);
+        std::uniform_real_distribution<float> stretch(0.8f, 1.4f);
+
+        for (size_t i = 0; i < count; i++) {
+            // Scale with a random height, lean a little around x, then turn around y
+            float s = size(rng);
+            Matrix4f scale(1.0f);
+            scale[0][0] = s;
+            scale[1][1] = s * stretch(rng);
+            scale[2][2] = s;
+            float lean = tilt(rng);
+            Matrix4f rotate_x(1.0f);
+            rotate_x[1] = Vector4f(0.0f, std::cos(lean), std::sin(lean), 0.0f);
+            rotate_x[2] = Vector4f(0.0f, -std::sin(lean), std::cos(lean), 0.0f);
+            float yaw = angle(rng);
+            Matrix4f rotate_y(1.0f);
+            rotate_y[0] = Vector4f(std::cos(yaw), 0.0f, -std::sin(yaw), 0.0f);
+            rotate_y[2] = Vector4f(std::sin(yaw), 0.0f, std::cos(yaw), 0.0f);
+            Matrix4f translate(1.0f);
+            translate[3] = Vector4f(position(rng), 0.0f, position(rng), 1.0f);
+
+            scene.Add(std::make_shared<Instance>(blas, translate * rotate_y * rotate_x * scale));
+        }
+
+        scene.Add(std::make_shared<Quad>(Vector3f(-extent, 0.0f, -extent),
+                                         Vector3f(0.0f, 0.0f, 2.0f * extent),
+                                         Vector3f(2.0f * extent, 0.0f, 0.0f),
+                                         grass));
+    }
+
+    CameraParams ForestCamera(size_t count)
+    {
+        float extent = 2.0f * std::sqrt(static_cast<float>(std::max<size_t>(count, 1)));
+        CameraParams camParams = {
+            1.0f,
+            900,
+            40.0f,
+            Vector3f(0.0f, 0.5f * extent + 10.0f, -extent - 20.0f),
+            Vector3f(0.0f, 0.0f, 0.0f),
+            Vector3f(0.0f, 1.0f, 0.0f),
+            0.0f,
+            1.0f
+        };
+        return camParams;
+    }
+
+    std::shared_ptr<Renderer> CornellBox(IntegratorType integrator_type)
+    {
+        CameraParams camParams = CornellBoxCamera();
+        std::unique_ptr<Camera> camera = std::make_unique<Camera>();
+        camera->Create(camParams);
+
+        std::unique_ptr<Integrator> integrator = Integrator::Create(integrator_type, camera->image_width, camera->image_height, 0, 30);
+        std::unique_ptr<Sampler> sampler = std::make_unique<Sampler>(FilterType::GAUSSIAN);
+        std::unique_ptr<Scene> scene = std::make_unique<Scene>();
+
+        BuildCornellBox(*scene);
 
-        // scene->BuildBVH();
+        scene->BuildBVH();
         scene->BuildLightTable(); 
         auto renderer = std::make_shared<Renderer>(std::move(camera), std::move(integrator), std::move(sampler), std::move(scene));
         return renderer;
     }
 
-    std::shared_ptr<Renderer> TestScene()
+    std::shared_ptr<Renderer> TestScene(IntegratorType integrator_type)
     {
         CameraParams camParams = {
             16.0f / 9.0f,                       
@@ -122,7 +238,7 @@ namespace RendererScene
         std::unique_ptr<Camera> camera = std::make_unique<Camera>();
         camera->Create(camParams);
 
-        std::unique_ptr<Integrator> integrator = std::make_unique<Integrator>(camera->image_width, camera->image_height, 12, 50);
+        std::unique_ptr<Integrator> integrator = Integrator::Create(integrator_type, camera->image_width, camera->image_height, 0, 50);
         std::unique_ptr<Sampler> sampler = std::make_unique<Sampler>(FilterType::GAUSSIAN);
         std::unique_ptr<Scene> scene = std::make_unique<Scene>();
 
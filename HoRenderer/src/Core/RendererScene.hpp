@@ -7,7 +7,19 @@
 #include "Renderer.hpp"
 
 namespace RendererScene {
-    std::shared_ptr<Renderer> CornellBox();
+    // Geometry and camera only, so they can be used without creating a window (e.g. benchmarks)
+    CameraParams CornellBoxCamera();
+    void BuildCornellBox(Scene &scene);
+    void BuildSphereField(Scene &scene, size_t count);
+    // Long thin quads in random orientations running through a field of small spheres. The quad
+    // bounds cover most of the field, so object splits cannot separate them from the spheres
+    void BuildSlivers(Scene &scene, size_t sliver_count, size_t sphere_count);
+    // One shared tree placed `count` times through Instance, plus a ground quad
+    void BuildForest(Scene &scene, size_t count);
+    CameraParams ForestCamera(size_t count);
 
-    std::shared_ptr<Renderer> TestScene();
+    // integrator_type picks the integrator of the job, see IntegratorType
+    std::shared_ptr<Renderer> CornellBox(IntegratorType integrator_type = IntegratorType::PATH);
+
+    std::shared_ptr<Renderer> TestScene(IntegratorType integrator_type = IntegratorType::PATH);
 }
\ No newline at end of file
@@ -3,9 +3,17 @@
 */
 #include "Scene.hpp"
 #include "BVH.hpp"
+#include "WideBVH.hpp"
+#include "QuantizedBVH.hpp"
+#include "LazyBVH.hpp"
+#include "EmbreeScene.hpp"
+#include "CompiledScene.hpp"
+#include "ThreadPool.hpp"
 #include "Light.hpp"
 #include "Material.hpp"
 #include "Sampler.hpp"
+#include <chrono>
+#include <mutex>
 
 
 AliasTable1D::AliasTable1D(const std::vector<float>& distrib) {
@@ -62,20 +70,62 @@ void Scene::Clean()
 {
     hit_objects.clear();
     bvh_tree.reset();
+    linear_bvh.reset();
+    wide_bvh4.reset();
+    wide_bvh8.reset();
+    quantized_bvh.reset();
+    lazy_bvh.reset();
+    embree_scene.reset();
+    compiled.reset();
+    materials.Clear();
+    pending_primitives.clear();
+    pending_update = false;
     lights.clear();
 }
 
+// SurfaceHit keeps the wrappers a hit went through in a fixed stack, deeper nesting is refused
+static bool FitsWrapperStack(const Hittable &object)
+{
+    int depth = object.WrapperDepth();
+    if (depth <= SurfaceHit::MaxWrapperDepth)
+        return true;
+    std::cerr << "Scene: object nested " << depth << " transforms deep, at most "
+              << SurfaceHit::MaxWrapperDepth << " are supported; object not added" << std::endl;
+    return false;
+}
+
 void Scene::Add(std::shared_ptr<Hittable> object)
 {
+    if (!FitsWrapperStack(*object))
+        return;
+    object->BindMaterials(materials);
     hit_objects.push_back(object);
 }
 
 void Scene::Add(std::shared_ptr<Light> light)
 {
-    lights.push_back(light);
     auto shape = light->GetShape();
-    if (shape) 
+    if (shape && !FitsWrapperStack(*shape))
+        return;
+    lights.push_back(light);
+    if (shape) {
+        shape->BindMaterials(materials);
         hit_objects.push_back(shape);
+    }
+}
+
+void Scene::BindMaterials([[maybe_unused]] MaterialTable &table)
+{
+    std::cerr << "Scene::BindMaterials: a scene cannot be added to another one, "
+              << "wrap its objects in a BottomLevelBVH and add an Instance instead" << std::endl;
+}
+
+int Scene::WrapperDepth() const
+{
+    int depth = 0;
+    for (const auto &object : hit_objects)
+        depth = std::max(depth, object->WrapperDepth());
+    return depth;
 }
 
 const std::vector<std::shared_ptr<Hittable>> Scene::GetObjects() const
@@ -87,16 +137,228 @@ const std::vector<std::shared_ptr<Light>>& Scene::GetLights() const {
     return lights;
 }
 
+void Scene::Compile()
+{
+    compiled = std::make_shared<CompiledScene>(hit_objects, materials);
+}
+
 void Scene::BuildBVH()
 {
-    if (!hit_objects.empty()) 
-    {
-        // auto start_time = std::chrono::high_resolution_clock::now();
-        bvh_tree = std::make_shared<BVHnode>(hit_objects, 0, hit_objects.size());
-        // auto end_time = std::chrono::high_resolution_clock::now();
-        // auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-        // std::cout << "BVH build: " << hit_objects.size() << " objects, Time: " << duration.count() << "ms" << std::endl;
+    bvh_tree.reset();
+    linear_bvh.reset();
+    wide_bvh4.reset();
+    wide_bvh8.reset();
+    quantized_bvh.reset();
+    lazy_bvh.reset();
+    embree_scene.reset();
+    compiled.reset();
+    build_stats = BVHBuildStats();
+    pending_primitives.clear();
+    pending_update = false;
+    effective_accelerator = accelerator;
+#ifndef HO_EMBREE
+    if (accelerator == AcceleratorType::EMBREE) {
+        static std::once_flag warned;
+        std::call_once(warned, [] {
+            std::cerr << "Scene::BuildBVH: built without Embree (xmake f --embree=y), using LINEAR_BVH" << std::endl;
+        });
+        effective_accelerator = AcceleratorType::LINEAR_BVH;
+    }
+#endif
+    if (hit_objects.empty()) 
+        return;
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    switch (effective_accelerator) {
+    case AcceleratorType::BVH_TREE: {
+        // BVHnode reorders the list it is given, keep hit_objects stable
+        auto objects = hit_objects;
+        bvh_tree = std::make_shared<BVHnode>(objects, 0, objects.size());
+        break;
+    }
+    case AcceleratorType::LINEAR_BVH:
+    case AcceleratorType::WIDE_BVH4:
+    case AcceleratorType::WIDE_BVH8:
+    case AcceleratorType::QUANTIZED_BVH: {
+        Compile();
+        std::vector<AABB> bounds(compiled->PrimitiveCount());
+        for (uint32_t i = 0; i < bounds.size(); i++)
+            bounds[i] = compiled->PrimitiveBounds(i);
+        auto polygon = [this](uint32_t primitive, Vector3f *vertices) { return compiled->PrimitivePolygon(primitive, vertices); };
+        linear_bvh = std::make_shared<LinearBVH>(bounds, build_options, &build_stats, polygon);
+        full_build_sah_cost = build_stats.sah_cost;
+        // The wide trees are collapsed from the binary one, which is kept for UpdateBVH
+        build_stats.memory_bytes = linear_bvh->MemoryBytes();
+        if (effective_accelerator == AcceleratorType::WIDE_BVH4) {
+            wide_bvh4 = std::make_shared<WideBVH<4>>(*linear_bvh);
+            wide_bvh4->Reorder(build_options.layout, build_options.treelet_bytes);
+            build_stats.memory_bytes = wide_bvh4->MemoryBytes();
+        } else if (effective_accelerator == AcceleratorType::WIDE_BVH8) {
+            wide_bvh8 = std::make_shared<WideBVH<8>>(*linear_bvh);
+            wide_bvh8->Reorder(build_options.layout, build_options.treelet_bytes);
+            build_stats.memory_bytes = wide_bvh8->MemoryBytes();
+        } else if (effective_accelerator == AcceleratorType::QUANTIZED_BVH) {
+            // Keeping the binary tree would cost more than the quantized one saves
+            quantized_bvh = std::make_shared<QuantizedBVH>(*linear_bvh);
+            quantized_bvh->Reorder(build_options.layout, build_options.treelet_bytes);
+            build_stats.memory_bytes = quantized_bvh->MemoryBytes();
+            linear_bvh.reset();
+        }
+        compiled->SortStorage(wide_bvh4 ? wide_bvh4->GetPrimitiveIndices() : wide_bvh8 ? wide_bvh8->GetPrimitiveIndices() :
+                              quantized_bvh ? quantized_bvh->GetPrimitiveIndices() : linear_bvh->GetPrimitiveIndices());
+        break;
+    }
+    case AcceleratorType::LAZY_BVH: {
+        // Storage stays in scene order, the leaf order is not known until every cluster is built
+        Compile();
+        std::vector<AABB> bounds(compiled->PrimitiveCount());
+        for (uint32_t i = 0; i < bounds.size(); i++)
+            bounds[i] = compiled->PrimitiveBounds(i);
+        auto polygon = [this](uint32_t primitive, Vector3f *vertices) { return compiled->PrimitivePolygon(primitive, vertices); };
+        lazy_bvh = std::make_shared<LazyBVH>(std::move(bounds), build_options, &build_stats, polygon);
+        build_stats.memory_bytes = lazy_bvh->MemoryBytes();
+        break;
+    }
+    case AcceleratorType::EMBREE:
+#ifdef HO_EMBREE
+        embree_scene = std::make_shared<EmbreeScene>(hit_objects);
+#endif
+        break;
+    case AcceleratorType::NONE:
+        return;
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    build_stats.build_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    if (verbose)
+        PrintBuildStats();
+}
+
+void Scene::PrintBuildStats() const
+{
+    std::cout << (build_stats.from_cache ? "BVH load from cache: " : "BVH build: ") << hit_objects.size() << " objects";
+    if (compiled)
+        std::cout << " (" << compiled->SphereCount() << " spheres, " << compiled->QuadCount() << " quads, " << compiled->ObjectCount() << " other)";
+    std::cout << ", Time: " << build_stats.build_ms << "ms";
+    if (effective_accelerator != AcceleratorType::BVH_TREE && effective_accelerator != AcceleratorType::EMBREE)
+        std::cout << ", SAH cost: " << build_stats.sah_cost << ", Nodes: " << build_stats.node_count;
+    if (build_stats.memory_bytes > 0)
+        std::cout << ", Memory: " << build_stats.memory_bytes / (1024.0 * 1024.0) << "MB";
+    if (build_stats.duplicate_references > 0)
+        std::cout << ", Duplicates: " << build_stats.duplicate_references;
+    if (lazy_bvh)
+        std::cout << ", Pending clusters: " << lazy_bvh->ClusterCount();
+    std::cout << std::endl;
+}
+
+size_t Scene::AddObject(std::shared_ptr<Hittable> object)
+{
+    if (!FitsWrapperStack(*object))
+        return hit_objects.size();
+    Add(object);
+    if (compiled)
+        compiled->AddObject(object, materials, pending_primitives);
+    pending_update = true;
+    return hit_objects.size() - 1;
+}
+
+void Scene::UpdateObject(size_t index, std::shared_ptr<Hittable> object)
+{
+    if (!FitsWrapperStack(*object))
+        return;
+    object->BindMaterials(materials);
+    // An area light moves to the new shape, or goes away when that one cannot carry it
+    auto light = std::find_if(lights.begin(), lights.end(), [&](const std::shared_ptr<Light> &light) {
+        return light->GetShape() == hit_objects[index];
+    });
+    if (light != lights.end()) {
+        if (auto rebound = (*light)->Rebind(object))
+            *light = rebound;
+        else
+            lights.erase(light);
+        BuildLightTable();
+    }
+    hit_objects[index] = object;
+    if (compiled)
+        compiled->UpdateObject(static_cast<uint32_t>(index), object, materials, pending_primitives);
+    pending_update = true;
+}
+
+void Scene::RemoveObject(size_t index)
+{
+    // An area light goes together with its shape
+    auto light = std::find_if(lights.begin(), lights.end(), [&](const std::shared_ptr<Light> &light) {
+        return light->GetShape() == hit_objects[index];
+    });
+    if (light != lights.end()) {
+        lights.erase(light);
+        BuildLightTable();
     }
+    hit_objects.erase(hit_objects.begin() + index);
+    if (compiled)
+        compiled->RemoveObject(static_cast<uint32_t>(index));
+    pending_update = true;
+}
+
+void Scene::UpdateBVH()
+{
+    if (!pending_update)
+        return;
+    if (!linear_bvh) {
+        // No incremental path for the other accelerators, NONE has nothing to update
+        if (effective_accelerator != AcceleratorType::NONE)
+            BuildBVH();
+        pending_update = false;
+        return;
+    }
+
+    auto start_time = std::chrono::high_resolution_clock::now();
+    size_t primitive_count = compiled->PrimitiveCount();
+    std::vector<AABB> bounds(primitive_count);
+    std::vector<uint8_t> live(primitive_count);
+    ThreadPool::Global().ParallelFor(primitive_count, 1024, [&](size_t i) {
+        live[i] = compiled->IsLive(static_cast<uint32_t>(i));
+        if (live[i])
+            bounds[i] = compiled->PrimitiveBounds(static_cast<uint32_t>(i));
+    });
+    // Objects removed again before this update leave dead entries behind
+    std::vector<uint32_t> inserted;
+    for (uint32_t primitive : pending_primitives) {
+        if (live[primitive])
+            inserted.push_back(primitive);
+    }
+    pending_primitives.clear();
+    pending_update = false;
+
+    linear_bvh->Insert(inserted, bounds, live, build_options);
+    linear_bvh->Refit(bounds, live);
+
+    // Insert rebuilds subtrees without knowing how deep they sit, which may outgrow the traversal stacks
+    BVHBuildStats update_stats;
+    BVHBuilder::ComputeStats(linear_bvh->GetNodes(), update_stats);
+    if (update_stats.sah_cost > build_options.rebuild_cost_ratio * full_build_sah_cost ||
+        2 * compiled->RemovedCount() > primitive_count || update_stats.max_depth > MaxBVHDepth) {
+        BuildBVH();
+        return;
+    }
+
+    if (wide_bvh4) {
+        wide_bvh4 = std::make_shared<WideBVH<4>>(*linear_bvh);
+        wide_bvh4->Reorder(build_options.layout, build_options.treelet_bytes);
+    } else if (wide_bvh8) {
+        wide_bvh8 = std::make_shared<WideBVH<8>>(*linear_bvh);
+        wide_bvh8->Reorder(build_options.layout, build_options.treelet_bytes);
+    }
+    // Insertions move primitives to other leaves and the new collapse may group the wide leaves
+    // differently, a refit of the binary tree alone keeps the order SortStorage left
+    if (wide_bvh4 || wide_bvh8 || !inserted.empty())
+        compiled->SortStorage(wide_bvh4 ? wide_bvh4->GetPrimitiveIndices() : wide_bvh8 ? wide_bvh8->GetPrimitiveIndices() :
+                              linear_bvh->GetPrimitiveIndices());
+
+    build_stats = update_stats;
+    build_stats.memory_bytes = wide_bvh4 ? wide_bvh4->MemoryBytes() : wide_bvh8 ? wide_bvh8->MemoryBytes() : linear_bvh->MemoryBytes();
+    build_stats.updated = true;
+    auto end_time = std::chrono::high_resolution_clock::now();
+    build_stats.build_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
 }
 
 void Scene::BuildLightTable()
@@ -105,35 +367,156 @@ void Scene::BuildLightTable()
     
     std::vector<float> power(lights.size());
     for (int i = 0; i < lights.size(); i++) {
-        auto light = lights[i];
+        const auto &light = lights[i];
         power[i] = light->GetPower();
     }
     lightTable = AliasTable1D(power);
 }
 
-bool Scene::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const
+bool Scene::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
 {
-    // If we have a BVH tree, then use BVH acceleration
+    // If we have a BVH, then use BVH acceleration. Its leaves index compiled primitives,
+    // which are tested a whole leaf at a time
+    auto intersect_leaf = [&](const uint32_t *leaf, uint32_t count, Vector2f &interval) {
+        return compiled->IntersectLeaf(leaf, count, r, interval, hit);
+    };
+#ifdef HO_EMBREE
+    if (embree_scene)
+        return embree_scene->Intersect(r, t_interval, hit);
+#endif
+    if (quantized_bvh)
+        return quantized_bvh->Intersect(r, t_interval, intersect_leaf);
+    if (lazy_bvh) {
+        // The cluster trees number their primitives locally, LazyBVH maps them one at a time
+        return lazy_bvh->Intersect(r, t_interval, [&](uint32_t index, Vector2f &interval) {
+            if (!compiled->IntersectPrimitive(index, r, interval, hit))
+                return false;
+            interval.y = hit.t;
+            return true;
+        });
+    }
+    if (wide_bvh8)
+        return wide_bvh8->Intersect(r, t_interval, intersect_leaf);
+    if (wide_bvh4)
+        return wide_bvh4->Intersect(r, t_interval, intersect_leaf);
+    if (linear_bvh)
+        return linear_bvh->Intersect(r, t_interval, intersect_leaf);
     if (bvh_tree) {
-        return bvh_tree->isHit(r, t_interval, rec);
+        return bvh_tree->Intersect(r, t_interval, hit);
     }
     
-    Hit_Payload temp_rec;
     bool isHit = false;
     auto closest_t = t_interval.y;
 
     for (const auto &object:hit_objects) {
-        if (object->isHit(r, Vector2f(t_interval.x, closest_t), temp_rec))
+        if (object->Intersect(r, Vector2f(t_interval.x, closest_t), hit))
         {
             isHit = true;
-            closest_t = temp_rec.t;
-            rec = temp_rec;
+            closest_t = hit.t;
         }
     }
 
     return isHit;
 }
 
+bool Scene::IntersectCounted(const Ray &r, Vector2f t_interval, SurfaceHit &hit, TraversalStats &stats) const
+{
+    // Same traversal order as Intersect, the primitive refs count as reads of the accelerator
+    auto intersect_object = [&](uint32_t index, Vector2f &interval) {
+        stats.Touch(&compiled->GetPrimitive(index), sizeof(PrimitiveRef));
+        if (!compiled->IntersectPrimitive(index, r, interval, hit))
+            return false;
+        interval.y = hit.t;
+        return true;
+    };
+    if (embree_scene)
+        return Intersect(r, t_interval, hit);
+    if (quantized_bvh)
+        return quantized_bvh->Intersect(r, t_interval, intersect_object, &stats);
+    if (lazy_bvh)
+        return lazy_bvh->Intersect(r, t_interval, intersect_object, &stats);
+    if (wide_bvh8)
+        return wide_bvh8->Intersect(r, t_interval, intersect_object, &stats);
+    if (wide_bvh4)
+        return wide_bvh4->Intersect(r, t_interval, intersect_object, &stats);
+    if (linear_bvh)
+        return linear_bvh->Intersect(r, t_interval, intersect_object, &stats);
+    return Intersect(r, t_interval, hit);
+}
+
+bool Scene::isOccluded(const Ray &r, float t_max) const
+{
+#ifdef HO_EMBREE
+    if (embree_scene)
+        return embree_scene->isOccluded(r, Vector2f(Epsilon, t_max));
+#endif
+
+    Vector2f t_interval(Epsilon, t_max);
+    auto occluded_by = [&](uint32_t index) {
+        return compiled->OccludedPrimitive(index, r, t_max);
+    };
+    if (quantized_bvh)
+        return quantized_bvh->Occluded(r, t_interval, occluded_by);
+    if (lazy_bvh)
+        return lazy_bvh->Occluded(r, t_interval, occluded_by);
+    if (wide_bvh8)
+        return wide_bvh8->Occluded(r, t_interval, occluded_by);
+    if (wide_bvh4)
+        return wide_bvh4->Occluded(r, t_interval, occluded_by);
+    if (linear_bvh)
+        return linear_bvh->Occluded(r, t_interval, occluded_by);
+    if (bvh_tree)
+        return bvh_tree->isOccluded(r, t_max);
+
+    for (const auto &object : hit_objects) {
+        if (object->isOccluded(r, t_max))
+            return true;
+    }
+    return false;
+}
+
+int Scene::IntersectPacket(RayPacket &packet, Hit_Payload rec[RayPacket::Size]) const
+{
+    int hit_mask = 0;
+    if (linear_bvh && !embree_scene && !quantized_bvh && !lazy_bvh) {
+        SurfaceHit hits[RayPacket::Size];
+        hit_mask = linear_bvh->IntersectPacket(packet, [&](int lane, const uint32_t *leaf, uint32_t count, Vector2f &interval) {
+            return compiled->IntersectLeaf(leaf, count, packet.rays[lane], interval, hits[lane]);
+        });
+        for (int mask = hit_mask; mask; mask &= mask - 1) {
+            int lane = std::countr_zero(static_cast<unsigned>(mask));
+            hits[lane].object->ComputeSurfaceInteraction(packet.rays[lane], hits[lane], rec[lane]);
+        }
+        return hit_mask;
+    }
+
+    for (int mask = packet.active; mask; mask &= mask - 1) {
+        int lane = std::countr_zero(static_cast<unsigned>(mask));
+        if (isHit(packet.rays[lane], Vector2f(packet.t_min[lane], packet.t_max[lane]), rec[lane])) {
+            packet.t_max[lane] = rec[lane].t;
+            hit_mask |= 1 << lane;
+        }
+    }
+    return hit_mask;
+}
+
+int Scene::OccludedPacket(const RayPacket &packet) const
+{
+    if (linear_bvh && !embree_scene && !quantized_bvh && !lazy_bvh) {
+        return linear_bvh->OccludedPacket(packet, [&](int lane, uint32_t index) {
+            return compiled->OccludedPrimitive(index, packet.rays[lane], packet.t_max[lane]);
+        });
+    }
+
+    int occluded_mask = 0;
+    for (int mask = packet.active; mask; mask &= mask - 1) {
+        int lane = std::countr_zero(static_cast<unsigned>(mask));
+        if (isOccluded(packet.rays[lane], packet.t_max[lane]))
+            occluded_mask |= 1 << lane;
+    }
+    return occluded_mask;
+}
+
 AABB Scene::getBoundingBox() const
 {
     if (hit_objects.empty()) return AABB();
@@ -145,7 +528,7 @@ AABB Scene::getBoundingBox() const
     return output_box;
 }
 
-Vector3f Scene::SampleLightEnvironment(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& pdf, Sampler& sampler) const
+Vector3f Scene::SampleLightEnvironment(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& light_distance, float& pdf, Sampler& sampler) const
 {
     if (lights.empty()) {
         pdf = 0.0f;
@@ -153,10 +536,10 @@ Vector3f Scene::SampleLightEnvironment(const Ray& r_in, const Hit_Payload& rec,
     }
 
     int index = lightTable.Sample(sampler.get_2d_sample());
-    auto light = lights[index];
+    const auto &light = lights[index];
 
     float light_pdf = 0.0f;
-    Vector3f radiance = light->Sample(r_in, rec, light_direction, light_pdf, sampler);
+    Vector3f radiance = light->Sample(r_in, rec, light_direction, light_distance, light_pdf, sampler);
 
     float light_selection_pdf = light->GetPower() / lightTable.Sum();
     pdf = light_pdf * light_selection_pdf;
@@ -175,7 +558,7 @@ Vector3f Scene::EvaluateLight(const Ray &light_ray, const Hit_Payload &light_rec
     pdf = 0.0f;
 
     for (int i = 0; i < lights.size(); i++) {
-        auto light = lights[i];
+        const auto &light = lights[i];
         float light_pdf = 0.0f;
 
         Vector3f light_radiance = light->Evaluate(light_ray, light_rec, light_pdf);
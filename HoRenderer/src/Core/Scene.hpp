@@ -5,6 +5,8 @@
 
 #include "Util.hpp"
 #include "Hittable.hpp"
+#include "BVHBuilder.hpp"
+#include "RayPacket.hpp"
 
 
 class AliasTable1D {
@@ -22,6 +24,20 @@ private:
 	float sumDistrib;
 };
 
+// Acceleration structure used by Scene::Intersect
+enum class AcceleratorType {
+    NONE,       // brute-force loop over hit_objects
+    BVH_TREE,   // shared_ptr BVHnode tree
+    LINEAR_BVH, // flattened, index-based BVH
+    WIDE_BVH4,  // 4-wide BVH, SSE child tests
+    WIDE_BVH8,  // 8-wide BVH, AVX child tests
+    QUANTIZED_BVH, // 8-wide BVH with 8-bit child bounds, nodes about 3x smaller than LINEAR_BVH's.
+                   // Drops the binary tree after collapsing, so UpdateBVH rebuilds
+    LAZY_BVH,   // LINEAR_BVH subtrees built the first time a ray reaches them, see LazyBVH. Fastest
+                // time to first pixel; UpdateBVH rebuilds
+    EMBREE      // Intel Embree scene, see EmbreeScene. Needs the xmake option embree, LINEAR_BVH without it
+};
+
 //  A class that stores a list of class Hittable
 class Scene : public Hittable {
 public:
@@ -34,17 +50,91 @@ public:
     const std::vector<std::shared_ptr<Hittable>> GetObjects() const;
     const std::vector<std::shared_ptr<Light>>& GetLights() const;
 
+    void SetAccelerator(AcceleratorType type) { accelerator = type; }
+    // The type set above, BuildBVH keeps it even when it has to build another one
+    AcceleratorType GetAccelerator() const { return accelerator; }
+    // The type BuildBVH actually built, LINEAR_BVH for EMBREE in builds without Embree
+    AcceleratorType GetEffectiveAccelerator() const { return effective_accelerator; }
+    // Print one line of build stats after every BuildBVH, off unless HoRenderer --verbose
+    static void SetVerbose(bool on) { verbose = on; }
+    void PrintBuildStats() const;
+    // FAST for preview jobs where startup matters, HIGH for final renders
+    void SetBuildOptions(const BVHBuildOptions &options) { build_options = options; }
+    const BVHBuildStats &GetBuildStats() const { return build_stats; }
+    /*
+    * @brief: Flatten hit_objects into the typed primitive arrays of CompiledScene. Called by
+    *         BuildBVH for the accelerators built by BVHBuilder (LINEAR_BVH, WIDE_BVH4/8,
+    *         QUANTIZED_BVH, LAZY_BVH), the others keep traversing hit_objects.
+    */
+    void Compile();
     void BuildBVH();
+    /*
+    * @brief: Changes after BuildBVH, applied to the acceleration structure by the next UpdateBVH.
+    *         Indices follow GetObjects(), RemoveObject shifts the later ones down like
+    *         std::vector::erase. Before BuildBVH they only edit the object list. Objects nested
+    *         deeper than SurfaceHit::MaxWrapperDepth are rejected like in Add, AddObject then
+    *         returns GetObjects().size() and UpdateObject keeps the old object. A light on the
+    *         replaced or removed shape follows it, see Light::Rebind, or is removed with it.
+    */
+    size_t AddObject(std::shared_ptr<Hittable> object);
+    void UpdateObject(size_t index, std::shared_ptr<Hittable> object);
+    void RemoveObject(size_t index);
+    /*
+    * @brief: Bring the BVH up to date with the changes above, once per frame. Moved objects only
+    *         refit the bounds, added ones rebuild the subtree they land in. Falls back to BuildBVH
+    *         when the SAH cost drifts past BVHBuildOptions::rebuild_cost_ratio times the last full
+    *         build or half of the compiled primitives are removed. BVH_TREE and EMBREE always rebuild.
+    */
+    void UpdateBVH();
     void BuildLightTable();
-    bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const override;
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    bool isOccluded(const Ray &r, float t_max) const override;
+    /*
+    * @brief: Closest hits of a packet of coherent rays. Goes through LinearBVH::IntersectPacket
+    *         when the scene keeps a LinearBVH (LINEAR_BVH, WIDE_BVH4/8), lane by lane through
+    *         isHit otherwise.
+    *
+    * @args: rec: surface data of every lane that hit
+    * @ret: mask of the lanes that hit
+    */
+    int IntersectPacket(RayPacket &packet, Hit_Payload rec[RayPacket::Size]) const;
+    // Packet form of isOccluded over each lane's (t_min, t_max), returns the mask of occluded lanes
+    int OccludedPacket(const RayPacket &packet) const;
+    // Closest hit through the accelerator Intersect would use, counting node visits and feeding
+    // stats' cache models, for Benchmark. Embree and the object BVH count nothing
+    bool IntersectCounted(const Ray &r, Vector2f t_interval, SurfaceHit &hit, TraversalStats &stats) const;
     AABB getBoundingBox() const override;
+    // A scene added to another one would have to rebind its objects to the outer table, which
+    // MaterialBinding refuses. Reports it instead, use BottomLevelBVH and Instance for that
+    void BindMaterials(MaterialTable &table) override;
+    int WrapperDepth() const override;
+
+    const Material *GetMaterial(MaterialID id) const { return materials.Get(id); }
+    const MaterialTable &GetMaterials() const { return materials; }
 
-    Vector3f SampleLightEnvironment(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& pdf, Sampler& sampler) const;
+    Vector3f SampleLightEnvironment(const Ray& r_in, const Hit_Payload& rec, Vector3f& light_direction, float& light_distance, float& pdf, Sampler& sampler) const;
     Vector3f EvaluateLight(const Ray& light_ray, const Hit_Payload& light_rec, float& pdf) const;
     
 private:
     std::vector<std::shared_ptr<Hittable>> hit_objects;
+    MaterialTable materials;
     std::shared_ptr<BVHnode> bvh_tree;
+    std::shared_ptr<LinearBVH> linear_bvh;
+    std::shared_ptr<WideBVH<4>> wide_bvh4;
+    std::shared_ptr<WideBVH<8>> wide_bvh8;
+    std::shared_ptr<QuantizedBVH> quantized_bvh;
+    std::shared_ptr<LazyBVH> lazy_bvh;
+    std::shared_ptr<EmbreeScene> embree_scene;
+    std::shared_ptr<CompiledScene> compiled;
+    AcceleratorType accelerator = AcceleratorType::LINEAR_BVH;
+    AcceleratorType effective_accelerator = AcceleratorType::LINEAR_BVH;
+    inline static bool verbose = false;
+    BVHBuildOptions build_options;
+    BVHBuildStats build_stats;
+    float full_build_sah_cost = 0.0f;
+    // Pending work for UpdateBVH
+    std::vector<uint32_t> pending_primitives;
+    bool pending_update = false;
     std::vector<std::shared_ptr<Light>> lights;
     AliasTable1D lightTable;
 };
\ No newline at end of file
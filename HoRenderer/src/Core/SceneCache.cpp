@@ -0,0 +1,396 @@
+#include "SceneCache.hpp"
+#include "TriangleMesh.hpp"
+#include "../Common/MappedFile.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+
+namespace {
+
+enum class CacheType : uint32_t {
+    BVH = 1,
+    MESH = 2,
+    TEXTURE = 3
+};
+
+constexpr char Magic[8] = {'H', 'O', 'R', 'C', 'A', 'C', 'H', 'E'};
+constexpr size_t MaxSections = 12;
+constexpr size_t SectionAlignment = 64;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    CacheType type;
+    uint64_t key;
+    uint64_t section_count;
+    uint64_t offsets[MaxSections];
+    uint64_t sizes[MaxSections];
+};
+
+std::string cache_directory;
+uint64_t max_cache_bytes = uint64_t(4) << 30;
+std::mutex eviction_mutex;
+
+std::string CachePath(uint64_t key, CacheType type) {
+    const char *extension = type == CacheType::BVH ? ".bvh" : type == CacheType::MESH ? ".mesh" : ".tex";
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << extension;
+    return (std::filesystem::path(cache_directory) / name.str()).string();
+}
+
+// Arrays of one cache file, written in order
+class CacheWriter {
+public:
+    template <typename T>
+    void Add(const T *data, size_t count) {
+        sections.push_back({reinterpret_cast<const char *>(data), count * sizeof(T)});
+    }
+    template <typename T>
+    void Add(std::span<const T> data) { Add(data.data(), data.size()); }
+    template <typename T>
+    void Add(const MappedArray<T> &data) { Add(data.data(), data.size()); }
+
+    void Write(uint64_t key, CacheType type) const {
+        auto start_time = std::chrono::high_resolution_clock::now();
+        CacheHeader header = {};
+        memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = SceneCache::Version;
+        header.type = type;
+        header.key = key;
+        header.section_count = sections.size();
+        uint64_t offset = AlignUp(sizeof(CacheHeader));
+        for (size_t i = 0; i < sections.size(); i++) {
+            header.offsets[i] = offset;
+            header.sizes[i] = sections[i].second;
+            offset = AlignUp(offset + sections[i].second);
+        }
+
+        // Write to a temporary name and rename, so a crash never leaves a truncated entry behind.
+        // The name is unique, threads and processes writing the same entry do not share one
+        static std::atomic<uint64_t> temp_counter = 0;
+        std::string path = CachePath(key, type);
+        std::ostringstream temp_name;
+        temp_name << path << "." << std::hex << std::hash<std::thread::id>()(std::this_thread::get_id()) << "."
+                  << start_time.time_since_epoch().count() << "." << temp_counter++ << ".tmp";
+        std::string temp_path = temp_name.str();
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                std::cerr << "Failed to write cache file: " << temp_path << std::endl;
+                return;
+            }
+            const char zeros[SectionAlignment] = {};
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(zeros, AlignUp(sizeof(CacheHeader)) - sizeof(CacheHeader));
+            for (const auto &[data, bytes] : sections) {
+                file.write(data, bytes);
+                file.write(zeros, AlignUp(bytes) - bytes);
+            }
+            if (!file) {
+                std::cerr << "Failed to write cache file: " << temp_path << std::endl;
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temp_path, path, error);
+        if (error) {
+            std::cerr << "Failed to write cache file: " << path << " (" << error.message() << ")" << std::endl;
+            std::filesystem::remove(temp_path, error);
+            return;
+        }
+
+        auto end_time = std::chrono::high_resolution_clock::now();
+        std::cout << "Cache write: " << path << ", " << offset / (1024.0 * 1024.0) << " MB, Time: "
+                  << std::chrono::duration<double, std::milli>(end_time - start_time).count() << "ms" << std::endl;
+        Evict();
+    }
+
+private:
+    static uint64_t AlignUp(uint64_t bytes) { return (bytes + SectionAlignment - 1) & ~uint64_t(SectionAlignment - 1); }
+
+    // Removes the least recently used entries until the directory fits max_cache_bytes, and
+    // temporary files that a crashed writer left behind
+    static void Evict() {
+        if (max_cache_bytes == 0)
+            return;
+        std::lock_guard<std::mutex> lock(eviction_mutex);
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type time;
+            uint64_t bytes;
+        };
+        std::vector<Entry> entries;
+        uint64_t total_bytes = 0;
+        auto stale_time = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+        std::error_code error;
+        for (const auto &file : std::filesystem::directory_iterator(cache_directory, error)) {
+            std::string extension = file.path().extension().string();
+            auto time = file.last_write_time(error);
+            uint64_t bytes = file.file_size(error);
+            if (error)
+                continue;
+            if (extension == ".tmp") {
+                if (time < stale_time)
+                    std::filesystem::remove(file.path(), error);
+                continue;
+            }
+            if (extension != ".bvh" && extension != ".mesh" && extension != ".tex")
+                continue;
+            entries.push_back({file.path(), time, bytes});
+            total_bytes += bytes;
+        }
+        if (total_bytes <= max_cache_bytes)
+            return;
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.time < b.time; });
+        for (const Entry &entry : entries) {
+            if (total_bytes <= max_cache_bytes)
+                break;
+            // Entries in use stay mapped, on Windows they cannot be removed until they are released
+            if (std::filesystem::remove(entry.path, error))
+                total_bytes -= entry.bytes;
+        }
+    }
+
+    std::vector<std::pair<const char *, size_t>> sections;
+};
+
+// Validated, memory-mapped cache file. Sections are handed out as views into the mapping,
+// which stays open as long as any of them does
+class CacheReader {
+public:
+    bool Open(uint64_t key, CacheType type, size_t expected_sections) {
+        path = CachePath(key, type);
+        if (!std::filesystem::exists(path) || !file->Open(path))
+            return false;
+        if (file->Size() < sizeof(CacheHeader))
+            return Reject("truncated header");
+        memcpy(&header, file->Data(), sizeof(CacheHeader));
+        if (memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.type != type)
+            return Reject("not a cache file");
+        if (header.version != SceneCache::Version)
+            return Reject("version mismatch");
+        if (header.key != key)
+            return Reject("content hash mismatch");
+        if (header.section_count != expected_sections)
+            return Reject("unexpected layout");
+        for (size_t i = 0; i < header.section_count; i++) {
+            if (header.offsets[i] > file->Size() || header.sizes[i] > file->Size() - header.offsets[i] ||
+                header.offsets[i] % SectionAlignment != 0)
+                return Reject("truncated data");
+        }
+        // Loads count as uses for eviction
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+        return true;
+    }
+
+    template <typename T>
+    bool Map(size_t section, MappedArray<T> &data) const {
+        static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= SectionAlignment);
+        if (header.sizes[section] % sizeof(T) != 0)
+            return false;
+        data = MappedArray<T>(file, reinterpret_cast<const T *>(file->Data() + header.offsets[section]),
+                              header.sizes[section] / sizeof(T));
+        return true;
+    }
+
+    template <typename T>
+    bool Read(size_t section, T &value) const {
+        if (header.sizes[section] != sizeof(T))
+            return false;
+        memcpy(&value, file->Data() + header.offsets[section], sizeof(T));
+        return true;
+    }
+
+    const std::string &Path() const { return path; }
+
+private:
+    bool Reject(const char *reason) {
+        std::cerr << "Ignoring cache file " << path << ": " << reason << std::endl;
+        file->Close();
+        return false;
+    }
+
+    std::string path;
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    CacheHeader header = {};
+};
+
+void LogLoad(const std::string &path, std::chrono::high_resolution_clock::time_point start_time) {
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::cout << "Cache load: " << path << ", Time: "
+              << std::chrono::duration<double, std::milli>(end_time - start_time).count() << "ms" << std::endl;
+}
+
+inline uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t HashBlock(const uint8_t *data, size_t bytes, uint64_t seed) {
+    uint64_t h = Mix(seed ^ (bytes * 0x9E3779B97F4A7C15ULL));
+    size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ Mix(word)) * 0x9E3779B97F4A7C15ULL;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, bytes - i);
+    return Mix(h ^ tail);
+}
+
+} // namespace
+
+
+namespace SceneCache {
+
+void SetDirectory(const std::string &directory) {
+    cache_directory = directory;
+    if (directory.empty())
+        return;
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        std::cerr << "Failed to create cache directory " << directory << ": " << error.message() << std::endl;
+        cache_directory.clear();
+    }
+}
+
+bool Enabled() {
+    return !cache_directory.empty();
+}
+
+void SetMaxBytes(uint64_t bytes) {
+    max_cache_bytes = bytes;
+}
+
+uint64_t Hash(const void *data, size_t bytes, uint64_t seed) {
+    // Hash 1MB blocks in parallel and chain the block hashes
+    const size_t block_size = 1 << 20;
+    const uint8_t *bytes_ptr = static_cast<const uint8_t *>(data);
+    size_t block_count = (bytes + block_size - 1) / block_size;
+    if (block_count <= 1)
+        return HashBlock(bytes_ptr, bytes, seed);
+
+    std::vector<uint64_t> block_hashes(block_count);
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < static_cast<int64_t>(block_count); i++) {
+        size_t begin = i * block_size;
+        block_hashes[i] = HashBlock(bytes_ptr + begin, std::min(block_size, bytes - begin), i);
+    }
+    return HashBlock(reinterpret_cast<const uint8_t *>(block_hashes.data()), block_count * sizeof(uint64_t), seed);
+}
+
+uint64_t HashFile(const std::string &path, uint64_t seed) {
+    std::error_code error;
+    std::filesystem::path file_path = std::filesystem::absolute(path, error);
+    std::string name = file_path.generic_string();
+    uint64_t h = Hash(name.data(), name.size(), seed);
+    uint64_t size = std::filesystem::file_size(file_path, error);
+    h = Hash(&size, sizeof(size), h);
+    int64_t time = std::filesystem::last_write_time(file_path, error).time_since_epoch().count();
+    return Hash(&time, sizeof(time), h);
+}
+
+bool LoadBVH(uint64_t key, MappedArray<LinearBVHNode> &nodes, MappedArray<uint32_t> &primitive_indices) {
+    if (!Enabled())
+        return false;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    CacheReader reader;
+    if (!reader.Open(key, CacheType::BVH, 2))
+        return false;
+    if (!reader.Map(0, nodes) || !reader.Map(1, primitive_indices) || nodes.empty())
+        return false;
+    LogLoad(reader.Path(), start_time);
+    return true;
+}
+
+void SaveBVH(uint64_t key, std::span<const LinearBVHNode> nodes, std::span<const uint32_t> primitive_indices) {
+    if (!Enabled())
+        return;
+    CacheWriter writer;
+    writer.Add(nodes);
+    writer.Add(primitive_indices);
+    writer.Write(key, CacheType::BVH);
+}
+
+std::shared_ptr<MeshBuffers> LoadMesh(uint64_t key) {
+    if (!Enabled())
+        return nullptr;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    CacheReader reader;
+    if (!reader.Open(key, CacheType::MESH, 9))
+        return nullptr;
+    auto mesh = std::make_shared<MeshBuffers>();
+    bool valid = reader.Map(0, mesh->px) && reader.Map(1, mesh->py) && reader.Map(2, mesh->pz) &&
+                 reader.Map(3, mesh->nx) && reader.Map(4, mesh->ny) && reader.Map(5, mesh->nz) &&
+                 reader.Map(6, mesh->u) && reader.Map(7, mesh->v) && reader.Map(8, mesh->indices);
+    if (!valid)
+        return nullptr;
+    // The sections fit the file, check that they also fit each other before anything indexes them
+    size_t vertices = mesh->px.size();
+    auto optional = [vertices](const MappedArray<float> &channel) { return channel.empty() || channel.size() == vertices; };
+    bool consistent = mesh->py.size() == vertices && mesh->pz.size() == vertices &&
+                      optional(mesh->nx) && mesh->ny.size() == mesh->nx.size() && mesh->nz.size() == mesh->nx.size() &&
+                      optional(mesh->u) && mesh->v.size() == mesh->u.size() && mesh->indices.size() % 3 == 0 &&
+                      std::all_of(mesh->indices.begin(), mesh->indices.end(), [vertices](uint32_t index) { return index < vertices; });
+    if (!consistent) {
+        std::cerr << "Ignoring cache file " << reader.Path() << ": inconsistent mesh" << std::endl;
+        return nullptr;
+    }
+    LogLoad(reader.Path(), start_time);
+    return mesh;
+}
+
+void SaveMesh(uint64_t key, const MeshBuffers &mesh) {
+    if (!Enabled())
+        return;
+    CacheWriter writer;
+    writer.Add(mesh.px);
+    writer.Add(mesh.py);
+    writer.Add(mesh.pz);
+    writer.Add(mesh.nx);
+    writer.Add(mesh.ny);
+    writer.Add(mesh.nz);
+    writer.Add(mesh.u);
+    writer.Add(mesh.v);
+    writer.Add(mesh.indices);
+    writer.Write(key, CacheType::MESH);
+}
+
+bool LoadTexture(uint64_t key, int &width, int &height, int &channels, MappedArray<uint8_t> &texels) {
+    if (!Enabled())
+        return false;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    CacheReader reader;
+    if (!reader.Open(key, CacheType::TEXTURE, 2))
+        return false;
+    int32_t size[3];
+    if (!reader.Read(0, size) || !reader.Map(1, texels))
+        return false;
+    width = size[0];
+    height = size[1];
+    channels = size[2];
+    LogLoad(reader.Path(), start_time);
+    return true;
+}
+
+void SaveTexture(uint64_t key, int width, int height, int channels, const void *texels, size_t bytes) {
+    if (!Enabled())
+        return;
+    int32_t size[3] = {width, height, channels};
+    CacheWriter writer;
+    writer.Add(size, 3);
+    writer.Add(static_cast<const uint8_t *>(texels), bytes);
+    writer.Write(key, CacheType::TEXTURE);
+}
+
+}
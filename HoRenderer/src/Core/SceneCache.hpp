@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Util.hpp"
+#include "BVH.hpp"
+
+// Versioned binary cache for data that is slow to rebuild on every launch: flattened
+// BVHs, parsed meshes and decoded textures. A cache file is a fixed header followed by
+// 64-byte aligned arrays, so loading is one mmap and the arrays are used in place, with
+// no parsing, no copy and no per-object allocation.
+//
+// Files are content-addressed: the name is the hash of the inputs they were built from,
+// and the same hash is stored in the header. Changing an input changes the key, so stale
+// entries are never looked up again and age out once the directory outgrows its limit.
+namespace SceneCache {
+    // Bump whenever a cached layout changes (e.g. LinearBVHNode)
+    constexpr uint32_t Version = 1;
+
+    // Empty string disables the cache (default)
+    void SetDirectory(const std::string &directory);
+    bool Enabled();
+    // The least recently used entries are removed once the directory holds more, 0 for no limit
+    void SetMaxBytes(uint64_t bytes);
+
+    uint64_t Hash(const void *data, size_t bytes, uint64_t seed = 0);
+    // Path, size and modification time of a source file, not its contents
+    uint64_t HashFile(const std::string &path, uint64_t seed = 0);
+
+    bool LoadBVH(uint64_t key, MappedArray<LinearBVHNode> &nodes, MappedArray<uint32_t> &primitive_indices);
+    void SaveBVH(uint64_t key, std::span<const LinearBVHNode> nodes, std::span<const uint32_t> primitive_indices);
+
+    std::shared_ptr<MeshBuffers> LoadMesh(uint64_t key);
+    void SaveMesh(uint64_t key, const MeshBuffers &mesh);
+
+    // Decoded texels of an image file, bytes as returned by the decoder
+    bool LoadTexture(uint64_t key, int &width, int &height, int &channels, MappedArray<uint8_t> &texels);
+    void SaveTexture(uint64_t key, int width, int height, int channels, const void *texels, size_t bytes);
+}
@@ -2,112 +2,103 @@
     Created by Yinghao He on 2025-05-18
 */
 #include "Shape.hpp"
+#include "Material.hpp"
 
-bool Sphere::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const
+bool Sphere::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
 {
-    Vector3f oc = center - r.origin();
-    float a = glm::dot(r.direction(), r.direction());
-    float h = glm::dot(r.direction(), oc);   // make b = -2h
-    float c = glm::dot(oc, oc) - radius*radius;
-    float discriminant = h * h -  a * c; //
-    
-
-    if (discriminant > 0) { 
-        float sqrt_d = std::sqrtf(discriminant);
-        float root = (h - sqrt_d) / a; 
-        if (isInInterval(t_interval, root)){
-            rec.t = root;
-            rec.p = r.at(rec.t);
-            // rec.normal = (rec.p - center) / radius;
-            Vector3f outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat = mat;
-            rec.uv = getSphereUV(rec.p);
-            return true;
-        }
-        root = (h + sqrt_d) / a;
-        if (isInInterval(t_interval, root)){
-            rec.t = root;
-            rec.p = r.at(rec.t);
-            Vector3f outward_normal = (rec.p - center) / radius;
-            rec.set_face_normal(r, outward_normal);
-            rec.mat = mat;
-            rec.uv = getSphereUV(rec.p);
-            return true;
-        }
-    }
+    float t;
+    if (!IntersectSphere(center, radius, r, t_interval, t))
+        return false;
 
-    return false;
+    hit.t = t;
+    hit.object = this;
+    return true;
 }
 
-Vector2f Sphere::getSphereUV(const Vector3f &hit_point) const
+void Sphere::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const
 {
-    Vector3f unit_p = glm::normalize(hit_point - center);
-    float theta = std::acos(glm::clamp(unit_p.y, -1.0f, 1.0f));
-    float phi = std::atan2(unit_p.z, unit_p.x);
+    rec.t = hit.t;
+    rec.p = r.at(rec.t);
+    Vector3f outward_normal = (rec.p - center) / radius;
+    rec.set_face_normal(r, outward_normal);
+    rec.material_id = material_binding.ID();
+    rec.uv = getSphereUV(rec.p);
+    rec.tangent = SphereTangent(outward_normal);
+}
 
-    if (phi < 0)
-        phi += 2.0f * PI;
+bool Sphere::isOccluded(const Ray &r, float t_max) const
+{
+    float t;
+    return IntersectSphere(center, radius, r, Vector2f(Epsilon, t_max), t);
+}
 
-    float u = phi / (2.0f * PI);
-    float v = theta / PI;
-    return Vector2f(u, v);
+Vector2f Sphere::getSphereUV(const Vector3f &hit_point) const
+{
+    return SphereUV(glm::normalize(hit_point - center));
 }
 
-bool Quad::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const
+bool Quad::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
 {
-    // Compute the intersection of a ray and a plane
-    float denom = glm::dot(normal, r.direction());
-    
-    // If the ray is parallel or nearly parallel to the plane, there is no intersection
-    if (std::fabs(denom) < 1e-6)
-        return false;
-    
-    // Calculate the intersection parameter t
-    float t = (D - glm::dot(normal, r.origin())) / denom;
-    
-    // Check if t is in the valid range
-    if (t < t_interval.x || t > t_interval.y)
+    float t;
+    Vector2f local;
+    if (!IntersectQuad(Q, u, v, normal, w, D, r, t_interval, t, local))
         return false;
-    
-    // Calculate intersection points
-    Vector3f hit_point = r.at(t);
-    
-    // Calculate the vector from the intersection point to the center
-    Vector3f hit_vec = hit_point - Q;
-    
-    // Compute parameter coordinates (alpha, beta)
-    float alpha = glm::dot(w, glm::cross(hit_vec, v));
-    float beta = glm::dot(w, glm::cross(u, hit_vec));
-    
-    // Check if it is within the rectangle
-    if (alpha < -Epsilon || alpha > 1 + Epsilon || beta < -Epsilon || beta > 1 + Epsilon)
-        return false;
-    
-    rec.t = t;
-    rec.p = hit_point;
+
+    hit.t = t;
+    hit.object = this;
+    hit.local = local;
+    return true;
+}
+
+void Quad::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const
+{
+    rec.t = hit.t;
+    rec.p = r.at(rec.t);
     rec.set_face_normal(r, normal);
-    rec.mat = mat;
-    rec.uv = Vector2f(alpha, beta);
+    rec.material_id = material_binding.ID();
+    rec.uv = hit.local;
+    rec.tangent = glm::normalize(u);
+}
+
+bool Quad::isOccluded(const Ray &r, float t_max) const
+{
+    float t;
+    Vector2f local;
+    return IntersectQuad(Q, u, v, normal, w, D, r, Vector2f(Epsilon, t_max), t, local);
+}
+
+bool Box::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const {
+    // All six faces in one kernel call, the nearest one wins
+    float t;
+    Vector2f local;
+    int face = IntersectQuads<8>(faces.Lanes(), static_cast<int>(sides.size()), r, t_interval, t, local);
+    if (face < 0)
+        return false;
 
+    hit.t = t;
+    hit.object = this;
+    hit.prim_id = face;
+    hit.local = local;
     return true;
 }
 
-bool Box::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const {
-    Hit_Payload temp_rec;
-    bool hit_anything = false;
-    float closest_t = t_interval.y;
-    
-    // Check the intersection of the ray with each face
-    for (const auto& side : sides) {
-        if (side->isHit(r, Vector2f(t_interval.x, closest_t), temp_rec)) {
-            hit_anything = true;
-            closest_t = temp_rec.t;
-            rec = temp_rec;
-        }
-    }
-    
-    return hit_anything;
+void Box::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const {
+    sides[hit.prim_id]->ComputeSurfaceInteraction(r, hit, rec);
+}
+
+bool Box::isOccluded(const Ray &r, float t_max) const
+{
+    // The box is closed, so the ray crosses a face in range iff its entry or exit distance is in range
+    Vector3f inv_dir = 1.0f / r.direction();
+    Vector3f t0 = (min_corner - r.origin()) * inv_dir;
+    Vector3f t1 = (max_corner - r.origin()) * inv_dir;
+    Vector3f t_small = glm::min(t0, t1);
+    Vector3f t_large = glm::max(t0, t1);
+    float t_enter = std::max(std::max(t_small.x, t_small.y), t_small.z);
+    float t_exit = std::min(std::min(t_large.x, t_large.y), t_large.z);
+    if (t_enter > t_exit)
+        return false;
+    return (t_enter >= Epsilon && t_enter <= t_max) || (t_exit >= Epsilon && t_exit <= t_max);
 }
 
 void Box::CreateSides()
@@ -158,4 +149,10 @@ void Box::CreateSides()
         Vector3f(0, 0, dimensions.z),
         Vector3f(0, dimensions.y, 0),
         mat));
+
+    faces = {};
+    for (size_t i = 0; i < sides.size(); i++) {
+        const Quad &side = *sides[i];
+        faces.Set(static_cast<int>(i), side.get_Q(), side.get_u(), side.get_v(), side.get_normal(), side.get_w(), side.get_D());
+    }
 }
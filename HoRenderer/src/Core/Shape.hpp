@@ -5,6 +5,82 @@
 
 #include "Util.hpp"
 #include "Hittable.hpp"
+#include "PrimitiveKernels.hpp"
+
+// The intersection routines below are shared by the shapes and by the flattened arrays
+// of CompiledScene, so both give bit-identical hits.
+
+/*
+* @brief: Ray/sphere intersection.
+*
+* @ret: true if a root lies inside t_interval, t is the nearest one
+*/
+inline bool IntersectSphere(const Vector3f &center, float radius, const Ray &r, Vector2f t_interval, float &t) {
+    Vector3f oc = center - r.origin();
+    float a = glm::dot(r.direction(), r.direction());
+    float h = glm::dot(r.direction(), oc);   // make b = -2h
+    float c = glm::dot(oc, oc) - radius*radius;
+    float discriminant = h * h -  a * c;
+    if (discriminant <= 0)
+        return false;
+
+    float sqrt_d = std::sqrtf(discriminant);
+    float root = (h - sqrt_d) / a;
+    if (!isInInterval(t_interval, root)) {
+        root = (h + sqrt_d) / a;
+        if (!isInInterval(t_interval, root))
+            return false;
+    }
+    t = root;
+    return true;
+}
+
+// (u, v) of a unit vector from the sphere center, u around the y axis and v from the +y pole
+inline Vector2f SphereUV(const Vector3f &unit_p) {
+    float theta = std::acos(glm::clamp(unit_p.y, -1.0f, 1.0f));
+    float phi = std::atan2(unit_p.z, unit_p.x);
+
+    if (phi < 0)
+        phi += 2.0f * PI;
+
+    return Vector2f(phi / (2.0f * PI), theta / PI);
+}
+
+// dp/dphi normalized, zero at the poles
+inline Vector3f SphereTangent(const Vector3f &outward_normal) {
+    Vector3f dpdu(-outward_normal.z, 0.0f, outward_normal.x);
+    float length = glm::length(dpdu);
+    return length > 0.0f ? dpdu / length : Vector3f(0.0f);
+}
+
+/*
+* @brief: Ray/parallelogram intersection.
+*
+* @args: w: n / dot(n, n) with n = cross(u, v); D: dot(normal, Q)
+* @ret: true if hit inside t_interval, local is the (alpha, beta) position along u and v
+*/
+inline bool IntersectQuad(const Vector3f &Q, const Vector3f &u, const Vector3f &v, const Vector3f &normal, const Vector3f &w, float D,
+                          const Ray &r, Vector2f t_interval, float &t, Vector2f &local) {
+    // If the ray is parallel or nearly parallel to the plane, there is no intersection
+    float denom = glm::dot(normal, r.direction());
+    if (std::fabs(denom) < 1e-6)
+        return false;
+
+    float t_plane = (D - glm::dot(normal, r.origin())) / denom;
+    if (t_plane < t_interval.x || t_plane > t_interval.y)
+        return false;
+
+    // Compute parameter coordinates (alpha, beta) of the hit point
+    Vector3f hit_vec = r.at(t_plane) - Q;
+    float alpha = glm::dot(w, glm::cross(hit_vec, v));
+    float beta = glm::dot(w, glm::cross(u, hit_vec));
+    if (alpha < -Epsilon || alpha > 1 + Epsilon || beta < -Epsilon || beta > 1 + Epsilon)
+        return false;
+
+    t = t_plane;
+    local = Vector2f(alpha, beta);
+    return true;
+}
 
 class Sphere : public Hittable {
 public:
@@ -15,16 +91,24 @@ public:
         bbox = AABB(center - rvec, center + rvec);
     }
 
-    bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const override;
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    bool isOccluded(const Ray &r, float t_max) const override;
     AABB getBoundingBox() const override {
         return bbox;
     }
+    void BindMaterials(MaterialTable &table) override { material_binding.Bind(table, mat); }
     Vector2f getSphereUV(const Vector3f &hit_point) const;
 
+    Vector3f get_center() const {return center;}
+    float get_radius() const {return radius;}
+    const std::shared_ptr<Material> &get_mat() const {return mat;}
+
 private:
     Vector3f center;
     float radius;
     std::shared_ptr<Material> mat;
+    MaterialBinding material_binding;
     AABB bbox;
 };
 
@@ -59,15 +143,21 @@ public:
         bbox = AABB(min_point, max_point);
     }
 
-    bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const override;
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    bool isOccluded(const Ray &r, float t_max) const override;
     AABB getBoundingBox() const override {
         return bbox;
     }
+    void BindMaterials(MaterialTable &table) override { material_binding.Bind(table, mat); }
 
     Vector3f get_u() const {return u;}
     Vector3f get_v() const {return v;}
     Vector3f get_Q() const {return Q;}
-    std::shared_ptr<Material> get_mat() const {return mat;}
+    Vector3f get_normal() const {return normal;}
+    Vector3f get_w() const {return w;}
+    float get_D() const {return D;}
+    const std::shared_ptr<Material> &get_mat() const {return mat;}
     
 private:
     Vector3f Q;    // The base point of the quadrilateral (a corner point)
@@ -76,6 +166,7 @@ private:
     Vector3f w; // Auxiliary vectors for parameter coordinate calculation
     float D;    // Plane equation D value
     std::shared_ptr<Material> mat;
+    MaterialBinding material_binding;
     AABB bbox;
 };
 
@@ -92,10 +183,20 @@ public:
         CreateSides();
     }
 
-    bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const override;
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    bool isOccluded(const Ray &r, float t_max) const override;
     AABB getBoundingBox() const override {
         return bbox;
     }
+    // The faces carry the material
+    void BindMaterials(MaterialTable &table) override {
+        for (const auto &side : sides)
+            side->BindMaterials(table);
+    }
+
+    const std::vector<std::shared_ptr<Quad>> &get_sides() const {return sides;}
+    const std::shared_ptr<Material> &get_mat() const {return mat;}
 
 private:
     Vector3f center;     // The center point of the cuboid
@@ -107,6 +208,8 @@ private:
 
     // The 6 faces of a cuboid (stored as rectangles)
     std::vector<std::shared_ptr<Quad>> sides;
+    // The same faces as lanes of the 8-wide quad kernel, Intersect tests them at once
+    QuadBlock<8> faces;
 
     // Auxiliary functions for calculating 6 faces
     void CreateSides();
@@ -2,6 +2,7 @@
     Created by Yinghao He on 2025-05-30
 */
 #include "Texture.hpp"
+#include "SceneCache.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "../Common/stb_image.h"
 
@@ -20,6 +21,19 @@ ImageTexture::ImageTexture(const std::string &filepath) : Texture(TextureType::I
 
 bool ImageTexture::LoadImage(const std::string &filepath)
 {
+    // Decoded texels are cached, keyed by the source file
+    uint64_t cache_key = 0;
+    if (SceneCache::Enabled()) {
+        cache_key = SceneCache::HashFile(filepath, static_cast<uint64_t>(TextureType::IMAGE));
+        MappedArray<uint8_t> texels;
+        if (SceneCache::LoadTexture(cache_key, width, height, channels, texels) && channels >= 3 &&
+            texels.size() == static_cast<size_t>(width) * height * channels) {
+            image_data = std::make_unique<unsigned char[]>(texels.size());
+            std::memcpy(image_data.get(), texels.data(), texels.size());
+            return true;
+        }
+    }
+
     unsigned char* data = stbi_load(filepath.c_str(), &width, &height, &channels, 0);
     
     if (!data) {
@@ -39,6 +53,8 @@ bool ImageTexture::LoadImage(const std::string &filepath)
     std::memcpy(image_data.get(), data, total_size);
 
     stbi_image_free(data);
+    if (cache_key != 0)
+        SceneCache::SaveTexture(cache_key, width, height, channels, image_data.get(), total_size);
     
     std::cout << "Successfully loaded image: " << filepath 
               << " (" << width << "x" << height << ", " << channels << " channels)" << std::endl;
@@ -81,6 +97,18 @@ HDRTexture::HDRTexture(const std::string &filepath) : Texture(TextureType::HDR),
 
 bool HDRTexture::LoadHDR(const std::string &filepath)
 {
+    uint64_t cache_key = 0;
+    if (SceneCache::Enabled()) {
+        cache_key = SceneCache::HashFile(filepath, static_cast<uint64_t>(TextureType::HDR));
+        MappedArray<uint8_t> texels;
+        if (SceneCache::LoadTexture(cache_key, width, height, channels, texels) && channels >= 3 &&
+            texels.size() == static_cast<size_t>(width) * height * channels * sizeof(float)) {
+            hdr_data = std::make_unique<float[]>(static_cast<size_t>(width) * height * channels);
+            std::memcpy(hdr_data.get(), texels.data(), texels.size());
+            return true;
+        }
+    }
+
     float* data = stbi_loadf(filepath.c_str(), &width, &height, &channels, 0);
     
     if (!data) {
@@ -100,6 +128,8 @@ bool HDRTexture::LoadHDR(const std::string &filepath)
     std::memcpy(hdr_data.get(), data, total_size * sizeof(float));
 
     stbi_image_free(data);
+    if (cache_key != 0)
+        SceneCache::SaveTexture(cache_key, width, height, channels, hdr_data.get(), total_size * sizeof(float));
     
     std::cout << "Successfully loaded HDR image: " << filepath 
               << " (" << width << "x" << height << ", " << channels << " channels)" << std::endl;
@@ -0,0 +1,196 @@
+#include "ThreadPool.hpp"
+
+namespace {
+    thread_local int current_thread_index = 0;
+
+    int configured_threads = 0;
+    bool configured_pinning = false;
+    std::atomic<bool> global_created = false;
+
+    // Sets the calling thread's Parallel index for the lifetime of the scope
+    struct ScopedThreadIndex {
+        int previous;
+        explicit ScopedThreadIndex(int index) : previous(current_thread_index) { current_thread_index = index; }
+        ~ScopedThreadIndex() { current_thread_index = previous; }
+    };
+
+    // Keeps the calling thread's OpenMP regions serial for the lifetime of the scope, as on the workers
+    struct ScopedSerialOpenMP {
+        int previous;
+        ScopedSerialOpenMP() : previous(omp_get_max_threads()) { omp_set_num_threads(1); }
+        ~ScopedSerialOpenMP() { omp_set_num_threads(previous); }
+    };
+
+    void PinThread(std::thread &thread, int processor)
+    {
+#ifdef _WIN32
+        SetThreadAffinityMask(thread.native_handle(), static_cast<DWORD_PTR>(1) << (processor % 64));
+#else
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(processor % CPU_SETSIZE, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+}
+
+ThreadPool::ThreadPool(int threads, bool pin_threads)
+{
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    workers.reserve(threads - 1);
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back([this] { WorkerLoop(); });
+        if (pin_threads)
+            PinThread(workers.back(), i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    work_cv.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+ThreadPool &ThreadPool::Global()
+{
+    static ThreadPool pool = [] {
+        global_created = true;
+        omp_set_num_threads(configured_threads > 0 ? configured_threads : std::max(1u, std::thread::hardware_concurrency()));
+        omp_set_max_active_levels(1);
+        return ThreadPool(configured_threads, configured_pinning);
+    }();
+    return pool;
+}
+
+void ThreadPool::Configure(int threads, bool pin_threads)
+{
+    if (global_created) {
+        std::cerr << "ThreadPool::Configure: the engine pool is already running, settings ignored" << std::endl;
+        return;
+    }
+    configured_threads = threads;
+    configured_pinning = pin_threads;
+}
+
+int ThreadPool::ThreadIndex()
+{
+    return current_thread_index;
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+        if (helpers > 0)
+            done_cv.notify_all();
+    }
+    work_cv.notify_one();
+}
+
+void ThreadPool::Parallel(int participants, const std::function<void(int)> &fn)
+{
+    participants = std::max(participants, 1);
+    std::atomic<int> remaining = participants - 1;
+    for (int i = 1; i < participants; i++) {
+        Submit([&fn, &remaining, i] {
+            ScopedThreadIndex index(i);
+            fn(i);
+            remaining--;
+        });
+    }
+    {
+        ScopedThreadIndex index(0);
+        ScopedSerialOpenMP serial;
+        fn(0);
+    }
+    HelpUntil([&remaining] { return remaining == 0; });
+}
+
+void ThreadPool::HelpUntil(const std::function<bool()> &done)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    helpers++;
+    while (!done()) {
+        if (!tasks.empty()) {
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop_front();
+            lock.unlock();
+            Execute(task);
+            lock.lock();
+            continue;
+        }
+        done_cv.wait(lock);
+    }
+    helpers--;
+}
+
+void ThreadPool::WorkerLoop()
+{
+    // The pool is the parallelism here, OpenMP regions inside tasks stay on their worker
+    omp_set_num_threads(1);
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_cv.wait(lock, [this] { return stop || !tasks.empty(); });
+            if (tasks.empty())
+                return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        Execute(task);
+    }
+}
+
+void ThreadPool::Execute(std::function<void()> &task)
+{
+    task();
+    // Taking the lock orders the task's effects before a helper's next done() check
+    std::lock_guard<std::mutex> lock(mutex);
+    if (helpers > 0)
+        done_cv.notify_all();
+}
+
+TaskGraph::TaskId TaskGraph::Add(std::function<void()> task, std::initializer_list<TaskId> dependencies)
+{
+    TaskId id = nodes.size();
+    Node &node = nodes.emplace_back();
+    node.task = std::move(task);
+    for (TaskId dependency : dependencies) {
+        nodes[dependency].dependents.push_back(id);
+        node.dependencies++;
+    }
+    return id;
+}
+
+void TaskGraph::Run(ThreadPool &pool)
+{
+    std::atomic<size_t> remaining = nodes.size();
+    for (Node &node : nodes)
+        node.pending = node.dependencies;
+    for (TaskId id = 0; id < nodes.size(); id++) {
+        if (nodes[id].dependencies == 0)
+            Launch(pool, id, remaining);
+    }
+    pool.HelpUntil([&remaining] { return remaining == 0; });
+}
+
+void TaskGraph::Launch(ThreadPool &pool, TaskId id, std::atomic<size_t> &remaining)
+{
+    pool.Submit([this, &pool, id, &remaining] {
+        Node &node = nodes[id];
+        node.task();
+        for (TaskId dependent : node.dependents) {
+            if (--nodes[dependent].pending == 0)
+                Launch(pool, dependent, remaining);
+        }
+        remaining--;
+    });
+}
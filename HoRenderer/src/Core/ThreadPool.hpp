@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Util.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Persistent worker threads shared by the whole engine: frame rendering, BVH builds and anything
+// else that can be cut into tasks. The threads start once and sleep between tasks, so a frame costs
+// a few queue operations rather than a new parallel region. A thread that waits for tasks (Parallel,
+// TaskGraph::Run) runs queued tasks meanwhile, so tasks may wait for other tasks without starving
+// the pool.
+class ThreadPool {
+public:
+    /*
+    * @args: threads: threads that run tasks, the one calling Parallel/HelpUntil included, 0 for
+    *        std::thread::hardware_concurrency
+    *        pin_threads: bind worker i to logical processor i
+    */
+    explicit ThreadPool(int threads = 0, bool pin_threads = false);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /*
+    * @brief: The engine-wide pool, created on first use. OpenMP regions opened by the thread that
+    *         creates it use the pool's thread count, and nested regions run serially. Inside pool
+    *         tasks and Parallel calls OpenMP regions run on the calling thread alone, whichever
+    *         thread that is, the pool is already busy.
+    */
+    static ThreadPool &Global();
+    // Settings of Global, only before its first use
+    static void Configure(int threads, bool pin_threads = false);
+    // Index of the calling thread in the innermost Parallel call, 0 outside of one
+    static int ThreadIndex();
+
+    int Size() const { return static_cast<int>(workers.size()) + 1; }
+
+    void Submit(std::function<void()> task);
+    // Runs fn(i) for every i in [0, participants) and returns when all have, the caller runs fn(0)
+    void Parallel(int participants, const std::function<void(int)> &fn);
+    // Runs fn(i) for every i in [0, count) on all threads of the pool, grain indices at a time
+    template <typename Fn>
+    void ParallelFor(size_t count, size_t grain, Fn &&fn) {
+        std::atomic<size_t> next = 0;
+        Parallel(Size(), [&](int) {
+            for (size_t begin; (begin = next.fetch_add(grain)) < count;) {
+                for (size_t i = begin; i < std::min(begin + grain, count); i++)
+                    fn(i);
+            }
+        });
+    }
+    // Runs queued tasks on the calling thread until done() holds
+    void HelpUntil(const std::function<bool()> &done);
+
+private:
+    void WorkerLoop();
+    // Runs task and wakes the threads waiting in HelpUntil
+    void Execute(std::function<void()> &task);
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable work_cv;  // new tasks, or stop
+    std::condition_variable done_cv;  // a task finished or was queued, for HelpUntil
+    int helpers = 0;
+    bool stop = false;
+};
+
+// Tasks with dependencies, run on a ThreadPool. A task starts once every task it depends on has
+// finished; independent tasks run concurrently.
+class TaskGraph {
+public:
+    using TaskId = size_t;
+
+    // dependencies: tasks added earlier that must finish first
+    TaskId Add(std::function<void()> task, std::initializer_list<TaskId> dependencies = {});
+    // Runs every task once and returns when all have finished, the calling thread helps
+    void Run(ThreadPool &pool = ThreadPool::Global());
+
+private:
+    struct Node {
+        std::function<void()> task;
+        std::vector<TaskId> dependents;
+        int dependencies = 0;
+        std::atomic<int> pending = 0;
+    };
+
+    void Launch(ThreadPool &pool, TaskId id, std::atomic<size_t> &remaining);
+
+private:
+    std::deque<Node> nodes; // Node is not movable, a deque never moves its elements on growth
+};
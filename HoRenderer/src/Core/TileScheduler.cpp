@@ -0,0 +1,105 @@
+#include "TileScheduler.hpp"
+
+namespace {
+    // Interleaves the bits of x and y, x in the even bits
+    uint32_t MortonCode(uint32_t x, uint32_t y)
+    {
+        auto spread = [](uint32_t v) {
+            v &= 0x0000FFFF;
+            v = (v | (v << 8)) & 0x00FF00FF;
+            v = (v | (v << 4)) & 0x0F0F0F0F;
+            v = (v | (v << 2)) & 0x33333333;
+            v = (v | (v << 1)) & 0x55555555;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+}
+
+TileScheduler::TileScheduler(int width, int height, int tile_size, TileOrder order) :
+    width(width), height(height), tile_size(std::max(tile_size, 1)), order(order)
+{
+    BuildTiles();
+}
+
+void TileScheduler::SetTileSize(int size)
+{
+    tile_size = std::max(size, 1);
+    BuildTiles();
+}
+
+void TileScheduler::SetOrder(TileOrder tile_order)
+{
+    order = tile_order;
+    BuildTiles();
+}
+
+void TileScheduler::BuildTiles()
+{
+    int columns = (width + tile_size - 1) / tile_size;
+    int rows = (height + tile_size - 1) / tile_size;
+    std::vector<std::pair<double, int>> keys;
+    keys.reserve(static_cast<size_t>(columns) * rows);
+
+    // Spiral: ring around the centre tile first, then the angle inside the ring
+    float center_x = 0.5f * (columns - 1), center_y = 0.5f * (rows - 1);
+    for (int row = 0; row < rows; row++) {
+        for (int column = 0; column < columns; column++) {
+            int tile = row * columns + column;
+            double key = tile;
+            if (order == TileOrder::MORTON) {
+                key = MortonCode(column, row);
+            } else if (order == TileOrder::CENTER_FIRST) {
+                float dx = column - center_x, dy = row - center_y;
+                float ring = std::floor(std::max(std::abs(dx), std::abs(dy)));
+                float angle = std::atan2(dy, dx) + PI; // [0, 2pi]
+                key = ring * 8.0f + angle;
+            }
+            keys.emplace_back(key, tile);
+        }
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+
+    tiles.clear();
+    tiles.reserve(keys.size());
+    for (const auto &[key, tile] : keys) {
+        int x0 = (tile % columns) * tile_size, y0 = (tile / columns) * tile_size;
+        tiles.push_back({x0, y0, std::min(x0 + tile_size, width), std::min(y0 + tile_size, height), static_cast<int>(tiles.size())});
+    }
+}
+
+void TileScheduler::Deal(int threads)
+{
+    queues = std::make_unique<TileQueue[]>(threads);
+    int count = static_cast<int>(tiles.size());
+    for (int tile = 0; tile < count; tile++) {
+        int owner = order == TileOrder::CENTER_FIRST ? tile % threads
+                                                     : static_cast<int>(static_cast<int64_t>(tile) * threads / count);
+        queues[owner].tiles.push_back(tile);
+    }
+}
+
+bool TileScheduler::Next(int thread, int threads, int &tile)
+{
+    {
+        TileQueue &own = queues[thread];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tiles.empty()) {
+            tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+    // Tiles are never added during a run, so one pass over empty deques means the frame is done
+    for (int i = 1; i < threads; i++) {
+        TileQueue &victim = queues[(thread + i) % threads];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tiles.empty()) {
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            steals++;
+            return true;
+        }
+    }
+    return false;
+}
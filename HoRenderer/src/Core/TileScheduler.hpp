@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Util.hpp"
+#include "ThreadPool.hpp"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+enum class TileOrder {
+    SCANLINE,     // rows of tiles, top to bottom
+    MORTON,       // Z-order curve: tiles rendered close together in time are close on screen
+    CENTER_FIRST  // spiral out from the centre of the image, the part a viewer looks at first
+};
+
+struct Tile {
+    int x0, y0, x1, y1; // pixel bounds, x1 and y1 exclusive
+    int index;          // position in the scheduling order
+};
+
+// Splits a frame into square tiles and renders them on the engine's ThreadPool. Every thread owns a
+// deque of tiles: it takes work from the front of its own and, once that is empty, steals from the
+// back of another thread's, so a few expensive tiles do not hold up the frame. SCANLINE and MORTON
+// hand every thread a contiguous run of the order, keeping neighbouring tiles in one thread's caches;
+// CENTER_FIRST deals the tiles out round-robin, so the whole team starts in the middle.
+class TileScheduler {
+public:
+    // Called after every tile from the thread that rendered it, with the tiles finished so far
+    using ProgressFn = std::function<void(const Tile &tile, size_t done, size_t total)>;
+
+    TileScheduler(int width, int height, int tile_size = 16, TileOrder order = TileOrder::MORTON);
+
+    /*
+    * @brief: Renders every tile once.
+    *
+    * @args: render_tile: called as render_tile(const Tile &, int thread) with thread in [0, threads),
+    *        so callers can keep per-thread state in an array. ThreadPool::ThreadIndex() gives the
+    *        same index further down the call stack
+    * @ret: false when Cancel stopped the run before every tile was rendered
+    */
+    template <typename RenderTileFn>
+    bool Run(int threads, RenderTileFn &&render_tile);
+
+    // Stops the running Run after the tiles in flight, does nothing between runs
+    void Cancel() {
+        if (running)
+            cancelled = true;
+    }
+    bool IsCancelled() const { return cancelled; }
+    void SetProgressCallback(ProgressFn callback) { progress = std::move(callback); }
+
+    void SetTileSize(int tile_size);
+    int GetTileSize() const { return tile_size; }
+    void SetOrder(TileOrder order);
+    TileOrder GetOrder() const { return order; }
+    const std::vector<Tile> &GetTiles() const { return tiles; }
+    // Tiles that moved from one thread's deque to another during the last Run
+    size_t GetSteals() const { return steals; }
+
+private:
+    struct alignas(64) TileQueue {
+        std::mutex lock;
+        std::deque<int> tiles;
+    };
+
+    // Lays the tiles out in order
+    void BuildTiles();
+    // Fills one deque per thread
+    void Deal(int threads);
+    // Front of the own deque, else the back of the first non-empty other one
+    bool Next(int thread, int threads, int &tile);
+
+private:
+    int width, height;
+    int tile_size;
+    TileOrder order;
+    std::vector<Tile> tiles;
+    std::unique_ptr<TileQueue[]> queues;
+    std::atomic<bool> running = false;
+    std::atomic<bool> cancelled = false;
+    std::atomic<size_t> tiles_done = 0;
+    std::atomic<size_t> steals = 0;
+    ProgressFn progress;
+};
+
+template <typename RenderTileFn>
+bool TileScheduler::Run(int threads, RenderTileFn &&render_tile)
+{
+    threads = std::max(threads, 1);
+    Deal(threads);
+    tiles_done = 0;
+    steals = 0;
+    // A Cancel that raced with the end of the last run must not stop this one
+    cancelled = false;
+    running = true;
+
+    // More threads than the pool has run one after another, finding their deques stolen
+    ThreadPool::Global().Parallel(threads, [&](int thread) {
+        int tile;
+        while (!cancelled && Next(thread, threads, tile)) {
+            render_tile(tiles[tile], thread);
+            size_t done = ++tiles_done;
+            if (progress)
+                progress(tiles[tile], done, tiles.size());
+        }
+    });
+
+    running = false;
+    bool finished = !cancelled;
+    cancelled = false;
+    return finished;
+}
@@ -3,55 +3,100 @@
 */
 #include "Transform.hpp"
 
-bool Translate::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const {
+bool Translate::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const {
     Ray offset_r(r.origin() - offset, r.direction());
 
-    if (!object->isHit(offset_r, t_interval, rec))
+    SurfaceHit inner;
+    if (!object->Intersect(offset_r, t_interval, inner))
         return false;
 
+    hit = inner;
+    hit.PushWrapper(this);
+    return true;
+}
+
+void Translate::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const {
+    SurfaceHit inner = hit.Unwrap();
+    inner.object->ComputeSurfaceInteraction(Ray(r.origin() - offset, r.direction()), inner, rec);
+
     rec.p += offset;
+}
 
-    return true;
+bool Translate::isOccluded(const Ray &r, float t_max) const {
+    return object->isOccluded(Ray(r.origin() - offset, r.direction()), t_max);
 }
 
-bool Rotate::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const {
-    Vector3f origin, direction;
+Matrix4f Translate::GetMatrix() const {
+    Matrix4f m(1.0f);
+    m[3] = Vector4f(offset, 1.0f);
+    return m;
+}
 
+Ray Rotate::toObjectSpace(const Ray &r) const {
     switch (axis) {
     case RotationAxis::X:
-        origin = rotateX_inverse(r.origin());
-        direction = rotateX_inverse(r.direction());
-        break;
+        return Ray(rotateX_inverse(r.origin()), rotateX_inverse(r.direction()));
     case RotationAxis::Y:
-        origin = rotateY_inverse(r.origin());
-        direction = rotateY_inverse(r.direction());
-        break;
+        return Ray(rotateY_inverse(r.origin()), rotateY_inverse(r.direction()));
     case RotationAxis::Z:
-        origin = rotateZ_inverse(r.origin());
-        direction = rotateZ_inverse(r.direction());
-        break;
+        return Ray(rotateZ_inverse(r.origin()), rotateZ_inverse(r.direction()));
+    }
+    return r;
+}
+
+Vector3f Rotate::toWorldSpace(const Vector3f &v) const {
+    switch (axis) {
+    case RotationAxis::X:
+        return rotateX_forward(v);
+    case RotationAxis::Y:
+        return rotateY_forward(v);
+    case RotationAxis::Z:
+        return rotateZ_forward(v);
     }
+    return v;
+}
 
-    Ray rotated_ray(origin, direction);
-    if (!object->isHit(rotated_ray, t_interval, rec))
+bool Rotate::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const {
+    SurfaceHit inner;
+    if (!object->Intersect(toObjectSpace(r), t_interval, inner))
         return false;
 
+    hit = inner;
+    hit.PushWrapper(this);
+    return true;
+}
+
+void Rotate::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const {
+    SurfaceHit inner = hit.Unwrap();
+    inner.object->ComputeSurfaceInteraction(toObjectSpace(r), inner, rec);
+
+    rec.p = toWorldSpace(rec.p);
+    rec.normal = toWorldSpace(rec.normal);
+    rec.tangent = toWorldSpace(rec.tangent);
+}
+
+bool Rotate::isOccluded(const Ray &r, float t_max) const {
+    return object->isOccluded(toObjectSpace(r), t_max);
+}
+
+Matrix4f Rotate::GetMatrix() const {
+    // Columns are the images of the basis vectors under the forward rotation
+    Matrix4f m(1.0f);
     switch (axis) {
     case RotationAxis::X:
-        rec.p = rotateX_forward(rec.p);
-        rec.normal = rotateX_forward(rec.normal);
+        m[1] = Vector4f(rotateX_forward(Vector3f(0, 1, 0)), 0.0f);
+        m[2] = Vector4f(rotateX_forward(Vector3f(0, 0, 1)), 0.0f);
         break;
     case RotationAxis::Y:
-        rec.p = rotateY_forward(rec.p);
-        rec.normal = rotateY_forward(rec.normal);
+        m[0] = Vector4f(rotateY_forward(Vector3f(1, 0, 0)), 0.0f);
+        m[2] = Vector4f(rotateY_forward(Vector3f(0, 0, 1)), 0.0f);
         break;
     case RotationAxis::Z:
-        rec.p = rotateZ_forward(rec.p);
-        rec.normal = rotateZ_forward(rec.normal);
+        m[0] = Vector4f(rotateZ_forward(Vector3f(1, 0, 0)), 0.0f);
+        m[1] = Vector4f(rotateZ_forward(Vector3f(0, 1, 0)), 0.0f);
         break;
     }
-
-    return true;
+    return m;
 }
 
 Vector3f Rotate::rotateX_inverse(const Vector3f &v) const {
@@ -132,37 +177,42 @@ AABB Rotate::computeRotatedBoundingBox() {
     return AABB(min_rotated, max_rotated);
 }
 
-bool Scale::isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const {
-    Vector3f scaled_origin = Vector3f(r.origin().x * inv_scale.x,
-                                      r.origin().y * inv_scale.y,
-                                      r.origin().z * inv_scale.z);
-
-    Vector3f scaled_direction = Vector3f(r.direction().x * inv_scale.x,
-                                         r.direction().y * inv_scale.y,
-                                         r.direction().z * inv_scale.z);
-
-    Ray scaled_ray(scaled_origin, scaled_direction);
+Ray Scale::toObjectSpace(const Ray &r) const {
+    // Origin and direction are scaled together, so t is the same in both spaces
+    return Ray(r.origin() * inv_scale, r.direction() * inv_scale);
+}
 
-    if (!object->isHit(scaled_ray, t_interval, rec))
+bool Scale::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const {
+    SurfaceHit inner;
+    if (!object->Intersect(toObjectSpace(r), t_interval, inner))
         return false;
 
-    Vector3f world_point = Vector3f(rec.p.x * scale.x,
-                                    rec.p.y * scale.y,
-                                    rec.p.z * scale.z);
-
-    Vector3f world_normal = Vector3f(rec.normal.x * inv_scale.x,
-                                     rec.normal.y * inv_scale.y,
-                                     rec.normal.z * inv_scale.z);
+    hit = inner;
+    hit.PushWrapper(this);
+    return true;
+}
 
-    world_normal = glm::normalize(world_normal);
+void Scale::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const {
+    SurfaceHit inner = hit.Unwrap();
+    inner.object->ComputeSurfaceInteraction(toObjectSpace(r), inner, rec);
 
-    float direction_scale = glm::length(scaled_direction) / glm::length(r.direction());
-    rec.t = rec.t / direction_scale;
+    rec.p = rec.p * scale;
+    // Normals transform with the inverse transpose, tangents with the scale itself
+    rec.normal = glm::normalize(rec.normal * inv_scale);
+    if (glm::dot(rec.tangent, rec.tangent) > 0.0f)
+        rec.tangent = glm::normalize(rec.tangent * scale);
+}
 
-    rec.p = world_point;
-    rec.normal = world_normal;
+bool Scale::isOccluded(const Ray &r, float t_max) const {
+    return object->isOccluded(toObjectSpace(r), t_max);
+}
 
-    return true;
+Matrix4f Scale::GetMatrix() const {
+    Matrix4f m(1.0f);
+    m[0][0] = scale.x;
+    m[1][1] = scale.y;
+    m[2][2] = scale.z;
+    return m;
 }
 
 AABB Scale::computeScaledBoundingBox() {
@@ -187,4 +237,74 @@ AABB Scale::computeScaledBoundingBox() {
                                   std::max(scaled_min.z, scaled_max.z));
 
     return AABB(final_min, final_max);
-}
\ No newline at end of file
+}
+
+AffineTransform::AffineTransform(std::shared_ptr<Hittable> object, const Matrix4f &object_to_world) :
+    object(object), to_world(object_to_world) {
+    to_object = glm::inverse(to_world);
+    normal_matrix = glm::transpose(glm::inverse(Matrix3f(to_world)));
+    bbox = TransformBoundingBox(object->getBoundingBox(), to_world);
+}
+
+Ray AffineTransform::toObjectSpace(const Ray &r) const {
+    return Ray(Vector3f(to_object * Vector4f(r.origin(), 1.0f)), Vector3f(to_object * Vector4f(r.direction(), 0.0f)));
+}
+
+bool AffineTransform::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const {
+    SurfaceHit inner;
+    if (!object->Intersect(toObjectSpace(r), t_interval, inner))
+        return false;
+
+    hit = inner;
+    hit.PushWrapper(this);
+    return true;
+}
+
+void AffineTransform::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const {
+    SurfaceHit inner = hit.Unwrap();
+    inner.object->ComputeSurfaceInteraction(toObjectSpace(r), inner, rec);
+
+    rec.p = Vector3f(to_world * Vector4f(rec.p, 1.0f));
+    rec.normal = glm::normalize(normal_matrix * rec.normal);
+    if (glm::dot(rec.tangent, rec.tangent) > 0.0f)
+        rec.tangent = glm::normalize(Vector3f(to_world * Vector4f(rec.tangent, 0.0f)));
+}
+
+bool AffineTransform::isOccluded(const Ray &r, float t_max) const {
+    return object->isOccluded(toObjectSpace(r), t_max);
+}
+
+AABB TransformBoundingBox(const AABB &bbox, const Matrix4f &matrix) {
+    Vector3f min_point(Infinity), max_point(-Infinity);
+    for (int i = 0; i < 8; i++) {
+        Vector3f corner((i & 1) ? bbox.max().x : bbox.min().x,
+                        (i & 2) ? bbox.max().y : bbox.min().y,
+                        (i & 4) ? bbox.max().z : bbox.min().z);
+        Vector3f p = Vector3f(matrix * Vector4f(corner, 1.0f));
+        min_point = glm::min(min_point, p);
+        max_point = glm::max(max_point, p);
+    }
+    return AABB(min_point, max_point);
+}
+
+std::shared_ptr<Hittable> Transform::Unwrap(std::shared_ptr<Hittable> object, Matrix4f &matrix,
+                                            std::vector<const Hittable *> *wrappers) {
+    matrix = Matrix4f(1.0f);
+    while (true) {
+        const Hittable *wrapper = object.get();
+        if (auto translate = std::dynamic_pointer_cast<Translate>(object)) {
+            matrix = matrix * translate->GetMatrix();
+            object = translate->GetObject();
+        } else if (auto rotate = std::dynamic_pointer_cast<Rotate>(object)) {
+            matrix = matrix * rotate->GetMatrix();
+            object = rotate->GetObject();
+        } else if (auto scale = std::dynamic_pointer_cast<Scale>(object)) {
+            matrix = matrix * scale->GetMatrix();
+            object = scale->GetObject();
+        } else {
+            return object;
+        }
+        if (wrappers)
+            wrappers->push_back(wrapper);
+    }
+}
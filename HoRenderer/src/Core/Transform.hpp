@@ -14,13 +14,24 @@ inline AABB operator+(const Vector3f& offset, const AABB& bbox) {
     return bbox + offset;
 }
 
+// Translate, Rotate, Scale and AffineTransform hand their object the ray mapped into object space
+// without renormalising its direction, so a hit at parameter t lies at r.at(t) in both spaces and
+// every wrapper reports t unchanged; the shapes solve for t with whatever direction length they get.
 class Translate : public Hittable {
 public:
     Translate(std::shared_ptr<Hittable> object, const Vector3f& offset) : object(object), offset(offset) {
         bbox = object->getBoundingBox() + offset;
     }
-    virtual bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const override;
+    virtual bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    virtual void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    virtual bool isOccluded(const Ray &r, float t_max) const override;
     AABB getBoundingBox() const override { return bbox; }
+    void BindMaterials(MaterialTable &table) override { object->BindMaterials(table); }
+    int WrapperDepth() const override { return object->WrapperDepth() + 1; }
+
+    std::shared_ptr<Hittable> GetObject() const { return object; }
+    // Object space to world space
+    Matrix4f GetMatrix() const;
 private:
     std::shared_ptr<Hittable> object;
     Vector3f offset;
@@ -39,8 +50,15 @@ public:
         cos_theta = std::cos(radians);
         bbox = computeRotatedBoundingBox();
     }
-    virtual bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const override;
+    virtual bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    virtual void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    virtual bool isOccluded(const Ray &r, float t_max) const override;
     AABB getBoundingBox() const override { return bbox; }
+    void BindMaterials(MaterialTable &table) override { object->BindMaterials(table); }
+    int WrapperDepth() const override { return object->WrapperDepth() + 1; }
+
+    std::shared_ptr<Hittable> GetObject() const { return object; }
+    Matrix4f GetMatrix() const;
 
 private:
     std::shared_ptr<Hittable> object;
@@ -55,6 +73,8 @@ private:
     Vector3f rotateY_forward(const Vector3f& v) const;
     Vector3f rotateZ_inverse(const Vector3f &v) const;
     Vector3f rotateZ_forward(const Vector3f& v) const;
+    Vector3f toWorldSpace(const Vector3f &v) const;
+    Ray toObjectSpace(const Ray &r) const;
     AABB computeRotatedBoundingBox();
 };
 
@@ -71,8 +91,15 @@ public:
         bbox = computeScaledBoundingBox();
     }
 
-    virtual bool isHit(const Ray &r, Vector2f t_interval, Hit_Payload &rec) const override;
+    virtual bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    virtual void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    virtual bool isOccluded(const Ray &r, float t_max) const override;
     AABB getBoundingBox() const override { return bbox; }
+    void BindMaterials(MaterialTable &table) override { object->BindMaterials(table); }
+    int WrapperDepth() const override { return object->WrapperDepth() + 1; }
+
+    std::shared_ptr<Hittable> GetObject() const { return object; }
+    Matrix4f GetMatrix() const;
     
 private:
     std::shared_ptr<Hittable> object;
@@ -80,10 +107,50 @@ private:
     Vector3f inv_scale;
     AABB bbox;
 
+    Ray toObjectSpace(const Ray &r) const;
     AABB computeScaledBoundingBox();
 };
 
+// Any affine object to world transform applied with a single matrix. Scene::Compile
+// collapses chains of Translate/Rotate/Scale it can not bake into geometry into one of these.
+class AffineTransform : public Hittable {
+public:
+    AffineTransform(std::shared_ptr<Hittable> object, const Matrix4f &object_to_world);
+
+    virtual bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    virtual void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    virtual bool isOccluded(const Ray &r, float t_max) const override;
+    AABB getBoundingBox() const override { return bbox; }
+    void BindMaterials(MaterialTable &table) override { object->BindMaterials(table); }
+    int WrapperDepth() const override { return object->WrapperDepth() + 1; }
+
+    std::shared_ptr<Hittable> GetObject() const { return object; }
+    const Matrix4f &GetMatrix() const { return to_world; }
+
+private:
+    // t is the same in both spaces since the direction is transformed without normalizing
+    Ray toObjectSpace(const Ray &r) const;
+
+    std::shared_ptr<Hittable> object;
+    Matrix4f to_world;
+    Matrix4f to_object;
+    Matrix3f normal_matrix; // inverse transpose of the linear part
+    AABB bbox;
+};
+
+// Bounds of an object space box after an affine transform
+AABB TransformBoundingBox(const AABB &bbox, const Matrix4f &matrix);
+
 namespace Transform {
+    /*
+    * @brief: Collapse a chain of Translate/Rotate/Scale into one object to world matrix.
+    *
+    * @args: wrappers: optional, receives the transforms of the chain outermost first
+    * @ret: the innermost object that is not a transform
+    */
+    std::shared_ptr<Hittable> Unwrap(std::shared_ptr<Hittable> object, Matrix4f &matrix,
+                                     std::vector<const Hittable *> *wrappers = nullptr);
+
     inline std::shared_ptr<Translate> translate(std::shared_ptr<Hittable> object, const Vector3f& offset) {
         return std::make_shared<Translate>(object, offset);
     }
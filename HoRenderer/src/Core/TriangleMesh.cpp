@@ -0,0 +1,183 @@
+#include "TriangleMesh.hpp"
+#include "Material.hpp"
+
+
+WatertightRay::WatertightRay(const Ray &r) : origin(r.origin())
+{
+    const Vector3f &dir = r.direction();
+    Vector3f abs_dir = glm::abs(dir);
+    kz = abs_dir.x > abs_dir.y ? (abs_dir.x > abs_dir.z ? 0 : 2) : (abs_dir.y > abs_dir.z ? 1 : 2);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    // Keep the winding of the triangle when the dominant axis points backwards
+    if (dir[kz] < 0.0f)
+        std::swap(kx, ky);
+
+    Sx = dir[kx] / dir[kz];
+    Sy = dir[ky] / dir[kz];
+    Sz = 1.0f / dir[kz];
+}
+
+bool IntersectTriangle(const WatertightRay &ray, const Vector3f &p0, const Vector3f &p1, const Vector3f &p2,
+                       Vector2f t_interval, float &t, float &b0, float &b1, float &b2)
+{
+    Vector3f A = p0 - ray.origin;
+    Vector3f B = p1 - ray.origin;
+    Vector3f C = p2 - ray.origin;
+
+    float Ax = A[ray.kx] - ray.Sx * A[ray.kz];
+    float Ay = A[ray.ky] - ray.Sy * A[ray.kz];
+    float Bx = B[ray.kx] - ray.Sx * B[ray.kz];
+    float By = B[ray.ky] - ray.Sy * B[ray.kz];
+    float Cx = C[ray.kx] - ray.Sx * C[ray.kz];
+    float Cy = C[ray.ky] - ray.Sy * C[ray.kz];
+
+    // Scaled barycentric coordinates
+    float U = Cx * By - Cy * Bx;
+    float V = Ax * Cy - Ay * Cx;
+    float W = Bx * Ay - By * Ax;
+
+    // The ray passes exactly through an edge, redo the edge tests in double precision
+    if (U == 0.0f || V == 0.0f || W == 0.0f) {
+        U = static_cast<float>(static_cast<double>(Cx) * By - static_cast<double>(Cy) * Bx);
+        V = static_cast<float>(static_cast<double>(Ax) * Cy - static_cast<double>(Ay) * Cx);
+        W = static_cast<float>(static_cast<double>(Bx) * Ay - static_cast<double>(By) * Ax);
+    }
+
+    if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f))
+        return false;
+
+    float det = U + V + W;
+    if (det == 0.0f)
+        return false;
+
+    float Az = ray.Sz * A[ray.kz];
+    float Bz = ray.Sz * B[ray.kz];
+    float Cz = ray.Sz * C[ray.kz];
+    float T = U * Az + V * Bz + W * Cz;
+
+    // Compare against the interval scaled by det to avoid the division for rejected hits
+    if (det < 0.0f) {
+        if (T > t_interval.x * det || T < t_interval.y * det)
+            return false;
+    } else {
+        if (T < t_interval.x * det || T > t_interval.y * det)
+            return false;
+    }
+
+    float inv_det = 1.0f / det;
+    t = T * inv_det;
+    b0 = U * inv_det;
+    b1 = V * inv_det;
+    b2 = W * inv_det;
+    return true;
+}
+
+TriangleMesh::TriangleMesh(std::shared_ptr<const MeshBuffers> buffers, std::shared_ptr<Material> material,
+                           const BVHBuildOptions &options) :
+    buffers(std::move(buffers)), mat(material)
+{
+    size_t triangle_count = this->buffers->TriangleCount();
+    std::vector<AABB> bounds(triangle_count);
+    #pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < static_cast<int64_t>(triangle_count); i++)
+        bounds[i] = getTriangleBounds(static_cast<uint32_t>(i));
+
+    // Long thin triangles are what SBVH clipping is for
+    auto polygon = [this](uint32_t triangle, Vector3f *vertices) {
+        const uint32_t *index = &this->buffers->indices[3 * triangle];
+        for (int i = 0; i < 3; i++)
+            vertices[i] = this->buffers->Position(index[i]);
+        return 3;
+    };
+    bvh = LinearBVH(bounds, options, nullptr, polygon);
+    bbox = bvh.getBoundingBox();
+}
+
+AABB TriangleMesh::getTriangleBounds(uint32_t triangle) const
+{
+    const uint32_t *index = &buffers->indices[3 * triangle];
+    Vector3f p0 = buffers->Position(index[0]);
+    Vector3f p1 = buffers->Position(index[1]);
+    Vector3f p2 = buffers->Position(index[2]);
+    return AABB(glm::min(p0, glm::min(p1, p2)), glm::max(p0, glm::max(p1, p2)));
+}
+
+bool TriangleMesh::Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const
+{
+    const MeshBuffers &mesh = *buffers;
+    WatertightRay ray(r);
+
+    return bvh.Intersect(r, t_interval, [&](uint32_t triangle, Vector2f &interval) {
+        const uint32_t *index = &mesh.indices[3 * triangle];
+        float t, b0, b1, b2;
+        if (!IntersectTriangle(ray, mesh.Position(index[0]), mesh.Position(index[1]), mesh.Position(index[2]),
+                               interval, t, b0, b1, b2))
+            return false;
+        interval.y = t;
+        hit.t = t;
+        hit.object = this;
+        hit.prim_id = triangle;
+        hit.local = Vector2f(b1, b2);
+        return true;
+    });
+}
+
+void TriangleMesh::ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const
+{
+    const MeshBuffers &mesh = *buffers;
+    const uint32_t *index = &mesh.indices[3 * hit.prim_id];
+    float b1 = hit.local.x, b2 = hit.local.y;
+    float b0 = 1.0f - b1 - b2;
+    Vector3f p0 = mesh.Position(index[0]);
+    Vector3f p1 = mesh.Position(index[1]);
+    Vector3f p2 = mesh.Position(index[2]);
+
+    rec.t = hit.t;
+    rec.p = b0 * p0 + b1 * p1 + b2 * p2;
+    rec.material_id = material_binding.ID();
+
+    Vector3f geometric_normal = glm::normalize(glm::cross(p1 - p0, p2 - p0));
+    rec.set_face_normal(r, geometric_normal);
+    if (mesh.HasNormals()) {
+        // Shading normal, flipped onto the side the ray arrived from
+        Vector3f shading_normal = b0 * mesh.Normal(index[0]) + b1 * mesh.Normal(index[1]) + b2 * mesh.Normal(index[2]);
+        float length = glm::length(shading_normal);
+        if (length > 0.0f) {
+            shading_normal /= length;
+            rec.normal = glm::dot(shading_normal, rec.normal) < 0.0f ? -shading_normal : shading_normal;
+        }
+    }
+
+    // dp/du from the uv parameterization when there is one, otherwise along the first edge
+    Vector3f dpdu = p1 - p0;
+    if (mesh.HasUVs()) {
+        rec.uv = Vector2f(b0 * mesh.u[index[0]] + b1 * mesh.u[index[1]] + b2 * mesh.u[index[2]],
+                          b0 * mesh.v[index[0]] + b1 * mesh.v[index[1]] + b2 * mesh.v[index[2]]);
+        Vector2f duv1(mesh.u[index[1]] - mesh.u[index[0]], mesh.v[index[1]] - mesh.v[index[0]]);
+        Vector2f duv2(mesh.u[index[2]] - mesh.u[index[0]], mesh.v[index[2]] - mesh.v[index[0]]);
+        float det = duv1.x * duv2.y - duv1.y * duv2.x;
+        if (std::abs(det) > 1e-12f)
+            dpdu = (duv2.y * (p1 - p0) - duv1.y * (p2 - p0)) / det;
+    } else {
+        rec.uv = Vector2f(b1, b2);
+    }
+
+    // Gram-Schmidt against the shading normal
+    Vector3f tangent = dpdu - glm::dot(dpdu, rec.normal) * rec.normal;
+    float length = glm::length(tangent);
+    rec.tangent = length > 0.0f ? tangent / length : Vector3f(0.0f);
+}
+
+bool TriangleMesh::isOccluded(const Ray &r, float t_max) const
+{
+    const MeshBuffers &mesh = *buffers;
+    WatertightRay ray(r);
+    Vector2f t_interval(Epsilon, t_max);
+    return bvh.Occluded(r, t_interval, [&](uint32_t triangle) {
+        const uint32_t *index = &mesh.indices[3 * triangle];
+        float t, b0, b1, b2;
+        return IntersectTriangle(ray, mesh.Position(index[0]), mesh.Position(index[1]), mesh.Position(index[2]),
+                                 t_interval, t, b0, b1, b2);
+    });
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Util.hpp"
+#include "Hittable.hpp"
+#include "BVH.hpp"
+
+// Vertex data of a mesh stored as structure of arrays: one array per component instead
+// of one heap object per triangle. Normals and uvs are optional and left empty when the
+// asset does not provide them. Shared between every TriangleMesh built from the same asset.
+struct MeshBuffers {
+    MappedArray<float> px, py, pz;
+    MappedArray<float> nx, ny, nz;
+    MappedArray<float> u, v;
+    MappedArray<uint32_t> indices; // 3 per triangle
+
+    size_t VertexCount() const { return px.size(); }
+    size_t TriangleCount() const { return indices.size() / 3; }
+    bool HasNormals() const { return !nx.empty(); }
+    bool HasUVs() const { return !u.empty(); }
+    Vector3f Position(uint32_t vertex) const { return Vector3f(px[vertex], py[vertex], pz[vertex]); }
+    Vector3f Normal(uint32_t vertex) const { return Vector3f(nx[vertex], ny[vertex], nz[vertex]); }
+};
+
+// Per-ray constants of the watertight ray/triangle test (Woop, Benthin and Wald 2013).
+// The ray is sheared so that it points along +z, which makes the edge tests exact for
+// rays passing through shared edges and vertices: no cracks between adjacent triangles.
+struct WatertightRay {
+    WatertightRay(const Ray &r);
+
+    Vector3f origin;
+    int kx, ky, kz;
+    float Sx, Sy, Sz;
+};
+
+/*
+* @brief: Watertight ray/triangle intersection.
+*
+* @args: b0, b1, b2: barycentric coordinates of the hit for p0, p1, p2
+* @ret: true if the triangle is hit inside t_interval
+*/
+bool IntersectTriangle(const WatertightRay &ray, const Vector3f &p0, const Vector3f &p1, const Vector3f &p2,
+                       Vector2f t_interval, float &t, float &b0, float &b1, float &b2);
+
+// A triangle mesh as a single hittable. It owns a LinearBVH over its triangles whose
+// leaves refer to triangles by index into the shared MeshBuffers.
+class TriangleMesh : public Hittable {
+public:
+    TriangleMesh(std::shared_ptr<const MeshBuffers> buffers, std::shared_ptr<Material> material = nullptr,
+                 const BVHBuildOptions &options = {});
+
+    bool Intersect(const Ray &r, Vector2f t_interval, SurfaceHit &hit) const override;
+    void ComputeSurfaceInteraction(const Ray &r, const SurfaceHit &hit, Hit_Payload &rec) const override;
+    bool isOccluded(const Ray &r, float t_max) const override;
+    AABB getBoundingBox() const override {
+        return bbox;
+    }
+    void BindMaterials(MaterialTable &table) override { material_binding.Bind(table, mat); }
+
+    AABB getTriangleBounds(uint32_t triangle) const;
+    size_t TriangleCount() const { return buffers->TriangleCount(); }
+    const MeshBuffers &GetBuffers() const { return *buffers; }
+    std::shared_ptr<const MeshBuffers> GetSharedBuffers() const { return buffers; }
+    const std::shared_ptr<Material> &get_mat() const { return mat; }
+
+private:
+    std::shared_ptr<const MeshBuffers> buffers;
+    std::shared_ptr<Material> mat;
+    MaterialBinding material_binding;
+    LinearBVH bvh;
+    AABB bbox;
+};
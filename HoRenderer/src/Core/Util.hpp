@@ -45,8 +45,11 @@ class ProgressTracker;
 class Sphere;
 class Quad;
 class Box;
+class TriangleMesh;
+struct MeshBuffers;
 
 class Material;
+class MaterialTable;
 class Diffuse;
 class Conductor;
 class Plastic;
@@ -59,6 +62,14 @@ class Glass;
 
 class AABB;
 class BVHnode;
+class LinearBVH;
+template <int Width> class WideBVH;
+class QuantizedBVH;
+class LazyBVH;
+class EmbreeScene;
+class CompiledScene;
+class BottomLevelBVH;
+class Instance;
 class Filter;
 class UniformFilter;
 class GaussianFilter;
@@ -96,6 +107,11 @@ using Matrix4f = glm::mat4x4;
 
 
 constexpr float Epsilon = 1e-5f;
+// Shadow rays stop ShadowEpsilon plus ShadowEpsilonRelative times the largest coordinate of the
+// sampled light point short of it, which covers the rounding of that point without growing with
+// the distance to the light
+constexpr float ShadowEpsilon = 1e-4f;
+constexpr float ShadowEpsilonRelative = 64.0f * std::numeric_limits<float>::epsilon();
 constexpr float Infinity = std::numeric_limits<float>::infinity();
 constexpr float PI = 3.1415926535897932385f;
 constexpr float INV_PI = 1.0f / PI;
@@ -0,0 +1,203 @@
+#include "WavefrontIntegrator.hpp"
+#include "Material.hpp"
+
+WavefrontIntegrator::WavefrontIntegrator(int width, int height, int threads, int bounce, int tile_size) :
+    Integrator(width, height, threads, bounce)
+{
+    scheduler.SetTileSize(tile_size);
+}
+
+WavefrontIntegrator::Wavefront::Wavefront(size_t size, const Sampler &prototype)
+{
+    paths.pixel.resize(size);
+    paths.origin.resize(size);
+    paths.direction.resize(size);
+    paths.throughput.resize(size);
+    paths.radiance.resize(size);
+    paths.hit.resize(size);
+    paths.scatter_pdf.resize(size);
+    paths.light_sampled.resize(size);
+    paths.sampler.assign(size, prototype);
+    paths.queued.resize(size);
+
+    shadow_rays.origin.resize(size);
+    shadow_rays.direction.resize(size);
+    shadow_rays.distance.resize(size);
+    shadow_rays.contribution.resize(size);
+
+    for (auto *queue : {&ray_queue, &hit_queue, &shadow_queue, &next_queue, &sorted_hits})
+        queue->reserve(size);
+}
+
+void WavefrontIntegrator::Wavefront::Compact(const std::vector<uint32_t> &from, uint8_t flag, std::vector<uint32_t> &to) const
+{
+    for (uint32_t slot : from) {
+        if (paths.queued[slot] & flag)
+            to.push_back(slot);
+    }
+}
+
+void WavefrontIntegrator::RenderImage(Camera &cam, Scene &world, Sampler &sampler, int sample_index)
+{
+    // Pixels take different sample counts under adaptive sampling, which the batches do not model
+    if (adaptive_sampling) {
+        Integrator::RenderImage(cam, world, sampler, sample_index);
+        return;
+    }
+    sampler.SetCurrentSample(sample_index);
+    BeginBounceStats();
+
+    // One workspace per thread, sized for a full tile
+    size_t tile_pixels = static_cast<size_t>(scheduler.GetTileSize()) * scheduler.GetTileSize();
+    std::vector<std::unique_ptr<Wavefront>> workspaces(std::max(num_threads, 1));
+    scheduler.Run(num_threads, [&](const Tile &tile, int thread) {
+        if (!workspaces[thread])
+            workspaces[thread] = std::make_unique<Wavefront>(tile_pixels, sampler);
+        TraceBatch(*workspaces[thread], cam, world, sample_index, tile);
+    });
+    EndBounceStats();
+}
+
+void WavefrontIntegrator::TraceBatch(Wavefront &wf, const Camera &cam, const Scene &world, int sample_index, const Tile &tile)
+{
+    size_t count = static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+    Generate(wf, cam, sample_index, tile);
+    if (max_bounce <= 0)
+        wf.ray_queue.clear();
+    // The rays left after the last bounce only look for emitters, see Integrator::ScatterRadiance
+    for (int bounce = max_bounce; !wf.ray_queue.empty(); bounce--) {
+        if (bounce > 0)
+            CountPaths(max_bounce - bounce, wf.ray_queue.size());
+        Intersect(wf, world, bounce);
+        SortByMaterial(wf, world);
+        Shade(wf, world, bounce);
+        TraceShadowRays(wf, world);
+        wf.ray_queue.swap(wf.next_queue);
+    }
+
+    for (size_t slot = 0; slot < count; slot++) {
+        uint32_t pixel = wf.paths.pixel[slot];
+        write_color(pixel % width, pixel / width, wf.paths.radiance[slot]);
+    }
+}
+
+void WavefrontIntegrator::Generate(Wavefront &wf, const Camera &cam, int sample_index, const Tile &tile)
+{
+    PathStates &paths = wf.paths;
+    int tile_width = tile.x1 - tile.x0;
+    size_t count = static_cast<size_t>(tile_width) * (tile.y1 - tile.y0);
+    wf.ray_queue.resize(count);
+    for (size_t slot = 0; slot < count; slot++) {
+        int i = tile.x0 + static_cast<int>(slot % tile_width), j = tile.y0 + static_cast<int>(slot / tile_width);
+        uint32_t pixel = static_cast<uint32_t>(j * width + i);
+        Sampler &path_sampler = paths.sampler[slot];
+        path_sampler.SetCurrentSample(sample_index);
+        path_sampler.SetPixel(i, j);
+        Vector2f offset = path_sampler.sample_square();
+        Ray r = cam.GenerateRay(i, j, path_sampler, offset);
+
+        paths.pixel[slot] = pixel;
+        paths.origin[slot] = r.origin();
+        paths.direction[slot] = r.direction();
+        paths.throughput[slot] = Vector3f(1.0f);
+        paths.radiance[slot] = Vector3f(0.0f);
+        paths.light_sampled[slot] = false;
+        wf.ray_queue[slot] = static_cast<uint32_t>(slot);
+    }
+}
+
+void WavefrontIntegrator::Intersect(Wavefront &wf, const Scene &world, int bounce)
+{
+    PathStates &paths = wf.paths;
+    for (uint32_t slot : wf.ray_queue) {
+        Ray r(paths.origin[slot], paths.direction[slot]);
+        if (world.isHit(r, Vector2f(0.0f, Infinity), paths.hit[slot])) {
+            SnapHitPoint(paths.hit[slot]);
+            paths.queued[slot] = QueuedHit;
+        } else {
+            if (bounce > 0)
+                paths.radiance[slot] += paths.throughput[slot] * BackgroundRadiance;
+            paths.queued[slot] = 0;
+        }
+    }
+    wf.hit_queue.clear();
+    wf.Compact(wf.ray_queue, QueuedHit, wf.hit_queue);
+}
+
+void WavefrontIntegrator::SortByMaterial(Wavefront &wf, const Scene &world)
+{
+    const PathStates &paths = wf.paths;
+    size_t material_count = world.GetMaterials().Size();
+    wf.material_offsets.assign(material_count + 1, 0);
+    for (uint32_t slot : wf.hit_queue)
+        wf.material_offsets[paths.hit[slot].material_id + 1]++;
+    for (size_t m = 0; m < material_count; m++)
+        wf.material_offsets[m + 1] += wf.material_offsets[m];
+
+    wf.sorted_hits.resize(wf.hit_queue.size());
+    for (uint32_t slot : wf.hit_queue)
+        wf.sorted_hits[wf.material_offsets[paths.hit[slot].material_id]++] = slot;
+}
+
+void WavefrontIntegrator::Shade(Wavefront &wf, const Scene &world, int bounce)
+{
+    PathStates &paths = wf.paths;
+    ShadowRays &shadow_rays = wf.shadow_rays;
+    for (uint32_t slot : wf.sorted_hits) {
+        Ray r(paths.origin[slot], paths.direction[slot]);
+        const Hit_Payload &rec = paths.hit[slot];
+        Sampler &path_sampler = paths.sampler[slot];
+        Vector3f throughput = paths.throughput[slot];
+        uint8_t queued = 0;
+
+        paths.radiance[slot] += throughput * EmittedRadiance(r, rec, world, paths.light_sampled[slot], paths.scatter_pdf[slot]);
+        if (bounce <= 0) {
+            paths.queued[slot] = 0;
+            continue;
+        }
+
+        // Same sample order as ScatterRadiance: light, then the BSDF ray that continues the path
+        bool light_sampled = SamplesDirectLighting(rec, world);
+        if (light_sampled) {
+            Ray shadow_ray;
+            Vector3f contribution;
+            if (SampleDirectLight(r, rec, world, path_sampler, shadow_ray, shadow_rays.distance[slot], contribution)) {
+                shadow_rays.origin[slot] = shadow_ray.origin();
+                shadow_rays.direction[slot] = shadow_ray.direction();
+                shadow_rays.contribution[slot] = throughput * contribution;
+                queued |= QueuedShadow;
+            }
+        }
+
+        Ray scattered;
+        Vector3f attenuation;
+        float pdf;
+        if (SampleScatter(r, rec, world, path_sampler, scattered, attenuation, pdf) && (bounce > 1 || light_sampled)) {
+            Vector3f next_throughput = throughput * attenuation;
+            if (SurvivesRoulette(max_bounce - bounce + 1, next_throughput, path_sampler)) {
+                paths.origin[slot] = scattered.origin();
+                paths.direction[slot] = scattered.direction();
+                paths.throughput[slot] = next_throughput;
+                paths.scatter_pdf[slot] = pdf;
+                paths.light_sampled[slot] = light_sampled;
+                queued |= QueuedNext;
+            }
+        }
+        paths.queued[slot] = queued;
+    }
+
+    wf.shadow_queue.clear();
+    wf.next_queue.clear();
+    wf.Compact(wf.sorted_hits, QueuedShadow, wf.shadow_queue);
+    wf.Compact(wf.sorted_hits, QueuedNext, wf.next_queue);
+}
+
+void WavefrontIntegrator::TraceShadowRays(Wavefront &wf, const Scene &world)
+{
+    const ShadowRays &shadow_rays = wf.shadow_rays;
+    for (uint32_t slot : wf.shadow_queue) {
+        Ray shadow_ray(shadow_rays.origin[slot], shadow_rays.direction[slot]);
+        if (!world.isOccluded(shadow_ray, shadow_rays.distance[slot]))
+            wf.paths.radiance[slot] += shadow_rays.contribution[slot];
+    }
+}
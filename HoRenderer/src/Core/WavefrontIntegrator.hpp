@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Util.hpp"
+#include "Integrator.hpp"
+#include "Sampler.hpp"
+
+// Stream path tracer: instead of one ray_color path per pixel, the pixels of a scheduler tile are
+// traced as one batch of paths, one stage at a time over the whole batch. Each stage is a
+// flat loop over a queue of path indices into structure-of-arrays path state:
+//   generate -> intersect -> sort by material -> shade -> shadow rays -> next bounce
+// Shading walks the hits grouped by material, so consecutive paths run the same Material code on the
+// same data. Every thread streams its own tiles, sized to stay in its caches, so the stages need
+// no synchronization. The estimator is Integrator's and every path draws its samples in the same
+// order, so both integrators produce the same image up to float rounding.
+class WavefrontIntegrator : public Integrator {
+public:
+    // tile_size: side of the scheduler tiles, tile_size^2 paths per batch
+    WavefrontIntegrator(int width, int height, int threads = 0, int bounce = 10, int tile_size = 32);
+
+    void RenderImage(Camera &cam, Scene &world, Sampler &sampler, int sample_index) override;
+
+private:
+    // Per-path state, indexed by path slot
+    struct PathStates {
+        std::vector<uint32_t> pixel;
+        std::vector<Vector3f> origin, direction; // current ray
+        std::vector<Vector3f> throughput;
+        std::vector<Vector3f> radiance;
+        std::vector<Hit_Payload> hit;
+        // How the current ray was sampled, for the MIS weight of the emission it finds
+        std::vector<float> scatter_pdf;
+        std::vector<uint8_t> light_sampled;
+        std::vector<Sampler> sampler;
+        std::vector<uint8_t> queued; // QueuedFlags of the current stage
+    };
+
+    // Pending shadow rays, indexed by path slot like the path state (a path queues at most one)
+    struct ShadowRays {
+        std::vector<Vector3f> origin, direction;
+        std::vector<float> distance;
+        std::vector<Vector3f> contribution; // added to the path's radiance when the ray is not blocked
+    };
+
+    enum QueuedFlags : uint8_t {
+        QueuedHit = 1,
+        QueuedShadow = 2,
+        QueuedNext = 4
+    };
+
+    // Everything one thread needs to stream a batch
+    struct Wavefront {
+        PathStates paths;
+        ShadowRays shadow_rays;
+        // Queues of path slots
+        std::vector<uint32_t> ray_queue, hit_queue, shadow_queue, next_queue;
+        std::vector<uint32_t> sorted_hits;
+        std::vector<size_t> material_offsets;
+
+        Wavefront(size_t size, const Sampler &prototype);
+        // Appends the slots of from whose queued flags have flag, in order
+        void Compact(const std::vector<uint32_t> &from, uint8_t flag, std::vector<uint32_t> &to) const;
+    };
+
+    // All bounces of the pixels of tile
+    void TraceBatch(Wavefront &wf, const Camera &cam, const Scene &world, int sample_index, const Tile &tile);
+    // Camera rays of the batch, fills the ray queue
+    void Generate(Wavefront &wf, const Camera &cam, int sample_index, const Tile &tile);
+    // Closest hits of the ray queue; misses pick up the background and leave, hits go to the hit queue.
+    // Past the last bounce (bounce 0) the rays only look for emitters and misses add nothing
+    void Intersect(Wavefront &wf, const Scene &world, int bounce);
+    // Counting sort of the hit queue by material
+    void SortByMaterial(Wavefront &wf, const Scene &world);
+    // Emission, light sample and BSDF-sampled next ray of every hit, queueing the rays they need
+    void Shade(Wavefront &wf, const Scene &world, int bounce);
+    void TraceShadowRays(Wavefront &wf, const Scene &world);
+};
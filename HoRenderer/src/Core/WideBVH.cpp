@@ -0,0 +1,146 @@
+#include "WideBVH.hpp"
+
+template <int Width>
+WideBVH<Width>::WideBVH(const LinearBVH &binary)
+{
+    const auto &binary_nodes = binary.GetNodes();
+    if (binary_nodes.empty())
+        return;
+
+    primitive_indices.assign(binary.GetPrimitiveIndices().begin(), binary.GetPrimitiveIndices().end());
+    bounds = binary.getBoundingBox();
+    nodes.reserve(binary_nodes.size() / (Width - 1) + 1);
+
+    if (binary_nodes[0].n_primitives > 0) {
+        // A single leaf still needs a root node to live in
+        nodes.emplace_back();
+        WideBVHNode<Width> &root = nodes[0];
+        for (int i = 0; i < Width; i++) {
+            root.min_x[i] = root.min_y[i] = root.min_z[i] = Infinity;
+            root.max_x[i] = root.max_y[i] = root.max_z[i] = -Infinity;
+            root.child[i] = 0;
+            root.count[i] = 0;
+        }
+        const LinearBVHNode &leaf = binary_nodes[0];
+        root.min_x[0] = leaf.bounds.min().x; root.min_y[0] = leaf.bounds.min().y; root.min_z[0] = leaf.bounds.min().z;
+        root.max_x[0] = leaf.bounds.max().x; root.max_y[0] = leaf.bounds.max().y; root.max_z[0] = leaf.bounds.max().z;
+        root.child[0] = leaf.primitives_offset;
+        root.count[0] = leaf.n_primitives;
+        return;
+    }
+
+    Collapse(binary_nodes, 0);
+    nodes.shrink_to_fit();
+}
+
+template <int Width>
+uint32_t WideBVH<Width>::Collapse(std::span<const LinearBVHNode> binary, uint32_t binary_index)
+{
+    // Pull grandchildren up until the node is full: always open the interior child
+    // with the largest surface area, it is the one most likely to be visited
+    uint32_t children[Width];
+    int n_children = 0;
+    children[n_children++] = binary_index + 1;
+    children[n_children++] = binary[binary_index].second_child_offset;
+
+    while (n_children < Width) {
+        int best = -1;
+        float best_area = -1.0f;
+        for (int i = 0; i < n_children; i++) {
+            const LinearBVHNode &candidate = binary[children[i]];
+            if (candidate.n_primitives == 0 && candidate.bounds.SurfaceArea() > best_area) {
+                best_area = candidate.bounds.SurfaceArea();
+                best = i;
+            }
+        }
+        if (best < 0)
+            break;
+        uint32_t opened = children[best];
+        children[best] = opened + 1;
+        children[n_children++] = binary[opened].second_child_offset;
+    }
+
+    uint32_t node_index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    for (int i = 0; i < Width; i++) {
+        WideBVHNode<Width> &node = nodes[node_index];
+        if (i >= n_children) {
+            node.min_x[i] = node.min_y[i] = node.min_z[i] = Infinity;
+            node.max_x[i] = node.max_y[i] = node.max_z[i] = -Infinity;
+            node.child[i] = 0;
+            node.count[i] = 0;
+            continue;
+        }
+
+        const LinearBVHNode &child = binary[children[i]];
+        Vector3f p_min = child.bounds.min(), p_max = child.bounds.max();
+        node.min_x[i] = p_min.x; node.min_y[i] = p_min.y; node.min_z[i] = p_min.z;
+        node.max_x[i] = p_max.x; node.max_y[i] = p_max.y; node.max_z[i] = p_max.z;
+        if (child.n_primitives > 0) {
+            node.child[i] = child.primitives_offset;
+            node.count[i] = child.n_primitives;
+        } else {
+            // nodes may reallocate inside the recursion, so index instead of holding a reference
+            uint32_t collapsed = Collapse(binary, children[i]);
+            nodes[node_index].child[i] = collapsed;
+            nodes[node_index].count[i] = 0;
+        }
+    }
+
+    return node_index;
+}
+
+template <int Width>
+void WideBVH<Width>::Reorder(BVHNodeLayout layout, size_t treelet_bytes)
+{
+    if (nodes.empty() || layout == BVHNodeLayout::DEPTH_FIRST)
+        return;
+
+    // Empty slots also have count 0, their inverted bounds tell them apart
+    auto is_node = [&](const WideBVHNode<Width> &node, int i) { return node.count[i] == 0 && node.min_x[i] <= node.max_x[i]; };
+    auto children = [&](uint32_t index, uint32_t *out) {
+        int n = 0;
+        for (int i = 0; i < Width; i++)
+            if (is_node(nodes[index], i))
+                out[n++] = nodes[index].child[i];
+        return n;
+    };
+    // The parent's slot holds the node's bounds, so the areas are collected top-down first
+    std::vector<float> areas(nodes.size());
+    areas[0] = bounds.SurfaceArea();
+    for (const auto &node : nodes)
+        for (int i = 0; i < Width; i++)
+            if (is_node(node, i))
+                areas[node.child[i]] = AABB(Vector3f(node.min_x[i], node.min_y[i], node.min_z[i]),
+                                            Vector3f(node.max_x[i], node.max_y[i], node.max_z[i])).SurfaceArea();
+
+    std::vector<uint32_t> order = ComputeNodeLayout(nodes.size(), layout, treelet_bytes, children,
+                                                    [&](uint32_t index) { return areas[index]; },
+                                                    [](uint32_t) { return sizeof(WideBVHNode<Width>); });
+    std::vector<uint32_t> position(nodes.size());
+    for (uint32_t i = 0; i < order.size(); i++)
+        position[order[i]] = i;
+
+    std::vector<WideBVHNode<Width>> reordered(nodes.size());
+    std::vector<uint32_t> reordered_primitives;
+    reordered_primitives.reserve(primitive_indices.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        WideBVHNode<Width> node = nodes[order[i]];
+        for (int slot = 0; slot < Width; slot++) {
+            if (is_node(node, slot)) {
+                node.child[slot] = position[node.child[slot]];
+            } else if (node.count[slot] > 0) {
+                uint32_t first = static_cast<uint32_t>(reordered_primitives.size());
+                reordered_primitives.insert(reordered_primitives.end(), primitive_indices.begin() + node.child[slot],
+                                            primitive_indices.begin() + node.child[slot] + node.count[slot]);
+                node.child[slot] = first;
+            }
+        }
+        reordered[i] = node;
+    }
+    nodes.swap(reordered);
+    primitive_indices.swap(reordered_primitives);
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,234 @@
+#pragma once
+
+#include "Util.hpp"
+#include "BVH.hpp"
+#include <bit>
+
+// Node with up to Width children whose bounds are stored as structure of arrays, so
+// one SIMD sequence tests the ray against all of them. Leaves are stored inline in
+// the parent: a slot with count > 0 refers to primitives [child, child + count).
+// Unused slots have inverted bounds and can never be hit.
+template <int Width>
+struct alignas(32) WideBVHNode {
+    float min_x[Width], min_y[Width], min_z[Width];
+    float max_x[Width], max_y[Width], max_z[Width];
+    uint32_t child[Width];
+    uint16_t count[Width];
+};
+
+// Ray data broadcast once per traversal
+template <int Width>
+struct WideRay;
+
+template <>
+struct WideRay<4> {
+    __m128 org_x, org_y, org_z;
+    __m128 inv_x, inv_y, inv_z;
+};
+
+template <>
+struct WideRay<8> {
+    __m256 org_x, org_y, org_z;
+    __m256 inv_x, inv_y, inv_z;
+};
+
+// 4-wide (SSE) or 8-wide (AVX) BVH collapsed from a binary LinearBVH
+template <int Width>
+class WideBVH {
+public:
+    static_assert(Width == 4 || Width == 8, "WideBVH supports 4 (SSE) or 8 (AVX) children");
+
+    WideBVH() {}
+    explicit WideBVH(const LinearBVH &binary);
+
+    // Same contract as LinearBVH::Intersect
+    template <typename IntersectFn>
+    bool Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats = nullptr) const;
+
+    // Same contract as LinearBVH::Occluded
+    template <typename OccludedFn>
+    bool Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const;
+
+    AABB getBoundingBox() const { return bounds; }
+    size_t GetNodeCount() const { return nodes.size(); }
+    size_t MemoryBytes() const { return nodes.size() * sizeof(WideBVHNode<Width>) + primitive_indices.size() * sizeof(uint32_t); }
+    const std::vector<uint32_t> &GetPrimitiveIndices() const { return primitive_indices; }
+
+    // Post-build pass: store the nodes in the given layout and the primitive indices in the order
+    // the leaves end up in, see ComputeNodeLayout
+    void Reorder(BVHNodeLayout layout, size_t treelet_bytes = 4096);
+
+private:
+    static WideRay<Width> MakeRay(const Vector3f &origin, const Vector3f &inv_dir);
+    uint32_t Collapse(std::span<const LinearBVHNode> binary, uint32_t binary_index);
+
+    // Returns a bit mask of the children hit inside t_interval and writes their entry distances
+    static int IntersectChildren(const WideBVHNode<Width> &node, const WideRay<Width> &ray, const int dir_is_neg[3],
+                                 Vector2f t_interval, float t_near[Width]);
+
+private:
+    std::vector<WideBVHNode<Width>> nodes;
+    std::vector<uint32_t> primitive_indices;
+    AABB bounds;
+};
+
+template <>
+inline int WideBVH<4>::IntersectChildren(const WideBVHNode<4> &node, const WideRay<4> &ray, const int dir_is_neg[3],
+                                         Vector2f t_interval, float t_near[4])
+{
+    // Near/far planes are chosen per axis from the direction sign, so no min/max swap is needed
+    __m128 near_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[0] ? node.max_x : node.min_x), ray.org_x), ray.inv_x);
+    __m128 near_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[1] ? node.max_y : node.min_y), ray.org_y), ray.inv_y);
+    __m128 near_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[2] ? node.max_z : node.min_z), ray.org_z), ray.inv_z);
+    __m128 far_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[0] ? node.min_x : node.max_x), ray.org_x), ray.inv_x);
+    __m128 far_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[1] ? node.min_y : node.max_y), ray.org_y), ray.inv_y);
+    __m128 far_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(dir_is_neg[2] ? node.min_z : node.max_z), ray.org_z), ray.inv_z);
+
+    __m128 t_min = _mm_max_ps(_mm_max_ps(near_x, near_y), _mm_max_ps(near_z, _mm_set1_ps(t_interval.x)));
+    __m128 t_max = _mm_min_ps(_mm_min_ps(far_x, far_y), _mm_min_ps(far_z, _mm_set1_ps(t_interval.y)));
+    _mm_storeu_ps(t_near, t_min);
+    return _mm_movemask_ps(_mm_cmple_ps(t_min, t_max));
+}
+
+template <>
+inline int WideBVH<8>::IntersectChildren(const WideBVHNode<8> &node, const WideRay<8> &ray, const int dir_is_neg[3],
+                                         Vector2f t_interval, float t_near[8])
+{
+    __m256 near_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[0] ? node.max_x : node.min_x), ray.org_x), ray.inv_x);
+    __m256 near_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[1] ? node.max_y : node.min_y), ray.org_y), ray.inv_y);
+    __m256 near_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[2] ? node.max_z : node.min_z), ray.org_z), ray.inv_z);
+    __m256 far_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[0] ? node.min_x : node.max_x), ray.org_x), ray.inv_x);
+    __m256 far_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[1] ? node.min_y : node.max_y), ray.org_y), ray.inv_y);
+    __m256 far_z = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(dir_is_neg[2] ? node.min_z : node.max_z), ray.org_z), ray.inv_z);
+
+    __m256 t_min = _mm256_max_ps(_mm256_max_ps(near_x, near_y), _mm256_max_ps(near_z, _mm256_set1_ps(t_interval.x)));
+    __m256 t_max = _mm256_min_ps(_mm256_min_ps(far_x, far_y), _mm256_min_ps(far_z, _mm256_set1_ps(t_interval.y)));
+    _mm256_storeu_ps(t_near, t_min);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_min, t_max, _CMP_LE_OQ));
+}
+
+template <int Width>
+inline WideRay<Width> WideBVH<Width>::MakeRay(const Vector3f &origin, const Vector3f &inv_dir)
+{
+    if constexpr (Width == 4) {
+        return {_mm_set1_ps(origin.x), _mm_set1_ps(origin.y), _mm_set1_ps(origin.z),
+                _mm_set1_ps(inv_dir.x), _mm_set1_ps(inv_dir.y), _mm_set1_ps(inv_dir.z)};
+    } else {
+        return {_mm256_set1_ps(origin.x), _mm256_set1_ps(origin.y), _mm256_set1_ps(origin.z),
+                _mm256_set1_ps(inv_dir.x), _mm256_set1_ps(inv_dir.y), _mm256_set1_ps(inv_dir.z)};
+    }
+}
+
+template <int Width>
+template <typename IntersectFn>
+bool WideBVH<Width>::Intersect(const Ray &r, Vector2f t_interval, IntersectFn &&intersect, TraversalStats *stats) const
+{
+    if (nodes.empty())
+        return false;
+    if (stats)
+        stats->rays++;
+
+    const Vector3f &origin = r.origin();
+    Vector3f inv_dir = 1.0f / r.direction();
+    int dir_is_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+
+    WideRay<Width> ray = MakeRay(origin, inv_dir);
+
+    struct StackEntry {
+        uint32_t child;
+        uint32_t count; // 0 -> interior node
+        float t_near;
+    };
+    // Every level pushes at most Width - 1 entries besides the one it pops
+    StackEntry stack[MaxBVHDepth * Width];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0, t_interval.x};
+    bool hit_anything = false;
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        // Entries pushed before a closer hit was found may now be out of range
+        if (entry.t_near > t_interval.y)
+            continue;
+
+        if (entry.count > 0) {
+            if (stats) {
+                stats->primitive_tests += entry.count;
+                stats->Touch(&primitive_indices[entry.child], entry.count * sizeof(uint32_t));
+            }
+            if (IntersectLeafPrimitives(intersect, &primitive_indices[entry.child], entry.count, t_interval))
+                hit_anything = true;
+            continue;
+        }
+
+        const WideBVHNode<Width> &node = nodes[entry.child];
+        if (stats) {
+            stats->node_visits++;
+            stats->Touch(&node, sizeof(node));
+        }
+        alignas(32) float t_near[Width];
+        int mask = IntersectChildren(node, ray, dir_is_neg, t_interval, t_near);
+        if (mask == 0)
+            continue;
+
+        // Sort the hit children far to near so the nearest one is popped first
+        int first = stack_size;
+        while (mask) {
+            int i = std::countr_zero(static_cast<unsigned>(mask));
+            mask &= mask - 1;
+            StackEntry child = {node.child[i], node.count[i], t_near[i]};
+            int j = stack_size++;
+            while (j > first && stack[j - 1].t_near < child.t_near) {
+                stack[j] = stack[j - 1];
+                j--;
+            }
+            stack[j] = child;
+        }
+    }
+
+    return hit_anything;
+}
+
+template <int Width>
+template <typename OccludedFn>
+bool WideBVH<Width>::Occluded(const Ray &r, Vector2f t_interval, OccludedFn &&occluded) const
+{
+    if (nodes.empty())
+        return false;
+
+    const Vector3f &origin = r.origin();
+    Vector3f inv_dir = 1.0f / r.direction();
+    int dir_is_neg[3] = {inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f};
+    WideRay<Width> ray = MakeRay(origin, inv_dir);
+
+    // Any hit ends the query, so children are pushed unsorted
+    struct StackEntry {
+        uint32_t child;
+        uint32_t count;
+    };
+    StackEntry stack[MaxBVHDepth * Width];
+    int stack_size = 0;
+    stack[stack_size++] = {0, 0};
+
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.count > 0) {
+            for (uint32_t i = 0; i < entry.count; i++) {
+                if (occluded(primitive_indices[entry.child + i]))
+                    return true;
+            }
+            continue;
+        }
+
+        const WideBVHNode<Width> &node = nodes[entry.child];
+        alignas(32) float t_near[Width];
+        int mask = IntersectChildren(node, ray, dir_is_neg, t_interval, t_near);
+        while (mask) {
+            int i = std::countr_zero(static_cast<unsigned>(mask));
+            mask &= mask - 1;
+            stack[stack_size++] = {node.child[i], node.count[i]};
+        }
+    }
+
+    return false;
+}
@@ -3,12 +3,44 @@
 */
 #include "Core/Util.hpp"
 #include "Core/RendererScene.hpp"
+#include "Core/Benchmark.hpp"
+#include "Core/SceneCache.hpp"
+#include "Common/FileManager.hpp"
 
 
-int main() {
+// HoRenderer                     renders the Cornell box in a window
+// HoRenderer --adaptive          the same with adaptive sampling
+// HoRenderer --benchmark <name>  runs one headless measurement of Benchmark and exits
+// HoRenderer --check <name|all>  runs the correctness checks of Benchmark, exits with 1 on any failure
+// HoRenderer --verbose           also prints the stats of every BVH build
+int main(int argc, char *argv[]) {
     srand(static_cast<unsigned int>(time(nullptr)));
+    // BVHs, meshes and textures built on the first run are reused by later runs
+    FileManager::getInstance()->init();
+    SceneCache::SetDirectory(FileManager::getInstance()->getCachePath());
+
+    bool adaptive = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--benchmark" && i + 1 < argc)
+            return Benchmark::Run(argv[i + 1]) ? 0 : 1;
+        if (arg == "--check" && i + 1 < argc)
+            return Benchmark::Check(argv[i + 1]) ? 0 : 1;
+        if (arg == "--adaptive") {
+            adaptive = true;
+            continue;
+        }
+        if (arg == "--verbose") {
+            Scene::SetVerbose(true);
+            continue;
+        }
+        std::cerr << "Usage: HoRenderer [--adaptive] [--verbose] [--benchmark <name>] [--check <name|all>]" << std::endl;
+        return 1;
+    }
+
     // auto renderer = RendererScene::TestScene();
     auto renderer = RendererScene::CornellBox();
+    renderer->integrator->SetAdaptiveSampling(adaptive);
     renderer->Run();
 
     return 0;
@@ -1,6 +1,16 @@
 add_rules("mode.debug", "mode.release")
 
-add_requires("glfw", "glad", "glm", "embree", "nlohmann_json")
+-- The Embree backend (AcceleratorType::EMBREE) is opt-in: xmake f --embree=y
+option("embree")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Build the Embree 4 scene accelerator")
+option_end()
+
+add_requires("glfw", "glad", "glm", "nlohmann_json")
+if has_config("embree") then
+    add_requires("embree")
+end
 add_rules("plugin.compile_commands.autoupdate", {outputdir = "../.vscode"})
 set_languages("c++23") 
 
@@ -21,8 +31,17 @@ target("HoRenderer")
         os.cp("Shader/*.frag", target:targetdir())
     end)
 
-    add_packages("glfw", "glad", "glm", "embree", "nlohmann_json")
+    add_packages("glfw", "glad", "glm", "nlohmann_json")
+    if has_config("embree") then
+        add_packages("embree")
+        add_defines("HO_EMBREE")
+    end
 
+    add_vectorexts("avx", "avx2")
+    -- No FMA contraction: the SIMD leaf kernels repeat the scalar intersection arithmetic and
+    -- HoRenderer --check expects bit-identical hits. MSVC only contracts with /fp:contract
+    add_cxflags("-ffp-contract=off", {tools = {"gcc", "clang"}})
+    add_cxflags("/clang:-ffp-contract=off", {tools = "clang_cl"})
     add_cxflags("/openmp:llvm")
 --
 -- If you want to known more usage about xmake, please see https://xmake.io